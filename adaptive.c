@@ -0,0 +1,132 @@
+#include <math.h>
+#include "logger.h"
+#include "adaptive.h"
+
+#define TAG          "envmon:adaptive"
+#define EWMA_ALPHA   0.2f  //weight of the newest value in the mean and variance
+#define RELAX_FACTOR 1.25f //period growth per quiet sample
+#define NOISE_K      2.0f  //a change of the mean below NOISE_K times its noise is not a slope
+
+static adaptive_t adaptive;
+
+/**
+ * @brief Register a sampling-rate controller for a signal.
+ * @param name The name reported in telemetry.
+ * @param min_period_ms The shortest sampling period.
+ * @param max_period_ms The longest sampling period.
+ * @param max_slope The slope, in signal units per second, above which the
+ *                  signal is considered as moving.
+ * @param max_stdev The recent standard deviation above which the signal is
+ *                  considered as moving.
+ * @param resolution The quantum of the signal, e.g. 1 for a sensor read in
+ *                   whole degrees, 0 if negligible.
+ * @return The controller id, or -1 if there are too many controllers.
+ */
+int adaptive_register(const char *name, uint32_t min_period_ms, uint32_t max_period_ms,
+                      float max_slope, float max_stdev, float resolution)
+{
+    adaptive_ctrl_t *c;
+
+    if (adaptive.n == ADAPTIVE_MAX)
+        return -1;
+    c = &adaptive.ctrls[adaptive.n];
+    c->name = name;
+    c->min_period_ms = min_period_ms;
+    c->max_period_ms = max_period_ms;
+    c->max_slope = max_slope;
+    c->max_stdev = max_stdev;
+    c->resolution = resolution;
+    c->period_ms = min_period_ms;
+    c->init = false;
+    return adaptive.n++;
+}
+
+/**
+ * @brief Feed a new value and get the next sampling period. When the slope
+ * of the smoothed value or the recent standard deviation exceeds its
+ * threshold, the period drops to its minimum at once. Otherwise it grows
+ * geometrically back to its maximum. A change of the smoothed value within
+ * its noise, from the learned deviation and the resolution, is no slope:
+ * divided by a short period, noise and quantization steps would otherwise
+ * keep the rate at its maximum.
+ * @param id The controller id.
+ * @param value The new value.
+ * @param time_us The esp_timer time of the value.
+ * @return The period until the next sample in ms.
+ */
+uint32_t adaptive_update(int id, float value, int64_t time_us)
+{
+    adaptive_ctrl_t *c = &adaptive.ctrls[id];
+    float change, noise, diff;
+    float dt;
+    uint32_t period;
+
+    if (!c->init)
+    {
+        c->mean = value;
+        c->var = 0;
+        c->prev_time = time_us;
+        c->init = true;
+        return c->period_ms;
+    }
+    dt = (time_us - c->prev_time) / 1e6f;
+    diff = value - c->mean;
+    change = fabsf(EWMA_ALPHA * diff); //of the mean, which follows a ramp at the ramp's slope
+    c->mean += EWMA_ALPHA * diff;
+    c->var = (1 - EWMA_ALPHA) * (c->var + EWMA_ALPHA * diff * diff);
+    c->prev_time = time_us;
+    noise = NOISE_K * EWMA_ALPHA * (sqrtf(c->var) + c->resolution);
+
+    if ((change > c->max_slope * dt && change > noise) || sqrtf(c->var) > c->max_stdev)
+    {
+        if (c->period_ms != c->min_period_ms)
+            LOGI(TAG, "%s: activity, period %u ms", c->name, (unsigned)c->min_period_ms);
+        c->period_ms = c->min_period_ms;
+    }
+    else
+    {
+        period = c->period_ms * RELAX_FACTOR;
+        c->period_ms = period < c->max_period_ms ? period : c->max_period_ms;
+    }
+    return c->period_ms;
+}
+
+/**
+ * @brief Change the bounds and thresholds of a controller. The current period
+ * is brought within the new bounds.
+ * @param id The controller id.
+ * @param min_period_ms The shortest sampling period.
+ * @param max_period_ms The longest sampling period.
+ * @param max_slope The slope threshold.
+ * @param max_stdev The standard deviation threshold.
+ */
+void adaptive_configure(int id, uint32_t min_period_ms, uint32_t max_period_ms, float max_slope, float max_stdev)
+{
+    adaptive_ctrl_t *c = &adaptive.ctrls[id];
+
+    c->min_period_ms = min_period_ms;
+    c->max_period_ms = max_period_ms;
+    c->max_slope = max_slope;
+    c->max_stdev = max_stdev;
+    if (c->period_ms < min_period_ms)
+        c->period_ms = min_period_ms;
+    if (c->period_ms > max_period_ms)
+        c->period_ms = max_period_ms;
+}
+
+/**
+ * @brief Get the number of registered controllers.
+ */
+int adaptive_count()
+{
+    return adaptive.n;
+}
+
+/**
+ * @brief Get a controller, e.g. to report its current period.
+ * @param id The controller id.
+ */
+const adaptive_ctrl_t *adaptive_get(int id)
+{
+    return &adaptive.ctrls[id];
+}
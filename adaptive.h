@@ -0,0 +1,36 @@
+#ifndef __ADAPTIVE_H__
+#define __ADAPTIVE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ADAPTIVE_MAX 8
+
+typedef struct adaptive_ctrl
+{
+    const char *name;
+    uint32_t min_period_ms; //fastest rate, used while the signal moves
+    uint32_t max_period_ms; //slowest rate, the floor when quiet
+    float max_slope; //change per second above which the rate goes up
+    float max_stdev; //standard deviation above which the rate goes up
+    float resolution; //quantum of the signal, 0 if negligible
+    uint32_t period_ms;
+    bool init;
+    float mean;
+    float var;
+    int64_t prev_time;
+} adaptive_ctrl_t;
+
+typedef struct adaptive
+{
+    int n;
+    adaptive_ctrl_t ctrls[ADAPTIVE_MAX];
+} adaptive_t;
+
+int         adaptive_register(const char *, uint32_t, uint32_t, float, float, float);
+uint32_t    adaptive_update(int, float, int64_t);
+void        adaptive_configure(int, uint32_t, uint32_t, float, float);
+int         adaptive_count();
+const adaptive_ctrl_t *adaptive_get(int);
+
+#endif /* __ADAPTIVE_H__ */
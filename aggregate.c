@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <math.h>
+#include <inttypes.h>
+#include "logger.h"
+#include "esp_timer.h"
+#include "aggregate.h"
+
+#define TAG "envmon:aggregate"
+
+static aggregate_t aggregate;
+
+static int  aggregate_series(const sample_t *);
+static void aggregate_publish(aggregate_window_t *);
+
+/**
+ * @brief Add a tumbling window over which every series is summarized. The
+ * windows are aligned on multiples of their period, so the summaries of
+ * several devices line up.
+ * @param stream The stream on which the summaries are published.
+ * @param period_ms The length of the window in ms.
+ * @return The window id, or -1 if there are too many windows.
+ */
+int aggregate_add_window(const mqtt_stream_t *stream, uint32_t period_ms)
+{
+    aggregate_window_t *w;
+
+    if (aggregate.n_windows == AGGREGATE_MAX_WINDOWS)
+        return -1;
+    w = &aggregate.windows[aggregate.n_windows];
+    w->stream = stream;
+    w->period_ms = period_ms;
+    w->start = -1;
+    return aggregate.n_windows++;
+}
+
+/**
+ * @brief Add a cycle of samples to every window. A window whose end is
+ * reached is published and restarted before the samples are added. The
+ * samples are timed with their epoch timestamp, or the uptime until the time
+ * is synchronized.
+ * @param samples The samples of the cycle.
+ * @param n The number of samples.
+ */
+void aggregate_add(const sample_t *samples, int n)
+{
+    aggregate_window_t *w;
+    aggregate_stat_t *st;
+    int64_t now;
+    double delta;
+    int id;
+
+    if (n == 0)
+        return;
+    now = samples[0].timestamp ? samples[0].timestamp : esp_timer_get_time() / 1000;
+    for (int i = 0; i < aggregate.n_windows; i++)
+    {
+        w = &aggregate.windows[i];
+        if (w->start >= 0 && (now >= w->start + w->period_ms || now < w->start))
+            aggregate_publish(w); //the window is over, or the clock stepped back
+        if (w->start < 0)
+            w->start = now - now % w->period_ms;
+    }
+
+    for (int j = 0; j < n; j++)
+    {
+        id = aggregate_series(&samples[j]);
+        if (id < 0)
+            continue;
+        for (int i = 0; i < aggregate.n_windows; i++)
+        {
+            st = &aggregate.windows[i].stats[id];
+            if (st->n == 0 || samples[j].value < st->min)
+                st->min = samples[j].value;
+            if (st->n == 0 || samples[j].value > st->max)
+                st->max = samples[j].value;
+            st->last = samples[j].value;
+            st->n++;
+            delta = samples[j].value - st->mean;
+            st->mean += delta / st->n;
+            st->m2 += delta * (samples[j].value - st->mean);
+        }
+    }
+}
+
+/**
+ * Find the statistics slot of the series of a sample, adding it if it is new.
+ */
+static int aggregate_series(const sample_t *sample)
+{
+    aggregate_stat_t *st;
+
+    for (int i = 0; i < aggregate.n_series; i++)
+    {
+        st = &aggregate.windows[0].stats[i];
+        if (st->sensor == sample->sensor && st->metric == sample->metric)
+            return i;
+    }
+    if (aggregate.n_series == AGGREGATE_MAX_SERIES)
+    {
+        LOGW(TAG, "Too many series, %s %s not aggregated",
+                 sample_sensor_name(sample->sensor), sample_metric_name(sample->metric));
+        return -1;
+    }
+    for (int i = 0; i < aggregate.n_windows; i++)
+    {
+        st = &aggregate.windows[i].stats[aggregate.n_series];
+        st->sensor = sample->sensor;
+        st->metric = sample->metric;
+        st->exponent = sample->exponent;
+        st->n = 0;
+        st->mean = 0;
+        st->m2 = 0;
+    }
+    return aggregate.n_series++;
+}
+
+/**
+ * Publish one summary record per series seen in the window, then restart it.
+ */
+static void aggregate_publish(aggregate_window_t *w)
+{
+    aggregate_stat_t *st;
+    char payload[MQTT_DATA_MAX_SIZE];
+    double scale;
+    int len;
+
+    for (int i = 0; i < aggregate.n_series; i++)
+    {
+        st = &w->stats[i];
+        if (st->n == 0)
+            continue;
+        scale = pow(10, st->exponent);
+        len = snprintf(payload, sizeof(payload),
+                       "{\"sensor\":\"%s\",\"metric\":\"%s\",\"start\":%" PRId64 ",\"window_s\":%" PRIu32
+                       ",\"count\":%" PRIu32 ",\"min\":%.10g,\"max\":%.10g,\"mean\":%.10g,\"stddev\":%.4g,\"last\":%.10g}",
+                       sample_sensor_name(st->sensor), sample_metric_name(st->metric), w->start,
+                       w->period_ms / 1000, st->n, st->min * scale, st->max * scale, st->mean * scale,
+                       st->n > 1 ? sqrt(st->m2 / (st->n - 1)) * scale : 0.0, st->last * scale);
+        if (len < (int)sizeof(payload))
+            mqtt_publish_stream(w->stream, payload, len);
+        st->n = 0;
+        st->mean = 0;
+        st->m2 = 0;
+    }
+    w->start = -1;
+}
@@ -0,0 +1,47 @@
+#ifndef __AGGREGATE_H__
+#define __AGGREGATE_H__
+
+#include <stdint.h>
+#include "mqtt.h"
+#include "sample.h"
+
+#define AGGREGATE_MAX_WINDOWS 2
+#define AGGREGATE_MAX_SERIES  12
+
+/*
+ * Running statistics of one series over one window, updated with Welford's
+ * method: the mean and the sum of squared deviations m2 are updated per value
+ * so that the variance stays accurate without keeping the values.
+ */
+typedef struct aggregate_stat
+{
+    uint8_t sensor;
+    uint8_t metric;
+    int8_t exponent;
+    uint32_t n;
+    double mean;
+    double m2;
+    int32_t min;
+    int32_t max;
+    int32_t last;
+} aggregate_stat_t;
+
+typedef struct aggregate_window
+{
+    const mqtt_stream_t *stream;
+    uint32_t period_ms;
+    int64_t start; //start of the current window, ms
+    aggregate_stat_t stats[AGGREGATE_MAX_SERIES];
+} aggregate_window_t;
+
+typedef struct aggregate
+{
+    int n_windows;
+    int n_series;
+    aggregate_window_t windows[AGGREGATE_MAX_WINDOWS];
+} aggregate_t;
+
+int  aggregate_add_window(const mqtt_stream_t *, uint32_t);
+void aggregate_add(const sample_t *, int);
+
+#endif /* __AGGREGATE_H__ */
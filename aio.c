@@ -1,5 +1,6 @@
 #include <string.h>
 #include "aio.h"
+#include "logger.h"
 
 #define AIO_API_URL   "https://io.adafruit.com/api/v2"
 #define TAG           "envmon:aio"
@@ -10,6 +11,7 @@ static aio_t aio;
 
 static void      aio_send_post_request(char *, char *, int);
 static esp_err_t aio_handle_http_event(esp_http_client_event_t *);
+static void      aio_trace_phase(int);
 
 /**
  * @brief Initialize the access to Adafruit IO.
@@ -20,6 +22,7 @@ void aio_init(const char *username, const char *key)
 {
     aio.username = username;
     aio.key = key;
+    aio.phase = -1;
 }
 
 /**
@@ -33,7 +36,7 @@ void aio_create_group(const char *group)
     int size;
 
     snprintf(url, URL_MAX_SIZE, "%s/%s/groups", AIO_API_URL, aio.username);
-    ESP_LOGI(TAG, "API URL: %s", url);
+    LOGI(TAG, "API URL: %s", url);
     size = snprintf(data, DATA_MAX_SIZE, "{\"group\": {\"name\": \"%s\"}}", group);
     aio_send_post_request(url, data, size);
 }
@@ -58,7 +61,7 @@ void aio_create_feed(const char *feed, const char *group_key)
     {
         snprintf(url, URL_MAX_SIZE, "%s/%s/feeds", AIO_API_URL, aio.username);
     }
-    ESP_LOGI(TAG, "API URL: %s", url);
+    LOGI(TAG, "API URL: %s", url);
     size = snprintf(data, DATA_MAX_SIZE, "{\"feed\": {\"name\": \"%s\"}}", feed);
     aio_send_post_request(url, data, size);
 }
@@ -75,14 +78,28 @@ void aio_create_data(const char *value, const char * feed_key)
     int size;
 
     snprintf(url, URL_MAX_SIZE, "%s/%s/feeds/%s/data", AIO_API_URL, aio.username, feed_key);
-    ESP_LOGI(TAG, "API URL: %s", url);
+    LOGD(TAG, "API URL: %s", url);
     size = snprintf(data, DATA_MAX_SIZE, "{\"value\": \"%s\"}", value);
     aio_send_post_request(url, data, size);
 }
 
+/**
+ * @brief Get the request counters.
+ * @param n_requests Where to store the number of POST requests sent.
+ * @param n_failed Where to store the number of POST requests that failed at
+ *                 the transport level or were answered with an HTTP error.
+ */
+void aio_get_stats(uint32_t *n_requests, uint32_t *n_failed)
+{
+    *n_requests = aio.n_requests;
+    *n_failed = aio.n_failed;
+}
+
 static void aio_send_post_request(char * url, char *data, int size)
 {
     esp_http_client_handle_t client;
+    esp_err_t err;
+    int status;
     esp_http_client_config_t config =
     {
         .url = url,
@@ -94,7 +111,26 @@ static void aio_send_post_request(char * url, char *data, int size)
     ESP_ERROR_CHECK(esp_http_client_set_header(client, "Content-Type", "application/json"));
     ESP_ERROR_CHECK(esp_http_client_set_header(client, "X-AIO-Key", aio.key));
     ESP_ERROR_CHECK(esp_http_client_set_post_field(client, data, size));
-    ESP_ERROR_CHECK(esp_http_client_perform(client));
+    aio.n_requests++;
+    TRACE_BEGIN(TRACE_AIO_POST, size);
+    aio_trace_phase(TRACE_AIO_CONNECT);
+    err = esp_http_client_perform(client);
+    aio_trace_phase(-1);
+    if (err != ESP_OK)
+    {
+        aio.n_failed++;
+        LOGW(TAG, "POST request failed: %s", esp_err_to_name(err));
+    }
+    else
+    {
+        status = esp_http_client_get_status_code(client);
+        if (status >= 400)
+        {
+            aio.n_failed++;
+            LOGW(TAG, "POST request rejected: HTTP %d", status);
+        }
+    }
+    TRACE_END(TRACE_AIO_POST, err == ESP_OK ? status : err);
     ESP_ERROR_CHECK(esp_http_client_cleanup(client));
 }
 
@@ -103,28 +139,45 @@ static esp_err_t aio_handle_http_event(esp_http_client_event_t *evt)
     switch(evt->event_id)
     {
         case HTTP_EVENT_ERROR:
-            ESP_LOGI(TAG, "HTTP_EVENT_ERROR");
+            LOGD(TAG, "HTTP_EVENT_ERROR");
+            TRACE_INSTANT(TRACE_AIO_ERROR, 0);
             break;
         case HTTP_EVENT_ON_CONNECTED:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_CONNECTED");
+            LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+            aio_trace_phase(TRACE_AIO_REQUEST);
             break;
         case HTTP_EVENT_HEADER_SENT:
-            ESP_LOGI(TAG, "HTTP_EVENT_HEADER_SENT");
+            LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
+            aio_trace_phase(TRACE_AIO_RESPONSE);
             break;
         case HTTP_EVENT_ON_HEADER:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_HEADER");
-            printf("%s: %s\n", evt->header_key, evt->header_value);
+            LOGV(TAG, "HTTP_EVENT_ON_HEADER, %s: %s", evt->header_key, evt->header_value);
             break;
         case HTTP_EVENT_ON_DATA:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-            printf("%.*s\n", evt->data_len, (char *)evt->data);
+            LOGV(TAG, "HTTP_EVENT_ON_DATA, len=%d: %.*s", evt->data_len, evt->data_len, (char *)evt->data);
+            TRACE_INSTANT(TRACE_AIO_DATA, evt->data_len);
             break;
         case HTTP_EVENT_ON_FINISH:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_FINISH");
+            LOGD(TAG, "HTTP_EVENT_ON_FINISH");
+            aio_trace_phase(-1);
             break;
         case HTTP_EVENT_DISCONNECTED:
-            ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
+            LOGD(TAG, "HTTP_EVENT_DISCONNECTED");
             break;
     }
     return ESP_OK;
 }
+
+/**
+ * End the traced phase of the request in progress, if any, and begin the next
+ * one: connection, request sent, response received. The phases follow the
+ * HTTP events, a failed request stops at the phase it failed in.
+ */
+static void aio_trace_phase(int phase)
+{
+    if (aio.phase >= 0)
+        TRACE_END(aio.phase, 0);
+    if (phase >= 0)
+        TRACE_BEGIN(phase, 0);
+    aio.phase = phase;
+}
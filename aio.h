@@ -3,16 +3,21 @@
 
 #include "esp_http_client.h"
 #include "esp_log.h"
+#include "trace.h"
 
 typedef struct aio
 {
     const char *username;
     const char *key;
+    uint32_t n_requests;
+    uint32_t n_failed;
+    int phase; /* trace point of the request phase in progress, -1 if none */
 } aio_t;
 
 void aio_init(const char *, const char *);
 void aio_create_group(const char *);
 void aio_create_feed(const char *, const char *);
 void aio_create_data(const char *, const char *);
+void aio_get_stats(uint32_t *, uint32_t *);
 
 #endif /* __AIO_H__ */
@@ -0,0 +1,125 @@
+#include "logger.h"
+#include "timesync.h"
+#include "batch.h"
+
+#define TAG "envmon:batch"
+
+static batch_t batch;
+
+static void batch_open();
+static bool batch_learn_series(const sample_t *, int);
+
+/**
+ * @brief Initialize the batching of sample cycles. A batch is published when
+ * it holds max_cycles cycles, or earlier when the next cycle would not fit in
+ * a MQTT message that can go through the offline queue.
+ * @param stream The stream on which batches are published.
+ * @param max_cycles The maximum number of cycles in a batch.
+ */
+void batch_init(const mqtt_stream_t *stream, int max_cycles)
+{
+    batch.stream = stream;
+    batch.max_cycles = max_cycles;
+    batch.open = false;
+}
+
+/**
+ * @brief Add a cycle of samples to the current batch. The timestamp of the
+ * cycle is the timestamp of its first sample. A batch has a value slot for
+ * every series seen so far, so cycles sampling only some sensors are cheap.
+ * @param samples The samples of the cycle.
+ * @param n The number of samples.
+ */
+void batch_add(const sample_t *samples, int n)
+{
+    if (n == 0)
+        return;
+    if (batch_learn_series(samples, n))
+        batch_flush(); /* a new series shows up, start a batch including it */
+    if (batch.open && batch.clock_steps != timesync_get_steps())
+        batch_flush(); /* the clock stepped, e.g. first synchronization: no batch spans it */
+    if (!batch.open)
+        batch_open();
+    if (!batch.open)
+        return;
+    if (tsc_append(&batch.enc, samples[0].timestamp, samples, n) != 0)
+    {
+        batch_flush();
+        batch_open();
+        if (tsc_append(&batch.enc, samples[0].timestamp, samples, n) != 0)
+        {
+            LOGW(TAG, "Cycle too large for a batch");
+            batch.open = false;
+            return;
+        }
+    }
+    if (batch.enc.state.n_cycles >= batch.max_cycles)
+        batch_flush();
+}
+
+/**
+ * @brief Publish the current batch, if any.
+ */
+void batch_flush()
+{
+    int len;
+
+    if (!batch.open || batch.enc.state.n_cycles == 0)
+        return;
+    len = tsc_finish(&batch.enc);
+    LOGI(TAG, "Batch of %d cycles: %d bytes", batch.enc.state.n_cycles, len);
+    mqtt_publish_stream(batch.stream, (const char *)batch.buf, len);
+    batch.open = false;
+}
+
+/**
+ * @brief Change the number of cycles per batch. The current batch is
+ * published if it already holds that many cycles.
+ * @param max_cycles The maximum number of cycles in a batch.
+ */
+void batch_set_max_cycles(int max_cycles)
+{
+    batch.max_cycles = max_cycles;
+    if (batch.open && batch.enc.state.n_cycles >= max_cycles)
+        batch_flush();
+}
+
+/**
+ * @brief Get the number of cycles per batch.
+ */
+int batch_get_max_cycles()
+{
+    return batch.max_cycles;
+}
+
+/**
+ * Add the series of the cycle that were never seen to the known series.
+ * Return true if there was any.
+ */
+static bool batch_learn_series(const sample_t *samples, int n)
+{
+    bool found;
+    bool learned = false;
+
+    for (int i = 0; i < n; i++)
+    {
+        found = false;
+        for (int j = 0; j < batch.n_series && !found; j++)
+            found = batch.series[j].sensor == samples[i].sensor && batch.series[j].metric == samples[i].metric;
+        if (!found && batch.n_series < TSC_MAX_SERIES)
+        {
+            batch.series[batch.n_series++] = samples[i];
+            learned = true;
+        }
+    }
+    return learned;
+}
+
+/**
+ * Start a batch with all the known series.
+ */
+static void batch_open()
+{
+    batch.open = tsc_begin(&batch.enc, batch.buf, sizeof(batch.buf), batch.series, batch.n_series) == 0;
+    batch.clock_steps = timesync_get_steps();
+}
@@ -0,0 +1,26 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "mqtt.h"
+#include "sample.h"
+#include "tsc.h"
+
+typedef struct batch
+{
+    const mqtt_stream_t *stream;
+    int max_cycles;
+    bool open;
+    uint32_t clock_steps; //timesync_get_steps() when the batch was opened
+    int n_series;
+    sample_t series[TSC_MAX_SERIES]; //every series seen so far
+    tsc_encoder_t enc;
+    uint8_t buf[MQTT_DATA_MAX_SIZE];
+} batch_t;
+
+void batch_init(const mqtt_stream_t *, int);
+void batch_add(const sample_t *, int);
+void batch_flush();
+void batch_set_max_cycles(int);
+int  batch_get_max_cycles();
+
+#endif /* __BATCH_H__ */
@@ -0,0 +1,90 @@
+#include "bme680_i2c.h"
+#include "driver/i2c.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "logger.h"
+
+/* macro definitions */
+#define TAG            "envmon:bme680_i2c"
+#define I2C_TIMEOUT_MS 50
+
+/* static function prototypes */
+static int8_t bme680_i2c_read(uint8_t, uint8_t, uint8_t *, uint16_t);
+static int8_t bme680_i2c_write(uint8_t, uint8_t, uint8_t *, uint16_t);
+static void   bme680_i2c_delay_ms(uint32_t);
+
+/**
+ * @brief Install the I2C master driver and bind the bus functions of the
+ * BME680 driver to it. Call it before bme680_init().
+ * @param dev The BME680 device.
+ * @param addr The I2C address of the sensor, BME680_I2C_ADDR_PRIMARY when SDO
+ *             is grounded, BME680_I2C_ADDR_SECONDARY otherwise.
+ */
+void bme680_i2c_init(struct bme680_dev *dev, uint8_t addr)
+{
+    i2c_config_t config = {
+        .mode = I2C_MODE_MASTER,
+        .sda_io_num = BME680_I2C_SDA_GPIO,
+        .sda_pullup_en = GPIO_PULLUP_ENABLE,
+        .scl_io_num = BME680_I2C_SCL_GPIO,
+        .scl_pullup_en = GPIO_PULLUP_ENABLE,
+        .master.clk_speed = BME680_I2C_FREQ_HZ,
+    };
+
+    ESP_ERROR_CHECK(i2c_param_config(BME680_I2C_PORT, &config));
+    ESP_ERROR_CHECK(i2c_driver_install(BME680_I2C_PORT, config.mode, 0, 0, 0));
+    dev->dev_id = addr;
+    dev->intf = BME680_I2C_INTF;
+    dev->read = bme680_i2c_read;
+    dev->write = bme680_i2c_write;
+    dev->delay_ms = bme680_i2c_delay_ms;
+}
+
+/**
+ * Read consecutive registers: the register address is written, then the data
+ * is read after a repeated start.
+ */
+static int8_t bme680_i2c_read(uint8_t dev_id, uint8_t reg_addr, uint8_t *data, uint16_t len)
+{
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    esp_err_t err;
+
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (dev_id << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, reg_addr, true);
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (dev_id << 1) | I2C_MASTER_READ, true);
+    i2c_master_read(cmd, data, len, I2C_MASTER_LAST_NACK);
+    i2c_master_stop(cmd);
+    err = i2c_master_cmd_begin(BME680_I2C_PORT, cmd, pdMS_TO_TICKS(I2C_TIMEOUT_MS));
+    i2c_cmd_link_delete(cmd);
+    if (err != ESP_OK)
+        LOGD(TAG, "Read of 0x%02x failed: %s", reg_addr, esp_err_to_name(err));
+    return err == ESP_OK ? 0 : -1;
+}
+
+/**
+ * Write registers. The driver passes the first register address apart and
+ * the data as value, address, value... pairs, which is the I2C write format.
+ */
+static int8_t bme680_i2c_write(uint8_t dev_id, uint8_t reg_addr, uint8_t *data, uint16_t len)
+{
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    esp_err_t err;
+
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (dev_id << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, reg_addr, true);
+    i2c_master_write(cmd, data, len, true);
+    i2c_master_stop(cmd);
+    err = i2c_master_cmd_begin(BME680_I2C_PORT, cmd, pdMS_TO_TICKS(I2C_TIMEOUT_MS));
+    i2c_cmd_link_delete(cmd);
+    if (err != ESP_OK)
+        LOGD(TAG, "Write of 0x%02x failed: %s", reg_addr, esp_err_to_name(err));
+    return err == ESP_OK ? 0 : -1;
+}
+
+static void bme680_i2c_delay_ms(uint32_t period)
+{
+    vTaskDelay(pdMS_TO_TICKS(period) + 1);
+}
@@ -0,0 +1,16 @@
+#ifndef __BME680_I2C_H__
+#define __BME680_I2C_H__
+
+#include <stdint.h>
+#include "bme680.h"
+
+/* macro definitions */
+#define BME680_I2C_PORT     0
+#define BME680_I2C_SDA_GPIO 21
+#define BME680_I2C_SCL_GPIO 22
+#define BME680_I2C_FREQ_HZ  100000
+
+/* function prototypes */
+void bme680_i2c_init(struct bme680_dev *, uint8_t);
+
+#endif /* __BME680_I2C_H__ */
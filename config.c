@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <string.h>
+#include "logger.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+#include "batch.h"
+#include "config.h"
+
+#define TAG           "envmon:config"
+#define NVS_NAMESPACE "envmon"
+#define NVS_KEY       "config"
+
+static config_t config = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+static const char *log_level_names[] = {"none", "error", "warn", "info", "debug", "verbose"};
+
+static void config_on_command(const char *, int);
+static int  config_parse(char *, config_settings_t *);
+static int  config_find_ctrl(const char *);
+static void config_status(const char *, const char *);
+static void config_save(const config_settings_t *);
+
+/**
+ * @brief Make the QoS of a stream configurable. Streams are registered
+ * before config_init().
+ * @param stream The stream.
+ */
+void config_register_stream(mqtt_stream_t *stream)
+{
+    if (config.n_streams < CONFIG_MAX_STREAMS)
+        config.streams[config.n_streams++] = stream;
+}
+
+/**
+ * @brief Take the current settings as the defaults, restore the settings
+ * saved in NVS and listen for commands. Called from the task that applies
+ * the settings, once the sampling controllers, the batching and the streams
+ * are set up. NVS must be initialized.
+ * @param topic The command topic (see config.h).
+ * @param status_stream The stream on which the outcome of commands is
+ *                      published.
+ * @param publish_raw Whether raw values are published by default.
+ */
+void config_init(const char *topic, const mqtt_stream_t *status_stream, bool publish_raw)
+{
+    config_settings_t *d = &config.defaults;
+    const adaptive_ctrl_t *ctrl;
+    nvs_handle_t handle;
+    size_t len = sizeof(config.pending);
+
+    config.status_stream = status_stream;
+    config.task = xTaskGetCurrentTaskHandle();
+    memset(d, 0, sizeof(*d));
+    d->version = CONFIG_VERSION;
+    d->publish_raw = publish_raw;
+    d->batch_cycles = batch_get_max_cycles();
+    for (int i = 0; i < adaptive_count(); i++)
+    {
+        ctrl = adaptive_get(i);
+        d->rates[i] = (config_rate_t){ctrl->min_period_ms, ctrl->max_period_ms, ctrl->max_slope, ctrl->max_stdev};
+    }
+    for (int i = 0; i < config.n_streams; i++)
+        config.default_qos[i] = config.streams[i]->qos;
+    config.current = *d;
+    config.pending = *d;
+
+    //settings saved by another firmware layout are ignored
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK)
+    {
+        if (nvs_get_blob(handle, NVS_KEY, &config.pending, &len) != ESP_OK
+            || len != sizeof(config.pending) || config.pending.version != CONFIG_VERSION)
+            config.pending = *d;
+        nvs_close(handle);
+    }
+    config.changed = true;
+    mqtt_subscribe(topic, 1, config_on_command);
+}
+
+/**
+ * @brief Apply the latest accepted settings if they changed since the last
+ * call, and save them in NVS if they came from a command. Called between two
+ * sampling cycles, so that a cycle never sees half of a change, and so that
+ * the flash write does not stall the MQTT task.
+ * @param changed Set to whether the settings changed, can be NULL.
+ * @return The current settings.
+ */
+const config_settings_t *config_apply(bool *changed)
+{
+    config_settings_t *s = &config.current;
+    config_settings_t next;
+    uint8_t qos;
+    bool found;
+    bool apply;
+    bool save;
+
+    portENTER_CRITICAL(&config.lock);
+    apply = config.changed;
+    save = config.unsaved;
+    config.changed = false;
+    config.unsaved = false;
+    if (apply)
+        next = config.pending;
+    portEXIT_CRITICAL(&config.lock);
+    if (changed)
+        *changed = apply;
+    if (!apply)
+        return s;
+
+    //tags no longer configured go back to the default level
+    for (int i = 0; i < s->n_log_levels; i++)
+    {
+        found = false;
+        for (int j = 0; j < next.n_log_levels && !found; j++)
+            found = strcmp(s->log_levels[i].tag, next.log_levels[j].tag) == 0;
+        if (!found)
+            logger_reset_level(s->log_levels[i].tag);
+    }
+    *s = next;
+
+    for (int i = 0; i < adaptive_count(); i++)
+        adaptive_configure(i, s->rates[i].min_period_ms, s->rates[i].max_period_ms,
+                           s->rates[i].max_slope, s->rates[i].max_stdev);
+    batch_set_max_cycles(s->batch_cycles);
+    for (int i = 0; i < config.n_streams; i++)
+    {
+        qos = config.default_qos[i];
+        for (int j = 0; j < s->n_qos; j++)
+        {
+            if (strcmp(s->qos[j].topic, config.streams[i]->topic) == 0)
+                qos = s->qos[j].qos;
+        }
+        config.streams[i]->qos = qos;
+    }
+    for (int i = 0; i < s->n_log_levels; i++)
+        logger_set_level(s->log_levels[i].tag, s->log_levels[i].level);
+    LOGI(TAG, "Settings applied");
+    if (save)
+        config_save(s);
+    return s;
+}
+
+/**
+ * Handle a message of the command topic. The commands are applied to a copy
+ * of the latest settings, which replaces them only if every command is valid.
+ */
+static void config_on_command(const char *data, int len)
+{
+    char buf[CONFIG_TEXT_MAX_SIZE];
+    config_settings_t next;
+    char *cmd, *save;
+
+    if (len >= CONFIG_TEXT_MAX_SIZE)
+    {
+        config_status("error: too long", NULL);
+        return;
+    }
+    memcpy(buf, data, len);
+    buf[len] = '\0';
+    portENTER_CRITICAL(&config.lock);
+    next = config.pending;
+    portEXIT_CRITICAL(&config.lock);
+    for (cmd = strtok_r(buf, ";\n", &save); cmd; cmd = strtok_r(NULL, ";\n", &save))
+    {
+        if (strspn(cmd, " \t\r") == strlen(cmd))
+            continue;
+        if (config_parse(cmd, &next) != 0)
+        {
+            config_status("error: ", cmd);
+            return;
+        }
+    }
+
+    portENTER_CRITICAL(&config.lock);
+    config.pending = next;
+    config.changed = true;
+    config.unsaved = true;
+    portEXIT_CRITICAL(&config.lock);
+    if (config.task)
+        xTaskNotifyGive(config.task); //apply and save without waiting for the next cycle
+    config_status("ok", NULL);
+}
+
+/**
+ * Apply one command to the settings. The command is modified.
+ */
+static int config_parse(char *cmd, config_settings_t *s)
+{
+    char verb[16], name[MQTT_TOPIC_MAX_SIZE], arg[16];
+    unsigned long a, b;
+    float x, y;
+    int n_levels = sizeof(log_level_names) / sizeof(log_level_names[0]);
+    int id;
+
+    if (sscanf(cmd, " %15s", verb) != 1)
+        return -1;
+    if (strcmp(verb, "reset") == 0)
+    {
+        *s = config.defaults;
+        return 0;
+    }
+    if (strcmp(verb, "raw") == 0 && sscanf(cmd, " raw %lu", &a) == 1 && a <= 1)
+    {
+        s->publish_raw = a;
+        return 0;
+    }
+    if (strcmp(verb, "batch") == 0 && sscanf(cmd, " batch %lu", &a) == 1 && a >= 1 && a <= UINT16_MAX)
+    {
+        s->batch_cycles = a;
+        return 0;
+    }
+    if (strcmp(verb, "rate") == 0 && sscanf(cmd, " rate %47s %lu %lu", name, &a, &b) == 3)
+    {
+        id = config_find_ctrl(name);
+        if (id < 0 || a == 0 || a > b)
+            return -1;
+        s->rates[id].min_period_ms = a;
+        s->rates[id].max_period_ms = b;
+        return 0;
+    }
+    if (strcmp(verb, "deadband") == 0 && sscanf(cmd, " deadband %47s %f %f", name, &x, &y) == 3)
+    {
+        id = config_find_ctrl(name);
+        if (id < 0 || x < 0 || y < 0)
+            return -1;
+        s->rates[id].max_slope = x;
+        s->rates[id].max_stdev = y;
+        return 0;
+    }
+    if (strcmp(verb, "qos") == 0 && sscanf(cmd, " qos %47s %lu", name, &a) == 2 && a <= 2)
+    {
+        for (id = 0; id < config.n_streams && strcmp(config.streams[id]->topic, name) != 0; id++)
+            ;
+        if (id == config.n_streams)
+            return -1;
+        for (int i = 0; i < s->n_qos; i++)
+        {
+            if (strcmp(s->qos[i].topic, name) == 0)
+            {
+                s->qos[i].qos = a;
+                return 0;
+            }
+        }
+        if (s->n_qos == CONFIG_MAX_QOS)
+            return -1;
+        strcpy(s->qos[s->n_qos].topic, name);
+        s->qos[s->n_qos++].qos = a;
+        return 0;
+    }
+    if (strcmp(verb, "log") == 0 && sscanf(cmd, " log %23s %15s", name, arg) == 2)
+    {
+        for (id = 0; id < n_levels && strcmp(arg, log_level_names[id]) != 0; id++)
+            ;
+        if (id == n_levels)
+            return -1;
+        for (int i = 0; i < s->n_log_levels; i++)
+        {
+            if (strcmp(s->log_levels[i].tag, name) == 0)
+            {
+                s->log_levels[i].level = id;
+                return 0;
+            }
+        }
+        if (s->n_log_levels == CONFIG_MAX_LOG_TAGS)
+            return -1;
+        strcpy(s->log_levels[s->n_log_levels].tag, name);
+        s->log_levels[s->n_log_levels++].level = id;
+        return 0;
+    }
+    return -1;
+}
+
+static int config_find_ctrl(const char *name)
+{
+    for (int i = 0; i < adaptive_count(); i++)
+        if (strcmp(adaptive_get(i)->name, name) == 0)
+            return i;
+    return -1;
+}
+
+static void config_status(const char *status, const char *cmd)
+{
+    char payload[CONFIG_TEXT_MAX_SIZE + 16];
+
+    snprintf(payload, sizeof(payload), "%s%s", status, cmd ? cmd : "");
+    LOGI(TAG, "%s", payload);
+    mqtt_publish_stream(config.status_stream, payload, 0);
+}
+
+static void config_save(const config_settings_t *s)
+{
+    nvs_handle_t handle;
+    esp_err_t err;
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+        return;
+    if (memcmp(s, &config.defaults, sizeof(*s)) == 0)
+        err = nvs_erase_key(handle, NVS_KEY);
+    else
+        err = nvs_set_blob(handle, NVS_KEY, s, sizeof(*s));
+    if ((err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) && nvs_commit(handle) == ESP_OK)
+        LOGI(TAG, "Settings saved");
+    else
+        LOGW(TAG, "Settings not saved");
+    nvs_close(handle);
+}
@@ -0,0 +1,87 @@
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "adaptive.h"
+#include "mqtt.h"
+
+/*
+ * Remote configuration
+ *
+ * A message on the command topic holds commands separated by ';' or
+ * newlines, applied all together or not at all:
+ *   raw 0|1                          publish the raw values
+ *   rate <ctrl> <min_ms> <max_ms>    sampling period bounds of a controller
+ *   deadband <ctrl> <slope> <stdev>  activity thresholds of a controller
+ *   batch <cycles>                   cycles per compressed batch
+ *   qos <topic> 0|1|2                QoS of a stream
+ *   log <tag>|* none|error|warn|info|debug|verbose
+ *   reset                            back to the firmware defaults
+ * e.g. "rate bme680_gas 2000 30000; batch 30; log envmon:mqtt warn".
+ * Log levels above the one the firmware is built with have no effect (see
+ * logger.h).
+ * The outcome ("ok" or "error: <command>") is published on the status
+ * stream, the settings are applied and saved in NVS by config_apply().
+ */
+#define CONFIG_MAX_STREAMS   20
+#define CONFIG_MAX_QOS       8 //streams whose QoS differs from the firmware one
+#define CONFIG_MAX_LOG_TAGS  4
+#define CONFIG_TAG_MAX_SIZE  24
+#define CONFIG_TEXT_MAX_SIZE 256
+#define CONFIG_VERSION       2
+
+typedef struct config_rate
+{
+    uint32_t min_period_ms;
+    uint32_t max_period_ms;
+    float max_slope;
+    float max_stdev;
+} config_rate_t;
+
+typedef struct config_qos
+{
+    char topic[MQTT_TOPIC_MAX_SIZE];
+    uint8_t qos;
+} config_qos_t;
+
+typedef struct config_log_level
+{
+    char tag[CONFIG_TAG_MAX_SIZE];
+    uint8_t level; //esp_log_level_t
+} config_log_level_t;
+
+typedef struct config_settings
+{
+    uint8_t version;
+    uint8_t publish_raw;
+    uint16_t batch_cycles;
+    config_rate_t rates[ADAPTIVE_MAX];
+    int n_qos;
+    config_qos_t qos[CONFIG_MAX_QOS]; //by topic, the saved settings outlive the stream order
+    int n_log_levels;
+    config_log_level_t log_levels[CONFIG_MAX_LOG_TAGS];
+} config_settings_t;
+
+typedef struct config
+{
+    const mqtt_stream_t *status_stream;
+    TaskHandle_t task; //the task applying the settings
+    int n_streams;
+    mqtt_stream_t *streams[CONFIG_MAX_STREAMS];
+    uint8_t default_qos[CONFIG_MAX_STREAMS];
+    config_settings_t defaults;
+    config_settings_t current; //applied, only used by the applying task
+    config_settings_t pending; //latest accepted, written by the MQTT task
+    volatile bool changed;
+    volatile bool unsaved; //pending came from a command
+    portMUX_TYPE lock;
+} config_t;
+
+void config_register_stream(mqtt_stream_t *);
+void config_init(const char *, const mqtt_stream_t *, bool);
+const config_settings_t *config_apply(bool *);
+
+#endif /* __CONFIG_H__ */
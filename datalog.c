@@ -0,0 +1,129 @@
+#include <string.h>
+#include "logger.h"
+#include "datalog.h"
+
+#define TAG        "envmon:datalog"
+#define SCAN_CHUNK 16 //records read at once while looking for the write position
+
+static datalog_t datalog;
+
+static uint8_t datalog_marker(uint32_t);
+
+/**
+ * @brief Open the data log and find where the previous run stopped writing.
+ * @param label The label of the data partition.
+ * @return 0 on success, or -1 if the partition is missing.
+ */
+int datalog_init(const char *label)
+{
+    datalog_record_t chunk[SCAN_CHUNK];
+    uint32_t size;
+    uint32_t newest = 0;
+    int64_t newest_ts = 0;
+    bool prev;
+
+    datalog.partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (!datalog.partition)
+    {
+        LOGW(TAG, "No %s partition, data log disabled", label);
+        return -1;
+    }
+    size = datalog.partition->size - datalog.partition->size % DATALOG_SECTOR_SIZE;
+
+    //the write position is the first erased record after a written one
+    prev = datalog_marker(size - sizeof(datalog_record_t)) == DATALOG_MARKER;
+    datalog.offset = 0;
+    for (uint32_t base = 0; base < size; base += sizeof(chunk))
+    {
+        esp_partition_read(datalog.partition, base, chunk, sizeof(chunk));
+        for (int i = 0; i < SCAN_CHUNK; i++)
+        {
+            if (prev && chunk[i].marker == 0xff)
+            {
+                datalog.offset = base + i * sizeof(datalog_record_t);
+                LOGI(TAG, "Resuming at offset %u", (unsigned)datalog.offset);
+                //at a sector start, the erase of the sector may have been cut short
+                if (datalog.offset % DATALOG_SECTOR_SIZE == 0)
+                    esp_partition_erase_range(datalog.partition, datalog.offset, DATALOG_SECTOR_SIZE);
+                return 0;
+            }
+            prev = chunk[i].marker == DATALOG_MARKER;
+            if (prev && chunk[i].timestamp > newest_ts)
+            {
+                newest_ts = chunk[i].timestamp;
+                newest = base + i * sizeof(datalog_record_t);
+            }
+        }
+    }
+
+    if (newest_ts > 0)
+    {
+        //no erased record: the power was lost between the last record of a sector and the erase of the next
+        //one, after the log wrapped around. The oldest sector follows the newest record.
+        datalog.offset = (newest / DATALOG_SECTOR_SIZE + 1) * DATALOG_SECTOR_SIZE % size;
+        LOGW(TAG, "No erased record, resuming after the newest one at offset %u", (unsigned)datalog.offset);
+    }
+    else if (datalog_marker(0) == 0xff)
+    {
+        return 0; //empty
+    }
+    //the oldest sector, or not a data log yet
+    esp_partition_erase_range(datalog.partition, datalog.offset, DATALOG_SECTOR_SIZE);
+    return 0;
+}
+
+/**
+ * @brief Append a sample to the data log.
+ * @param sample The sample.
+ * @return 0 on success, or -1 if the log is disabled or the write failed.
+ */
+int datalog_append(const sample_t *sample)
+{
+    datalog_record_t r;
+    uint32_t size;
+
+    if (!datalog.partition)
+        return -1;
+    r.timestamp = sample->timestamp;
+    r.value = sample->value;
+    r.sensor = sample->sensor;
+    r.metric = sample->metric;
+    r.exponent = sample->exponent;
+    r.marker = DATALOG_MARKER;
+    if (esp_partition_write(datalog.partition, datalog.offset, &r, sizeof(r)) != ESP_OK)
+    {
+        datalog.n_failed++;
+        return -1;
+    }
+    datalog.n_written++;
+
+    //keep the next sector erased
+    size = datalog.partition->size - datalog.partition->size % DATALOG_SECTOR_SIZE;
+    datalog.offset += sizeof(r);
+    if (datalog.offset % DATALOG_SECTOR_SIZE == 0)
+    {
+        if (datalog.offset == size)
+            datalog.offset = 0;
+        esp_partition_erase_range(datalog.partition, datalog.offset, DATALOG_SECTOR_SIZE);
+    }
+    return 0;
+}
+
+/**
+ * @brief Get the data log counters.
+ * @param n_written Where to store the number of records written.
+ * @param n_failed Where to store the number of failed writes.
+ */
+void datalog_get_stats(uint32_t *n_written, uint32_t *n_failed)
+{
+    *n_written = datalog.n_written;
+    *n_failed = datalog.n_failed;
+}
+
+static uint8_t datalog_marker(uint32_t offset)
+{
+    datalog_record_t r;
+
+    esp_partition_read(datalog.partition, offset, &r, sizeof(r));
+    return r.marker;
+}
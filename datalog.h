@@ -0,0 +1,45 @@
+#ifndef __DATALOG_H__
+#define __DATALOG_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_partition.h"
+#include "sample.h"
+
+/*
+ * Flash data log
+ *
+ * A ring of fixed-size sample records in a raw data partition, which the
+ * partition table declares as, e.g.
+ *   datalog, data, 0x40, , 64K
+ * Records are written in order and the sector ahead of the write position is
+ * always erased, so the position is found again at boot as the first erased
+ * record that follows a written one. The oldest sector is lost when the log
+ * wraps around.
+ */
+#define DATALOG_SECTOR_SIZE 4096
+#define DATALOG_MARKER      0xa5
+
+typedef struct datalog_record
+{
+    int64_t timestamp;
+    int32_t value;
+    uint8_t sensor;
+    uint8_t metric;
+    int8_t exponent;
+    uint8_t marker; //DATALOG_MARKER once written, 0xff when erased
+} datalog_record_t;
+
+typedef struct datalog
+{
+    const esp_partition_t *partition;
+    uint32_t offset; //next record
+    uint32_t n_written;
+    uint32_t n_failed;
+} datalog_t;
+
+int  datalog_init(const char *);
+int  datalog_append(const sample_t *);
+void datalog_get_stats(uint32_t *, uint32_t *);
+
+#endif /* __DATALOG_H__ */
@@ -0,0 +1,183 @@
+#include <math.h>
+#include "logger.h"
+#include "fusion.h"
+
+#define TAG           "envmon:fusion"
+#define GATE2         9.0f  //squared gate: 3 sigma
+#define NOISE_ALPHA   0.02f //learning rate of the noise models
+#define BIAS_ALPHA    0.01f //learning rate of the offsets
+#define VAR_FLOOR     0.25f //the learned noise never drops below 1/4 of the prior
+#define FAULT_CYCLES  12    //1 min at 5 s per cycle
+#define RECOVER_CYCLES 12
+
+static int fusion_gate(const fusion_t *, const float *, const bool *, bool *, int *);
+
+/**
+ * @brief Initialize a fusion filter.
+ * @param f The filter.
+ * @param n_sources The number of sources measuring the same quantity.
+ * @param prior_var The initial noise variance of each source, e.g. the
+ *                  square of its datasheet accuracy. The learned variance is
+ *                  kept above a fraction of it, so that the confidence
+ *                  interval does not claim more than the sensors can do.
+ * @param process_var The variance of the change of the quantity per second.
+ */
+void fusion_init(fusion_t *f, int n_sources, const float *prior_var, float process_var)
+{
+    f->n_sources = n_sources > FUSION_MAX_SOURCES ? FUSION_MAX_SOURCES : n_sources;
+    for (int i = 0; i < f->n_sources; i++)
+    {
+        f->sources[i].var = prior_var[i];
+        f->sources[i].var_floor = VAR_FLOOR * prior_var[i];
+        f->sources[i].bias = 0;
+        f->sources[i].n_disagree = 0;
+        f->sources[i].n_agree = 0;
+        f->sources[i].faulty = false;
+    }
+    f->process_var = process_var;
+    f->init = false;
+}
+
+/**
+ * @brief Fuse one cycle of measurements with a scalar Kalman filter. Each
+ * source is corrected by its learned offset to the estimate and weighted by
+ * its learned noise variance. A source outside the
+ * 3-sigma gate is ignored for the cycle, and flagged as faulty after it
+ * disagrees for FAULT_CYCLES cycles in a row while other sources agree,
+ * until it agrees again as long. When no source agrees, the quantity itself
+ * changed: the estimate starts again from the most trusted source.
+ * @param f The filter.
+ * @param values The measurement of each source.
+ * @param valid Whether each measurement is available.
+ * @param time The esp_timer time of the measurements, the estimate is
+ *             expected to drift with the time elapsed since the last update.
+ * @param est Where to store the estimate.
+ */
+void fusion_update(fusion_t *f, const float *values, const bool *valid, int64_t time, fusion_estimate_t *est)
+{
+    fusion_source_t *src;
+    bool inside[FUSION_MAX_SOURCES];
+    float y, s, k, y2;
+    int n_used = 0;
+    int n_agree, best;
+
+    if (!f->init)
+    {
+        //start from the most trusted source available
+        for (int i = 0; i < f->n_sources; i++)
+        {
+            if (valid[i] && (!f->init || f->sources[i].var < f->p))
+            {
+                f->x = values[i];
+                f->p = f->sources[i].var;
+                f->time = time;
+                f->init = true;
+            }
+        }
+        if (!f->init)
+        {
+            est->valid = false;
+            return;
+        }
+    }
+
+    //predict: the value is expected to stay the same, with an uncertainty growing with the time elapsed
+    f->p += f->process_var * (time - f->time) / 1e6f;
+    f->time = time;
+
+    n_agree = fusion_gate(f, values, valid, inside, &best);
+    if (n_agree == 0 && best >= 0)
+    {
+        //a step faster than the process noise, e.g. a window opened: rejecting every source would freeze the
+        //estimate and end up flagging the sources that follow the change
+        f->x = values[best] - f->sources[best].bias;
+        f->p = f->sources[best].var;
+        n_agree = fusion_gate(f, values, valid, inside, &best);
+        LOGI(TAG, "Step change, estimate restarted from source %d", best);
+    }
+    for (int i = 0; i < f->n_sources; i++)
+    {
+        if (!valid[i])
+            continue;
+        src = &f->sources[i];
+        y = values[i] - src->bias - f->x;
+        s = f->p + src->var;
+        y2 = y * y;
+
+        //noise model, with outliers clipped to the gate; a disagreeing
+        //source does not learn, or its model would grow to hide the fault
+        if (src->n_disagree == 0)
+        {
+            src->bias += BIAS_ALPHA * fmaxf(fminf(y, 3 * sqrtf(s)), -3 * sqrtf(s));
+            src->var += NOISE_ALPHA * (fminf(y2, GATE2 * s) - f->p - src->var);
+            if (src->var < src->var_floor)
+                src->var = src->var_floor;
+        }
+
+        //persistent disagreement with the other sources, not with an estimate they left behind
+        if (y2 > GATE2 * s)
+        {
+            if (n_agree - (inside[i] && !src->faulty) == 0)
+                continue;
+            src->n_agree = 0;
+            if (src->n_disagree < FAULT_CYCLES)
+                src->n_disagree++;
+            else if (!src->faulty)
+            {
+                src->faulty = true;
+                LOGW(TAG, "Source %d disagrees with the estimate", i);
+            }
+            continue;
+        }
+        src->n_disagree = 0;
+        if (src->faulty)
+        {
+            if (++src->n_agree < RECOVER_CYCLES)
+                continue;
+            src->faulty = false;
+            LOGI(TAG, "Source %d agrees again", i);
+        }
+
+        //update
+        k = f->p / s;
+        f->x += k * y;
+        f->p *= 1.0f - k;
+        n_used++;
+    }
+
+    est->valid = n_used > 0;
+    est->value = f->x;
+    est->ci95 = 1.96f * sqrtf(f->p);
+    est->faulty = 0;
+    for (int i = 0; i < f->n_sources; i++)
+    {
+        if (f->sources[i].faulty)
+            est->faulty |= 1 << i;
+    }
+}
+
+/**
+ * Gate the valid sources against the predicted estimate. Returns the number
+ * of sources inside the gate, the faulty ones aside, and sets best to the
+ * valid source with the lowest noise, faulty ones aside, or -1.
+ */
+static int fusion_gate(const fusion_t *f, const float *values, const bool *valid, bool *inside, int *best)
+{
+    const fusion_source_t *src;
+    float y;
+    int n = 0;
+
+    *best = -1;
+    for (int i = 0; i < f->n_sources; i++)
+    {
+        src = &f->sources[i];
+        y = values[i] - src->bias - f->x;
+        inside[i] = valid[i] && y * y <= GATE2 * (f->p + src->var);
+        if (!valid[i] || src->faulty)
+            continue;
+        n += inside[i];
+        if (*best < 0 || src->var < f->sources[*best].var)
+            *best = i;
+    }
+    return n;
+}
@@ -0,0 +1,41 @@
+#ifndef __FUSION_H__
+#define __FUSION_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FUSION_MAX_SOURCES 4
+
+typedef struct fusion_source
+{
+    float bias; //learned offset to the estimate
+    float var; //learned measurement noise variance
+    float var_floor;
+    uint16_t n_disagree; //consecutive cycles outside the gate
+    uint16_t n_agree; //consecutive cycles inside the gate, to recover
+    bool faulty;
+} fusion_source_t;
+
+typedef struct fusion
+{
+    int n_sources;
+    fusion_source_t sources[FUSION_MAX_SOURCES];
+    float process_var; //how much the true value may change per second
+    float x; //estimate
+    float p; //variance of the estimate
+    int64_t time; //esp_timer time of the last update
+    bool init;
+} fusion_t;
+
+typedef struct fusion_estimate
+{
+    bool valid;
+    float value;
+    float ci95; //half-width of the 95% confidence interval
+    uint8_t faulty; //bit i set when source i persistently disagrees
+} fusion_estimate_t;
+
+void fusion_init(fusion_t *, int, const float *, float);
+void fusion_update(fusion_t *, const float *, const bool *, int64_t, fusion_estimate_t *);
+
+#endif /* __FUSION_H__ */
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "logger.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "wifi.h"
+#include "aio.h"
+#include "mqtt.h"
+#include "adaptive.h"
+#include "health.h"
+
+#define TAG               "envmon:health"
+#define HEALTH_STACK_SIZE 3072
+#define HEALTH_PRIORITY   2
+
+static health_t health;
+
+static void health_task(void *);
+
+/**
+ * @brief Start publishing the device health at a low rate. Each sample is
+ * published as two records that each fit in an offline queue slot: the link
+ * and uplink counters on the topic, the PUBACK latency, memory usage and
+ * sampling periods on its /device subtopic.
+ * @param topic The topic on which link records are published.
+ * @param period_ms The period between two health records in ms.
+ */
+void health_init(const char *topic, uint32_t period_ms)
+{
+    snprintf(health.device_topic, sizeof(health.device_topic), "%s/device", topic);
+    //status streams: the offline queue keeps every record of an outage
+    health.stream = (mqtt_stream_t){topic, 1, 0, MQTT_QUEUE_STATUS};
+    health.device_stream = (mqtt_stream_t){health.device_topic, 1, 0, MQTT_QUEUE_STATUS};
+    health.period_ms = period_ms;
+    xTaskCreate(health_task, "health", HEALTH_STACK_SIZE, NULL, HEALTH_PRIORITY, NULL);
+}
+
+/**
+ * @brief Sample the link quality, uplink counters and memory usage. The PUBACK
+ * latency covers the publications since the previous sample.
+ * @param data Where to store the sample. The RSSI is 0 when the station is not
+ *             associated.
+ */
+void health_sample(health_data_t *data)
+{
+    if (wifi_get_rssi(&data->rssi) != 0)
+        data->rssi = 0;
+    wifi_get_link_stats(&data->wifi_disconnects, &data->wifi_reconnects);
+    mqtt_get_stats(&data->mqtt_connects, &data->mqtt_failed);
+    data->mqtt_outbox = mqtt_get_outbox_size();
+    mqtt_get_queue_stats(&data->mqtt_queued, &data->mqtt_dropped);
+    aio_get_stats(&data->aio_requests, &data->aio_failed);
+    mqtt_get_latency(&data->puback, true);
+    data->free_heap = esp_get_free_heap_size();
+    data->min_free_heap = esp_get_minimum_free_heap_size();
+    data->uptime = esp_timer_get_time() / 1000000;
+}
+
+/**
+ * @brief Format the link and uplink counters of a health sample as a JSON object.
+ * @param data The sample to format.
+ * @param buf The output buffer.
+ * @param size The size of the output buffer.
+ * @return The length of the record, or -1 if it does not fit in the buffer.
+ */
+int health_format(const health_data_t *data, char *buf, int size)
+{
+    int len;
+
+    len = snprintf(buf, size,
+                   "{\"rssi\":%d,\"wifi_disc\":%" PRIu32 ",\"wifi_reconn\":%" PRIu32
+                   ",\"mqtt_conn\":%" PRIu32 ",\"mqtt_fail\":%" PRIu32 ",\"mqtt_outbox\":%d"
+                   ",\"mqtt_queue\":%" PRIu32 ",\"mqtt_drop\":%" PRIu32
+                   ",\"aio_req\":%" PRIu32 ",\"aio_fail\":%" PRIu32 ",\"uptime\":%" PRIu32 "}",
+                   data->rssi, data->wifi_disconnects, data->wifi_reconnects,
+                   data->mqtt_connects, data->mqtt_failed, data->mqtt_outbox,
+                   data->mqtt_queued, data->mqtt_dropped,
+                   data->aio_requests, data->aio_failed, data->uptime);
+    return len < size ? len : -1;
+}
+
+/**
+ * @brief Format the PUBACK latency, memory usage and sampling periods of a
+ * health sample as a JSON object.
+ * @param data The sample to format.
+ * @param buf The output buffer.
+ * @param size The size of the output buffer.
+ * @return The length of the record, or -1 if it does not fit in the buffer.
+ */
+int health_format_device(const health_data_t *data, char *buf, int size)
+{
+    const adaptive_ctrl_t *ctrl;
+    int len;
+
+    len = snprintf(buf, size,
+                   "{\"puback\":{\"n\":%" PRIu32 ",\"lost\":%" PRIu32 ",\"p50\":%" PRId64
+                   ",\"p95\":%" PRId64 ",\"p99\":%" PRId64 ",\"max\":%" PRId64 "}"
+                   ",\"heap\":%" PRIu32 ",\"min_heap\":%" PRIu32 ",\"uptime\":%" PRIu32 "}",
+                   data->puback.n, data->puback.n_lost, data->puback.p50,
+                   data->puback.p95, data->puback.p99, data->puback.max,
+                   data->free_heap, data->min_free_heap, data->uptime);
+    //current sampling periods, appended inside the object
+    for (int i = 0; i < adaptive_count() && len < size; i++)
+    {
+        ctrl = adaptive_get(i);
+        len--; //overwrite the closing brace
+        len += snprintf(buf + len, size - len, "%s\"%s\":%u}", i == 0 ? ",\"period_ms\":{" : ",",
+                        ctrl->name, (unsigned)ctrl->period_ms);
+    }
+    if (adaptive_count() > 0 && len < size)
+        len += snprintf(buf + len, size - len, "}");
+    return len < size ? len : -1;
+}
+
+static void health_task(void *arg)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+    health_data_t data;
+    char payload[MQTT_DATA_MAX_SIZE]; //a record must fit in an offline queue slot
+
+    while (1)
+    {
+        vTaskDelayUntil(&last_wake, health.period_ms / portTICK_PERIOD_MS);
+        health_sample(&data);
+        if (health_format(&data, payload, sizeof(payload)) < 0)
+            LOGW(TAG, "Health record truncated");
+        else
+            mqtt_publish_stream(&health.stream, payload, 0);
+        if (health_format_device(&data, payload, sizeof(payload)) < 0)
+            LOGW(TAG, "Device health record truncated");
+        else
+            mqtt_publish_stream(&health.device_stream, payload, 0);
+    }
+}
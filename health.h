@@ -0,0 +1,38 @@
+#ifndef __HEALTH_H__
+#define __HEALTH_H__
+
+#include <stdint.h>
+#include "mqtt.h"
+
+typedef struct health_data
+{
+    int8_t   rssi;
+    uint32_t wifi_disconnects;
+    uint32_t wifi_reconnects;
+    uint32_t mqtt_connects;
+    uint32_t mqtt_failed;
+    int      mqtt_outbox;
+    uint32_t mqtt_queued;
+    uint32_t mqtt_dropped;
+    uint32_t aio_requests;
+    uint32_t aio_failed;
+    mqtt_latency_t puback;
+    uint32_t free_heap;
+    uint32_t min_free_heap;
+    uint32_t uptime;
+} health_data_t;
+
+typedef struct health
+{
+    mqtt_stream_t stream;
+    mqtt_stream_t device_stream;
+    char device_topic[MQTT_TOPIC_MAX_SIZE];
+    uint32_t period_ms;
+} health_t;
+
+void health_init(const char *, uint32_t);
+void health_sample(health_data_t *);
+int  health_format(const health_data_t *, char *, int);
+int  health_format_device(const health_data_t *, char *, int);
+
+#endif /* __HEALTH_H__ */
@@ -0,0 +1,63 @@
+#include <string.h>
+#include "histogram.h"
+
+/* upper bounds of the buckets in us, the last bucket catches the rest */
+static const int64_t bounds[HISTOGRAM_N_BUCKETS - 1] = {
+    1000, 2000, 5000, 10000, 20000, 50000, 100000,
+    200000, 500000, 1000000, 2000000, 5000000, 10000000
+};
+
+/**
+ * @brief Empty a histogram.
+ * @param h The histogram.
+ */
+void histogram_reset(histogram_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+/**
+ * @brief Record a value.
+ * @param h The histogram.
+ * @param value The value in us.
+ */
+void histogram_add(histogram_t *h, int64_t value)
+{
+    int i = 0;
+
+    while (i < HISTOGRAM_N_BUCKETS - 1 && value > bounds[i])
+        i++;
+    h->counts[i]++;
+    if (h->n == 0 || value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+    h->sum += value;
+    h->n++;
+}
+
+/**
+ * @brief Estimate a percentile from the bucket counts.
+ * @param h The histogram.
+ * @param p The percentile, from 0 to 100.
+ * @return The upper bound of the bucket holding the percentile, clamped to the
+ *         largest recorded value, or 0 if the histogram is empty.
+ */
+int64_t histogram_percentile(const histogram_t *h, uint32_t p)
+{
+    uint64_t rank;
+    uint64_t cumul = 0;
+
+    if (h->n == 0)
+        return 0;
+    rank = ((uint64_t)h->n * p + 99) / 100;
+    if (rank == 0)
+        rank = 1;
+    for (int i = 0; i < HISTOGRAM_N_BUCKETS - 1; i++)
+    {
+        cumul += h->counts[i];
+        if (cumul >= rank)
+            return bounds[i] < h->max ? bounds[i] : h->max;
+    }
+    return h->max;
+}
@@ -0,0 +1,21 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdint.h>
+
+#define HISTOGRAM_N_BUCKETS 14
+
+typedef struct histogram
+{
+    uint32_t counts[HISTOGRAM_N_BUCKETS];
+    uint32_t n;
+    int64_t  min;
+    int64_t  max;
+    int64_t  sum;
+} histogram_t;
+
+void    histogram_reset(histogram_t *);
+void    histogram_add(histogram_t *, int64_t);
+int64_t histogram_percentile(const histogram_t *, uint32_t);
+
+#endif /* __HISTOGRAM_H__ */
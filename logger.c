@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "logger.h"
+
+static logger_t logger = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+    .default_level = CONFIG_LOG_DEFAULT_LEVEL,
+};
+
+static esp_log_level_t logger_get_level(const char *);
+
+/**
+ * @brief Set the runtime level of a tag, for the LOGx macros and ESP_LOGx
+ * alike. Levels above LOGGER_LEVEL have no effect on the LOGx calls, they are
+ * not compiled in. At most LOGGER_MAX_TAGS tags have their own level, the
+ * others are ignored.
+ * @param tag The tag, or "*" for the default level of all the tags, which
+ *            also resets the levels set per tag.
+ * @param level The most verbose level logged.
+ */
+void logger_set_level(const char *tag, esp_log_level_t level)
+{
+    logger_tag_t reset[LOGGER_MAX_TAGS];
+    int n_reset = 0;
+    int i;
+
+    portENTER_CRITICAL(&logger.lock);
+    if (strcmp(tag, "*") == 0)
+    {
+        logger.default_level = level;
+        n_reset = logger.n_tags;
+        memcpy(reset, logger.tags, n_reset * sizeof(logger_tag_t));
+        logger.n_tags = 0;
+    }
+    else
+    {
+        for (i = 0; i < logger.n_tags && strcmp(logger.tags[i].tag, tag) != 0; i++)
+            ;
+        if (i < LOGGER_MAX_TAGS)
+        {
+            snprintf(logger.tags[i].tag, LOGGER_TAG_MAX_SIZE, "%s", tag);
+            logger.tags[i].level = level;
+            if (i == logger.n_tags)
+                logger.n_tags++;
+        }
+    }
+    portEXIT_CRITICAL(&logger.lock);
+    //ESP-IDF keeps the levels set per tag over a new default
+    for (i = 0; i < n_reset; i++)
+        esp_log_level_set(reset[i].tag, level);
+    esp_log_level_set(tag, level);
+}
+
+/**
+ * @brief Give a tag the default level back and free its entry.
+ * @param tag The tag, or "*" to give every tag the level of the build,
+ *            CONFIG_LOG_DEFAULT_LEVEL.
+ */
+void logger_reset_level(const char *tag)
+{
+    esp_log_level_t level;
+    int i;
+
+    if (strcmp(tag, "*") == 0)
+    {
+        logger_set_level(tag, CONFIG_LOG_DEFAULT_LEVEL);
+        return;
+    }
+    portENTER_CRITICAL(&logger.lock);
+    for (i = 0; i < logger.n_tags && strcmp(logger.tags[i].tag, tag) != 0; i++)
+        ;
+    if (i < logger.n_tags)
+        logger.tags[i] = logger.tags[--logger.n_tags];
+    level = logger.default_level;
+    portEXIT_CRITICAL(&logger.lock);
+    esp_log_level_set(tag, level);
+}
+
+/**
+ * @brief Decide whether a message is logged: its level is enabled for its tag
+ * and its call site has a token left. Called by the LOGx macros.
+ * @param bucket The token bucket of the call site.
+ * @param tag The tag of the message.
+ * @param level The level of the message.
+ * @param n_suppressed Where to store the number of messages of the call site
+ *                     dropped since the last one logged.
+ * @return Whether the message is logged.
+ */
+bool logger_take(logger_bucket_t *bucket, const char *tag, esp_log_level_t level, uint32_t *n_suppressed)
+{
+    uint32_t now_ms;
+    uint32_t n_refills;
+    bool take;
+
+    if (level > logger_get_level(tag))
+        return false;
+    now_ms = esp_timer_get_time() / 1000;
+    portENTER_CRITICAL(&logger.lock);
+    n_refills = (now_ms - bucket->last_ms) / LOGGER_REFILL_MS;
+    if (n_refills > 0)
+    {
+        bucket->tokens = bucket->tokens + n_refills >= LOGGER_BURST ? LOGGER_BURST : bucket->tokens + n_refills;
+        bucket->last_ms += n_refills * LOGGER_REFILL_MS;
+    }
+    take = bucket->tokens > 0;
+    if (take)
+    {
+        bucket->tokens--;
+        *n_suppressed = bucket->n_suppressed;
+        bucket->n_suppressed = 0;
+    }
+    else if (bucket->n_suppressed < UINT16_MAX)
+    {
+        bucket->n_suppressed++;
+    }
+    portEXIT_CRITICAL(&logger.lock);
+    return take;
+}
+
+/**
+ * The level of a tag. Without levels set per tag, the common case, the table
+ * is not searched nor locked.
+ */
+static esp_log_level_t logger_get_level(const char *tag)
+{
+    esp_log_level_t level = logger.default_level;
+
+    if (logger.n_tags == 0)
+        return level;
+    portENTER_CRITICAL(&logger.lock);
+    for (int i = 0; i < logger.n_tags; i++)
+    {
+        if (strcmp(logger.tags[i].tag, tag) == 0)
+            level = logger.tags[i].level;
+    }
+    portEXIT_CRITICAL(&logger.lock);
+    return level;
+}
@@ -0,0 +1,89 @@
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+/*
+ * Logging
+ *
+ * LOGE, LOGW, LOGI, LOGD and LOGV take the arguments of ESP_LOGx and add:
+ * - compile-time elision: the calls above LOGGER_LEVEL are removed with
+ *   their arguments. LOGGER_LEVEL is CONFIG_LOG_MAXIMUM_LEVEL, and
+ *   ESP_LOG_NONE in release builds (NDEBUG, set when assertions are
+ *   disabled in menuconfig): nothing is formatted nor written to the UART;
+ * - runtime levels per tag, checked before the arguments are formatted, set
+ *   by logger_set_level() and cleared by logger_reset_level() (the log
+ *   command of config.h);
+ * - rate limiting: each call site has a token bucket of LOGGER_BURST
+ *   messages, refilled by one every LOGGER_REFILL_MS. The messages beyond are
+ *   dropped and counted, the count is logged before the next message of the
+ *   site.
+ * With LOGGER_LEVEL below ESP_LOG_INFO the console sink of the uplink is not
+ * started either.
+ */
+#ifndef LOGGER_LEVEL
+#if defined(NDEBUG)
+#define LOGGER_LEVEL ESP_LOG_NONE
+#elif defined(CONFIG_LOG_MAXIMUM_LEVEL)
+#define LOGGER_LEVEL CONFIG_LOG_MAXIMUM_LEVEL
+#else
+#define LOGGER_LEVEL CONFIG_LOG_DEFAULT_LEVEL
+#endif
+#endif
+#define LOGGER_BURST        5
+#define LOGGER_REFILL_MS    1000
+#define LOGGER_MAX_TAGS     8
+#define LOGGER_TAG_MAX_SIZE 24
+
+typedef struct logger_bucket
+{
+    uint32_t last_ms;      /* time of the last refill */
+    uint16_t tokens;
+    uint16_t n_suppressed; /* since the last message */
+} logger_bucket_t;
+
+typedef struct logger_tag
+{
+    char tag[LOGGER_TAG_MAX_SIZE];
+    uint8_t level; //esp_log_level_t
+} logger_tag_t;
+
+typedef struct logger
+{
+    portMUX_TYPE lock;
+    uint8_t default_level;
+    volatile int n_tags;
+    logger_tag_t tags[LOGGER_MAX_TAGS];
+} logger_t;
+
+#define LOGGER_BUCKET_INITIALIZER {0, LOGGER_BURST, 0}
+
+#define LOGGER_LOG(level, esp_log, tag, format, ...)                                                \
+    do                                                                                              \
+    {                                                                                               \
+        static logger_bucket_t logger_bucket = LOGGER_BUCKET_INITIALIZER;                           \
+        uint32_t logger_suppressed;                                                                 \
+        if ((level) <= LOGGER_LEVEL && logger_take(&logger_bucket, tag, level, &logger_suppressed)) \
+        {                                                                                           \
+            if (logger_suppressed > 0)                                                              \
+                esp_log(tag, "%" PRIu32 " similar messages suppressed", logger_suppressed);         \
+            esp_log(tag, format, ##__VA_ARGS__);                                                    \
+        }                                                                                           \
+    } while (0)
+
+#define LOGE(tag, format, ...) LOGGER_LOG(ESP_LOG_ERROR, ESP_LOGE, tag, format, ##__VA_ARGS__)
+#define LOGW(tag, format, ...) LOGGER_LOG(ESP_LOG_WARN, ESP_LOGW, tag, format, ##__VA_ARGS__)
+#define LOGI(tag, format, ...) LOGGER_LOG(ESP_LOG_INFO, ESP_LOGI, tag, format, ##__VA_ARGS__)
+#define LOGD(tag, format, ...) LOGGER_LOG(ESP_LOG_DEBUG, ESP_LOGD, tag, format, ##__VA_ARGS__)
+#define LOGV(tag, format, ...) LOGGER_LOG(ESP_LOG_VERBOSE, ESP_LOGV, tag, format, ##__VA_ARGS__)
+
+void logger_set_level(const char *, esp_log_level_t);
+void logger_reset_level(const char *);
+bool logger_take(logger_bucket_t *, const char *, esp_log_level_t, uint32_t *);
+
+#endif /* __LOGGER_H__ */
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <math.h>
 #include "freertos/FreeRTOS.h" //sets configuration required to run freeRTOS on ESP32
 #include "freertos/task.h" //provides the multitasking functionality
 #include "sdkconfig.h" //make sdkconfig options available to the project build system and source files
@@ -6,139 +7,282 @@
 #include "mcp9700.h"
 #include "vma311.h"
 #include "bme680.h"
+#include "bme680_i2c.h"
 #include "wifi.h"
 #include "aio.h"
 #include "mqtt.h"
 #include "bme680.h"
+#include "ps_bench.h"
+#include "health.h"
+#include "sample.h"
+#include "batch.h"
+#include "timesync.h"
+#include "snapshot.h"
+#include "fusion.h"
+#include "adaptive.h"
+#include "aggregate.h"
+#include "rules.h"
+#include "config.h"
+#include "uplink.h"
+#include "registry.h"
+#include "trace.h"
+#include "logger.h"
+#include "esp_timer.h"
 
 
+#define TAG "envmon:main" //log tag
 #define BUILTIN_LED_GPIO GPIO_NUM_2 //GPIO 2 assigned to LED
 #define MCP9700_ADC_UNIT ADC_UNIT_1 //ADC1 for MCP9700
 #define MCP9700_ADC_CHANNEL ADC_CHANNEL_4 //Channel 4 for MCP9700
 #define VMA311_GPIO GPIO_NUM_5 //GPIO 5 assigned to VMA311
+#define PUBLISH_PERIOD_MS 5000 //delay between two publications
+#define HEALTH_PERIOD_MS 60000 //delay between two device health records
+#define N_SAMPLES 9 //raw and fused samples per cycle
+#define CBOR_MAX_SIZE 128 //room for a whole cycle in CBOR
+#define BATCH_CYCLES 60 //cycles per compressed batch
+#define SUMMARY_SHORT_MS 60000 //1 min summaries
+#define SUMMARY_LONG_MS 900000 //15 min summaries, for the long-retention dashboards
+#define PUBLISH_RAW 0 //set to 1 to publish the raw values next to the fused ones
+#define PS_BENCHMARK 0 //set to 1 to measure the power-save impact on publication latency
+
+//MQTT streams: the fused values are the primary streams (JSON with the 95% confidence interval)
+static mqtt_stream_t fused_temp_stream = {"vn170735/fused/temp", 1, 0, MQTT_QUEUE_DATA};
+static mqtt_stream_t fused_humidity_stream = {"vn170735/fused/humidity", 1, 0, MQTT_QUEUE_DATA};
+//Raw samples use QoS 0, the next cycle supersedes a lost one
+//Each metric topic (see the registry below) carries text, the samples topic carries a whole cycle in CBOR (see sample.h)
+static mqtt_stream_t samples_stream = {"vn170735/samples", 0, 0, MQTT_QUEUE_DATA};
+//The batch topic carries compressed batches of cycles (see tsc.h), they are worth a PUBACK
+static mqtt_stream_t batch_stream = {"vn170735/batch", 1, 0, MQTT_QUEUE_DATA};
+//Window summaries (min, max, mean, stddev, count, last per series), one JSON record per series
+static mqtt_stream_t summary_short_stream = {"vn170735/summary/1m", 1, 0, MQTT_QUEUE_DATA};
+static mqtt_stream_t summary_long_stream = {"vn170735/summary/15m", 1, 0, MQTT_QUEUE_DATA};
+//Alarms go out as soon as a rule triggers, the rule table comes from NVS or the config topic (see rules.h)
+//The offline queue never downsamples them
+static mqtt_stream_t alarm_stream = {"vn170735/alarm", 1, 0, MQTT_QUEUE_ALARM};
+
+//Raw values are published only on demand, see the raw command (config.h)
+static bool publish_raw = PUBLISH_RAW;
+
+//Streams whose QoS can be changed remotely, the registry adds the raw ones
+static mqtt_stream_t *const streams[] = {
+    &fused_temp_stream, &fused_humidity_stream, &samples_stream, &batch_stream,
+    &summary_short_stream, &summary_long_stream, &alarm_stream,
+};
+static const mqtt_stream_t config_status_stream = {"vn170735/config/status", 1, 0, MQTT_QUEUE_STATUS};
+
+//Event traces are dumped on demand, see trace.h
+static const mqtt_stream_t trace_stream = {"vn170735/trace", 0, 0, MQTT_QUEUE_DATA};
+
+//Uplink routes of the fused values: console label, MQTT stream, Adafruit IO feed key and units
+static const uplink_route_t fused_temp_route = {"fused:temp", &fused_temp_stream, "envmon.fused-temp", "degC"};
+static const uplink_route_t fused_humidity_route = {"fused:humidity", &fused_humidity_stream, "envmon.fused-humidity", "%RH"};
+
+//Sensor registry: the sensors are sampled between their own period bounds, faster while a controlled metric moves
+enum {MCP9700, VMA311, BME680};
+enum {MCP9700_TEMP, VMA311_TEMP, VMA311_HUMIDITY, BME680_TEMP, BME680_HUMIDITY, BME680_PRESSURE, BME680_GAS_RESISTANCE};
+
+static bool mcp9700_ok(const snapshot_data_t *snap) { return true; }
+static bool vma311_ok(const snapshot_data_t *snap) { return snap->vma311.status == VMA311_OK; }
+static bool bme680_ok(const snapshot_data_t *snap) { return snap->bme680_status == BME680_OK; }
+static int32_t mcp9700_temp(const snapshot_data_t *snap) { return snap->mcp9700; }
+static int32_t vma311_temp(const snapshot_data_t *snap) { return snap->vma311.t_int * 10 + snap->vma311.t_dec; }
+static int32_t vma311_humidity(const snapshot_data_t *snap) { return snap->vma311.rh_int * 10 + snap->vma311.rh_dec; }
+static int32_t bme680_temp(const snapshot_data_t *snap) { return snap->bme680.temperature; }
+static int32_t bme680_humidity(const snapshot_data_t *snap) { return snap->bme680.humidity; }
+static int32_t bme680_pressure(const snapshot_data_t *snap) { return snap->bme680.pressure; }
+static int32_t bme680_gas_resistance(const snapshot_data_t *snap) { return snap->bme680.gas_resistance; }
+
+static const registry_sensor_t sensors[] = {
+    //name, snapshot bit, period bounds (ms), read status
+    [MCP9700] = {"mcp9700", SNAPSHOT_MCP9700, 1000, 60000, mcp9700_ok},
+    [VMA311] = {"vma311", SNAPSHOT_VMA311, 2000, 60000, vma311_ok}, //the DHT11 needs 1 s between reads, 2 s to be safe
+    [BME680] = {"bme680", SNAPSHOT_BME680, 3000, 60000, bme680_ok}, //each forced cycle heats the gas plate
+};
+
+static const registry_metric_t metrics[] = {
+    //sensor, codes, topic suffix, units, exponent, read, plausible range, rate controller (slope per s, stdev, ln, resolution)
+    //the thresholds apply to the smoothed values, the stdev ones stay above the quantization flicker
+    [MCP9700_TEMP] = {MCP9700, SAMPLE_MCP9700, SAMPLE_TEMPERATURE, "temp", "degC", 0, mcp9700_temp, -40, 125, "mcp9700", 0.05f, 1.5f, false, 1},
+    [VMA311_TEMP] = {VMA311, SAMPLE_VMA311, SAMPLE_TEMPERATURE, "temp", "degC", -1, vma311_temp, 0, 50},
+    [VMA311_HUMIDITY] = {VMA311, SAMPLE_VMA311, SAMPLE_HUMIDITY, "humidity", "%RH", -1, vma311_humidity, 0, 100, "vma311", 0.2f, 2.0f, false, 1}, //whole %RH
+    [BME680_TEMP] = {BME680, SAMPLE_BME680, SAMPLE_TEMPERATURE, "temp", "degC", -2, bme680_temp, -40, 85, "bme680", 0.02f, 0.3f, false, 0.01f},
+    [BME680_HUMIDITY] = {BME680, SAMPLE_BME680, SAMPLE_HUMIDITY, "humidity", "%RH", -3, bme680_humidity, 0, 100},
+    [BME680_PRESSURE] = {BME680, SAMPLE_BME680, SAMPLE_PRESSURE, "pressure", "Pa", 0, bme680_pressure, 30000, 110000},
+    [BME680_GAS_RESISTANCE] = {BME680, SAMPLE_BME680, SAMPLE_GAS_RESISTANCE, "gas_resistance", "Ohm", 0, bme680_gas_resistance, 1, 1e8f, "bme680_gas", 0.01f, 0.1f, true}, //relative change
+};
+
+//Fusion priors: datasheet accuracy as 2 sigma, squared; sources in the order mcp9700, vma311, bme680
+static const float temp_prior_var[] = {1.0f, 1.0f, 0.25f};
+static const float humidity_prior_var[] = {6.25f, 2.25f}; //vma311, bme680
+#define TEMP_PROCESS_VAR 0.002f //per second: 0.1 degC in 5 s
+#define HUMIDITY_PROCESS_VAR 0.05f //per second: 0.5 %RH in 5 s
+
+#define SCHEDULE_SLACK_US 50000 //sensors due within 50 ms join the snapshot
+
+
+static void publish_estimate(const uplink_route_t *route, const sample_t *sample, const fusion_estimate_t *est)
+{
+    char detail[UPLINK_DETAIL_MAX_SIZE];
+
+    snprintf(detail, sizeof(detail), "\"ci95\":%.2f,\"faulty\":%d", est->ci95, est->faulty);
+    uplink_publish(route, sample, detail, UPLINK_ALL);
+}
 
 
 void app_main()
 {
-    //Create variables for each sensor
-    uint32_t mcp_temp;
-    char mcp9700_temperature[8];
-    char vma311_temperature[8];
-    char vma311_humidity[8];
-    char bme680_humidity[8];
-    char bme680_pressure[8];
-    char bme680_gas_resistance[8];
-    char bme680_temperature[8];
-
-    vma311_data_t vma311_data;
+    uint8_t raw_to; //sinks of the raw values
+    sample_t samples[N_SAMPLES];
+    int n_samples;
+    uint8_t cbor[CBOR_MAX_SIZE];
+    int cbor_len;
+    int64_t timestamp;
+    fusion_t fused_temp;
+    fusion_t fused_humidity;
+    fusion_estimate_t temp_est;
+    fusion_estimate_t humidity_est;
+    float values[3];
+    bool valid[3];
+
+    int64_t now, wake;
+    uint8_t due;
+    bool reconfigured;
+
     struct bme680_dev bme;
-    struct bme680_field_data bme_data;
+    snapshot_data_t snap;
   
     
 
     /* Device initialization */
     
     //Wi-Fi connection
+    wifi_set_power_save(sensors[MCP9700].min_period_ms); //radio sleep tuned to the fastest sensor, updated as the rates change
     wifi_init("Freebox-A28900", "condida-sospitatis6-gemellorum-emoti8"); //wifi connection
     //wifi_init("Raspberry", "esilv-evd21");
     //wifi_init("iPhone", "azertyazerty");
+
+    //Time synchronization, samples are stamped with the epoch time
+    timesync_init("pool.ntp.org");
     
     //Adafruit.io initialization
     aio_init("victornitot","aio_wSii70UyFJTrweGsyyK4X33loIpq"); //adafruit
     aio_create_group("envmon");
-    aio_create_feed("mcp9700","envmon");
-    aio_create_feed("vma311","envmon");
+    aio_create_feed("fused-temp", "envmon");
+    aio_create_feed("fused-humidity", "envmon");
     
+    //Uplink sinks, each with its own queue and task
+    uplink_init("datalog");
+
     //Mqtt broker initialization
     mqtt_init("mqtts://@iot.devinci.online", "vn170735", "%%@s5$ZQ");  //parameters are : protocol, host name, username & password
     
+    //Alarm rules
+    rules_init(&alarm_stream, "vn170735/config/rules");
+
+    //Compressed batches of cycles
+    batch_init(&batch_stream, BATCH_CYCLES);
+
+    //Windowed summaries
+    aggregate_add_window(&summary_short_stream, SUMMARY_SHORT_MS);
+    aggregate_add_window(&summary_long_stream, SUMMARY_LONG_MS);
+
+    //Device health telemetry
+    health_init("vn170735/health", HEALTH_PERIOD_MS);
+
+    //Event tracer dumps
+    trace_init("vn170735/trace/cmd", &trace_stream);
+
+#if PS_BENCHMARK
+    ps_bench_run("vn170735/ps_bench", 20, PUBLISH_PERIOD_MS);
+#endif
+
     //Sensors initialization
     mcp9700_init(MCP9700_ADC_UNIT, MCP9700_ADC_CHANNEL); //mcp9700 init
     vma311_init(VMA311_GPIO); //vma311 init
-    bme.intf = BME680_I2C_INTF;
+    bme680_i2c_init(&bme, BME680_I2C_ADDR_SECONDARY);
     bme680_init(&bme); //bme680 init
+    snapshot_init(&bme); //all sensors sampled together
+    fusion_init(&fused_temp, 3, temp_prior_var, TEMP_PROCESS_VAR);
+    fusion_init(&fused_humidity, 2, humidity_prior_var, HUMIDITY_PROCESS_VAR);
+
+    //Routes, feeds, streams and rate controllers of the sensor metrics
+    registry_init(sensors, sizeof(sensors) / sizeof(sensors[0]), metrics, sizeof(metrics) / sizeof(metrics[0]),
+                  "vn170735", "envmon");
+
+    //Remote configuration, restores the settings saved in NVS
+    for (size_t i = 0; i < sizeof(streams) / sizeof(streams[0]); i++)
+        config_register_stream(streams[i]);
+    config_init("vn170735/config/cmd", &config_status_stream, PUBLISH_RAW);
 
     
 
     while (1)
     {
-        /* Data collection, printing, MQTT publishing, adafruit publishing*/
+        //sleep until the next sensor is due, a command wakes the loop up
+        wake = registry_next_due();
+        now = esp_timer_get_time();
+        if (wake > now)
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((wake - now) / 1000) + 1);
 
-                                    /*MCP9700*/
-        
-        //get value
-        mcp_temp = mcp9700_get_value();
-        
-        //print to console
-        printf("mcp9700:temp:%d\n", mcp_temp);
-        
-        //convert the int into a char
-        sprintf(mcp9700_temperature, "%d", mcp_temp);
-        
-        //publish to adafruit io
-        aio_create_data(mcp9700_temperature, "envmon.mcp9700");
-        
-        //publish to mqtt borker
-        mqtt_publish("vn170735/mcp9700/temp",mcp9700_temperature);
+        //settings and rules received by MQTT are applied and saved between two cycles, new rates start with a fresh sample
+        publish_raw = config_apply(&reconfigured)->publish_raw;
+        if (reconfigured)
+            registry_reschedule();
+        rules_save();
+        raw_to = UPLINK_TO(UPLINK_CONSOLE) | UPLINK_TO(UPLINK_FLASH);
+        if (publish_raw)
+            raw_to |= UPLINK_TO(UPLINK_MQTT) | UPLINK_TO(UPLINK_AIO);
 
+        //sample the sensors that are due at once, with one shared timestamp
+        due = registry_due(esp_timer_get_time(), SCHEDULE_SLACK_US);
+        if (!due)
+            continue; //woken up early
+        TRACE_BEGIN(TRACE_CYCLE, due);
+        snapshot_take(&snap, due);
+        timestamp = snap.timestamp;
+        LOGD(TAG, "snapshot:cycle_us:%d", snap.cycle_us);
 
-                             /* VMA311 (DHT11) */
-        
-        vma311_data = vma311_get_values();
-        
-        //Convert the int into a char
-        sprintf(vma311_temperature,"%d", vma311_data.t_int);
-        sprintf(vma311_humidity,"%d", vma311_data.rh_int);
-        
-        //print to console
-        if (vma311_data.status == VMA311_OK) //if no time out error absurdity 
+        //print, log and publish the raw values, schedule the next samples
+        n_samples = registry_collect(&snap, samples, N_SAMPLES - 2, raw_to); //room left for the fused values
+        wifi_set_power_save(registry_shortest_period()); //the rates follow the signals and the settings
+
+
+                            /*Fusion*/
+
+        valid[0] = registry_value(MCP9700_TEMP, &values[0]);
+        valid[1] = registry_value(VMA311_TEMP, &values[1]);
+        valid[2] = registry_value(BME680_TEMP, &values[2]);
+        fusion_update(&fused_temp, values, valid, snap.mono_time, &temp_est);
+
+        valid[0] = registry_value(VMA311_HUMIDITY, &values[0]);
+        valid[1] = registry_value(BME680_HUMIDITY, &values[1]);
+        fusion_update(&fused_humidity, values, valid, snap.mono_time, &humidity_est);
+
+        if (temp_est.valid)
         {
-            printf("vma311:temp:%d.%d\n", vma311_data.t_int, vma311_data.t_dec);
-            printf("vma311:humidity:%d.%d\n", vma311_data.rh_int, vma311_data.rh_dec);
+            samples[n_samples] = (sample_t){SAMPLE_FUSED, SAMPLE_TEMPERATURE, -2, lroundf(temp_est.value * 100), timestamp};
+            publish_estimate(&fused_temp_route, &samples[n_samples++], &temp_est);
         }
-        else
+        if (humidity_est.valid)
         {
-            printf("vma311:error\n");
+            samples[n_samples] = (sample_t){SAMPLE_FUSED, SAMPLE_HUMIDITY, -2, lroundf(humidity_est.value * 100), timestamp};
+            publish_estimate(&fused_humidity_route, &samples[n_samples++], &humidity_est);
         }
-        
-        //Publish on adafruit
-        aio_create_data(vma311_temperature, "envmon.vma311-temp");
-        aio_create_data(vma311_humidity, "envmon.vma311-humidity");
-        
-        //Publish on MQTT broker
-        mqtt_publish("vn170735/vma311/temp",vma311_temperature);
-        mqtt_publish("vn170735/vma311/humidity",vma311_humidity);
 
 
-                            /*BME680*/
-        
-        bme680_get_sensor_data(&bme_data, &bme); //get values
-        
-        //Print to console
-        printf("bme680:temp:%d\n", bme_data.temperature);
-        printf("bme680:humidity:%d\n", bme_data.humidity);
-        printf("bme680:pressure:%d\n", bme_data.pressure);
-        printf("bme680:gas_resistance:%d\n", bme_data.gas_resistance);
-        
-        //Convert the int into a char
-        sprintf(bme680_temperature,"%d", bme_data.temperature); 
-        sprintf(bme680_humidity,"%d", bme_data.humidity);
-        sprintf(bme680_pressure,"%d", bme_data.pressure);
-        sprintf(bme680_gas_resistance,"%d", bme_data.gas_resistance);
-        
-        //Publish on adafruit
-        aio_create_data(bme680_humidity, "envmon.bme680-temp");
-        aio_create_data(bme680_pressure, "envmon.bme680-humidity");
-        aio_create_data(bme680_gas_resistance, "envmon.bme680-pressure");
-        aio_create_data(bme680_temperature, "envmon.bme680-gas_resistance");
-        
-        //Publish on MQTT broker
-        mqtt_publish("vn170735/bme680/temp",bme680_temperature);
-        mqtt_publish("vn170735/bme680/humidity",bme680_humidity);
-        mqtt_publish("vn170735/bme680/pressure",bme680_pressure);
-        mqtt_publish("vn170735/bme680/gas_resistance",bme680_gas_resistance);
+                            /*Whole cycle, binary*/
+
+        if (publish_raw)
+        {
+            cbor_len = sample_encode_cbor(samples, n_samples, cbor, sizeof(cbor));
+            if (cbor_len > 0)
+                mqtt_publish_stream(&samples_stream, (const char *)cbor, cbor_len);
+        }
+        rules_check(samples, n_samples);
+        batch_add(samples, n_samples);
+        aggregate_add(samples, n_samples);
+        TRACE_END(TRACE_CYCLE, n_samples);
         
      
-        vTaskDelay(5000 / portTICK_PERIOD_MS); // 5 sec delay
     }
 }
@@ -16,18 +16,17 @@ void mcp9700_init(adc_unit_t unit, adc_channel_t channel)
     else
     {
         adc2_config_channel_atten(channel, ADC_ATTEN); //mcp9700.unit == ADC_UNIT_2
-        adc_chars = calloc(1, sizeof(esp_adc_cal_characteristics_t)); //to allocate memory
-        esp_adc_cal_characterize(unit, ADC_ATTEN, ADC_WIDTH, DEFAULT_VREF, adc_chars); //in function of the ADC, we store the voltage value to the pointed address
-        mcp9700.unit = unit; //assigning parameter values
-        mcp9700.channel = channel;
-        mcp9700.adc_chars = *adc_chars;
+    }
+    adc_chars = calloc(1, sizeof(esp_adc_cal_characteristics_t)); //to allocate memory
+    esp_adc_cal_characterize(unit, ADC_ATTEN, ADC_WIDTH, DEFAULT_VREF, adc_chars); //in function of the ADC, we store the voltage value to the pointed address
+    mcp9700.unit = unit; //assigning parameter values
+    mcp9700.channel = channel;
+    mcp9700.adc_chars = *adc_chars;
 }
 
 int32_t mcp9700_get_value()
 {
     uint32_t adc_reading = 0;
-    uint32_t voltage; //creating the voltage variable to calculate temperature
-    uint32_t temperature; //creating the temperature variable which will be returned
     for (int i = 0; i < NO_OF_SAMPLES; i++) //64 samples as defined in mcp9700.h
     {
         if (mcp9700.unit == ADC_UNIT_1)
@@ -42,8 +41,11 @@ int32_t mcp9700_get_value()
         }
     }
     adc_reading /= NO_OF_SAMPLES; //we make an average of the adc value by dividing by number of samples
-    voltage = esp_adc_cal_raw_to_voltage(adc_reading, adc_chars);
-    voltage = voltage - 500; //formula to have the voltage
-    temperature = voltage/10; //temperature with the voltage
-    return temperature;
+    return mcp9700_raw_to_temperature(adc_reading, adc_chars);
+}
+
+int32_t mcp9700_raw_to_temperature(uint32_t raw, const esp_adc_cal_characteristics_t *chars)
+{
+    int32_t voltage = esp_adc_cal_raw_to_voltage(raw, chars); //in mV
+    return (voltage - 500) / 10; //500 mV at 0 degC, 10 mV/degC, signed below 0 degC
 }
@@ -21,5 +21,6 @@ typedef struct mcp9700
 // function prototypes
 void    mcp9700_init(adc_unit_t, adc_channel_t); //init will be used in the main
 int32_t mcp9700_get_value(); //get value will be used in the main
+int32_t mcp9700_raw_to_temperature(uint32_t, const esp_adc_cal_characteristics_t *); //averaged ADC reading to degC
 
 #endif 
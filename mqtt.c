@@ -1,16 +1,37 @@
 #include <stdlib.h>
 #include <string.h>
-#include "esp_log.h"
+#include "logger.h"
 #include "esp_event.h"
 #include "esp_tls.h"
+#include "esp_timer.h"
 #include "mqtt_client.h"
 #include "mqtt.h"
+#include "trace.h"
 
 #define TAG "envmon:mqtt"
 
-static mqtt_t mqtt;
+#define FLUSH_BATCH      8   /* messages sent back to back on reconnection */
+#define FLUSH_PACE_MS    250 /* delay between two batches */
+#define FLUSH_STACK_SIZE 4096
+#define FLUSH_PRIORITY   4
+
+static mqtt_t mqtt = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
 
 static void mqtt_event_handler(void *, esp_event_base_t, int32_t, void *);
+static void mqtt_track_publish(int, int64_t);
+static void mqtt_track_puback(int, int64_t);
+static int  mqtt_publish_qos(const char *, const char *, int, int, int, int);
+static int  mqtt_send(const char *, const char *, int, int, int);
+static void mqtt_queue_push(const char *, const char *, int, int, int, int);
+static mqtt_queue_topic_t *mqtt_queue_find(const char *);
+static bool mqtt_queue_thin();
+static bool mqtt_queue_evict(bool);
+static bool mqtt_queue_pop(mqtt_message_t *);
+static void mqtt_queue_unpop(const mqtt_message_t *);
+static void mqtt_flush_task(void *);
+static void mqtt_dispatch(esp_mqtt_event_t *);
 
 /**
  * @brief Initialize a connection to a MQTT broker.
@@ -26,25 +47,558 @@ void mqtt_init(const char *uri, const char *username, const char *password)
         .password = password,
     };
 
+    mqtt.queue_lock = xSemaphoreCreateMutex();
+    xTaskCreate(mqtt_flush_task, "mqtt_flush", FLUSH_STACK_SIZE, NULL, FLUSH_PRIORITY, &mqtt.flush_task);
     mqtt.client = esp_mqtt_client_init(&client_config);
     ESP_ERROR_CHECK(esp_mqtt_client_register_event(mqtt.client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL));
     ESP_ERROR_CHECK(esp_mqtt_client_start(mqtt.client));
 }
 
 /**
- * @brief Publish data on a MQTT topic.
+ * @brief Publish a string on a MQTT topic with QoS 1.
  * @param topic The topic on which data will be plublish in the form /some/where.
  * @param data The data to publish.
+ * @return The message ID, 0 if the message was queued, or -1 if the
+ *         publication failed.
+ */
+int mqtt_publish(const char *topic, const char *data)
+{
+    return mqtt_publish_qos(topic, data, strlen(data), 1, 0, MQTT_QUEUE_DATA);
+}
+
+/**
+ * @brief Publish data on a stream, with the QoS and retain flag of the stream.
+ * @param stream The stream on which data will be published.
+ * @param data The data to publish.
+ * @param len The length of data. If 0, data is a null-terminated string.
+ * @return The message ID (0 for QoS 0 or queued messages), or -1 if the
+ *         publication failed.
+ */
+int mqtt_publish_stream(const mqtt_stream_t *stream, const char *data, int len)
+{
+    if (len == 0)
+        len = strlen(data);
+    return mqtt_publish_qos(stream->topic, data, len, stream->qos, stream->retain, stream->queue_class);
+}
+
+/**
+ * Hand a message to the client outbox without waiting for the network task.
+ * While the client is disconnected, or while older messages are still waiting
+ * to be flushed, the message is copied in the bounded offline queue instead.
+ * So is a message the outbox refused, the flush retries it.
+ */
+static int mqtt_publish_qos(const char *topic, const char *data, int len, int qos, int retain, int queue_class)
+{
+    int message_id;
+
+    TRACE_BEGIN(TRACE_MQTT_PUBLISH, len);
+    xSemaphoreTake(mqtt.queue_lock, portMAX_DELAY);
+    if (!mqtt.connected || mqtt.queue.count > 0)
+    {
+        mqtt_queue_push(topic, data, len, qos, retain, queue_class);
+        xSemaphoreGive(mqtt.queue_lock);
+        if (mqtt.connected)
+            xTaskNotifyGive(mqtt.flush_task);
+        TRACE_END(TRACE_MQTT_PUBLISH, 0);
+        return 0;
+    }
+    xSemaphoreGive(mqtt.queue_lock);
+    message_id = mqtt_send(topic, data, len, qos, retain);
+    if (message_id == -1)
+    {
+        xSemaphoreTake(mqtt.queue_lock, portMAX_DELAY);
+        mqtt_queue_push(topic, data, len, qos, retain, queue_class);
+        xSemaphoreGive(mqtt.queue_lock);
+        message_id = 0;
+    }
+    TRACE_END(TRACE_MQTT_PUBLISH, message_id);
+    return message_id;
+}
+
+/**
+ * @brief Select what happens to the offline queue when it is full.
+ * MQTT_QUEUE_DROP_OLDEST discards the oldest message. MQTT_QUEUE_DOWNSAMPLE
+ * discards every other queued message of the topic that holds the most and
+ * halves the rate at which new messages of that topic are accepted, so that
+ * each stream spans the whole outage at a coarser resolution. The status and
+ * alarm streams are never downsampled. With either policy, alarms are only
+ * evicted by newer alarms.
+ * @param policy The policy.
  */
-void mqtt_publish(const char *topic, const char *data)
+void mqtt_set_queue_policy(mqtt_queue_policy_t policy)
+{
+    xSemaphoreTake(mqtt.queue_lock, portMAX_DELAY);
+    mqtt.queue.policy = policy;
+    xSemaphoreGive(mqtt.queue_lock);
+}
+
+/**
+ * @brief Get the offline queue counters.
+ * @param depth Where to store the number of queued messages.
+ * @param n_dropped Where to store the number of messages dropped by the queue.
+ */
+void mqtt_get_queue_stats(uint32_t *depth, uint32_t *n_dropped)
+{
+    *depth = mqtt.queue.count;
+    *n_dropped = mqtt.queue.n_dropped;
+}
+
+/**
+ * Enqueue a message in the client outbox. The network task sends it, so the
+ * caller never blocks on the socket.
+ */
+static int mqtt_send(const char *topic, const char *data, int len, int qos, int retain)
 {
     int message_id;
+    int64_t start;
 
-    message_id = esp_mqtt_client_publish(mqtt.client, topic, data, 0, 1, 0);
+    start = esp_timer_get_time();
+    message_id = esp_mqtt_client_enqueue(mqtt.client, topic, data, len, qos, retain, true);
     if (message_id != -1)
-        ESP_LOGI(TAG, "Message publication succeed: message ID=%d", message_id);
+    {
+        if (qos > 0)
+            mqtt_track_publish(message_id, start);
+        LOGD(TAG, "Message publication succeed: message ID=%d", message_id);
+    }
+    else
+    {
+        mqtt.n_failed++;
+        LOGW(TAG, "Message publication failed");
+    }
+    return message_id;
+}
+
+/**
+ * @brief Get the size of the messages waiting in the client outbox.
+ * @return The outbox size in bytes.
+ */
+int mqtt_get_outbox_size()
+{
+    return esp_mqtt_client_get_outbox_size(mqtt.client);
+}
+
+/**
+ * @brief Tell whether the client is connected to the broker.
+ */
+bool mqtt_is_connected()
+{
+    return mqtt.connected;
+}
+
+/**
+ * @brief Get the connection and publication counters.
+ * @param n_connects Where to store the number of connections to the broker.
+ * @param n_failed Where to store the number of failed publications.
+ */
+void mqtt_get_stats(uint32_t *n_connects, uint32_t *n_failed)
+{
+    *n_connects = mqtt.n_connects;
+    *n_failed = mqtt.n_failed;
+}
+
+/**
+ * @brief Get the distribution of the QoS 1 publication round trips, from the
+ * publish call to the matching PUBACK.
+ * @param latency Where to store the percentiles, in us.
+ * @param reset If true, start a new measurement window.
+ */
+void mqtt_get_latency(mqtt_latency_t *latency, bool reset)
+{
+    histogram_t h;
+
+    portENTER_CRITICAL(&mqtt.lock);
+    h = mqtt.latency;
+    latency->n_lost = mqtt.n_lost;
+    if (reset)
+    {
+        histogram_reset(&mqtt.latency);
+        mqtt.n_lost = 0;
+    }
+    portEXIT_CRITICAL(&mqtt.lock);
+    latency->n = h.n;
+    latency->p50 = histogram_percentile(&h, 50);
+    latency->p95 = histogram_percentile(&h, 95);
+    latency->p99 = histogram_percentile(&h, 99);
+    latency->max = h.max;
+}
+
+/**
+ * Copy a message at the tail of the offline queue, applying the queue policy
+ * when it is full. A message that finds the queue full of alarms is dropped,
+ * unless it is an alarm itself. The queue lock must be held.
+ */
+static void mqtt_queue_push(const char *topic, const char *data, int len, int qos, int retain, int queue_class)
+{
+    mqtt_queue_t *q = &mqtt.queue;
+    mqtt_queue_topic_t *t;
+    mqtt_message_t *msg;
+
+    if (strlen(topic) >= MQTT_TOPIC_MAX_SIZE || len > MQTT_DATA_MAX_SIZE)
+    {
+        q->n_dropped++;
+        LOGW(TAG, "Message too large to be queued: %s", topic);
+        return;
+    }
+    t = queue_class == MQTT_QUEUE_DATA ? mqtt_queue_find(topic) : NULL;
+    if (t != NULL && t->n_offered++ % t->decimation != 0)
+    {
+        q->n_dropped++;
+        return;
+    }
+    if (q->count == MQTT_QUEUE_LEN && (q->policy == MQTT_QUEUE_DROP_OLDEST || !mqtt_queue_thin())
+        && !mqtt_queue_evict(queue_class == MQTT_QUEUE_ALARM))
+    {
+        q->n_dropped++;
+        return;
+    }
+    msg = &q->messages[(q->head + q->count) % MQTT_QUEUE_LEN];
+    strcpy(msg->topic, topic);
+    memcpy(msg->data, data, len);
+    msg->len = len;
+    msg->qos = qos;
+    msg->retain = retain;
+    msg->queue_class = queue_class;
+    q->count++;
+}
+
+/**
+ * Find the downsampling state of a topic, NULL if it is not downsampled.
+ */
+static mqtt_queue_topic_t *mqtt_queue_find(const char *topic)
+{
+    for (int i = 0; i < mqtt.queue.n_topics; i++)
+    {
+        if (strcmp(mqtt.queue.topics[i].topic, topic) == 0)
+            return &mqtt.queue.topics[i];
+    }
+    return NULL;
+}
+
+/**
+ * Discard every other queued message of the data topic that holds the most
+ * and halve the rate at which its new messages are accepted. Fails when no
+ * topic holds two messages or too many topics are downsampled already, the
+ * caller then falls back to dropping the oldest message.
+ */
+static bool mqtt_queue_thin()
+{
+    mqtt_queue_t *q = &mqtt.queue;
+    mqtt_queue_topic_t *t;
+    mqtt_message_t *msg;
+    const char *topic = NULL;
+    int n_max = 1;
+    int n;
+    int kept;
+
+    for (int i = 0; i < q->count; i++)
+    {
+        msg = &q->messages[(q->head + i) % MQTT_QUEUE_LEN];
+        if (msg->queue_class != MQTT_QUEUE_DATA)
+            continue;
+        n = 0;
+        for (int j = i; j < q->count; j++)
+            n += strcmp(q->messages[(q->head + j) % MQTT_QUEUE_LEN].topic, msg->topic) == 0;
+        if (n > n_max)
+        {
+            n_max = n;
+            topic = msg->topic;
+        }
+    }
+    if (topic == NULL)
+        return false;
+    t = mqtt_queue_find(topic);
+    if (t == NULL)
+    {
+        if (q->n_topics == MQTT_QUEUE_N_TOPICS)
+            return false;
+        t = &q->topics[q->n_topics++];
+        strcpy(t->topic, topic);
+        t->decimation = 1;
+        t->n_offered = 0;
+    }
+    //keep the 1st, 3rd... message of the topic, and all the others
+    kept = 0;
+    n = 0;
+    for (int i = 0; i < q->count; i++)
+    {
+        msg = &q->messages[(q->head + i) % MQTT_QUEUE_LEN];
+        if (strcmp(msg->topic, t->topic) == 0 && n++ % 2 != 0)
+            continue;
+        if (kept != i)
+            q->messages[(q->head + kept) % MQTT_QUEUE_LEN] = *msg;
+        kept++;
+    }
+    q->n_dropped += q->count - kept;
+    q->count = kept;
+    t->decimation *= 2;
+    LOGW(TAG, "Offline queue full, keeping 1 message out of %u on %s", (unsigned)t->decimation, t->topic);
+    return true;
+}
+
+/**
+ * Drop the oldest message that is not an alarm or, if there are none and
+ * alarm is true, the oldest alarm. Fails if nothing can be dropped.
+ */
+static bool mqtt_queue_evict(bool alarm)
+{
+    mqtt_queue_t *q = &mqtt.queue;
+    int i;
+
+    for (i = 0; i < q->count; i++)
+    {
+        if (q->messages[(q->head + i) % MQTT_QUEUE_LEN].queue_class != MQTT_QUEUE_ALARM)
+            break;
+    }
+    if (i == q->count)
+    {
+        if (!alarm || q->count == 0)
+            return false;
+        i = 0;
+    }
+    //close the gap by moving the older messages up
+    for (; i > 0; i--)
+        q->messages[(q->head + i) % MQTT_QUEUE_LEN] = q->messages[(q->head + i - 1) % MQTT_QUEUE_LEN];
+    q->head = (q->head + 1) % MQTT_QUEUE_LEN;
+    q->count--;
+    q->n_dropped++;
+    return true;
+}
+
+/**
+ * Take the message at the head of the offline queue.
+ */
+static bool mqtt_queue_pop(mqtt_message_t *msg)
+{
+    mqtt_queue_t *q = &mqtt.queue;
+    bool found = false;
+
+    xSemaphoreTake(mqtt.queue_lock, portMAX_DELAY);
+    if (q->count > 0)
+    {
+        *msg = q->messages[q->head];
+        q->head = (q->head + 1) % MQTT_QUEUE_LEN;
+        q->count--;
+        found = true;
+    }
+    else
+    {
+        q->n_topics = 0;
+    }
+    xSemaphoreGive(mqtt.queue_lock);
+    return found;
+}
+
+/**
+ * Put back at the head of the offline queue a message taken by
+ * mqtt_queue_pop() that could not be sent. If the queue filled up
+ * meanwhile, the message is the oldest one and is dropped, unless it is an
+ * alarm that can take the place of a message of another stream.
+ */
+static void mqtt_queue_unpop(const mqtt_message_t *msg)
+{
+    mqtt_queue_t *q = &mqtt.queue;
+
+    xSemaphoreTake(mqtt.queue_lock, portMAX_DELAY);
+    if (q->count < MQTT_QUEUE_LEN || (msg->queue_class == MQTT_QUEUE_ALARM && mqtt_queue_evict(false)))
+    {
+        q->head = (q->head + MQTT_QUEUE_LEN - 1) % MQTT_QUEUE_LEN;
+        q->messages[q->head] = *msg;
+        q->count++;
+    }
     else
-        ESP_LOGI(TAG, "Message publication failed");
+    {
+        q->n_dropped++;
+    }
+    xSemaphoreGive(mqtt.queue_lock);
+}
+
+/**
+ * Flush the offline queue in paced batches once the client is connected, so
+ * that a reconnection does not burst the whole backlog at the broker.
+ */
+static void mqtt_flush_task(void *arg)
+{
+    static mqtt_message_t msg;
+    int n_sent;
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (mqtt.connected)
+        {
+            for (n_sent = 0; n_sent < FLUSH_BATCH; n_sent++)
+            {
+                if (!mqtt_queue_pop(&msg))
+                    break;
+                if (mqtt_send(msg.topic, msg.data, msg.len, msg.qos, msg.retain) == -1)
+                {
+                    //outbox full or disconnected meanwhile: retried on the next notification
+                    mqtt_queue_unpop(&msg);
+                    break;
+                }
+            }
+            if (n_sent < FLUSH_BATCH)
+                break;
+            vTaskDelay(FLUSH_PACE_MS / portTICK_PERIOD_MS);
+        }
+    }
+}
+
+/**
+ * Remember when a QoS 1 message was handed to the client. When the table is
+ * full the oldest entry is evicted and counted as lost. The client may send
+ * the message and handle its PUBACK before this is called: such a PUBACK is
+ * kept aside and matched here, provided it came after the call that handed
+ * the message over, so that an old PUBACK with a reused ID does not match.
+ */
+static void mqtt_track_publish(int msg_id, int64_t time)
+{
+    int slot = 0;
+
+    portENTER_CRITICAL(&mqtt.lock);
+    for (int i = 0; i < MQTT_N_EARLY; i++)
+    {
+        if (mqtt.early[i].msg_id == msg_id && mqtt.early[i].time >= time)
+        {
+            histogram_add(&mqtt.latency, mqtt.early[i].time - time);
+            mqtt.early[i].msg_id = 0;
+            portEXIT_CRITICAL(&mqtt.lock);
+            return;
+        }
+    }
+    for (int i = 0; i < MQTT_N_PENDING; i++)
+    {
+        if (mqtt.pending[i].msg_id == 0)
+        {
+            slot = i;
+            break;
+        }
+        if (mqtt.pending[i].time < mqtt.pending[slot].time)
+            slot = i;
+    }
+    if (mqtt.pending[slot].msg_id != 0)
+        mqtt.n_lost++;
+    mqtt.pending[slot].msg_id = msg_id;
+    mqtt.pending[slot].time = time;
+    portEXIT_CRITICAL(&mqtt.lock);
+}
+
+/**
+ * Record the round trip of an acknowledged message. A PUBACK of a message
+ * not tracked yet takes a free early slot, or replaces the oldest early
+ * PUBACK when there are none.
+ */
+static void mqtt_track_puback(int msg_id, int64_t time)
+{
+    int slot = 0;
+
+    portENTER_CRITICAL(&mqtt.lock);
+    for (int i = 0; i < MQTT_N_PENDING; i++)
+    {
+        if (mqtt.pending[i].msg_id == msg_id)
+        {
+            histogram_add(&mqtt.latency, time - mqtt.pending[i].time);
+            mqtt.pending[i].msg_id = 0;
+            portEXIT_CRITICAL(&mqtt.lock);
+            return;
+        }
+    }
+    for (int i = 0; i < MQTT_N_EARLY; i++)
+    {
+        if (mqtt.early[i].msg_id == 0)
+        {
+            slot = i;
+            break;
+        }
+        if (mqtt.early[i].time < mqtt.early[slot].time)
+            slot = i;
+    }
+    mqtt.early[slot].msg_id = msg_id;
+    mqtt.early[slot].time = time;
+    portEXIT_CRITICAL(&mqtt.lock);
+}
+
+/**
+ * @brief Publish data on a MQTT topic and wait for its acknowledgement.
+ * Only one task at a time may wait for a publication.
+ * @param topic The topic on which data will be plublish in the form /some/where.
+ * @param data The data to publish.
+ * @param timeout_ms The maximum time to wait for the PUBACK in ms.
+ * @return The time between the call and the PUBACK in us, or -1 on failure or
+ *         timeout.
+ */
+int64_t mqtt_publish_wait(const char *topic, const char *data, uint32_t timeout_ms)
+{
+    int64_t start;
+    int64_t deadline;
+    int64_t latency = -1;
+    int message_id;
+
+    mqtt.waiting_task = xTaskGetCurrentTaskHandle();
+    start = esp_timer_get_time();
+    deadline = start + (int64_t)timeout_ms * 1000;
+    message_id = mqtt_publish(topic, data);
+    /* the PUBACK may be handled before we start waiting: the notification
+     * count and the recorded message ID cover that case */
+    while (message_id > 0 && latency < 0 && esp_timer_get_time() < deadline)
+    {
+        if (mqtt.acked_msg_id == message_id)
+            latency = mqtt.acked_time - start;
+        else
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+    }
+    /* later PUBACKs must not notify a task that stopped waiting */
+    mqtt.waiting_task = NULL;
+    return latency;
+}
+
+/**
+ * @brief Subscribe to a topic. The subscription is renewed on every
+ * connection. The handler runs in the MQTT task, so it must not block.
+ * @param topic The topic, without wildcards.
+ * @param qos The maximum QoS of the messages received.
+ * @param handler The function called with the payload of each message, which
+ *                is not null-terminated.
+ * @return 0 on success, or -1 if there are too many subscriptions.
+ */
+int mqtt_subscribe(const char *topic, int qos, mqtt_handler_t handler)
+{
+    mqtt_subscription_t *sub;
+
+    if (mqtt.n_subscriptions == MQTT_N_SUBSCRIPTIONS)
+        return -1;
+    sub = &mqtt.subscriptions[mqtt.n_subscriptions];
+    sub->topic = topic;
+    sub->qos = qos;
+    sub->handler = handler;
+    mqtt.n_subscriptions++;
+    if (mqtt.connected)
+        esp_mqtt_client_subscribe(mqtt.client, topic, qos);
+    return 0;
+}
+
+/**
+ * Hand a received message to the handler of its topic. Messages larger than
+ * the receive buffer arrive in fragments, they are dropped.
+ */
+static void mqtt_dispatch(esp_mqtt_event_t *event)
+{
+    mqtt_subscription_t *sub;
+
+    if (event->current_data_offset != 0 || event->data_len != event->total_data_len)
+    {
+        LOGW(TAG, "Fragmented message dropped");
+        return;
+    }
+    for (int i = 0; i < mqtt.n_subscriptions; i++)
+    {
+        sub = &mqtt.subscriptions[i];
+        if ((int)strlen(sub->topic) == event->topic_len && strncmp(sub->topic, event->topic, event->topic_len) == 0)
+        {
+            sub->handler(event->data, event->data_len);
+            return;
+        }
+    }
 }
 
 static void mqtt_event_handler(void *event_handler_arg,
@@ -57,36 +611,51 @@ static void mqtt_event_handler(void *event_handler_arg,
     switch (event_id)
     {
         case MQTT_EVENT_ERROR:
-            ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+            LOGW(TAG, "MQTT_EVENT_ERROR");
             if (event->error_handle->error_type == MQTT_ERROR_TYPE_ESP_TLS) {
-                ESP_LOGI(TAG, "Last error code reported from esp-tls: 0x%x", event->error_handle->esp_tls_last_esp_err);
-                ESP_LOGI(TAG, "Last tls stack error number: 0x%x", event->error_handle->esp_tls_stack_err);
+                LOGW(TAG, "Last error code reported from esp-tls: 0x%x", event->error_handle->esp_tls_last_esp_err);
+                LOGW(TAG, "Last tls stack error number: 0x%x", event->error_handle->esp_tls_stack_err);
             } else if (event->error_handle->error_type == MQTT_ERROR_TYPE_CONNECTION_REFUSED) {
-                ESP_LOGI(TAG, "Connection refused error: 0x%x", event->error_handle->connect_return_code);
+                LOGW(TAG, "Connection refused error: 0x%x", event->error_handle->connect_return_code);
             } else {
-                ESP_LOGW(TAG, "Unknown error type: 0x%x", event->error_handle->error_type);
+                LOGW(TAG, "Unknown error type: 0x%x", event->error_handle->error_type);
             }
             break;
         case MQTT_EVENT_CONNECTED:
-            ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+            LOGI(TAG, "MQTT_EVENT_CONNECTED");
+            TRACE_INSTANT(TRACE_MQTT_CONNECTED, 0);
+            mqtt.n_connects++;
+            mqtt.connected = true;
+            for (int i = 0; i < mqtt.n_subscriptions; i++)
+                esp_mqtt_client_subscribe(mqtt.client, mqtt.subscriptions[i].topic, mqtt.subscriptions[i].qos);
+            xTaskNotifyGive(mqtt.flush_task);
             break;
         case MQTT_EVENT_DISCONNECTED:
-            ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+            LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+            TRACE_INSTANT(TRACE_MQTT_DISCONNECTED, 0);
+            mqtt.connected = false;
             break;
         case MQTT_EVENT_SUBSCRIBED:
-            ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, message ID=%d", event->msg_id);
+            LOGD(TAG, "MQTT_EVENT_SUBSCRIBED, message ID=%d", event->msg_id);
             break;
         case MQTT_EVENT_UNSUBSCRIBED:
-            ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
+            LOGD(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
             break;
         case MQTT_EVENT_PUBLISHED:
-            ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+            LOGD(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+            TRACE_INSTANT(TRACE_MQTT_PUBACK, event->msg_id);
+            mqtt.acked_time = esp_timer_get_time();
+            mqtt.acked_msg_id = event->msg_id;
+            mqtt_track_puback(event->msg_id, mqtt.acked_time);
+            if (mqtt.waiting_task)
+                xTaskNotifyGive(mqtt.waiting_task);
             break;
         case MQTT_EVENT_DATA:
-            ESP_LOGI(TAG, "MQTT_EVENT_DATA");
+            LOGD(TAG, "MQTT_EVENT_DATA, topic=%.*s", event->topic_len, event->topic);
+            mqtt_dispatch(event);
             break;
         case MQTT_EVENT_BEFORE_CONNECT:
-            ESP_LOGI(TAG, "MQTT_EVENT_BEFORE_CONNECT");
+            LOGD(TAG, "MQTT_EVENT_BEFORE_CONNECT");
             break;
     }
 }
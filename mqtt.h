@@ -1,14 +1,125 @@
 #ifndef __MQTT_H__
 #define __MQTT_H__
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "mqtt_client.h"
+#include "histogram.h"
+
+#define MQTT_N_PENDING      32
+#define MQTT_N_EARLY        4
+#define MQTT_QUEUE_LEN      32
+#define MQTT_QUEUE_N_TOPICS 8 //downsampled topics tracked by the offline queue
+#define MQTT_TOPIC_MAX_SIZE 48
+#define MQTT_DATA_MAX_SIZE  256
+#define MQTT_N_SUBSCRIPTIONS 4
+
+typedef enum mqtt_queue_policy
+{
+    MQTT_QUEUE_DROP_OLDEST,
+    MQTT_QUEUE_DOWNSAMPLE
+} mqtt_queue_policy_t;
+
+typedef enum mqtt_queue_class
+{
+    MQTT_QUEUE_DATA,   //subject to the queue policy
+    MQTT_QUEUE_STATUS, //never downsampled
+    MQTT_QUEUE_ALARM   //never downsampled, only evicted by a newer alarm
+} mqtt_queue_class_t;
+
+typedef struct mqtt_message
+{
+    char topic[MQTT_TOPIC_MAX_SIZE];
+    char data[MQTT_DATA_MAX_SIZE];
+    int len;
+    uint8_t qos;
+    uint8_t retain;
+    uint8_t queue_class;
+} mqtt_message_t;
+
+typedef struct mqtt_queue_topic
+{
+    char topic[MQTT_TOPIC_MAX_SIZE];
+    uint32_t decimation;
+    uint32_t n_offered;
+} mqtt_queue_topic_t;
+
+typedef struct mqtt_queue
+{
+    mqtt_message_t messages[MQTT_QUEUE_LEN];
+    int head;
+    int count;
+    mqtt_queue_policy_t policy;
+    mqtt_queue_topic_t topics[MQTT_QUEUE_N_TOPICS]; //downsampled since the queue was last empty
+    int n_topics;
+    uint32_t n_dropped;
+} mqtt_queue_t;
+
+typedef struct mqtt_stream
+{
+    const char *topic;
+    uint8_t qos;
+    uint8_t retain;
+    uint8_t queue_class; //how the offline queue treats the messages, see mqtt_queue_class_t
+} mqtt_stream_t;
+
+typedef void (*mqtt_handler_t)(const char *, int);
+
+typedef struct mqtt_subscription
+{
+    const char *topic;
+    int qos;
+    mqtt_handler_t handler;
+} mqtt_subscription_t;
+
+typedef struct mqtt_pending
+{
+    int msg_id;
+    int64_t time;
+} mqtt_pending_t;
+
+typedef struct mqtt_latency
+{
+    uint32_t n;
+    uint32_t n_lost;
+    int64_t  p50;
+    int64_t  p95;
+    int64_t  p99;
+    int64_t  max;
+} mqtt_latency_t;
 
 typedef struct mqtt
 {
     esp_mqtt_client_handle_t client;
+    TaskHandle_t waiting_task;
+    volatile int acked_msg_id;
+    volatile int64_t acked_time;
+    uint32_t n_connects;
+    uint32_t n_failed;
+    portMUX_TYPE lock;
+    mqtt_pending_t pending[MQTT_N_PENDING];
+    mqtt_pending_t early[MQTT_N_EARLY]; //PUBACKs handled before their publication was tracked
+    uint32_t n_lost;
+    histogram_t latency;
+    volatile bool connected;
+    SemaphoreHandle_t queue_lock;
+    TaskHandle_t flush_task;
+    mqtt_queue_t queue;
+    int n_subscriptions;
+    mqtt_subscription_t subscriptions[MQTT_N_SUBSCRIPTIONS];
 } mqtt_t;
 
-void mqtt_init(const char *, const char *, const char *);
-void mqtt_publish(const char *, const char *);
+void    mqtt_init(const char *, const char *, const char *);
+int     mqtt_publish(const char *, const char *);
+int     mqtt_publish_stream(const mqtt_stream_t *, const char *, int);
+int64_t mqtt_publish_wait(const char *, const char *, uint32_t);
+int     mqtt_get_outbox_size();
+bool    mqtt_is_connected();
+void    mqtt_get_stats(uint32_t *, uint32_t *);
+void    mqtt_get_latency(mqtt_latency_t *, bool);
+void    mqtt_set_queue_policy(mqtt_queue_policy_t);
+void    mqtt_get_queue_stats(uint32_t *, uint32_t *);
+int     mqtt_subscribe(const char *, int, mqtt_handler_t);
 
 #endif /* __MQTT_H__ */
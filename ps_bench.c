@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "logger.h"
+#include "esp_wifi.h"
+#include "mqtt.h"
+#include "ps_bench.h"
+
+#define TAG             "envmon:ps_bench"
+#define PUBACK_TIMEOUT  5000
+
+static const wifi_ps_type_t modes[] = {WIFI_PS_NONE, WIFI_PS_MIN_MODEM, WIFI_PS_MAX_MODEM};
+static const char *mode_names[] = {"none", "min_modem", "max_modem"};
+
+/**
+ * @brief Measure the impact of the Wi-Fi power-save modes on the time needed
+ * for a QoS 1 publication to be acknowledged by the broker. Each mode is tried
+ * in turn, idling between publications so that the modem can actually sleep.
+ * Results are printed to the console, one line per mode.
+ * @param topic The topic used for the benchmark publications.
+ * @param n_samples The number of publications per mode.
+ * @param idle_ms The delay between two publications in ms.
+ */
+void ps_bench_run(const char *topic, uint32_t n_samples, uint32_t idle_ms)
+{
+    wifi_ps_type_t saved;
+    int64_t latency;
+    int64_t min, max, sum;
+    uint32_t n_ok;
+
+    ESP_ERROR_CHECK(esp_wifi_get_ps(&saved));
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        ESP_ERROR_CHECK(esp_wifi_set_ps(modes[m]));
+        min = INT64_MAX;
+        max = 0;
+        sum = 0;
+        n_ok = 0;
+        for (uint32_t i = 0; i < n_samples; i++)
+        {
+            vTaskDelay(idle_ms / portTICK_PERIOD_MS);
+            latency = mqtt_publish_wait(topic, "ps_bench", PUBACK_TIMEOUT);
+            if (latency < 0)
+                continue;
+            n_ok++;
+            sum += latency;
+            if (latency < min)
+                min = latency;
+            if (latency > max)
+                max = latency;
+        }
+        if (n_ok)
+            printf("ps_bench:%s:n=%" PRIu32 ":lost=%" PRIu32 ":min_us=%" PRId64 ":mean_us=%" PRId64 ":max_us=%" PRId64 "\n",
+                   mode_names[m], n_ok, n_samples - n_ok, min, sum / n_ok, max);
+        else
+            printf("ps_bench:%s:n=0:lost=%" PRIu32 "\n", mode_names[m], n_samples);
+    }
+    ESP_ERROR_CHECK(esp_wifi_set_ps(saved));
+    LOGI(TAG, "Power-save benchmark finished");
+}
@@ -0,0 +1,8 @@
+#ifndef __PS_BENCH_H__
+#define __PS_BENCH_H__
+
+#include <stdint.h>
+
+void ps_bench_run(const char *, uint32_t, uint32_t);
+
+#endif /* __PS_BENCH_H__ */
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "logger.h"
+#include "adaptive.h"
+#include "aio.h"
+#include "config.h"
+#include "registry.h"
+
+#define TAG "envmon:registry"
+
+static registry_t registry;
+
+static int32_t registry_scale(float, int8_t);
+static int64_t registry_earliest(int);
+
+/**
+ * @brief Build the routes of the metrics, create their feeds and register
+ * their rate controllers and streams. Called once, after aio_init() and
+ * before config_init().
+ * @param sensors The sensor table.
+ * @param n_sensors The number of sensors.
+ * @param metrics The metric table.
+ * @param n_metrics The number of metrics.
+ * @param topic_prefix The prefix of the topics, e.g. "device" for
+ *                     "device/sensor/suffix".
+ * @param feed_group The Adafruit IO group of the feeds.
+ */
+void registry_init(const registry_sensor_t *sensors, int n_sensors, const registry_metric_t *metrics, int n_metrics,
+                   const char *topic_prefix, const char *feed_group)
+{
+    const registry_metric_t *m;
+    const registry_sensor_t *s;
+    registry_entry_t *e;
+    char *c;
+
+    registry.sensors = sensors;
+    registry.n_sensors = n_sensors < REGISTRY_MAX_SENSORS ? n_sensors : REGISTRY_MAX_SENSORS;
+    registry.metrics = metrics;
+    registry.n_metrics = n_metrics < REGISTRY_MAX_METRICS ? n_metrics : REGISTRY_MAX_METRICS;
+    for (int i = 0; i < registry.n_sensors; i++)
+    {
+        registry.last_sampled[i] = -(int64_t)sensors[i].min_period_ms * 1000;
+        registry.period_ms[i] = sensors[i].min_period_ms;
+    }
+    for (int i = 0; i < registry.n_metrics; i++)
+    {
+        m = &metrics[i];
+        s = &sensors[m->sensor];
+        e = &registry.entries[i];
+        snprintf(e->topic, sizeof(e->topic), "%s/%s/%s", topic_prefix, s->name, m->suffix);
+        snprintf(e->label, sizeof(e->label), "%s:%s", s->name, m->suffix);
+        snprintf(e->feed_key, sizeof(e->feed_key), "%s.%s-%s", feed_group, s->name, m->suffix);
+        for (c = e->feed_key; *c; c++)
+            if (*c == '_')
+                *c = '-'; //Adafruit IO keys have no underscores
+        e->stream = (mqtt_stream_t){e->topic, 0, 0, MQTT_QUEUE_DATA}; //raw values: the next cycle supersedes a lost one
+        e->route = (uplink_route_t){e->label, &e->stream, e->feed_key, m->units};
+        e->raw_min = registry_scale(m->min, m->exponent);
+        e->raw_max = registry_scale(m->max, m->exponent);
+        e->ctrl = m->ctrl ? adaptive_register(m->ctrl, s->min_period_ms, s->max_period_ms, m->max_slope, m->max_stdev,
+                                                   m->log ? 0 : m->resolution) : -1;
+        config_register_stream(&e->stream);
+        aio_create_feed(e->feed_key + strlen(feed_group) + 1, feed_group);
+    }
+}
+
+/**
+ * @brief Get the sensors due for sampling. A sensor is never sampled sooner
+ * than its minimum period after its last sample, slack or not: some drivers
+ * (the VMA311) cannot be read faster.
+ * @param now The esp_timer time.
+ * @param slack Sensors due within this time are included, in us.
+ * @return The SNAPSHOT_* bits of the sensors due.
+ */
+uint8_t registry_due(int64_t now, int64_t slack)
+{
+    uint8_t due = 0;
+
+    for (int i = 0; i < registry.n_sensors; i++)
+        if (registry.next_due[i] <= now + slack
+            && registry.last_sampled[i] + registry.sensors[i].min_period_ms * 1000LL <= now)
+            due |= registry.sensors[i].snapshot;
+    return due;
+}
+
+/**
+ * @brief Get the esp_timer time at which the next sensor is due.
+ */
+int64_t registry_next_due()
+{
+    int64_t next = INT64_MAX;
+
+    for (int i = 0; i < registry.n_sensors; i++)
+        if (registry_earliest(i) < next)
+            next = registry_earliest(i);
+    return next;
+}
+
+/**
+ * @brief Make every sensor due now, e.g. when the rates changed.
+ */
+void registry_reschedule()
+{
+    for (int i = 0; i < registry.n_sensors; i++)
+        registry.next_due[i] = 0;
+}
+
+/**
+ * @brief Get the shortest sampling period in use, e.g. to tune the radio
+ * sleep. Before the first snapshot of a sensor, its minimum period is used.
+ * @return The period in ms.
+ */
+uint32_t registry_shortest_period()
+{
+    uint32_t shortest = UINT32_MAX;
+
+    for (int i = 0; i < registry.n_sensors; i++)
+        if (registry.period_ms[i] < shortest)
+            shortest = registry.period_ms[i];
+    return shortest;
+}
+
+/**
+ * @brief Turn the sampled sensors of a snapshot into samples, hand them to
+ * the uplink and schedule the next sample of each sensor. The faster of the
+ * controllers of a sensor sets its period, a failed read is retried at the
+ * fastest rate.
+ * @param snap The snapshot.
+ * @param samples Where to store the samples.
+ * @param max The capacity of samples.
+ * @param to The UPLINK_TO() bits of the sinks of the samples.
+ * @return The number of samples.
+ */
+int registry_collect(const snapshot_data_t *snap, sample_t *samples, int max, uint8_t to)
+{
+    const registry_sensor_t *s;
+    const registry_metric_t *m;
+    registry_entry_t *e;
+    uint32_t period_ms[REGISTRY_MAX_SENSORS];
+    bool ok[REGISTRY_MAX_SENSORS];
+    uint32_t p;
+    int32_t raw;
+    int n = 0;
+
+    for (int i = 0; i < registry.n_sensors; i++)
+    {
+        s = &registry.sensors[i];
+        ok[i] = (snap->sampled & s->snapshot) && s->ok(snap);
+        period_ms[i] = ok[i] ? s->max_period_ms : s->min_period_ms;
+        if ((snap->sampled & s->snapshot) && !ok[i])
+            LOGW(TAG, "%s read failed", s->name);
+    }
+
+    for (int i = 0; i < registry.n_metrics; i++)
+    {
+        m = &registry.metrics[i];
+        e = &registry.entries[i];
+        e->valid = false;
+        if (!ok[m->sensor])
+            continue;
+        raw = m->read(snap);
+        if (raw < e->raw_min || raw > e->raw_max)
+        {
+            e->n_filtered++;
+            LOGW(TAG, "%s out of range: %ld", e->label, (long)raw);
+            continue;
+        }
+        e->valid = true;
+        e->value = raw * powf(10, m->exponent);
+        if (n < max)
+        {
+            samples[n] = (sample_t){m->code, m->metric, m->exponent, raw, snap->timestamp};
+            uplink_publish(&e->route, &samples[n++], NULL, to);
+        }
+        if (e->ctrl >= 0 && (!m->log || e->value > 0))
+        {
+            p = adaptive_update(e->ctrl, m->log ? logf(e->value) : e->value, snap->mono_time);
+            if (p < period_ms[m->sensor])
+                period_ms[m->sensor] = p;
+        }
+    }
+
+    for (int i = 0; i < registry.n_sensors; i++)
+    {
+        if (snap->sampled & registry.sensors[i].snapshot)
+        {
+            registry.next_due[i] = snap->mono_time + period_ms[i] * 1000LL;
+            registry.last_sampled[i] = snap->mono_time;
+            registry.period_ms[i] = period_ms[i];
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Get the value of a metric in the last cycle.
+ * @param id The index of the metric in the metric table.
+ * @param value Where to store the value, in units.
+ * @return Whether the metric was sampled in the last cycle.
+ */
+bool registry_value(int id, float *value)
+{
+    *value = registry.entries[id].value;
+    return registry.entries[id].valid;
+}
+
+/**
+ * The time at which a sensor can be sampled: when it is due, but not before
+ * its minimum period has elapsed since its last sample.
+ */
+static int64_t registry_earliest(int i)
+{
+    int64_t earliest = registry.last_sampled[i] + registry.sensors[i].min_period_ms * 1000LL;
+
+    return registry.next_due[i] > earliest ? registry.next_due[i] : earliest;
+}
+
+static int32_t registry_scale(float value, int8_t exponent)
+{
+    double raw = value * pow(10, -exponent);
+
+    if (raw >= INT32_MAX)
+        return INT32_MAX;
+    if (raw <= INT32_MIN)
+        return INT32_MIN;
+    return lround(raw);
+}
@@ -0,0 +1,86 @@
+#ifndef __REGISTRY_H__
+#define __REGISTRY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "mqtt.h"
+#include "sample.h"
+#include "snapshot.h"
+#include "uplink.h"
+
+#define REGISTRY_MAX_SENSORS     4
+#define REGISTRY_MAX_METRICS     12
+#define REGISTRY_LABEL_MAX_SIZE  32
+#define REGISTRY_FEED_MAX_SIZE   40
+
+/*
+ * Sensor registry
+ *
+ * The sensors and their metrics are described by two constant tables. At
+ * init the registry builds the topic, feed key and console label of every
+ * metric once, and registers the rate controllers and the streams. Each
+ * cycle it turns a snapshot into samples and hands them to the uplink, so
+ * adding a metric is adding a table row.
+ */
+typedef struct registry_sensor
+{
+    const char *name; //prefix of the topics, feed keys and labels
+    uint8_t snapshot; //SNAPSHOT_* bit
+    uint32_t min_period_ms;
+    uint32_t max_period_ms;
+    bool (*ok)(const snapshot_data_t *); //whether the read succeeded
+} registry_sensor_t;
+
+typedef struct registry_metric
+{
+    uint8_t sensor; //index in the sensor table
+    uint8_t code;   //SAMPLE_* sensor code
+    uint8_t metric; //SAMPLE_* metric code
+    const char *suffix; //topic suffix, also used for the feed key
+    const char *units;
+    int8_t exponent;
+    int32_t (*read)(const snapshot_data_t *);
+    float min, max; //plausible range, values outside are dropped
+    const char *ctrl; //rate controller name, NULL if the metric does not drive the rate
+    float max_slope;
+    float max_stdev;
+    bool log; //the controller follows ln(value), for multiplicative signals
+    float resolution; //quantum of the readings in units, 0 if negligible; unused with log
+} registry_metric_t;
+
+typedef struct registry_entry
+{
+    char topic[MQTT_TOPIC_MAX_SIZE];
+    char feed_key[REGISTRY_FEED_MAX_SIZE];
+    char label[REGISTRY_LABEL_MAX_SIZE];
+    mqtt_stream_t stream;
+    uplink_route_t route;
+    int32_t raw_min;
+    int32_t raw_max;
+    int ctrl; //-1 without controller
+    bool valid; //sampled in the last cycle
+    float value; //value of the last cycle, in units
+    uint32_t n_filtered;
+} registry_entry_t;
+
+typedef struct registry
+{
+    const registry_sensor_t *sensors;
+    int n_sensors;
+    const registry_metric_t *metrics;
+    int n_metrics;
+    registry_entry_t entries[REGISTRY_MAX_METRICS];
+    int64_t next_due[REGISTRY_MAX_SENSORS]; //esp_timer time at which each sensor is due
+    int64_t last_sampled[REGISTRY_MAX_SENSORS]; //esp_timer time of the last snapshot of each sensor
+    uint32_t period_ms[REGISTRY_MAX_SENSORS]; //sampling period set by the last snapshot of each sensor
+} registry_t;
+
+void    registry_init(const registry_sensor_t *, int, const registry_metric_t *, int, const char *, const char *);
+uint8_t registry_due(int64_t, int64_t);
+int64_t registry_next_due();
+void    registry_reschedule();
+uint32_t registry_shortest_period();
+int     registry_collect(const snapshot_data_t *, sample_t *, int, uint8_t);
+bool    registry_value(int, float *);
+
+#endif /* __REGISTRY_H__ */
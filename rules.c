@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include "logger.h"
+#include "nvs.h"
+#include "rules.h"
+
+#define TAG           "envmon:rules"
+#define NVS_NAMESPACE "envmon"
+#define NVS_KEY       "rules"
+
+static rules_t rules;
+
+static void rules_on_config(const char *, int);
+static int  rule_parse(char *, rule_t *);
+static int  series_key(uint8_t, uint8_t);
+static void rule_scale(rule_t *, int8_t);
+static void rule_publish(const rule_t *, const sample_t *);
+
+/**
+ * @brief Load the alarm rules saved in NVS and listen for new rule tables.
+ * NVS must be initialized.
+ * @param stream The stream on which alarms are published.
+ * @param config_topic The topic on which rule tables are received. A valid
+ *                     table replaces the current one and is saved in NVS by
+ *                     rules_save().
+ */
+void rules_init(const mqtt_stream_t *stream, const char *config_topic)
+{
+    char text[RULES_TEXT_MAX_SIZE];
+    size_t len = sizeof(text);
+    nvs_handle_t handle;
+
+    rules.stream = stream;
+    rules.lock = xSemaphoreCreateMutex();
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK)
+    {
+        if (nvs_get_str(handle, NVS_KEY, text, &len) == ESP_OK)
+            rules_load(text, strlen(text));
+        nvs_close(handle);
+    }
+    mqtt_subscribe(config_topic, 1, rules_on_config);
+}
+
+/**
+ * @brief Compile a rule table and make it the current one. The rules are
+ * sorted by series with an index per series, so that checking a sample only
+ * goes through the rules of its series. The state of every alarm is reset.
+ * @param text The rule table (see rules.h), not necessarily null-terminated.
+ * @param len The length of the text.
+ * @return The number of rules, or -1 if the table is invalid, in which case
+ *         the current one is kept.
+ */
+int rules_load(const char *text, int len)
+{
+    char buf[RULES_TEXT_MAX_SIZE];
+    rule_t parsed[RULES_MAX];
+    char *line, *save;
+    int n = 0;
+    int key, pos;
+
+    if (len >= RULES_TEXT_MAX_SIZE)
+    {
+        LOGW(TAG, "Rule table too large");
+        return -1;
+    }
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+    for (line = strtok_r(buf, ";\n", &save); line; line = strtok_r(NULL, ";\n", &save))
+    {
+        if (strspn(line, " \t\r") == strlen(line))
+            continue;
+        if (n == RULES_MAX || rule_parse(line, &parsed[n]) != 0)
+        {
+            LOGW(TAG, "Invalid rule: %s", line);
+            return -1;
+        }
+        n++;
+    }
+
+    //counting sort by series, straight into the current table: the NVS restore and the MQTT task may both load one
+    xSemaphoreTake(rules.lock, portMAX_DELAY);
+    memset(rules.count, 0, sizeof(rules.count));
+    for (int i = 0; i < n; i++)
+        rules.count[series_key(parsed[i].sensor, parsed[i].metric)]++;
+    pos = 0;
+    for (key = 0; key < RULES_N_SERIES; key++)
+    {
+        rules.first[key] = pos;
+        pos += rules.count[key];
+    }
+    memset(rules.count, 0, sizeof(rules.count));
+    for (int i = 0; i < n; i++)
+    {
+        key = series_key(parsed[i].sensor, parsed[i].metric);
+        rules.rules[rules.first[key] + rules.count[key]++] = parsed[i];
+    }
+    rules.n_rules = n;
+    xSemaphoreGive(rules.lock);
+    LOGI(TAG, "%d rules loaded", n);
+    return n;
+}
+
+/**
+ * @brief Check the samples of a cycle against the rules of their series.
+ * Alarms are published right away, they do not wait for the next batch.
+ * @param samples The samples.
+ * @param n The number of samples.
+ */
+void rules_check(const sample_t *samples, int n)
+{
+    const sample_t *s;
+    rule_t *r, *end;
+    int32_t v;
+    int key;
+
+    xSemaphoreTake(rules.lock, portMAX_DELAY);
+    for (int i = 0; i < n && rules.n_rules > 0; i++)
+    {
+        s = &samples[i];
+        key = series_key(s->sensor, s->metric);
+        if (key < 0)
+            continue;
+        r = &rules.rules[rules.first[key]];
+        end = r + rules.count[key];
+        for (; r < end; r++)
+        {
+            if (r->exponent != s->exponent)
+                rule_scale(r, s->exponent);
+            v = r->sign * s->value;
+            if (r->raised ? v <= r->clear : v > r->trip)
+            {
+                if (++r->count >= r->debounce)
+                {
+                    r->raised = !r->raised;
+                    r->count = 0;
+                    rule_publish(r, s);
+                }
+            }
+            else
+                r->count = 0;
+        }
+    }
+    xSemaphoreGive(rules.lock);
+}
+
+/**
+ * @brief Save in NVS the latest rule table received, if it was not yet.
+ * Called from the main loop, so that the flash write does not stall the MQTT
+ * task.
+ */
+void rules_save()
+{
+    nvs_handle_t handle;
+    char text[RULES_TEXT_MAX_SIZE];
+    bool unsaved;
+
+    xSemaphoreTake(rules.lock, portMAX_DELAY);
+    unsaved = rules.unsaved;
+    rules.unsaved = false;
+    if (unsaved)
+        strcpy(text, rules.text);
+    xSemaphoreGive(rules.lock);
+    if (!unsaved)
+        return;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK)
+    {
+        if (nvs_set_str(handle, NVS_KEY, text) != ESP_OK || nvs_commit(handle) != ESP_OK)
+            LOGW(TAG, "Rules not saved");
+        nvs_close(handle);
+    }
+}
+
+/**
+ * Handle a rule table received on the config topic. The table is only kept
+ * aside for rules_save().
+ */
+static void rules_on_config(const char *data, int len)
+{
+    if (rules_load(data, len) < 0)
+        return;
+    xSemaphoreTake(rules.lock, portMAX_DELAY);
+    memcpy(rules.text, data, len); //rules_load() checked the length
+    rules.text[len] = '\0';
+    rules.unsaved = true;
+    xSemaphoreGive(rules.lock);
+}
+
+/**
+ * Parse one rule. The line is modified.
+ */
+static int rule_parse(char *line, rule_t *r)
+{
+    char sensor[16], metric[16], op[2];
+    int debounce = 1;
+    int n;
+
+    memset(r, 0, sizeof(*r));
+    n = sscanf(line, " %15s %15[^.].%15s %1[<>] %f %f %d", r->name, sensor, metric, op,
+               &r->threshold, &r->hysteresis, &debounce);
+    if (n < 5 || r->hysteresis < 0 || debounce < 1 || debounce > UINT8_MAX)
+        return -1;
+    r->debounce = debounce;
+    r->sensor = r->metric = UINT8_MAX;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        if (strcmp(sensor, sample_sensor_name(i)) == 0)
+            r->sensor = i;
+        if (strcmp(metric, sample_metric_name(i)) == 0)
+            r->metric = i;
+    }
+    if (series_key(r->sensor, r->metric) < 0)
+        return -1;
+    r->sign = op[0] == '>' ? 1 : -1;
+    r->exponent = INT8_MIN; //scaled on the first sample
+    return 0;
+}
+
+static int series_key(uint8_t sensor, uint8_t metric)
+{
+    return sensor < 4 && metric < 4 ? sensor * 4 + metric : -1;
+}
+
+/**
+ * Convert the threshold and the clear level of a rule to the units of the
+ * samples of its series.
+ */
+static void rule_scale(rule_t *r, int8_t exponent)
+{
+    float scale = powf(10, -exponent);
+
+    r->exponent = exponent;
+    r->trip = r->sign * lroundf(r->threshold * scale);
+    r->clear = r->sign * lroundf((r->threshold - r->sign * r->hysteresis) * scale);
+}
+
+static void rule_publish(const rule_t *r, const sample_t *s)
+{
+    char value[SAMPLE_TEXT_MAX_SIZE];
+    char payload[MQTT_DATA_MAX_SIZE];
+    int len;
+
+    sample_format_text(s, value, sizeof(value));
+    LOGW(TAG, "%s %s: %s", r->name, r->raised ? "raised" : "cleared", value);
+    len = snprintf(payload, sizeof(payload),
+                   "{\"rule\":\"%s\",\"state\":\"%s\",\"sensor\":\"%s\",\"metric\":\"%s\","
+                   "\"value\":%s,\"threshold\":%g,\"timestamp\":%" PRId64 "}",
+                   r->name, r->raised ? "raised" : "cleared", sample_sensor_name(s->sensor),
+                   sample_metric_name(s->metric), value, r->threshold, s->timestamp);
+    if (len < (int)sizeof(payload))
+        mqtt_publish_stream(rules.stream, payload, len);
+}
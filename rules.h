@@ -0,0 +1,63 @@
+#ifndef __RULES_H__
+#define __RULES_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "mqtt.h"
+#include "sample.h"
+
+/*
+ * Alarm rules
+ *
+ * A rule table is text, one rule per line or separated by ';':
+ *   name sensor.metric op threshold [hysteresis [debounce]]
+ * with op '>' or '<', the threshold and hysteresis in the units of the metric
+ * and debounce the number of consecutive samples needed to raise or clear the
+ * alarm (1 by default), e.g.
+ *   gas_drop bme680.gas_resistance < 50000 5000 3; hot fused.temp > 30 0.5 2
+ * An alarm raised when the value crosses the threshold clears once the value
+ * is back past the threshold by the hysteresis.
+ */
+#define RULES_MAX           16
+#define RULES_NAME_MAX_SIZE 16
+#define RULES_TEXT_MAX_SIZE 512
+#define RULES_N_SERIES      16 //4 sensors x 4 metrics
+
+typedef struct rule
+{
+    char name[RULES_NAME_MAX_SIZE];
+    uint8_t sensor;
+    uint8_t metric;
+    int8_t sign; //+1 for '>', -1 for '<'
+    uint8_t debounce;
+    float threshold;
+    float hysteresis;
+    //compiled in the units of the samples, multiplied by sign
+    int8_t exponent;
+    int32_t trip;
+    int32_t clear;
+    //state
+    bool raised;
+    uint8_t count;
+} rule_t;
+
+typedef struct rules
+{
+    const mqtt_stream_t *stream;
+    SemaphoreHandle_t lock;
+    int n_rules;
+    rule_t rules[RULES_MAX]; //sorted by series
+    uint8_t first[RULES_N_SERIES];
+    uint8_t count[RULES_N_SERIES];
+    char text[RULES_TEXT_MAX_SIZE]; //latest table received, saved by rules_save()
+    bool unsaved;
+} rules_t;
+
+void rules_init(const mqtt_stream_t *, const char *);
+int  rules_load(const char *, int);
+void rules_check(const sample_t *, int);
+void rules_save();
+
+#endif /* __RULES_H__ */
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include "sample.h"
+
+#define CBOR_UINT  0x00
+#define CBOR_NINT  0x20
+#define CBOR_ARRAY 0x80
+
+static const char *sensor_names[] = {"mcp9700", "vma311", "bme680", "fused"};
+static const char *metric_names[] = {"temp", "humidity", "pressure", "gas_resistance"};
+
+typedef struct cbor_writer
+{
+    uint8_t *buf;
+    int size;
+    int len;
+} cbor_writer_t;
+
+static void cbor_put_head(cbor_writer_t *, uint8_t, uint64_t);
+static void cbor_put_int(cbor_writer_t *, int64_t);
+
+/**
+ * @brief Format a sample as a decimal string.
+ * @param sample The sample.
+ * @param buf The output buffer.
+ * @param size The size of the output buffer.
+ * @return The length of the string, or -1 if it does not fit in the buffer.
+ */
+int sample_format_text(const sample_t *sample, char *buf, int size)
+{
+    int64_t scale = 1;
+    int64_t value = sample->value;
+    int64_t magnitude = value < 0 ? -value : value; //-INT32_MIN fits in 64 bits
+    int len;
+
+    if (sample->exponent >= 0)
+    {
+        for (int i = 0; i < sample->exponent; i++)
+            scale *= 10;
+        len = snprintf(buf, size, "%" PRId64, value * scale);
+    }
+    else
+    {
+        for (int i = 0; i < -sample->exponent; i++)
+            scale *= 10;
+        len = snprintf(buf, size, "%s%" PRId64 ".%0*" PRId64, value < 0 ? "-" : "",
+                       magnitude / scale, -sample->exponent, magnitude % scale);
+    }
+    return len < size ? len : -1;
+}
+
+/**
+ * @brief Encode samples as one CBOR message (see sample.h for the schema).
+ * The timestamp of the first sample is the base of the message. No memory is
+ * allocated.
+ * @param samples The samples.
+ * @param n The number of samples.
+ * @param buf The output buffer.
+ * @param size The size of the output buffer.
+ * @return The length of the message, or -1 if it does not fit in the buffer.
+ */
+int sample_encode_cbor(const sample_t *samples, int n, uint8_t *buf, int size)
+{
+    cbor_writer_t w = {buf, size, 0};
+    int64_t base = n > 0 ? samples[0].timestamp : 0;
+    int64_t dt;
+
+    if (n < 0)
+        return -1;
+    cbor_put_head(&w, CBOR_ARRAY, n + 2);
+    cbor_put_head(&w, CBOR_UINT, SAMPLE_SCHEMA_VERSION);
+    cbor_put_head(&w, CBOR_UINT, base);
+    for (int i = 0; i < n; i++)
+    {
+        dt = samples[i].timestamp - base;
+        cbor_put_head(&w, CBOR_ARRAY, 5);
+        cbor_put_head(&w, CBOR_UINT, samples[i].sensor);
+        cbor_put_head(&w, CBOR_UINT, samples[i].metric);
+        cbor_put_int(&w, samples[i].exponent);
+        cbor_put_int(&w, samples[i].value);
+        cbor_put_head(&w, CBOR_UINT, dt > 0 ? dt : 0);
+    }
+    return w.len <= w.size ? w.len : -1;
+}
+
+/**
+ * @brief Get the name of a sensor code.
+ */
+const char *sample_sensor_name(uint8_t sensor)
+{
+    return sensor < sizeof(sensor_names) / sizeof(sensor_names[0]) ? sensor_names[sensor] : "unknown";
+}
+
+/**
+ * @brief Get the name of a metric code.
+ */
+const char *sample_metric_name(uint8_t metric)
+{
+    return metric < sizeof(metric_names) / sizeof(metric_names[0]) ? metric_names[metric] : "unknown";
+}
+
+/**
+ * Write a CBOR head with the shortest argument encoding. Past the end of the
+ * buffer only the length is updated, so the caller checks it once.
+ */
+static void cbor_put_head(cbor_writer_t *w, uint8_t major, uint64_t arg)
+{
+    uint8_t head[9];
+    int n;
+
+    if (arg < 24)
+    {
+        head[0] = major | arg;
+        n = 1;
+    }
+    else if (arg <= 0xff)
+    {
+        head[0] = major | 24;
+        n = 2;
+    }
+    else if (arg <= 0xffff)
+    {
+        head[0] = major | 25;
+        n = 3;
+    }
+    else if (arg <= 0xffffffff)
+    {
+        head[0] = major | 26;
+        n = 5;
+    }
+    else
+    {
+        head[0] = major | 27;
+        n = 9;
+    }
+    for (int i = 1; i < n; i++)
+        head[i] = arg >> (8 * (n - 1 - i));
+    for (int i = 0; i < n; i++, w->len++)
+    {
+        if (w->len < w->size)
+            w->buf[w->len] = head[i];
+    }
+}
+
+static void cbor_put_int(cbor_writer_t *w, int64_t value)
+{
+    if (value >= 0)
+        cbor_put_head(w, CBOR_UINT, value);
+    else
+        cbor_put_head(w, CBOR_NINT, -1 - value);
+}
@@ -0,0 +1,64 @@
+#ifndef __SAMPLE_H__
+#define __SAMPLE_H__
+
+#include <stdint.h>
+
+/*
+ * Sample records
+ *
+ * A sample is an integer value with a decimal exponent, so that each sensor
+ * keeps the resolution of its driver without floating point:
+ *   mcp9700     temperature     degC          exponent  0
+ *   vma311      temperature     0.1 degC      exponent -1
+ *   vma311      humidity        0.1 %RH       exponent -1
+ *   bme680      temperature     0.01 degC     exponent -2
+ *   bme680      humidity        0.001 %RH     exponent -3
+ *   bme680      pressure        Pa            exponent  0
+ *   bme680      gas_resistance  Ohm           exponent  0
+ *   fused       temperature     0.01 degC     exponent -2
+ *   fused       humidity        0.01 %RH      exponent -2
+ *
+ * Text encoding: the scaled decimal value, e.g. "23.45".
+ *
+ * CBOR encoding (RFC 8949), schema version 1: one definite-length array
+ *   [1, base_ts, record, record, ...]
+ * where base_ts is an unsigned integer in ms since the Unix epoch (0 when the
+ * time is unknown) and each record is a definite-length array
+ *   [sensor, metric, exponent, value, dt]
+ * with sensor and metric the unsigned codes below, exponent and value signed
+ * integers and dt the unsigned offset of the sample from base_ts in ms.
+ */
+#define SAMPLE_SCHEMA_VERSION 1
+#define SAMPLE_TEXT_MAX_SIZE  16
+
+typedef enum sample_sensor
+{
+    SAMPLE_MCP9700 = 0,
+    SAMPLE_VMA311  = 1,
+    SAMPLE_BME680  = 2,
+    SAMPLE_FUSED   = 3
+} sample_sensor_t;
+
+typedef enum sample_metric
+{
+    SAMPLE_TEMPERATURE    = 0,
+    SAMPLE_HUMIDITY       = 1,
+    SAMPLE_PRESSURE       = 2,
+    SAMPLE_GAS_RESISTANCE = 3
+} sample_metric_t;
+
+typedef struct sample
+{
+    uint8_t sensor;
+    uint8_t metric;
+    int8_t  exponent;
+    int32_t value;
+    int64_t timestamp; /* ms since the Unix epoch, 0 if unknown */
+} sample_t;
+
+int sample_format_text(const sample_t *, char *, int);
+int sample_encode_cbor(const sample_t *, int, uint8_t *, int);
+const char *sample_sensor_name(uint8_t);
+const char *sample_metric_name(uint8_t);
+
+#endif /* __SAMPLE_H__ */
@@ -0,0 +1,218 @@
+/*
+ * Bus traffic of the BME680 driver, measured on the virtual sensor.
+ *
+ * usage: bme680_bench [-n measurements] [-b frames] [-s script] [-k bus_hz]
+ *
+ * The sensor is set up and sampled as snapshot.c does it: the settings once,
+ * then for each measurement forced mode, a wait for the profile duration and
+ * the field data. The clock only advances with the bus transfers and the
+ * delays of the driver, so the run takes no time and is reproducible.
+ *
+ * One line per driver call with the transactions, bytes and bus time of one
+ * call, then the totals of one measurement:
+ *   call=<name> calls=<n> reads=<r> writes=<w> bytes=<b> bus_us=<us>
+ *   measurement transactions=<t> bytes=<b> bus_us=<us> latency_ms=<ms> new_data=<n> heat_stab=<n>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "bme680.h"
+#include "esp_timer.h"
+#include "env.h"
+#include "sim.h"
+#include "vbme680.h"
+
+/* macro definitions */
+#define DEFAULT_MEASUREMENTS 100
+#define DEFAULT_BUS_HZ       100000 /* BME680_I2C_FREQ */
+#define HEATR_TEMP           320 /* as snapshot.c */
+#define HEATR_DUR            150
+#define AMB_TEMP             25
+
+/* structure definitions */
+typedef struct call
+{
+    const char     *name;
+    int             calls;
+    vbme680_stats_t stats;
+} call_t;
+
+/* global variables */
+sim_options_t sim_options = {.speed = 1, .seed = 1};
+
+/* static variables */
+static int64_t now_us;
+static long    bus_hz = DEFAULT_BUS_HZ;
+
+/* static function prototypes */
+static int8_t bench_read(uint8_t, uint8_t, uint8_t *, uint16_t);
+static int8_t bench_write(uint8_t, uint8_t, uint8_t *, uint16_t);
+static void   bench_delay_ms(uint32_t);
+static void   bench_begin();
+static void   bench_end(call_t *);
+static void   bench_print(const call_t *);
+
+int64_t esp_timer_get_time()
+{
+    return now_us;
+}
+
+int main(int argc, char **argv)
+{
+    struct bme680_dev dev = {0};
+    struct bme680_field_data data;
+    call_t init = {.name = "bme680_init"};
+    call_t settings = {.name = "bme680_set_sensor_settings"};
+    call_t mode = {.name = "bme680_set_sensor_mode"};
+    call_t get_data = {.name = "bme680_get_sensor_data"};
+    int n = DEFAULT_MEASUREMENTS;
+    const char *frames = NULL;
+    int n_new_data = 0;
+    int n_heat_stab = 0;
+    int64_t latency_us = 0;
+    int64_t start;
+    uint16_t dur_ms;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:s:k:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'b':
+                frames = optarg;
+                break;
+            case 's':
+                sim_options.script = optarg;
+                break;
+            case 'k':
+                bus_hz = atol(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n measurements] [-b frames] [-s script] [-k bus_hz]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (n <= 0 || bus_hz <= 0 || env_load(sim_options.script) != 0)
+        return 1;
+    vbme680_init(BME680_I2C_ADDR_SECONDARY);
+    if (frames != NULL && vbme680_replay(frames) < 0)
+        return 1;
+
+    dev.dev_id = BME680_I2C_ADDR_SECONDARY;
+    dev.intf = BME680_I2C_INTF;
+    dev.read = bench_read;
+    dev.write = bench_write;
+    dev.delay_ms = bench_delay_ms;
+    dev.amb_temp = AMB_TEMP;
+    bench_begin();
+    if (bme680_init(&dev) != BME680_OK)
+    {
+        fprintf(stderr, "bme680_init failed\n");
+        return 1;
+    }
+    bench_end(&init);
+
+    dev.tph_sett.os_hum = BME680_OS_2X;
+    dev.tph_sett.os_pres = BME680_OS_4X;
+    dev.tph_sett.os_temp = BME680_OS_8X;
+    dev.tph_sett.filter = BME680_FILTER_SIZE_3;
+    dev.gas_sett.run_gas = BME680_ENABLE_GAS_MEAS;
+    dev.gas_sett.heatr_temp = HEATR_TEMP;
+    dev.gas_sett.heatr_dur = HEATR_DUR;
+    dev.power_mode = BME680_FORCED_MODE;
+    bench_begin();
+    bme680_set_sensor_settings(BME680_OST_SEL | BME680_OSP_SEL | BME680_OSH_SEL | BME680_FILTER_SEL
+                               | BME680_GAS_SENSOR_SEL, &dev);
+    bench_end(&settings);
+    bme680_get_profile_dur(&dur_ms, &dev);
+
+    for (int i = 0; i < n; i++)
+    {
+        start = now_us;
+        bench_begin();
+        bme680_set_sensor_mode(&dev);
+        bench_end(&mode);
+        bench_delay_ms(dur_ms + 1); /* as snapshot_take, one tick late */
+        bench_begin();
+        if (bme680_get_sensor_data(&data, &dev) == BME680_OK && (data.status & BME680_NEW_DATA_MSK))
+        {
+            n_new_data++;
+            n_heat_stab += (data.status & BME680_HEAT_STAB_MSK) != 0;
+        }
+        bench_end(&get_data);
+        latency_us += now_us - start;
+        now_us += 1000000; /* next snapshot, the sensor sleeps */
+    }
+
+    bench_print(&init);
+    bench_print(&settings);
+    bench_print(&mode);
+    bench_print(&get_data);
+    printf("measurement transactions=%.2f bytes=%.1f bus_us=%.1f latency_ms=%.2f new_data=%d heat_stab=%d\n",
+           (double)(mode.stats.reads + mode.stats.writes + get_data.stats.reads + get_data.stats.writes) / n,
+           (double)(mode.stats.bytes + get_data.stats.bytes) / n,
+           (double)(mode.stats.bits + get_data.stats.bits) * 1e6 / bus_hz / n, latency_us / 1000.0 / n,
+           n_new_data, n_heat_stab);
+    return 0;
+}
+
+/**
+ * The transfers take their time on the bus, the sensor converts meanwhile.
+ */
+static int8_t bench_read(uint8_t dev_id, uint8_t reg_addr, uint8_t *data, uint16_t len)
+{
+    vbme680_stats_t before;
+    vbme680_stats_t after;
+    int8_t rslt;
+
+    vbme680_get_stats(&before);
+    rslt = vbme680_read(dev_id, reg_addr, data, len);
+    vbme680_get_stats(&after);
+    now_us += (after.bits - before.bits) * 1000000LL / bus_hz;
+    return rslt;
+}
+
+static int8_t bench_write(uint8_t dev_id, uint8_t reg_addr, uint8_t *data, uint16_t len)
+{
+    vbme680_stats_t before;
+    vbme680_stats_t after;
+    int8_t rslt;
+
+    vbme680_get_stats(&before);
+    rslt = vbme680_write(dev_id, reg_addr, data, len);
+    vbme680_get_stats(&after);
+    now_us += (after.bits - before.bits) * 1000000LL / bus_hz;
+    return rslt;
+}
+
+static void bench_delay_ms(uint32_t period)
+{
+    now_us += period * 1000LL;
+}
+
+static void bench_begin()
+{
+    vbme680_reset_stats();
+}
+
+static void bench_end(call_t *call)
+{
+    vbme680_stats_t stats;
+
+    vbme680_get_stats(&stats);
+    call->calls++;
+    call->stats.reads += stats.reads;
+    call->stats.writes += stats.writes;
+    call->stats.bytes += stats.bytes;
+    call->stats.bits += stats.bits;
+}
+
+static void bench_print(const call_t *call)
+{
+    printf("call=%s calls=%d reads=%.2f writes=%.2f bytes=%.1f bus_us=%.1f\n", call->name, call->calls,
+           (double)call->stats.reads / call->calls, (double)call->stats.writes / call->calls,
+           (double)call->stats.bytes / call->calls, (double)call->stats.bits * 1e6 / bus_hz / call->calls);
+}
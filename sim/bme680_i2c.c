@@ -0,0 +1,41 @@
+/*
+ * The I2C bus of the BME680, with the virtual sensor on it.
+ */
+#include <stdio.h>
+#include "bme680_i2c.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "vbme680.h"
+#include "sim.h"
+
+/* static function prototypes */
+static int8_t bme680_i2c_read(uint8_t, uint8_t, uint8_t *, uint16_t);
+static int8_t bme680_i2c_write(uint8_t, uint8_t, uint8_t *, uint16_t);
+static void   bme680_i2c_delay_ms(uint32_t);
+
+void bme680_i2c_init(struct bme680_dev *dev, uint8_t addr)
+{
+    vbme680_init(addr);
+    if (sim_options.frames != NULL && vbme680_replay(sim_options.frames) < 0)
+        fprintf(stderr, "%s: no BME680 frame to replay\n", sim_options.frames);
+    dev->dev_id = addr;
+    dev->intf = BME680_I2C_INTF;
+    dev->read = bme680_i2c_read;
+    dev->write = bme680_i2c_write;
+    dev->delay_ms = bme680_i2c_delay_ms;
+}
+
+static int8_t bme680_i2c_read(uint8_t dev_id, uint8_t reg_addr, uint8_t *data, uint16_t len)
+{
+    return vbme680_read(dev_id, reg_addr, data, len);
+}
+
+static int8_t bme680_i2c_write(uint8_t dev_id, uint8_t reg_addr, uint8_t *data, uint16_t len)
+{
+    return vbme680_write(dev_id, reg_addr, data, len);
+}
+
+static void bme680_i2c_delay_ms(uint32_t period)
+{
+    vTaskDelay(pdMS_TO_TICKS(period) + 1);
+}
@@ -0,0 +1,274 @@
+/*
+ * Environment observed by the virtual sensors. Each quantity is the sum of
+ * scripted waveforms, each sensor sees it with its own offset and noise, and
+ * a sensor, or the Wi-Fi link, can be made to fail for a while.
+ *
+ * Script, one directive per line, '#' starts a comment, times in s:
+ *   <quantity> const  <level>
+ *   <quantity> sine   <amplitude> <period> [phase]
+ *   <quantity> square <amplitude> <period> [phase]
+ *   <quantity> ramp   <change> <start> <end>
+ *   <quantity> step   <change> <start> [end]
+ *   error <sensor> <quantity> <offset> <stdev>
+ *   fault <sensor> <start> <end>
+ * The quantities are temp (degC), humidity (%RH), pressure (Pa) and gas
+ * (Ohm), the sensors mcp9700, vma311 and bme680, and wifi for the link.
+ */
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "env.h"
+#include "sim.h"
+
+/* macro definitions */
+#define LINE_MAX_SIZE 256
+
+/* static variables */
+static const char *quantity_names[ENV_N_QUANTITIES] = {"temp", "humidity", "pressure", "gas"};
+static const char *shape_names[] = {"const", "sine", "square", "ramp", "step"};
+
+/* an office over a day: heating cycles, occupancy from t=600 s */
+static const char *default_script =
+    "temp const 21.5\n"
+    "temp sine 1.5 3600\n"
+    "temp square 0.3 900\n"
+    "humidity const 45\n"
+    "humidity sine 5 7200 900\n"
+    "humidity step 8 600 1800\n"
+    "pressure const 101325\n"
+    "pressure sine 120 86400\n"
+    "gas const 120000\n"
+    "gas step -50000 600 1800\n"
+    "error mcp9700 temp 0.8 0.4\n"
+    "error vma311 temp -0.4 0.3\n"
+    "error vma311 humidity 2 1\n"
+    "error bme680 temp 0.3 0.02\n"
+    "error bme680 humidity -1 0.2\n"
+    "error bme680 pressure 0 3\n"
+    "error bme680 gas 0 800\n";
+
+static env_wave_t      waves[ENV_MAX_WAVES];
+static int             n_waves;
+static env_error_t     errors[ENV_MAX_ERRORS];
+static int             n_errors;
+static env_fault_t     faults[ENV_MAX_FAULTS];
+static int             n_faults;
+static uint64_t        rng_state;
+static pthread_mutex_t rng_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* static function prototypes */
+static int    env_parse(const char *);
+static int    env_lookup(const char *, const char **, int);
+static double env_gaussian();
+
+/**
+ * @brief Load the environment script.
+ * @param path The script, NULL for the built-in one.
+ * @return 0 on success, -1 if the script cannot be read or is invalid.
+ */
+int env_load(const char *path)
+{
+    char line[LINE_MAX_SIZE];
+    const char *next;
+    int n_line = 0;
+    FILE *file;
+
+    rng_state = 0x9e3779b97f4a7c15ull ^ sim_options.seed;
+    srand(sim_options.seed);
+    if (path == NULL)
+    {
+        for (const char *s = default_script; *s; s = next + 1)
+        {
+            next = strchr(s, '\n');
+            snprintf(line, sizeof(line), "%.*s", (int)(next - s), s);
+            if (env_parse(line) != 0)
+                return -1;
+        }
+        return 0;
+    }
+    if ((file = fopen(path, "r")) == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        n_line++;
+        if (env_parse(line) != 0)
+        {
+            fprintf(stderr, "%s:%d: invalid directive\n", path, n_line);
+            fclose(file);
+            return -1;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+/**
+ * @brief Get the true value of a quantity.
+ * @param quantity The quantity.
+ * @param time_us The simulated time in us.
+ * @return The value in the unit of the quantity.
+ */
+double env_value(env_quantity_t quantity, int64_t time_us)
+{
+    double t = time_us / 1e6;
+    double value = 0;
+    double phase;
+
+    for (int i = 0; i < n_waves; i++)
+    {
+        const env_wave_t *w = &waves[i];
+
+        if (w->quantity != quantity)
+            continue;
+        switch (w->shape)
+        {
+            case ENV_CONST:
+                value += w->value;
+                break;
+            case ENV_SINE:
+                value += w->value * sin(2 * M_PI * (t + w->t1) / w->t0);
+                break;
+            case ENV_SQUARE:
+                phase = fmod(t + w->t1, w->t0);
+                value += phase < w->t0 / 2 ? w->value : -w->value;
+                break;
+            case ENV_RAMP:
+                if (t >= w->t1)
+                    value += w->value;
+                else if (t > w->t0)
+                    value += w->value * (t - w->t0) / (w->t1 - w->t0);
+                break;
+            case ENV_STEP:
+                if (t >= w->t0 && (w->t1 <= w->t0 || t < w->t1))
+                    value += w->value;
+                break;
+        }
+    }
+    if (quantity == ENV_HUMIDITY)
+        value = fmin(fmax(value, 0), 100);
+    else if (quantity == ENV_GAS_RESISTANCE)
+        value = fmax(value, 1);
+    return value;
+}
+
+/**
+ * @brief Get the value of a quantity as a sensor measures it.
+ * @param sensor The sensor name.
+ * @param quantity The quantity.
+ * @param time_us The simulated time in us.
+ * @return The value in the unit of the quantity.
+ */
+double env_read(const char *sensor, env_quantity_t quantity, int64_t time_us)
+{
+    double value = env_value(quantity, time_us);
+
+    for (int i = 0; i < n_errors; i++)
+    {
+        if (errors[i].quantity == quantity && strcmp(errors[i].sensor, sensor) == 0)
+            value += errors[i].offset + errors[i].stdev * env_gaussian();
+    }
+    return value;
+}
+
+/**
+ * @brief Tell whether a sensor, or the link, is failing.
+ * @param sensor The sensor name, or "wifi".
+ * @param time_us The simulated time in us.
+ */
+bool env_fault(const char *sensor, int64_t time_us)
+{
+    double t = time_us / 1e6;
+
+    for (int i = 0; i < n_faults; i++)
+    {
+        if (t >= faults[i].start && t < faults[i].end && strcmp(faults[i].sensor, sensor) == 0)
+            return true;
+    }
+    return false;
+}
+
+static int env_parse(const char *line)
+{
+    char verb[16];
+    char arg[16];
+    char sensor[16];
+    double p[3] = {0, 0, 0};
+    int n;
+    int quantity;
+    int shape;
+    char *comment;
+    char text[LINE_MAX_SIZE];
+
+    snprintf(text, sizeof(text), "%s", line);
+    if ((comment = strchr(text, '#')) != NULL)
+        *comment = '\0';
+    n = sscanf(text, "%15s %15s", verb, arg);
+    if (n <= 0)
+        return 0; /* blank */
+    if (strcmp(verb, "error") == 0)
+    {
+        if (n_errors == ENV_MAX_ERRORS
+            || sscanf(text, "%*s %15s %15s %lf %lf", sensor, arg, &p[0], &p[1]) != 4
+            || (quantity = env_lookup(arg, quantity_names, ENV_N_QUANTITIES)) < 0)
+            return -1;
+        snprintf(errors[n_errors].sensor, sizeof(errors[n_errors].sensor), "%s", sensor);
+        errors[n_errors].quantity = quantity;
+        errors[n_errors].offset = p[0];
+        errors[n_errors++].stdev = p[1];
+        return 0;
+    }
+    if (strcmp(verb, "fault") == 0)
+    {
+        if (n_faults == ENV_MAX_FAULTS || sscanf(text, "%*s %15s %lf %lf", sensor, &p[0], &p[1]) != 3)
+            return -1;
+        snprintf(faults[n_faults].sensor, sizeof(faults[n_faults].sensor), "%s", sensor);
+        faults[n_faults].start = p[0];
+        faults[n_faults++].end = p[1];
+        return 0;
+    }
+    quantity = env_lookup(verb, quantity_names, ENV_N_QUANTITIES);
+    shape = n == 2 ? env_lookup(arg, shape_names, sizeof(shape_names) / sizeof(shape_names[0])) : -1;
+    if (quantity < 0 || shape < 0 || n_waves == ENV_MAX_WAVES)
+        return -1;
+    n = sscanf(text, "%*s %*s %lf %lf %lf", &p[0], &p[1], &p[2]);
+    if (n < 1 || ((shape == ENV_SINE || shape == ENV_SQUARE) && (n < 2 || p[1] <= 0))
+        || (shape == ENV_RAMP && (n < 3 || p[2] <= p[1])) || (shape == ENV_STEP && n < 2))
+        return -1;
+    waves[n_waves++] = (env_wave_t){quantity, shape, p[0], p[1], p[2]};
+    return 0;
+}
+
+static int env_lookup(const char *name, const char **names, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Standard normal deviate, Box-Muller on a xorshift64* generator shared by
+ * the sensors so that a seed gives the same run.
+ */
+static double env_gaussian()
+{
+    double u[2];
+
+    pthread_mutex_lock(&rng_lock);
+    for (int i = 0; i < 2; i++)
+    {
+        rng_state ^= rng_state >> 12;
+        rng_state ^= rng_state << 25;
+        rng_state ^= rng_state >> 27;
+        u[i] = ((rng_state * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0);
+    }
+    pthread_mutex_unlock(&rng_lock);
+    return sqrt(-2 * log(u[0] + 1e-300)) * cos(2 * M_PI * u[1]);
+}
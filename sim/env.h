@@ -0,0 +1,62 @@
+#ifndef __ENV_H__
+#define __ENV_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* macro definitions */
+#define ENV_MAX_WAVES  32
+#define ENV_MAX_ERRORS 16
+#define ENV_MAX_FAULTS 16
+
+/* enumerations */
+typedef enum env_quantity
+{
+    ENV_TEMPERATURE,    /* degC */
+    ENV_HUMIDITY,       /* %RH */
+    ENV_PRESSURE,       /* Pa */
+    ENV_GAS_RESISTANCE, /* Ohm */
+    ENV_N_QUANTITIES
+} env_quantity_t;
+
+typedef enum env_shape
+{
+    ENV_CONST,
+    ENV_SINE,
+    ENV_SQUARE,
+    ENV_RAMP,
+    ENV_STEP
+} env_shape_t;
+
+/* structure definitions */
+typedef struct env_wave
+{
+    env_quantity_t quantity;
+    env_shape_t    shape;
+    double         value;   /* level, amplitude or change */
+    double         t0;      /* period, or start in s */
+    double         t1;      /* phase, or end in s */
+} env_wave_t;
+
+typedef struct env_error
+{
+    char           sensor[16];
+    env_quantity_t quantity;
+    double         offset;
+    double         stdev;
+} env_error_t;
+
+typedef struct env_fault
+{
+    char   sensor[16];
+    double start;
+    double end;
+} env_fault_t;
+
+/* function prototypes */
+int    env_load(const char *);
+double env_value(env_quantity_t, int64_t);
+double env_read(const char *, env_quantity_t, int64_t);
+bool   env_fault(const char *, int64_t);
+
+#endif /* __ENV_H__ */
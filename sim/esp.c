@@ -0,0 +1,570 @@
+/*
+ * ESP-IDF system services: log, errors, heap, NVS, flash partitions, power
+ * management and SNTP. NVS and the partitions live in memory, and in files
+ * of the state directory when one is given so that they survive a restart.
+ */
+#include <malloc.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_pm.h"
+#include "esp_sntp.h"
+#include "esp_partition.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "sim.h"
+
+/* macro definitions */
+#define LOG_MAX_TAGS       32
+#define HEAP_SIZE          (300 * 1024) /* free heap of the device once Wi-Fi is up */
+#define NVS_MAX_ENTRIES    64
+#define NVS_MAX_HANDLES    16
+#define NVS_KEY_MAX_SIZE   16
+#define NVS_VALUE_MAX_SIZE 1984 /* largest blob the device accepts in one page */
+#define NVS_FILE           "nvs.bin"
+#define FLASH_SECTOR_SIZE  4096
+#define SNTP_DELAY_MS      300
+#define SNTP_STACK_SIZE    2048
+
+/* structure definitions */
+typedef struct log_tag
+{
+    char            tag[32];
+    esp_log_level_t level;
+} log_tag_t;
+
+typedef struct nvs_entry
+{
+    char     namespace[NVS_KEY_MAX_SIZE];
+    char     key[NVS_KEY_MAX_SIZE];
+    uint16_t size;
+    uint8_t  value[NVS_VALUE_MAX_SIZE];
+} nvs_entry_t;
+
+typedef struct sim_partition
+{
+    esp_partition_t partition;
+    uint8_t        *data;
+} sim_partition_t;
+
+/* static variables */
+static pthread_mutex_t     log_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_tag_t           log_tags[LOG_MAX_TAGS];
+static int                 n_log_tags;
+static esp_log_level_t     log_default_level = CONFIG_LOG_DEFAULT_LEVEL;
+static uint32_t            min_free_heap = HEAP_SIZE;
+static pthread_mutex_t     nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static nvs_entry_t         nvs_entries[NVS_MAX_ENTRIES];
+static int                 n_nvs_entries;
+static char                nvs_handles[NVS_MAX_HANDLES][NVS_KEY_MAX_SIZE];
+static bool                nvs_initialized;
+static sim_partition_t     partitions[] = {
+    {{ESP_PARTITION_TYPE_DATA, 0x81, 0x110000, 0x40000, "datalog"}, NULL},
+};
+static sntp_sync_time_cb_t sntp_cb;
+static uint32_t            sntp_interval_ms = 3600000;
+static bool                sntp_running;
+
+/* static function prototypes */
+static nvs_entry_t *nvs_find(nvs_handle_t, const char *);
+static esp_err_t    nvs_get(nvs_handle_t, const char *, void *, size_t *, bool);
+static esp_err_t    nvs_set(nvs_handle_t, const char *, const void *, size_t);
+static void         partition_load(sim_partition_t *);
+static void         partition_save(const sim_partition_t *, size_t, size_t);
+static void         sntp_task(void *);
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    pthread_mutex_lock(&log_lock);
+    if (strcmp(tag, "*") == 0)
+    {
+        log_default_level = level;
+        n_log_tags = 0;
+    }
+    else
+    {
+        int i;
+
+        for (i = 0; i < n_log_tags && strcmp(log_tags[i].tag, tag) != 0; i++)
+            ;
+        if (i < LOG_MAX_TAGS)
+        {
+            snprintf(log_tags[i].tag, sizeof(log_tags[i].tag), "%s", tag);
+            log_tags[i].level = level;
+            if (i == n_log_tags)
+                n_log_tags++;
+        }
+    }
+    pthread_mutex_unlock(&log_lock);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    esp_log_level_t tag_level = log_default_level;
+    va_list args;
+
+    pthread_mutex_lock(&log_lock);
+    for (int i = 0; i < n_log_tags; i++)
+    {
+        if (strcmp(log_tags[i].tag, tag) == 0)
+            tag_level = log_tags[i].level;
+    }
+    if (level <= tag_level)
+    {
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
+    pthread_mutex_unlock(&log_lock);
+}
+
+uint32_t esp_log_timestamp()
+{
+    return (uint32_t)(sim_time_us() / 1000);
+}
+
+const char *esp_err_to_name(esp_err_t err)
+{
+    switch (err)
+    {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+        case ESP_ERR_NVS_NO_FREE_PAGES: return "ESP_ERR_NVS_NO_FREE_PAGES";
+        case ESP_ERR_NVS_NEW_VERSION_FOUND: return "ESP_ERR_NVS_NEW_VERSION_FOUND";
+        default: return "UNKNOWN ERROR";
+    }
+}
+
+/**
+ * The heap in use is the one of the host allocator, which the firmware
+ * shares with the shims.
+ */
+uint32_t esp_get_free_heap_size()
+{
+    struct mallinfo2 info = mallinfo2();
+    uint32_t free_heap = info.uordblks < HEAP_SIZE ? HEAP_SIZE - (uint32_t)info.uordblks : 0;
+
+    if (free_heap < min_free_heap)
+        min_free_heap = free_heap;
+    return free_heap;
+}
+
+uint32_t esp_get_minimum_free_heap_size()
+{
+    esp_get_free_heap_size();
+    return min_free_heap;
+}
+
+/**
+ * Restart the program with the same arguments, NVS and the partitions
+ * persist if there is a state directory.
+ */
+void esp_restart()
+{
+    sim_nvs_save();
+    sim_restart();
+}
+
+int64_t esp_timer_get_time()
+{
+    return sim_time_us();
+}
+
+uint32_t esp_cpu_get_ccount()
+{
+    return (uint32_t)(sim_time_us() * CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ);
+}
+
+esp_err_t esp_pm_configure(const void *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_init()
+{
+    pthread_mutex_lock(&nvs_lock);
+    if (!nvs_initialized)
+    {
+        nvs_initialized = true;
+        pthread_mutex_unlock(&nvs_lock);
+        sim_nvs_load();
+        return ESP_OK;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase()
+{
+    pthread_mutex_lock(&nvs_lock);
+    n_nvs_entries = 0;
+    pthread_mutex_unlock(&nvs_lock);
+    sim_nvs_save();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *namespace, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    pthread_mutex_lock(&nvs_lock);
+    for (int i = 0; i < NVS_MAX_HANDLES; i++)
+    {
+        if (nvs_handles[i][0] == '\0')
+        {
+            snprintf(nvs_handles[i], NVS_KEY_MAX_SIZE, "%s", namespace);
+            *handle = i + 1;
+            err = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&nvs_lock);
+    if (handle >= 1 && handle <= NVS_MAX_HANDLES)
+        nvs_handles[handle - 1][0] = '\0';
+    pthread_mutex_unlock(&nvs_lock);
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    sim_nvs_save();
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    nvs_entry_t *entry;
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+
+    pthread_mutex_lock(&nvs_lock);
+    entry = nvs_find(handle, key);
+    if (entry != NULL)
+    {
+        *entry = nvs_entries[--n_nvs_entries];
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length)
+{
+    return nvs_get(handle, key, value, length, true);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return nvs_set(handle, key, value, length);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *value, size_t *length)
+{
+    return nvs_get(handle, key, value, length, true);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return nvs_set(handle, key, value, strlen(value) + 1);
+}
+
+#define NVS_INTEGER(suffix, type)                                                     \
+    esp_err_t nvs_get_##suffix(nvs_handle_t handle, const char *key, type *value)     \
+    {                                                                                 \
+        size_t length = sizeof(type);                                                 \
+        return nvs_get(handle, key, value, &length, false);                           \
+    }                                                                                 \
+    esp_err_t nvs_set_##suffix(nvs_handle_t handle, const char *key, type value)      \
+    {                                                                                 \
+        return nvs_set(handle, key, &value, sizeof(type));                            \
+    }
+
+NVS_INTEGER(u8, uint8_t)
+NVS_INTEGER(i32, int32_t)
+NVS_INTEGER(u32, uint32_t)
+
+/**
+ * @brief Restore NVS from the state directory, if any.
+ */
+void sim_nvs_load()
+{
+    char path[256];
+    FILE *file;
+
+    for (size_t i = 0; i < sizeof(partitions) / sizeof(partitions[0]); i++)
+        partition_load(&partitions[i]);
+    if (sim_options.state_dir == NULL)
+        return;
+    snprintf(path, sizeof(path), "%s/%s", sim_options.state_dir, NVS_FILE);
+    if ((file = fopen(path, "rb")) == NULL)
+        return;
+    pthread_mutex_lock(&nvs_lock);
+    n_nvs_entries = fread(nvs_entries, sizeof(nvs_entry_t), NVS_MAX_ENTRIES, file);
+    pthread_mutex_unlock(&nvs_lock);
+    fclose(file);
+}
+
+/**
+ * @brief Save NVS to the state directory, if any.
+ */
+void sim_nvs_save()
+{
+    char path[256];
+    FILE *file;
+
+    if (sim_options.state_dir == NULL)
+        return;
+    snprintf(path, sizeof(path), "%s/%s", sim_options.state_dir, NVS_FILE);
+    if ((file = fopen(path, "wb")) == NULL)
+        return;
+    pthread_mutex_lock(&nvs_lock);
+    fwrite(nvs_entries, sizeof(nvs_entry_t), n_nvs_entries, file);
+    pthread_mutex_unlock(&nvs_lock);
+    fclose(file);
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    for (size_t i = 0; i < sizeof(partitions) / sizeof(partitions[0]); i++)
+    {
+        const esp_partition_t *partition = &partitions[i].partition;
+
+        if (partition->type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || partition->subtype == subtype)
+            && (label == NULL || strcmp(partition->label, label) == 0))
+        {
+            partition_load(&partitions[i]);
+            return partition;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size)
+{
+    const sim_partition_t *sim = (const sim_partition_t *)partition;
+
+    if (offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    memcpy(dst, sim->data + offset, size);
+    return ESP_OK;
+}
+
+/**
+ * Programming NOR flash only clears bits, writing over data that was not
+ * erased corrupts it as on the device.
+ */
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size)
+{
+    const sim_partition_t *sim = (const sim_partition_t *)partition;
+    const uint8_t *bytes = src;
+
+    if (offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    for (size_t i = 0; i < size; i++)
+        sim->data[offset + i] &= bytes[i];
+    partition_save(sim, offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    const sim_partition_t *sim = (const sim_partition_t *)partition;
+
+    if (offset % FLASH_SECTOR_SIZE != 0 || size % FLASH_SECTOR_SIZE != 0)
+        return ESP_ERR_INVALID_ARG;
+    if (offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    memset(sim->data + offset, 0xff, size);
+    partition_save(sim, offset, size);
+    return ESP_OK;
+}
+
+void sntp_setoperatingmode(uint8_t mode)
+{
+}
+
+void sntp_setservername(uint8_t index, const char *server)
+{
+}
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t cb)
+{
+    sntp_cb = cb;
+}
+
+void sntp_set_sync_interval(uint32_t interval_ms)
+{
+    sntp_interval_ms = interval_ms;
+}
+
+/**
+ * The host clock is the reference, the first synchronization completes after
+ * a typical NTP round trip.
+ */
+void sntp_init()
+{
+    if (sntp_running)
+        return;
+    sntp_running = true;
+    xTaskCreate(sntp_task, "sntp", SNTP_STACK_SIZE, NULL, 1, NULL);
+}
+
+void sntp_stop()
+{
+    sntp_running = false;
+}
+
+bool sntp_enabled()
+{
+    return sntp_running;
+}
+
+static nvs_entry_t *nvs_find(nvs_handle_t handle, const char *key)
+{
+    const char *namespace = nvs_handles[handle - 1];
+
+    for (int i = 0; i < n_nvs_entries; i++)
+    {
+        if (strcmp(nvs_entries[i].namespace, namespace) == 0 && strcmp(nvs_entries[i].key, key) == 0)
+            return &nvs_entries[i];
+    }
+    return NULL;
+}
+
+/**
+ * Read a value. With a NULL value, the length of the stored one is returned
+ * as for blobs and strings on the device.
+ */
+static esp_err_t nvs_get(nvs_handle_t handle, const char *key, void *value, size_t *length, bool variable)
+{
+    nvs_entry_t *entry;
+    esp_err_t err = ESP_OK;
+
+    if (handle < 1 || handle > NVS_MAX_HANDLES)
+        return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&nvs_lock);
+    entry = nvs_find(handle, key);
+    if (entry == NULL)
+        err = ESP_ERR_NVS_NOT_FOUND;
+    else if (value == NULL && variable)
+        *length = entry->size;
+    else if (*length < entry->size || (!variable && *length != entry->size))
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    else
+        memcpy(value, entry->value, *length = entry->size);
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+static esp_err_t nvs_set(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    nvs_entry_t *entry;
+    esp_err_t err = ESP_OK;
+
+    if (handle < 1 || handle > NVS_MAX_HANDLES || strlen(key) >= NVS_KEY_MAX_SIZE)
+        return ESP_ERR_INVALID_ARG;
+    if (length > NVS_VALUE_MAX_SIZE)
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    pthread_mutex_lock(&nvs_lock);
+    entry = nvs_find(handle, key);
+    if (entry == NULL && n_nvs_entries < NVS_MAX_ENTRIES)
+    {
+        entry = &nvs_entries[n_nvs_entries++];
+        snprintf(entry->namespace, NVS_KEY_MAX_SIZE, "%s", nvs_handles[handle - 1]);
+        snprintf(entry->key, NVS_KEY_MAX_SIZE, "%s", key);
+    }
+    if (entry == NULL)
+    {
+        err = ESP_ERR_NVS_NO_FREE_PAGES;
+    }
+    else
+    {
+        memcpy(entry->value, value, length);
+        entry->size = length;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+/**
+ * Map the partition content, erased flash unless the state directory holds a
+ * previous image.
+ */
+static void partition_load(sim_partition_t *sim)
+{
+    char path[256];
+    FILE *file;
+
+    if (sim->data != NULL)
+        return;
+    sim->data = malloc(sim->partition.size);
+    memset(sim->data, 0xff, sim->partition.size);
+    if (sim_options.state_dir == NULL)
+        return;
+    snprintf(path, sizeof(path), "%s/%s.bin", sim_options.state_dir, sim->partition.label);
+    if ((file = fopen(path, "rb")) != NULL)
+    {
+        if (fread(sim->data, 1, sim->partition.size, file) != sim->partition.size)
+            memset(sim->data, 0xff, sim->partition.size);
+        fclose(file);
+    }
+}
+
+static void partition_save(const sim_partition_t *sim, size_t offset, size_t size)
+{
+    char path[256];
+    FILE *file;
+
+    if (sim_options.state_dir == NULL)
+        return;
+    snprintf(path, sizeof(path), "%s/%s.bin", sim_options.state_dir, sim->partition.label);
+    if ((file = fopen(path, "r+b")) == NULL)
+    {
+        if ((file = fopen(path, "wb")) == NULL)
+            return;
+        fwrite(sim->data, 1, sim->partition.size, file);
+    }
+    else
+    {
+        fseek(file, offset, SEEK_SET);
+        fwrite(sim->data + offset, 1, size, file);
+    }
+    fclose(file);
+}
+
+static void sntp_task(void *arg)
+{
+    struct timeval tv;
+
+    vTaskDelay(pdMS_TO_TICKS(SNTP_DELAY_MS));
+    while (sntp_running)
+    {
+        gettimeofday(&tv, NULL);
+        if (sntp_cb != NULL)
+            sntp_cb(&tv);
+        vTaskDelay(pdMS_TO_TICKS(sntp_interval_ms));
+    }
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,439 @@
+/*
+ * FreeRTOS on POSIX threads. Each task is a thread, queues, semaphores and
+ * event groups are condition variables on CLOCK_MONOTONIC. Priorities and
+ * stack sizes are ignored, the host scheduler runs the tasks in parallel.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "sim.h"
+
+/* structure definitions */
+struct sim_task
+{
+    pthread_t       thread;
+    char            name[16];
+    TaskFunction_t  function;
+    void           *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t  notified;
+    uint32_t        notify_value;
+};
+
+struct sim_queue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+    uint8_t        *items;
+    UBaseType_t     item_size;
+    UBaseType_t     length;
+    UBaseType_t     head;
+    UBaseType_t     count;
+};
+
+struct sim_event_group
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+    EventBits_t     bits;
+};
+
+/* static variables */
+static __thread struct sim_task *current;
+
+/* static function prototypes */
+static void *task_entry(void *);
+static void  cond_init(pthread_cond_t *);
+static bool  cond_wait(pthread_cond_t *, pthread_mutex_t *, bool, const struct timespec *);
+static BaseType_t queue_send(QueueHandle_t, const void *, TickType_t, bool);
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_size, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    struct sim_task *task = calloc(1, sizeof(*task));
+    pthread_attr_t attr;
+
+    strncpy(task->name, name, sizeof(task->name) - 1);
+    task->function = function;
+    task->arg = arg;
+    pthread_mutex_init(&task->lock, NULL);
+    cond_init(&task->notified);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&task->thread, &attr, task_entry, task) != 0)
+    {
+        pthread_attr_destroy(&attr);
+        free(task);
+        return pdFAIL;
+    }
+    pthread_attr_destroy(&attr);
+    if (handle != NULL)
+        *handle = task;
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_size, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    return xTaskCreate(function, name, stack_size, arg, priority, handle);
+}
+
+/**
+ * Only a task can delete itself, the task control block is kept since other
+ * tasks may still hold its handle.
+ */
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == current)
+        pthread_exit(NULL);
+    abort();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (ticks == 0)
+        sched_yield();
+    else
+        sim_sleep_us((int64_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t increment)
+{
+    TickType_t wake = *previous_wake + increment;
+
+    sim_sleep_us((int64_t)(int32_t)(wake - xTaskGetTickCount()) * portTICK_PERIOD_MS * 1000);
+    *previous_wake = wake;
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return (TickType_t)(sim_time_us() / (portTICK_PERIOD_MS * 1000));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return current;
+}
+
+const char *pcTaskGetName(TaskHandle_t task)
+{
+    task = task != NULL ? task : current;
+    return task != NULL ? task->name : "host";
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify_value++;
+    pthread_cond_signal(&task->notified);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    struct sim_task *task = current;
+    struct timespec deadline;
+    bool timed = sim_deadline(&deadline, ticks);
+    uint32_t value;
+
+    pthread_mutex_lock(&task->lock);
+    while (task->notify_value == 0 && ticks != 0)
+    {
+        if (!cond_wait(&task->notified, &task->lock, timed, &deadline))
+            break;
+    }
+    value = task->notify_value;
+    if (value != 0)
+        task->notify_value = clear_on_exit ? 0 : value - 1;
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+BaseType_t xPortGetCoreID()
+{
+    return 0;
+}
+
+/**
+ * The critical sections of the ESP32 port are spinlocks that the owning core
+ * may take again, here the owner is a thread.
+ */
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    uintptr_t self = (uintptr_t)pthread_self();
+    uintptr_t unlocked;
+
+    if (__atomic_load_n(&mux->owner, __ATOMIC_ACQUIRE) == self)
+    {
+        mux->count++;
+        return;
+    }
+    for (;;)
+    {
+        unlocked = 0;
+        if (__atomic_compare_exchange_n(&mux->owner, &unlocked, self, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        sched_yield();
+    }
+    mux->count = 1;
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+    if (--mux->count == 0)
+        __atomic_store_n(&mux->owner, 0, __ATOMIC_RELEASE);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct sim_queue *queue = calloc(1, sizeof(*queue));
+
+    queue->items = item_size > 0 ? calloc(length, item_size) : NULL;
+    queue->item_size = item_size;
+    queue->length = length;
+    pthread_mutex_init(&queue->lock, NULL);
+    cond_init(&queue->not_empty);
+    cond_init(&queue->not_full);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    return queue_send(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    return queue_send(queue, item, ticks, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    struct timespec deadline;
+    bool timed = sim_deadline(&deadline, ticks);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0)
+    {
+        if (ticks == 0 || !cond_wait(&queue->not_empty, &queue->lock, timed, &deadline))
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+    if (queue->item_size > 0)
+        memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    struct timespec deadline;
+    bool timed = sim_deadline(&deadline, ticks);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0)
+    {
+        if (ticks == 0 || !cond_wait(&queue->not_empty, &queue->lock, timed, &deadline))
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+    if (queue->item_size > 0)
+        memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    pthread_cond_signal(&queue->not_empty); /* still there for the other receivers */
+    pthread_mutex_unlock(&queue->lock);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    UBaseType_t count;
+
+    pthread_mutex_lock(&queue->lock);
+    count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    return queue->length - uxQueueMessagesWaiting(queue);
+}
+
+/**
+ * A mutex is a semaphore given once at creation. Priority inheritance and
+ * ownership are not checked.
+ */
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    QueueHandle_t queue = xQueueCreate(max_count, 0);
+
+    queue->count = initial_count;
+    return queue;
+}
+
+EventGroupHandle_t xEventGroupCreate()
+{
+    struct sim_event_group *group = calloc(1, sizeof(*group));
+
+    pthread_mutex_init(&group->lock, NULL);
+    cond_init(&group->changed);
+    return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    pthread_cond_destroy(&group->changed);
+    pthread_mutex_destroy(&group->lock);
+    free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t value;
+
+    pthread_mutex_lock(&group->lock);
+    group->bits |= bits;
+    value = group->bits;
+    pthread_cond_broadcast(&group->changed);
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t value;
+
+    pthread_mutex_lock(&group->lock);
+    value = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    EventBits_t value;
+
+    pthread_mutex_lock(&group->lock);
+    value = group->bits;
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks)
+{
+    struct timespec deadline;
+    bool timed = sim_deadline(&deadline, ticks);
+    EventBits_t value;
+    bool done;
+
+    pthread_mutex_lock(&group->lock);
+    for (;;)
+    {
+        value = group->bits;
+        done = wait_for_all ? (value & bits) == bits : (value & bits) != 0;
+        if (done || ticks == 0 || !cond_wait(&group->changed, &group->lock, timed, &deadline))
+            break;
+    }
+    if (done && clear_on_exit)
+        group->bits &= ~bits;
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+static void *task_entry(void *arg)
+{
+    current = arg;
+    pthread_setname_np(pthread_self(), current->name);
+    current->function(current->arg);
+    return NULL;
+}
+
+static void cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/**
+ * Wait on a condition until the deadline, if any.
+ * \return false on timeout.
+ */
+static bool cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock, bool timed, const struct timespec *deadline)
+{
+    if (!timed)
+        return pthread_cond_wait(cond, lock) == 0;
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+static BaseType_t queue_send(QueueHandle_t queue, const void *item, TickType_t ticks, bool to_front)
+{
+    struct timespec deadline;
+    bool timed = sim_deadline(&deadline, ticks);
+    UBaseType_t index;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length)
+    {
+        if (ticks == 0 || !cond_wait(&queue->not_full, &queue->lock, timed, &deadline))
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+    if (to_front)
+    {
+        queue->head = (queue->head + queue->length - 1) % queue->length;
+        index = queue->head;
+    }
+    else
+    {
+        index = (queue->head + queue->count) % queue->length;
+    }
+    if (queue->item_size > 0)
+        memcpy(queue->items + index * queue->item_size, item, queue->item_size);
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    return pdTRUE;
+}
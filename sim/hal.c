@@ -0,0 +1,229 @@
+/*
+ * Peripheral drivers: the ADC behind the MCP9700 and the GPIO line of the
+ * DHT11 in the VMA311. The DHT11 answers a start signal with the frame of
+ * the datasheet. The bits are told apart by counting polls of 1 us, which
+ * the host clock cannot time at any speed, so while the sensor answers the
+ * line follows a clock of its own that only ets_delay_us advances.
+ */
+#include <math.h>
+#include <sched.h>
+#include <string.h>
+#include "driver/adc.h"
+#include "driver/gpio.h"
+#include "esp_adc_cal.h"
+#include "esp_timer.h"
+#include "rom/ets_sys.h"
+#include "env.h"
+#include "sim.h"
+
+/* macro definitions */
+#define MCP9700_CHANNEL     ADC_CHANNEL_4
+#define MCP9700_V0_MV       500.0 /* output at 0 degC */
+#define MCP9700_TC_MV       10.0  /* per degC */
+#define ADC_FULL_SCALE_MV   1100.0
+#define ADC_NOISE_LSB       2.0
+#define DHT_GPIO            GPIO_NUM_5
+#define DHT_START_MIN_US    18000
+#define DHT_MIN_PERIOD_US   1000000
+#define DHT_RESPONSE_US     20 /* delay before the sensor pulls the line low */
+#define DHT_PREAMBLE_US     80
+#define DHT_BIT_LOW_US      50
+#define DHT_BIT_0_US        26
+#define DHT_BIT_1_US        70
+#define DHT_N_EDGES         (3 + 2 * 40 + 1)
+
+/* structure definitions */
+typedef struct dht
+{
+    gpio_mode_t mode;
+    int         level;      /* driven by the host */
+    int64_t     low_since;  /* when the host pulled the line low */
+    int64_t     last_frame; /* start of the last answer */
+    int64_t     edges[DHT_N_EDGES]; /* time of each level change of the answer */
+    int         n_edges;    /* 0 when not answering */
+    int64_t     clock;      /* time seen by the host while the sensor answers */
+} dht_t;
+
+/* static variables */
+static adc_bits_width_t adc_width = ADC_WIDTH_BIT_12;
+static dht_t            dht = {.level = 1, .last_frame = -DHT_MIN_PERIOD_US};
+
+/* static function prototypes */
+static void dht_answer(int64_t);
+static int  dht_level(int64_t);
+
+esp_err_t adc1_config_width(adc_bits_width_t width)
+{
+    adc_width = width;
+    return ESP_OK;
+}
+
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten)
+{
+    return ESP_OK;
+}
+
+esp_err_t adc2_config_channel_atten(adc2_channel_t channel, adc_atten_t atten)
+{
+    return ESP_OK;
+}
+
+/**
+ * The MCP9700 output, with the noise of the ADC. A disconnected channel
+ * reads 0, as does the sensor while it is failing.
+ */
+int adc1_get_raw(adc1_channel_t channel)
+{
+    int64_t now = esp_timer_get_time();
+    int max_raw = (1 << (9 + adc_width)) - 1;
+    double mv;
+    double raw;
+
+    if (channel != MCP9700_CHANNEL || env_fault("mcp9700", now))
+        return 0;
+    mv = MCP9700_V0_MV + MCP9700_TC_MV * env_read("mcp9700", ENV_TEMPERATURE, now);
+    raw = mv / ADC_FULL_SCALE_MV * max_raw + ADC_NOISE_LSB * ((double)rand() / RAND_MAX - 0.5);
+    return (int)fmin(fmax(lround(raw), 0), max_raw);
+}
+
+esp_err_t adc2_get_raw(adc2_channel_t channel, adc_bits_width_t width, int *raw)
+{
+    *raw = 0;
+    return ESP_OK;
+}
+
+/**
+ * An ideal linear characteristic over the full scale of the 0 dB attenuation.
+ */
+esp_adc_cal_value_t esp_adc_cal_characterize(adc_unit_t unit, adc_atten_t atten, adc_bits_width_t width,
+                                             uint32_t default_vref, esp_adc_cal_characteristics_t *chars)
+{
+    memset(chars, 0, sizeof(*chars));
+    chars->adc_num = unit;
+    chars->atten = atten;
+    chars->bit_width = width;
+    chars->vref = default_vref;
+    chars->coeff_a = (uint32_t)(ADC_FULL_SCALE_MV * 65536 / ((1 << (9 + width)) - 1));
+    return ESP_ADC_CAL_VAL_DEFAULT_VREF;
+}
+
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t raw, const esp_adc_cal_characteristics_t *chars)
+{
+    return (uint32_t)(((uint64_t)raw * chars->coeff_a + 32768) >> 16) + chars->coeff_b;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t num)
+{
+    if (num == DHT_GPIO)
+    {
+        dht.mode = GPIO_MODE_INPUT;
+        dht.level = 1;
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t num, gpio_mode_t mode)
+{
+    if (num == DHT_GPIO)
+        dht.mode = mode;
+    return ESP_OK;
+}
+
+/**
+ * Releasing the line after a long enough low level is the start signal of
+ * the DHT11.
+ */
+esp_err_t gpio_set_level(gpio_num_t num, uint32_t level)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (num != DHT_GPIO || !(dht.mode & GPIO_MODE_OUTPUT))
+        return ESP_OK;
+    if (level == 0 && dht.level != 0)
+    {
+        dht.low_since = now;
+        dht.n_edges = 0; /* a new start signal */
+    }
+    else if (level != 0 && dht.level == 0 && now - dht.low_since >= DHT_START_MIN_US)
+        dht_answer(now);
+    dht.level = level != 0;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t num)
+{
+    if (num != DHT_GPIO)
+        return 0;
+    if (dht.mode == GPIO_MODE_OUTPUT)
+        return dht.level;
+    return dht.level && dht_level(dht.clock); /* open drain, pulled up */
+}
+
+void ets_delay_us(uint32_t us)
+{
+    int64_t end = esp_timer_get_time() + us;
+
+    if (dht.n_edges > 0)
+    {
+        dht.clock += us;
+        return;
+    }
+
+    while (esp_timer_get_time() < end)
+        if (us > 1000)
+            sched_yield();
+}
+
+/**
+ * Build the answer to a start signal: 80 us low, 80 us high, then each of
+ * the 40 bits as 50 us low and 26 us (0) or 70 us (1) high, the MSB first,
+ * and a last 50 us low. The sensor only answers once per second.
+ */
+static void dht_answer(int64_t now)
+{
+    uint8_t data[5];
+    double rh;
+    double t;
+    int t10;
+    int64_t time;
+
+    dht.n_edges = 0;
+    if (now - dht.last_frame < DHT_MIN_PERIOD_US || env_fault("vma311", now))
+        return;
+    dht.last_frame = now;
+    rh = env_read("vma311", ENV_HUMIDITY, now);
+    t = env_read("vma311", ENV_TEMPERATURE, now);
+    data[0] = (uint8_t)fmin(fmax(lround(rh), 20), 90); /* range of the DHT11 */
+    data[1] = 0;
+    t10 = (int)fmin(fmax(lround(t * 10), 0), 500);
+    data[2] = t10 / 10;
+    data[3] = t10 % 10;
+    data[4] = data[0] + data[1] + data[2] + data[3];
+
+    dht.clock = now;
+    time = now + DHT_RESPONSE_US;
+    dht.edges[dht.n_edges++] = time; /* low */
+    dht.edges[dht.n_edges++] = time += DHT_PREAMBLE_US; /* high */
+    dht.edges[dht.n_edges++] = time += DHT_PREAMBLE_US; /* first bit */
+    for (int i = 0; i < 40; i++)
+    {
+        dht.edges[dht.n_edges++] = time += DHT_BIT_LOW_US;
+        dht.edges[dht.n_edges++] = time += (data[i / 8] >> (7 - i % 8)) & 1 ? DHT_BIT_1_US : DHT_BIT_0_US;
+    }
+    dht.edges[dht.n_edges++] = time += DHT_BIT_LOW_US; /* released */
+}
+
+/**
+ * Level driven by the sensor: the edges alternate low and high, starting
+ * with low. The line is released for good after the last edge.
+ */
+static int dht_level(int64_t now)
+{
+    int n = 0;
+
+    while (n < dht.n_edges && now >= dht.edges[n])
+        n++;
+    if (n == dht.n_edges)
+        dht.n_edges = 0;
+    return n % 2 == 0;
+}
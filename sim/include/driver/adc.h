@@ -0,0 +1,48 @@
+#pragma once
+#include "esp_err.h"
+
+typedef enum
+{
+    ADC_UNIT_1 = 1,
+    ADC_UNIT_2 = 2
+} adc_unit_t;
+
+typedef enum
+{
+    ADC_CHANNEL_0,
+    ADC_CHANNEL_1,
+    ADC_CHANNEL_2,
+    ADC_CHANNEL_3,
+    ADC_CHANNEL_4,
+    ADC_CHANNEL_5,
+    ADC_CHANNEL_6,
+    ADC_CHANNEL_7,
+    ADC_CHANNEL_8,
+    ADC_CHANNEL_9,
+    ADC_CHANNEL_MAX
+} adc_channel_t;
+
+typedef enum
+{
+    ADC_WIDTH_BIT_9,
+    ADC_WIDTH_BIT_10,
+    ADC_WIDTH_BIT_11,
+    ADC_WIDTH_BIT_12
+} adc_bits_width_t;
+
+typedef enum
+{
+    ADC_ATTEN_DB_0,
+    ADC_ATTEN_DB_2_5,
+    ADC_ATTEN_DB_6,
+    ADC_ATTEN_DB_11
+} adc_atten_t;
+
+typedef adc_channel_t adc1_channel_t;
+typedef adc_channel_t adc2_channel_t;
+
+esp_err_t adc1_config_width(adc_bits_width_t);
+esp_err_t adc1_config_channel_atten(adc1_channel_t, adc_atten_t);
+esp_err_t adc2_config_channel_atten(adc2_channel_t, adc_atten_t);
+int       adc1_get_raw(adc1_channel_t);
+esp_err_t adc2_get_raw(adc2_channel_t, adc_bits_width_t, int *);
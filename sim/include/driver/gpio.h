@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+#include "rom/ets_sys.h"
+
+typedef enum
+{
+    GPIO_NUM_0 = 0,
+    GPIO_NUM_2 = 2,
+    GPIO_NUM_4 = 4,
+    GPIO_NUM_5 = 5,
+    GPIO_NUM_21 = 21,
+    GPIO_NUM_22 = 22,
+    GPIO_NUM_MAX = 40
+} gpio_num_t;
+
+typedef enum
+{
+    GPIO_MODE_DISABLE = 0,
+    GPIO_MODE_INPUT = 1,
+    GPIO_MODE_OUTPUT = 2,
+    GPIO_MODE_INPUT_OUTPUT = 3
+} gpio_mode_t;
+
+esp_err_t gpio_reset_pin(gpio_num_t);
+esp_err_t gpio_set_direction(gpio_num_t, gpio_mode_t);
+esp_err_t gpio_set_level(gpio_num_t, uint32_t);
+int       gpio_get_level(gpio_num_t);
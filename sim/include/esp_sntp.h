@@ -0,0 +1,16 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+
+#define SNTP_OPMODE_POLL 0
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval *);
+
+void sntp_setoperatingmode(uint8_t);
+void sntp_setservername(uint8_t, const char *);
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t);
+void sntp_set_sync_interval(uint32_t);
+void sntp_init(void);
+void sntp_stop(void);
+bool sntp_enabled(void);
@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+
+/* simulated time since boot in us, see sim/sim.c */
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,2 @@
+#pragma once
+/* TLS is not simulated, the MQTT client shim is a loopback. */
@@ -0,0 +1,94 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+
+extern esp_event_base_t const WIFI_EVENT;
+
+enum
+{
+    WIFI_EVENT_WIFI_READY,
+    WIFI_EVENT_SCAN_DONE,
+    WIFI_EVENT_STA_START,
+    WIFI_EVENT_STA_STOP,
+    WIFI_EVENT_STA_CONNECTED,
+    WIFI_EVENT_STA_DISCONNECTED
+};
+
+typedef struct
+{
+    int dummy;
+} wifi_init_config_t;
+
+#define WIFI_INIT_CONFIG_DEFAULT() {0}
+
+typedef enum
+{
+    WIFI_AUTH_OPEN,
+    WIFI_AUTH_WEP,
+    WIFI_AUTH_WPA_PSK,
+    WIFI_AUTH_WPA2_PSK
+} wifi_auth_mode_t;
+
+typedef enum
+{
+    WIFI_MODE_NULL,
+    WIFI_MODE_STA
+} wifi_mode_t;
+
+typedef enum
+{
+    WIFI_PS_NONE,
+    WIFI_PS_MIN_MODEM,
+    WIFI_PS_MAX_MODEM
+} wifi_ps_type_t;
+
+typedef enum
+{
+    ESP_IF_WIFI_STA
+} esp_interface_t;
+
+typedef struct
+{
+    bool capable;
+    bool required;
+} wifi_pmf_config_t;
+
+typedef struct
+{
+    int8_t           rssi;
+    wifi_auth_mode_t authmode;
+} wifi_scan_threshold_t;
+
+typedef struct
+{
+    uint8_t               ssid[32];
+    uint8_t               password[64];
+    wifi_scan_threshold_t threshold;
+    wifi_pmf_config_t     pmf_cfg;
+    uint16_t              listen_interval;
+} wifi_sta_config_t;
+
+typedef union
+{
+    wifi_sta_config_t sta;
+} wifi_config_t;
+
+typedef struct
+{
+    uint8_t bssid[6];
+    uint8_t ssid[33];
+    uint8_t primary;
+    int8_t  rssi;
+} wifi_ap_record_t;
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *);
+esp_err_t esp_wifi_set_mode(wifi_mode_t);
+esp_err_t esp_wifi_set_config(esp_interface_t, wifi_config_t *);
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_connect(void);
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t);
+esp_err_t esp_wifi_get_ps(wifi_ps_type_t *);
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *);
@@ -0,0 +1,15 @@
+#pragma once
+#include "FreeRTOS.h"
+
+typedef struct sim_queue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t, UBaseType_t);
+void          vQueueDelete(QueueHandle_t);
+BaseType_t    xQueueSend(QueueHandle_t, const void *, TickType_t);
+BaseType_t    xQueueSendToFront(QueueHandle_t, const void *, TickType_t);
+BaseType_t    xQueueReceive(QueueHandle_t, void *, TickType_t);
+BaseType_t    xQueuePeek(QueueHandle_t, void *, TickType_t);
+UBaseType_t   uxQueueMessagesWaiting(QueueHandle_t);
+UBaseType_t   uxQueueSpacesAvailable(QueueHandle_t);
+
+#define xQueueSendToBack(queue, item, timeout) xQueueSend(queue, item, timeout)
@@ -0,0 +1,13 @@
+#pragma once
+#include "queue.h"
+
+/* semaphores are queues of empty items, as in FreeRTOS */
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t, UBaseType_t);
+
+#define xSemaphoreTake(sem, timeout) xQueueReceive(sem, NULL, timeout)
+#define xSemaphoreGive(sem)          xQueueSend(sem, NULL, 0)
+#define vSemaphoreDelete(sem)        vQueueDelete(sem)
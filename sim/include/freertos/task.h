@@ -0,0 +1,17 @@
+#pragma once
+#include "FreeRTOS.h"
+
+typedef struct sim_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t   xTaskCreate(TaskFunction_t, const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *);
+BaseType_t   xTaskCreatePinnedToCore(TaskFunction_t, const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *, BaseType_t);
+void         vTaskDelete(TaskHandle_t);
+void         vTaskDelay(TickType_t);
+void         vTaskDelayUntil(TickType_t *, TickType_t);
+TickType_t   xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+const char  *pcTaskGetName(TaskHandle_t);
+BaseType_t   xTaskNotifyGive(TaskHandle_t);
+uint32_t     ulTaskNotifyTake(BaseType_t, TickType_t);
+BaseType_t   xPortGetCoreID(void);
@@ -0,0 +1,79 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+typedef enum
+{
+    MQTT_EVENT_ANY = -1,
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+    MQTT_EVENT_BEFORE_CONNECT,
+    MQTT_EVENT_DELETED
+} esp_mqtt_event_id_t;
+
+typedef enum
+{
+    MQTT_ERROR_TYPE_NONE,
+    MQTT_ERROR_TYPE_ESP_TLS,
+    MQTT_ERROR_TYPE_CONNECTION_REFUSED
+} esp_mqtt_error_type_t;
+
+typedef struct
+{
+    esp_err_t             esp_tls_last_esp_err;
+    int                   esp_tls_stack_err;
+    int                   esp_tls_cert_verify_flags;
+    esp_mqtt_error_type_t error_type;
+    int                   connect_return_code;
+} esp_mqtt_error_codes_t;
+
+typedef struct esp_mqtt_event
+{
+    esp_mqtt_event_id_t      event_id;
+    esp_mqtt_client_handle_t client;
+    void                    *user_context;
+    char                    *data;
+    int                      data_len;
+    int                      total_data_len;
+    int                      current_data_offset;
+    char                    *topic;
+    int                      topic_len;
+    int                      msg_id;
+    int                      session_present;
+    esp_mqtt_error_codes_t  *error_handle;
+    bool                     retain;
+    int                      qos;
+    bool                     dup;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+
+typedef struct
+{
+    const char *uri;
+    const char *username;
+    const char *password;
+    const char *client_id;
+    int         keepalive;
+    const char *lwt_topic;
+    const char *lwt_msg;
+    int         lwt_qos;
+    int         lwt_retain;
+} esp_mqtt_client_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *);
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t, esp_mqtt_event_id_t, esp_event_handler_t, void *);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t);
+int       esp_mqtt_client_publish(esp_mqtt_client_handle_t, const char *, const char *, int, int, int);
+int       esp_mqtt_client_enqueue(esp_mqtt_client_handle_t, const char *, const char *, int, int, int, bool);
+int       esp_mqtt_client_subscribe(esp_mqtt_client_handle_t, const char *, int);
+int       esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t);
@@ -0,0 +1,7 @@
+#pragma once
+/* Host simulation configuration, the subset of sdkconfig used by envmon. */
+#define CONFIG_FREERTOS_HZ                1000
+#define CONFIG_LOG_DEFAULT_LEVEL          3
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ 240
+#define CONFIG_PM_ENABLE                  0
+#define CONFIG_FREERTOS_USE_TICKLESS_IDLE 0
@@ -0,0 +1,1010 @@
+/*
+ * Network stack: the default event loop, a Wi-Fi station that associates
+ * after the usual delays, an HTTP client whose requests all succeed and a
+ * loopback MQTT client. The broker acknowledges QoS 1 messages after one
+ * round trip, delivers the published messages to the matching subscriptions
+ * and the scripted ones (-i) at their time. The link goes down while the
+ * environment script makes "wifi" fail, the MQTT outbox then fills up until
+ * it comes back.
+ *
+ * With a broker (-m), the MQTT client speaks MQTT 3.1.1 over TCP to it
+ * instead, the loopback and the scripted messages are left out.
+ */
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_event.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "esp_http_client.h"
+#include "mqtt_client.h"
+#include "env.h"
+#include "sim.h"
+
+/* macro definitions */
+#define EVENT_MAX_HANDLERS   16
+#define EVENT_DATA_MAX_SIZE  64
+#define EVENT_QUEUE_LEN      16
+#define TASK_STACK_SIZE      4096
+#define TASK_PRIORITY        5
+#define WIFI_POLL_MS         100
+#define WIFI_ASSOCIATE_MS    800 /* scan, authentication and DHCP */
+#define WIFI_IP              0x3201a8c0 /* 192.168.1.50 */
+#define WIFI_RSSI            -58
+#define MQTT_POLL_MS         5
+#define MQTT_TOPIC_MAX_SIZE  128
+#define MQTT_MAX_SUBS        8
+#define MQTT_MAX_PENDING     8
+#define INJECT_LINE_MAX_SIZE 1024
+#define BROKER_PORT          1883
+#define BROKER_TIMEOUT_S     5
+#define BROKER_RETRY_MS      2000
+#define BROKER_KEEPALIVE_S   120 /* as esp-mqtt */
+#define BROKER_RX_SIZE       4096
+
+/* structure definitions */
+typedef struct event_handler
+{
+    esp_event_base_t    base;
+    int32_t             id;
+    esp_event_handler_t handler;
+    void               *arg;
+} event_handler_t;
+
+typedef struct event
+{
+    esp_event_base_t base;
+    int32_t          id;
+    uint8_t          data[EVENT_DATA_MAX_SIZE];
+} event_t;
+
+struct esp_http_client
+{
+    char                 url[256];
+    http_event_handle_cb handler;
+    void                *user_data;
+    const char          *body;
+    int                  body_len;
+    int                  status;
+};
+
+typedef struct mqtt_message
+{
+    char                 topic[MQTT_TOPIC_MAX_SIZE];
+    char                *data;
+    int                  len;
+    int                  qos;
+    int                  retain;
+    int                  msg_id;
+    int64_t              time;     /* when it is acknowledged, or delivered if injected */
+    bool                 sent;
+    struct mqtt_message *next;
+} mqtt_message_t;
+
+struct esp_mqtt_client
+{
+    pthread_mutex_t     lock;
+    esp_event_handler_t handler;
+    void               *handler_arg;
+    bool                connected;
+    int                 last_msg_id;
+    mqtt_message_t     *outbox;
+    int                 outbox_size;
+    mqtt_message_t     *inbox;     /* injected, sorted by time */
+    char                subs[MQTT_MAX_SUBS][MQTT_TOPIC_MAX_SIZE];
+    int                 n_subs;
+    int                 subacks[MQTT_MAX_PENDING];
+    int                 n_subacks;
+    char                client_id[64];
+    int                 keepalive_s;
+    int                 sock;      /* to the broker, -1 if none */
+    bool                lost;      /* a send to the broker failed */
+    int64_t             last_tx;
+    uint8_t             rx[BROKER_RX_SIZE];
+    int                 rx_len;
+    uint8_t             packet[BROKER_RX_SIZE]; /* the last one received */
+};
+
+/* global variables */
+esp_event_base_t const WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t const IP_EVENT = "IP_EVENT";
+
+/* static variables */
+static pthread_mutex_t handlers_lock = PTHREAD_MUTEX_INITIALIZER;
+static event_handler_t handlers[EVENT_MAX_HANDLERS];
+static int             n_handlers;
+static QueueHandle_t   events;
+static volatile bool   wifi_connected;
+static volatile bool   wifi_connecting;
+
+/* static function prototypes */
+static void            event_task(void *);
+static void            wifi_task(void *);
+static void            http_event(esp_http_client_handle_t, esp_http_client_event_id_t);
+static void            mqtt_task(void *);
+static bool            mqtt_step(esp_mqtt_client_handle_t);
+static void            mqtt_event(esp_mqtt_client_handle_t, esp_mqtt_event_id_t, int, mqtt_message_t *);
+static bool            mqtt_subscribed(esp_mqtt_client_handle_t, const char *);
+static bool            mqtt_matches(const char *, const char *);
+static mqtt_message_t *mqtt_message(const char *, const char *, int, int);
+static void            mqtt_load_inbox(esp_mqtt_client_handle_t, const char *);
+static bool            broker_connect(esp_mqtt_client_handle_t);
+static void            broker_close(esp_mqtt_client_handle_t);
+static bool            broker_send(esp_mqtt_client_handle_t, uint8_t, const uint8_t *, int, const char *, int);
+static void            broker_publish(esp_mqtt_client_handle_t, const mqtt_message_t *);
+static int             broker_receive(esp_mqtt_client_handle_t);
+static void            broker_handle(esp_mqtt_client_handle_t, int);
+static int             put_string(uint8_t *, const char *);
+
+esp_err_t esp_event_loop_create_default()
+{
+    if (events != NULL)
+        return ESP_ERR_INVALID_STATE;
+    events = xQueueCreate(EVENT_QUEUE_LEN, sizeof(event_t));
+    xTaskCreate(event_task, "sys_evt", TASK_STACK_SIZE, NULL, TASK_PRIORITY, NULL);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg)
+{
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    pthread_mutex_lock(&handlers_lock);
+    if (n_handlers < EVENT_MAX_HANDLERS)
+    {
+        handlers[n_handlers++] = (event_handler_t){base, id, handler, arg};
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&handlers_lock);
+    return err;
+}
+
+esp_err_t esp_event_handler_unregister(esp_event_base_t base, int32_t id, esp_event_handler_t handler)
+{
+    pthread_mutex_lock(&handlers_lock);
+    for (int i = 0; i < n_handlers; i++)
+    {
+        if (handlers[i].base == base && handlers[i].id == id && handlers[i].handler == handler)
+        {
+            memmove(&handlers[i], &handlers[i + 1], (n_handlers - i - 1) * sizeof(handlers[0]));
+            n_handlers--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&handlers_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post(esp_event_base_t base, int32_t id, void *data, size_t size, uint32_t ticks)
+{
+    event_t event = {.base = base, .id = id};
+
+    if (events == NULL)
+        return ESP_ERR_INVALID_STATE;
+    if (size > EVENT_DATA_MAX_SIZE)
+        return ESP_ERR_INVALID_SIZE;
+    if (data != NULL)
+        memcpy(event.data, data, size);
+    return xQueueSend(events, &event, ticks) == pdPASS ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+esp_err_t esp_netif_init()
+{
+    return ESP_OK;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_sta()
+{
+    static int netif;
+
+    return (esp_netif_t *)&netif;
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(esp_interface_t interface, wifi_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start()
+{
+    xTaskCreate(wifi_task, "wifi", TASK_STACK_SIZE, NULL, TASK_PRIORITY, NULL);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect()
+{
+    wifi_connecting = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_ps(wifi_ps_type_t *type)
+{
+    *type = WIFI_PS_MIN_MODEM;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *info)
+{
+    if (!wifi_connected)
+        return ESP_FAIL;
+    memset(info, 0, sizeof(*info));
+    strcpy((char *)info->ssid, "sim");
+    info->primary = 6;
+    info->rssi = WIFI_RSSI + rand() % 5 - 2;
+    return ESP_OK;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(*client));
+
+    snprintf(client->url, sizeof(client->url), "%s", config->url);
+    client->handler = config->event_handler;
+    client->user_data = config->user_data;
+    return client;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char *data, int len)
+{
+    client->body = data;
+    client->body_len = len;
+    return ESP_OK;
+}
+
+/**
+ * The request takes one HTTP latency and is answered 200, or fails at once
+ * while the link is down.
+ */
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+    if (!wifi_connected)
+    {
+        http_event(client, HTTP_EVENT_ERROR);
+        return ESP_FAIL;
+    }
+    http_event(client, HTTP_EVENT_ON_CONNECTED);
+    http_event(client, HTTP_EVENT_HEADERS_SENT);
+    vTaskDelay(pdMS_TO_TICKS(sim_options.http_latency_ms));
+    sim_traffic("http", client->url, -1, client->body != NULL ? client->body : "", client->body_len);
+    client->status = 200;
+    http_event(client, HTTP_EVENT_ON_FINISH);
+    http_event(client, HTTP_EVENT_DISCONNECTED);
+    return ESP_OK;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    free(client);
+    return ESP_OK;
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    esp_mqtt_client_handle_t client = calloc(1, sizeof(*client));
+
+    pthread_mutex_init(&client->lock, NULL);
+    snprintf(client->client_id, sizeof(client->client_id), "%s",
+             config->client_id != NULL ? config->client_id : "envmon_sim");
+    client->keepalive_s = config->keepalive > 0 ? config->keepalive : BROKER_KEEPALIVE_S;
+    client->sock = -1;
+    if (sim_options.inject != NULL && sim_options.broker == NULL)
+        mqtt_load_inbox(client, sim_options.inject);
+    return client;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t handler, void *arg)
+{
+    client->handler = handler;
+    client->handler_arg = arg;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    xTaskCreate(mqtt_task, "mqtt_task", TASK_STACK_SIZE, client, TASK_PRIORITY, NULL);
+    return ESP_OK;
+}
+
+/**
+ * Queue a message in the outbox. QoS 0 messages get the ID 0, they are only
+ * kept while disconnected if asked to.
+ */
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len,
+                            int qos, int retain, bool store)
+{
+    mqtt_message_t *message;
+    mqtt_message_t **last;
+    int msg_id;
+
+    if (len == 0 && data != NULL)
+        len = strlen(data);
+    pthread_mutex_lock(&client->lock);
+    if (!client->connected && qos == 0 && !store)
+    {
+        pthread_mutex_unlock(&client->lock);
+        return -1;
+    }
+    msg_id = qos > 0 ? client->last_msg_id = client->last_msg_id % 0xffff + 1 : 0;
+    message = mqtt_message(topic, data, len, qos);
+    message->retain = retain;
+    message->msg_id = msg_id;
+    for (last = &client->outbox; *last != NULL; last = &(*last)->next)
+        ;
+    *last = message;
+    client->outbox_size += len;
+    pthread_mutex_unlock(&client->lock);
+    return msg_id;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len,
+                            int qos, int retain)
+{
+    if (!client->connected)
+        return -1;
+    return esp_mqtt_client_enqueue(client, topic, data, len, qos, retain, true);
+}
+
+/**
+ * Subscribe, the broker acknowledges with a SUBACK or the loopback one after
+ * the next step.
+ */
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    uint8_t body[2 + 2 + MQTT_TOPIC_MAX_SIZE + 1];
+    int msg_id = -1;
+    int len;
+
+    pthread_mutex_lock(&client->lock);
+    if (client->connected && sim_options.broker != NULL)
+    {
+        msg_id = client->last_msg_id = client->last_msg_id % 0xffff + 1;
+        body[0] = msg_id >> 8;
+        body[1] = msg_id & 0xff;
+        len = 2 + put_string(&body[2], topic);
+        body[len++] = qos;
+        if (!broker_send(client, 0x82, body, len, NULL, 0))
+            msg_id = -1;
+    }
+    else if (client->connected && client->n_subacks < MQTT_MAX_PENDING)
+    {
+        if (!mqtt_subscribed(client, topic) && client->n_subs < MQTT_MAX_SUBS)
+            snprintf(client->subs[client->n_subs++], MQTT_TOPIC_MAX_SIZE, "%s", topic);
+        msg_id = client->last_msg_id = client->last_msg_id % 0xffff + 1;
+        client->subacks[client->n_subacks++] = msg_id;
+    }
+    pthread_mutex_unlock(&client->lock);
+    return msg_id;
+}
+
+int esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t client)
+{
+    int size;
+
+    pthread_mutex_lock(&client->lock);
+    size = client->outbox_size;
+    pthread_mutex_unlock(&client->lock);
+    return size;
+}
+
+static void event_task(void *arg)
+{
+    event_handler_t matching[EVENT_MAX_HANDLERS];
+    event_t event;
+    int n;
+
+    for (;;)
+    {
+        xQueueReceive(events, &event, portMAX_DELAY);
+        pthread_mutex_lock(&handlers_lock);
+        n = 0;
+        for (int i = 0; i < n_handlers; i++)
+        {
+            if (handlers[i].base == event.base && (handlers[i].id == ESP_EVENT_ANY_ID || handlers[i].id == event.id))
+                matching[n++] = handlers[i];
+        }
+        pthread_mutex_unlock(&handlers_lock);
+        for (int i = 0; i < n; i++)
+            matching[i].handler(matching[i].arg, event.base, event.id, event.data);
+    }
+}
+
+/**
+ * Associate when asked to, unless the link is failing, and report the loss of
+ * the link when a failure starts.
+ */
+static void wifi_task(void *arg)
+{
+    ip_event_got_ip_t got_ip = {.ip_info = {.ip = {WIFI_IP}}};
+    bool failing;
+
+    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0, portMAX_DELAY);
+    for (;;)
+    {
+        vTaskDelay(pdMS_TO_TICKS(WIFI_POLL_MS));
+        failing = env_fault("wifi", sim_time_us());
+        if (wifi_connected && failing)
+        {
+            wifi_connected = false;
+            esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, NULL, 0, portMAX_DELAY);
+        }
+        else if (!wifi_connected && wifi_connecting && !failing)
+        {
+            vTaskDelay(pdMS_TO_TICKS(WIFI_ASSOCIATE_MS));
+            wifi_connecting = false;
+            wifi_connected = true;
+            esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, NULL, 0, portMAX_DELAY);
+            esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &got_ip, sizeof(got_ip), portMAX_DELAY);
+        }
+    }
+}
+
+static void http_event(esp_http_client_handle_t client, esp_http_client_event_id_t id)
+{
+    esp_http_client_event_t event = {.event_id = id, .client = client, .user_data = client->user_data};
+
+    if (client->handler != NULL)
+        client->handler(&event);
+}
+
+static void mqtt_task(void *arg)
+{
+    esp_mqtt_client_handle_t client = arg;
+
+    for (;;)
+    {
+        while (mqtt_step(client))
+            ;
+        vTaskDelay(pdMS_TO_TICKS(MQTT_POLL_MS));
+    }
+}
+
+/**
+ * Handle the next thing to happen, the handler is called without the lock
+ * since it publishes and subscribes.
+ * \return true if something happened.
+ */
+static bool mqtt_step(esp_mqtt_client_handle_t client)
+{
+    int64_t now = sim_time_us();
+    mqtt_message_t **link;
+    mqtt_message_t *message;
+    int msg_id;
+    int len;
+
+    pthread_mutex_lock(&client->lock);
+    if (client->connected != wifi_connected)
+    {
+        pthread_mutex_unlock(&client->lock);
+        if (wifi_connected)
+        {
+            mqtt_event(client, MQTT_EVENT_BEFORE_CONNECT, 0, NULL);
+            if (sim_options.broker == NULL)
+            {
+                vTaskDelay(pdMS_TO_TICKS(3 * sim_options.mqtt_latency_ms)); /* TCP, TLS and CONNECT */
+            }
+            else if (!broker_connect(client))
+            {
+                mqtt_event(client, MQTT_EVENT_ERROR, 0, NULL);
+                vTaskDelay(pdMS_TO_TICKS(BROKER_RETRY_MS));
+                return false;
+            }
+            pthread_mutex_lock(&client->lock);
+            client->connected = true;
+            for (message = client->outbox; message != NULL; message = message->next)
+                message->sent = false; /* sent again, with DUP */
+            pthread_mutex_unlock(&client->lock);
+            mqtt_event(client, MQTT_EVENT_CONNECTED, 0, NULL);
+        }
+        else
+        {
+            pthread_mutex_lock(&client->lock);
+            client->connected = false;
+            client->n_subacks = 0;
+            broker_close(client);
+            pthread_mutex_unlock(&client->lock);
+            mqtt_event(client, MQTT_EVENT_DISCONNECTED, 0, NULL);
+        }
+        return true;
+    }
+    if (!client->connected)
+    {
+        pthread_mutex_unlock(&client->lock);
+        return false;
+    }
+    if (sim_options.broker != NULL && (len = broker_receive(client)) != 0)
+    {
+        pthread_mutex_unlock(&client->lock);
+        broker_handle(client, len);
+        return true;
+    }
+    if (client->n_subacks > 0)
+    {
+        msg_id = client->subacks[0];
+        memmove(&client->subacks[0], &client->subacks[1], --client->n_subacks * sizeof(client->subacks[0]));
+        pthread_mutex_unlock(&client->lock);
+        mqtt_event(client, MQTT_EVENT_SUBSCRIBED, msg_id, NULL);
+        return true;
+    }
+    for (link = &client->outbox; (message = *link) != NULL; link = &message->next)
+    {
+        if (!message->sent)
+        {
+            message->sent = true;
+            message->time = now + (int64_t)sim_options.mqtt_latency_ms * 1000;
+            sim_traffic("mqtt", message->topic, message->qos, message->data, message->len);
+            if (sim_options.broker != NULL)
+            {
+                broker_publish(client, message);
+                message->time = INT64_MAX; /* until the PUBACK */
+                if (message->qos == 0)
+                {
+                    *link = message->next;
+                    client->outbox_size -= message->len;
+                    free(message->data);
+                    free(message);
+                }
+                pthread_mutex_unlock(&client->lock);
+                return true;
+            }
+            if (message->qos == 0)
+            {
+                *link = message->next;
+                client->outbox_size -= message->len;
+            }
+            else
+            {
+                message = mqtt_message(message->topic, message->data, message->len, message->qos);
+            }
+            pthread_mutex_unlock(&client->lock);
+            if (mqtt_subscribed(client, message->topic))
+                mqtt_event(client, MQTT_EVENT_DATA, 0, message); /* the broker sends it back */
+            free(message->data);
+            free(message);
+            return true;
+        }
+        if (message->qos > 0 && now >= message->time)
+        {
+            *link = message->next;
+            client->outbox_size -= message->len;
+            pthread_mutex_unlock(&client->lock);
+            mqtt_event(client, MQTT_EVENT_PUBLISHED, message->msg_id, NULL);
+            free(message->data);
+            free(message);
+            return true;
+        }
+    }
+    if (sim_options.broker != NULL && now - client->last_tx >= client->keepalive_s * 500000LL)
+        broker_send(client, 0xc0, NULL, 0, NULL, 0); /* PINGREQ, halfway through the keepalive */
+    if ((message = client->inbox) != NULL && now >= message->time)
+    {
+        client->inbox = message->next;
+        pthread_mutex_unlock(&client->lock);
+        if (mqtt_subscribed(client, message->topic))
+            mqtt_event(client, MQTT_EVENT_DATA, 0, message);
+        free(message->data);
+        free(message);
+        return true;
+    }
+    pthread_mutex_unlock(&client->lock);
+    return false;
+}
+
+static void mqtt_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t id, int msg_id, mqtt_message_t *message)
+{
+    esp_mqtt_error_codes_t error = {0};
+    esp_mqtt_event_t event = {
+        .event_id = id,
+        .client = client,
+        .msg_id = msg_id,
+        .error_handle = &error,
+    };
+
+    if (message != NULL)
+    {
+        event.topic = message->topic;
+        event.topic_len = strlen(message->topic);
+        event.data = message->data;
+        event.data_len = message->len;
+        event.total_data_len = message->len;
+        event.qos = message->qos;
+    }
+    if (client->handler != NULL)
+        client->handler(client->handler_arg, "MQTT_EVENTS", id, &event);
+}
+
+static bool mqtt_subscribed(esp_mqtt_client_handle_t client, const char *topic)
+{
+    for (int i = 0; i < client->n_subs; i++)
+    {
+        if (mqtt_matches(client->subs[i], topic))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Match a topic against a filter with the + and # wildcards.
+ */
+static bool mqtt_matches(const char *filter, const char *topic)
+{
+    while (*filter != '\0')
+    {
+        if (*filter == '#')
+            return true;
+        if (*filter == '+')
+        {
+            while (*topic != '\0' && *topic != '/')
+                topic++;
+            filter++;
+        }
+        else if (*filter++ != *topic++)
+        {
+            return false;
+        }
+    }
+    return *topic == '\0';
+}
+
+static mqtt_message_t *mqtt_message(const char *topic, const char *data, int len, int qos)
+{
+    mqtt_message_t *message = calloc(1, sizeof(*message));
+
+    snprintf(message->topic, sizeof(message->topic), "%s", topic);
+    message->data = malloc(len + 1);
+    memcpy(message->data, data, len);
+    message->data[len] = '\0';
+    message->len = len;
+    message->qos = qos;
+    return message;
+}
+
+/**
+ * Load the messages to deliver, one "time_s topic payload" per line, the
+ * payload runs to the end of the line.
+ */
+static void mqtt_load_inbox(esp_mqtt_client_handle_t client, const char *path)
+{
+    char line[INJECT_LINE_MAX_SIZE];
+    char topic[MQTT_TOPIC_MAX_SIZE];
+    mqtt_message_t **last;
+    mqtt_message_t *message;
+    double time;
+    int offset;
+    FILE *file;
+
+    if ((file = fopen(path, "r")) == NULL)
+    {
+        perror(path);
+        return;
+    }
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#' || sscanf(line, "%lf %127s %n", &time, topic, &offset) != 2)
+            continue;
+        message = mqtt_message(topic, line + offset, strlen(line + offset), 1);
+        message->time = (int64_t)(time * 1e6);
+        for (last = &client->inbox; *last != NULL && (*last)->time <= message->time; last = &(*last)->next)
+            ;
+        message->next = *last;
+        *last = message;
+    }
+    fclose(file);
+}
+
+/**
+ * Open a TCP connection to the broker and go through CONNECT and CONNACK,
+ * with a clean session. Called without the lock, the client is disconnected.
+ * \return true if the broker accepted the connection.
+ */
+static bool broker_connect(esp_mqtt_client_handle_t client)
+{
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct timeval timeout = {.tv_sec = BROKER_TIMEOUT_S};
+    struct addrinfo *addrs;
+    char host[256];
+    char port[8];
+    uint8_t body[10 + 2 + sizeof(client->client_id)];
+    uint8_t connack[4];
+    int one = 1;
+    int len = 0;
+    int n;
+
+    snprintf(port, sizeof(port), "%d", BROKER_PORT);
+    if (sscanf(sim_options.broker, "mqtt://%255[^:/]:%7[0-9]", host, port) < 1
+        && sscanf(sim_options.broker, "%255[^:/]:%7[0-9]", host, port) < 1)
+    {
+        fprintf(stderr, "%s: not a broker URI\n", sim_options.broker);
+        return false;
+    }
+    if (getaddrinfo(host, port, &hints, &addrs) != 0)
+    {
+        fprintf(stderr, "%s: unknown host\n", host);
+        return false;
+    }
+    client->sock = socket(addrs->ai_family, addrs->ai_socktype, addrs->ai_protocol);
+    if (client->sock < 0 || connect(client->sock, addrs->ai_addr, addrs->ai_addrlen) != 0)
+    {
+        fprintf(stderr, "%s:%s: %s\n", host, port, strerror(errno));
+        freeaddrinfo(addrs);
+        broker_close(client);
+        return false;
+    }
+    freeaddrinfo(addrs);
+    setsockopt(client->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); /* no Nagle, the latency is measured */
+    setsockopt(client->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    len = put_string(body, "MQTT");
+    body[len++] = 4;    /* 3.1.1 */
+    body[len++] = 0x02; /* clean session */
+    body[len++] = client->keepalive_s >> 8;
+    body[len++] = client->keepalive_s & 0xff;
+    len += put_string(&body[len], client->client_id);
+    client->rx_len = 0;
+    client->lost = false;
+    if (!broker_send(client, 0x10, body, len, NULL, 0))
+    {
+        broker_close(client);
+        return false;
+    }
+    for (len = 0; len < (int)sizeof(connack); len += n)
+    {
+        if ((n = recv(client->sock, &connack[len], sizeof(connack) - len, 0)) <= 0)
+            break;
+    }
+    if (len < (int)sizeof(connack) || connack[0] != 0x20 || connack[3] != 0)
+    {
+        fprintf(stderr, "%s:%s: connection refused\n", host, port);
+        broker_close(client);
+        return false;
+    }
+    return true;
+}
+
+static void broker_close(esp_mqtt_client_handle_t client)
+{
+    if (client->sock >= 0)
+        close(client->sock);
+    client->sock = -1;
+    client->rx_len = 0;
+}
+
+/**
+ * Send a control packet: the first byte, then the remaining length, the body
+ * and the payload. Called with the lock, or while connecting.
+ * \return false if the connection is lost.
+ */
+static bool broker_send(esp_mqtt_client_handle_t client, uint8_t type, const uint8_t *body, int body_len,
+                        const char *payload, int payload_len)
+{
+    int remaining = body_len + payload_len;
+    uint8_t header[5] = {type};
+    int header_len = 1;
+    struct iovec iov[3];
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 3};
+    ssize_t total = 0;
+    ssize_t n;
+
+    if (client->sock < 0 || client->lost)
+        return false;
+    do
+    {
+        header[header_len++] = (remaining & 0x7f) | (remaining > 0x7f ? 0x80 : 0);
+        remaining >>= 7;
+    } while (remaining > 0);
+    iov[0] = (struct iovec){header, header_len};
+    iov[1] = (struct iovec){(void *)body, body_len};
+    iov[2] = (struct iovec){(void *)payload, payload_len};
+    while (msg.msg_iovlen > 0)
+    {
+        if ((n = sendmsg(client->sock, &msg, MSG_NOSIGNAL)) < 0)
+        {
+            client->lost = true;
+            return false;
+        }
+        for (total += n; msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len; msg.msg_iov++, msg.msg_iovlen--)
+            n -= msg.msg_iov->iov_len;
+        if (msg.msg_iovlen > 0)
+        {
+            msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    client->last_tx = sim_time_us();
+    return true;
+}
+
+static void broker_publish(esp_mqtt_client_handle_t client, const mqtt_message_t *message)
+{
+    uint8_t body[2 + MQTT_TOPIC_MAX_SIZE + 2];
+    int len = put_string(body, message->topic);
+
+    if (message->qos > 0)
+    {
+        body[len++] = message->msg_id >> 8;
+        body[len++] = message->msg_id & 0xff;
+    }
+    broker_send(client, 0x30 | message->qos << 1 | (message->retain ? 1 : 0), body, len, message->data,
+                message->len);
+}
+
+/**
+ * Take the next complete packet from the connection into client->packet,
+ * without waiting. Called with the lock.
+ * \return its length, 0 if there is none yet or -1 if the connection is lost.
+ */
+static int broker_receive(esp_mqtt_client_handle_t client)
+{
+    int remaining;
+    int total;
+    int i;
+    ssize_t n;
+
+    for (;;)
+    {
+        remaining = 0;
+        for (i = 1; i < client->rx_len && i <= 4; i++)
+        {
+            remaining |= (client->rx[i] & 0x7f) << 7 * (i - 1);
+            if (!(client->rx[i] & 0x80))
+                break;
+        }
+        if (i < client->rx_len && i <= 4)
+        {
+            total = i + 1 + remaining;
+            if (total > BROKER_RX_SIZE)
+                return -1;
+            if (total <= client->rx_len)
+            {
+                memcpy(client->packet, client->rx, total);
+                memmove(client->rx, &client->rx[total], client->rx_len - total);
+                client->rx_len -= total;
+                return total;
+            }
+        }
+        if (client->lost)
+            return -1;
+        n = recv(client->sock, &client->rx[client->rx_len], BROKER_RX_SIZE - client->rx_len, MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+            return -1;
+        if (n < 0)
+            return 0;
+        client->rx_len += n;
+    }
+}
+
+/**
+ * Handle a packet from the broker, or the loss of the connection, without the
+ * lock.
+ */
+static void broker_handle(esp_mqtt_client_handle_t client, int len)
+{
+    const uint8_t *p = client->packet;
+    mqtt_message_t **link;
+    mqtt_message_t *message;
+    char topic[MQTT_TOPIC_MAX_SIZE];
+    uint8_t puback[2];
+    int offset;
+    int topic_len;
+    int msg_id = 0;
+    int qos;
+
+    if (len < 0)
+    {
+        pthread_mutex_lock(&client->lock);
+        client->connected = false;
+        broker_close(client);
+        pthread_mutex_unlock(&client->lock);
+        mqtt_event(client, MQTT_EVENT_DISCONNECTED, 0, NULL);
+        return;
+    }
+    for (offset = 1; p[offset] & 0x80; offset++)
+        ;
+    offset++;
+    switch (p[0] >> 4)
+    {
+        case 3: /* PUBLISH */
+            qos = (p[0] >> 1) & 3;
+            topic_len = p[offset] << 8 | p[offset + 1];
+            offset += 2;
+            if (offset + topic_len + (qos > 0 ? 2 : 0) > len)
+                break;
+            snprintf(topic, sizeof(topic), "%.*s", topic_len, (const char *)&p[offset]);
+            offset += topic_len;
+            if (qos > 0)
+            {
+                msg_id = p[offset] << 8 | p[offset + 1];
+                offset += 2;
+            }
+            message = mqtt_message(topic, (const char *)&p[offset], len - offset, qos);
+            if (qos > 0)
+            {
+                puback[0] = msg_id >> 8;
+                puback[1] = msg_id & 0xff;
+                pthread_mutex_lock(&client->lock);
+                broker_send(client, 0x40, puback, 2, NULL, 0);
+                pthread_mutex_unlock(&client->lock);
+            }
+            mqtt_event(client, MQTT_EVENT_DATA, msg_id, message);
+            free(message->data);
+            free(message);
+            break;
+        case 4: /* PUBACK */
+            msg_id = p[offset] << 8 | p[offset + 1];
+            pthread_mutex_lock(&client->lock);
+            for (link = &client->outbox; (message = *link) != NULL && message->msg_id != msg_id;
+                 link = &message->next)
+                ;
+            if (message != NULL)
+            {
+                *link = message->next;
+                client->outbox_size -= message->len;
+                free(message->data);
+                free(message);
+            }
+            pthread_mutex_unlock(&client->lock);
+            if (message != NULL)
+                mqtt_event(client, MQTT_EVENT_PUBLISHED, msg_id, NULL);
+            break;
+        case 9: /* SUBACK */
+            mqtt_event(client, MQTT_EVENT_SUBSCRIBED, p[offset] << 8 | p[offset + 1], NULL);
+            break;
+        default: /* PINGRESP */
+            break;
+    }
+}
+
+/**
+ * Write a length-prefixed UTF-8 string.
+ * \return the number of bytes written.
+ */
+static int put_string(uint8_t *p, const char *s)
+{
+    int len = strlen(s);
+
+    p[0] = len >> 8;
+    p[1] = len & 0xff;
+    memcpy(&p[2], s, len);
+    return 2 + len;
+}
@@ -0,0 +1,79 @@
+#!/bin/sh
+#
+# Regression scenarios of the host build: each runs the firmware on a
+# scripted environment (see env.c) and checks the messages it published.
+#
+# usage: regress.sh [scenario...]
+#
+# Without scenarios, all of them are run. Prints one "<scenario>: ok" or
+# "<scenario>: FAILED <reason>" line each, exits with 1 if any failed.
+#
+# step  a -4 degC step at t=200 s: the fused temperature keeps being
+#       published, follows the step and flags no source.
+# quiet 30 min of steady readings after a step at t=60 s, the VMA311
+#       humidity noisier than usual: once the step is sampled, the noise
+#       does not keep the rates up, the VMA311 is read less often than at
+#       the former fixed 5 s.
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+SIM=$DIR/envmon_sim
+SPEED=100
+
+# sources with their usual offsets and noise, the quantities steady
+SENSORS='
+temp const 21.5
+humidity const 45
+pressure const 101325
+gas const 120000
+error mcp9700 temp 0.8 0.4
+error vma311 temp -0.4 0.3
+error vma311 humidity 2 1
+error bme680 temp 0.3 0.02
+error bme680 humidity -1 0.2
+error bme680 pressure 0 3
+error bme680 gas 0 800
+'
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT INT TERM
+status=0
+
+# run <duration_s> <script lines...>: traffic in $WORK/traffic, logs in $WORK/log
+run() {
+    duration=$1
+    shift
+    printf '%s\n' "$SENSORS" "$@" >"$WORK/script"
+    "$SIM" -x "$SPEED" -t "$duration" -s "$WORK/script" -o "$WORK/traffic" >"$WORK/log" 2>&1
+}
+
+# longest silence of a topic in s, from its first message to the end of the run
+max_gap() {
+    awk -v topic="$1" -v end="$duration" '$3 == topic { t = $1 / 1000; if (n++ && t - last > gap) gap = t - last; last = t }
+                                          END { if (end - last > gap) gap = end - last; printf "%d\n", gap }' "$WORK/traffic"
+}
+
+scenario_step() {
+    run 600 'temp step -4 200'
+    gap=$(max_gap vn170735/fused/temp)
+    [ "$gap" -le 70 ] || { echo "fused/temp silent for $gap s"; return 1; }
+    ! grep -q '"faulty":[1-9]' "$WORK/traffic" || { echo "a source flagged faulty"; return 1; }
+    awk '$3 == "vn170735/fused/temp" && $1 > 300000 { split($5, v, "[:,]"); n++; if (v[2] > 19.5) bad = 1 }
+         END { exit bad || !n }' "$WORK/traffic" || { echo "fused/temp did not follow the step"; return 1; }
+}
+
+scenario_quiet() {
+    run 1800 'temp step 2 60' 'humidity step 8 60' 'error vma311 humidity 0 1'
+    n=$(grep -c '^vma311:temp' "$WORK/log")
+    [ "$n" -le 360 ] || { echo "vma311 read $n times"; return 1; }
+}
+
+[ $# -gt 0 ] || set -- step quiet
+for scenario in "$@"; do
+    if reason=$(scenario_"$scenario"); then
+        echo "$scenario: ok"
+    else
+        echo "$scenario: FAILED $reason"
+        status=1
+    fi
+done
+exit $status
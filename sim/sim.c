@@ -0,0 +1,251 @@
+/*
+ * Host simulation of the envmon firmware.
+ *
+ * usage: envmon_sim [-x speed] [-t duration_s] [-s script] [-i inject]
+ *                   [-b frames] [-o traffic] [-d state_dir] [-r seed]
+ *                   [-m broker] [-q]
+ *
+ * app_main runs in a task as on the device. The FreeRTOS, ESP-IDF and driver
+ * calls of the firmware are served by the shims of this directory, the
+ * sensors are virtual devices observing the environment described by the
+ * script (see env.c), the uplinks are a loopback MQTT broker and an HTTP
+ * endpoint that accept everything.
+ *
+ * -x  run the simulated clock faster than the host one
+ * -t  stop after this many simulated seconds
+ * -s  environment script, the built-in one otherwise
+ * -i  MQTT messages to deliver, one "time_s topic payload" per line
+ * -b  BME680 field data to replay instead of measuring (see vbme680.c)
+ * -o  log of the published messages, one "time_ms proto topic qos payload" per line
+ * -d  directory where NVS and the flash partitions persist across runs
+ * -r  seed of the sensor noise
+ * -m  MQTT broker to publish to, mqtt://host[:port], instead of the loopback
+ *     one; at -x 1 the timestamps of the samples are the host time
+ * -q  firmware logs at warning level only
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "sim.h"
+#include "env.h"
+
+/* macro definitions */
+#define MAIN_STACK_SIZE 8192
+#define MAIN_PRIORITY   1
+
+/* global variables */
+sim_options_t sim_options = {
+    .speed = 1.0,
+    .seed = 1,
+    .mqtt_latency_ms = 40,
+    .http_latency_ms = 250,
+};
+
+/* static variables */
+static struct timespec boot;
+static FILE           *traffic;
+static pthread_mutex_t traffic_lock = PTHREAD_MUTEX_INITIALIZER;
+static char          **args;
+
+/* static function prototypes */
+static void main_task(void *);
+static void usage(const char *);
+
+void app_main();
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    args = argv;
+    while ((opt = getopt(argc, argv, "x:t:s:i:b:o:d:r:m:qh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'x':
+                sim_options.speed = atof(optarg);
+                break;
+            case 't':
+                sim_options.duration_s = atof(optarg);
+                break;
+            case 's':
+                sim_options.script = optarg;
+                break;
+            case 'i':
+                sim_options.inject = optarg;
+                break;
+            case 'b':
+                sim_options.frames = optarg;
+                break;
+            case 'o':
+                sim_options.traffic = optarg;
+                break;
+            case 'd':
+                sim_options.state_dir = optarg;
+                break;
+            case 'r':
+                sim_options.seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                sim_options.broker = optarg;
+                break;
+            case 'q':
+                sim_options.quiet = true;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (sim_options.speed <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (env_load(sim_options.script) != 0)
+        return 1;
+    if (sim_options.traffic != NULL && (traffic = fopen(sim_options.traffic, "w")) == NULL)
+    {
+        fprintf(stderr, "%s: %s\n", sim_options.traffic, strerror(errno));
+        return 1;
+    }
+    if (sim_options.quiet)
+        esp_log_level_set("*", ESP_LOG_WARN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    clock_gettime(CLOCK_MONOTONIC, &boot);
+
+    xTaskCreate(main_task, "main", MAIN_STACK_SIZE, NULL, MAIN_PRIORITY, NULL);
+    if (sim_options.duration_s > 0)
+    {
+        sim_sleep_us((int64_t)(sim_options.duration_s * 1e6));
+        if (traffic != NULL)
+        {
+            pthread_mutex_lock(&traffic_lock);
+            fflush(traffic);
+        }
+        sim_nvs_save();
+        fflush(stdout);
+        _exit(0); /* the tasks never return */
+    }
+    pthread_exit(NULL);
+}
+
+/**
+ * @brief Get the simulated time since boot.
+ * @return The time in us.
+ */
+int64_t sim_time_us()
+{
+    struct timespec now;
+    int64_t elapsed_ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_ns = (int64_t)(now.tv_sec - boot.tv_sec) * 1000000000 + (now.tv_nsec - boot.tv_nsec);
+    return (int64_t)(elapsed_ns * sim_options.speed / 1000);
+}
+
+/**
+ * @brief Sleep for a simulated duration.
+ * @param us The duration in us.
+ */
+void sim_sleep_us(int64_t us)
+{
+    struct timespec ts;
+    int64_t ns;
+
+    if (us <= 0)
+        return;
+    ns = (int64_t)(us * 1000 / sim_options.speed);
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+}
+
+/**
+ * @brief Convert a FreeRTOS timeout to the host deadline of a timed wait.
+ * @param deadline Where to store the deadline, on CLOCK_MONOTONIC.
+ * @param ticks The timeout in ticks.
+ * @return false if the timeout is portMAX_DELAY, i.e. there is no deadline.
+ */
+bool sim_deadline(struct timespec *deadline, uint32_t ticks)
+{
+    int64_t ns;
+
+    if (ticks == portMAX_DELAY)
+        return false;
+    ns = (int64_t)((int64_t)ticks * portTICK_PERIOD_MS * 1000000 / sim_options.speed);
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += ns / 1000000000;
+    deadline->tv_nsec += ns % 1000000000;
+    if (deadline->tv_nsec >= 1000000000)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+    return true;
+}
+
+/**
+ * @brief Log a message sent by the device. Printable payloads are written as
+ * they are, the others in hexadecimal with a "hex:" prefix.
+ * @param proto "mqtt" or "http".
+ * @param topic The topic or URL.
+ * @param qos The QoS, -1 for HTTP.
+ * @param payload The payload.
+ * @param len The length of the payload.
+ */
+void sim_traffic(const char *proto, const char *topic, int qos, const char *payload, int len)
+{
+    bool printable = true;
+
+    if (traffic == NULL)
+        return;
+    for (int i = 0; i < len && printable; i++)
+        printable = payload[i] >= 0x20 && payload[i] < 0x7f;
+    pthread_mutex_lock(&traffic_lock);
+    fprintf(traffic, "%" PRId64 " %s %s %d ", sim_time_us() / 1000, proto, topic, qos);
+    if (printable)
+    {
+        fwrite(payload, 1, len, traffic);
+    }
+    else
+    {
+        fputs("hex:", traffic);
+        for (int i = 0; i < len; i++)
+            fprintf(traffic, "%02x", (uint8_t)payload[i]);
+    }
+    fputc('\n', traffic);
+    pthread_mutex_unlock(&traffic_lock);
+}
+
+/**
+ * @brief Run the program again with the same arguments, as after a reset.
+ */
+void sim_restart()
+{
+    fflush(NULL);
+    execv("/proc/self/exe", args);
+    _exit(1);
+}
+
+static void main_task(void *arg)
+{
+    app_main();
+    vTaskDelete(NULL);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-x speed] [-t duration_s] [-s script] [-i inject]\n"
+                    "       [-b frames] [-o traffic] [-d state_dir] [-r seed]\n"
+                    "       [-m broker] [-q]\n", name);
+}
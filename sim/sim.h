@@ -0,0 +1,37 @@
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+/* structure definitions */
+typedef struct sim_options
+{
+    double      speed;           /* simulated seconds per host second */
+    double      duration_s;      /* simulated run time, 0 to run forever */
+    uint32_t    seed;            /* seed of the sensor noise */
+    const char *script;          /* environment script, NULL for the built-in one */
+    const char *inject;          /* MQTT messages to deliver to the device */
+    const char *frames;          /* BME680 field data to replay */
+    const char *traffic;         /* where to log the MQTT and HTTP traffic */
+    const char *state_dir;       /* where NVS and the flash partitions persist */
+    const char *broker;          /* MQTT broker URI, NULL for the loopback one */
+    int         mqtt_latency_ms; /* broker round trip */
+    int         http_latency_ms; /* HTTP request duration */
+    bool        quiet;           /* firmware logs at warning level only */
+} sim_options_t;
+
+/* global variables */
+extern sim_options_t sim_options;
+
+/* function prototypes */
+int64_t sim_time_us();
+void    sim_sleep_us(int64_t);
+bool    sim_deadline(struct timespec *, uint32_t);
+void    sim_restart() __attribute__((noreturn));
+void    sim_traffic(const char *, const char *, int, const char *, int);
+void    sim_nvs_load();
+void    sim_nvs_save();
+
+#endif /* __SIM_H__ */
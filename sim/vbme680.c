@@ -0,0 +1,623 @@
+/*
+ * BME680 at the register level, as the driver sees it on the I2C bus: chip
+ * id, calibration, soft reset, forced mode and field data. A conversion
+ * lasts as long as the oversampling and heater settings make it last on the
+ * device, its raw ADC values are found by inverting the compensation of the
+ * driver on the environment at the start of the conversion, or come from a
+ * recording. The status bits follow the conversion: measuring for all of
+ * it, gas_measuring once the heater is on, then new_data, gas_valid and
+ * heat_stab if the heater had the time to reach its target.
+ *
+ * Recording, one frame per line, '#' starts a comment: the 15 bytes of
+ * field 0 (BME680_FIELD0_ADDR) in hex, as bme680_get_sensor_data reads them,
+ * optionally separated by blanks.
+ * The status, index and heater bits are the ones of the model, the ADC
+ * values and the gas range the ones of the frame.
+ *
+ * Every transaction is counted with the bytes it clocks on the bus.
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bme680_defs.h"
+#include "esp_timer.h"
+#include "vbme680.h"
+#include "env.h"
+
+/* macro definitions */
+#define REG_MEAS_STATUS   0x1d
+#define REG_PRESS_MSB     0x1f
+#define REG_GAS_R_LSB     0x2b
+#define REG_CTRL_GAS_0    0x70
+#define REG_CTRL_GAS_1    0x71
+#define REG_CTRL_HUM      0x72
+#define REG_CTRL_MEAS     0x74
+#define MEASURING_MSK     0x20
+#define GAS_MEASURING_MSK 0x40
+#define HEAT_OFF_MSK      0x08
+#define TPH_CYCLE_US      1963
+#define TPH_SWITCH_US     (477 * 4)
+#define GAS_MEAS_US       (477 * 5)
+#define WAKE_UP_US        1000
+#define HEATER_TAU_MS     5.0 /* thermal time constant of the hot plate */
+#define HEATER_STAB_C     1.0 /* stable once this close to the target */
+#define HEATER_MAX_C      400
+#define REPLAY_MAX_FRAMES 65536
+#define I2C_BYTE_BITS     9 /* 8 data bits and the acknowledge */
+
+/* structure definitions */
+typedef struct calib
+{
+    uint16_t par_t1;
+    int16_t  par_t2;
+    int8_t   par_t3;
+    uint16_t par_p1;
+    int16_t  par_p2;
+    int8_t   par_p3;
+    int16_t  par_p4;
+    int16_t  par_p5;
+    int8_t   par_p6;
+    int8_t   par_p7;
+    int16_t  par_p8;
+    int16_t  par_p9;
+    uint8_t  par_p10;
+    uint16_t par_h1;
+    uint16_t par_h2;
+    int8_t   par_h3;
+    int8_t   par_h4;
+    int8_t   par_h5;
+    uint8_t  par_h6;
+    int8_t   par_h7;
+    int8_t   par_gh1;
+    int16_t  par_gh2;
+    int8_t   par_gh3;
+    uint8_t  res_heat_range;
+    int8_t   res_heat_val;
+    int8_t   range_sw_err;
+} calib_t;
+
+typedef struct vbme680
+{
+    uint8_t         addr;
+    uint8_t         regs[256];
+    bool            converting;
+    int64_t         start;     /* of the conversion */
+    int64_t         gas_start; /* when the heater turns on */
+    int64_t         end;
+    vbme680_stats_t stats;
+} vbme680_t;
+
+/* static variables */
+static vbme680_t vbme680;
+static uint8_t (*frames)[BME680_FIELD_LENGTH];
+static int       n_frames;
+static int       next_frame;
+
+/* calibration of a production sample */
+static const calib_t calib = {
+    .par_t1 = 26154, .par_t2 = 26374, .par_t3 = 3,
+    .par_p1 = 36187, .par_p2 = -10378, .par_p3 = 88, .par_p4 = 6986, .par_p5 = -117,
+    .par_p6 = 30, .par_p7 = 34, .par_p8 = -3340, .par_p9 = -2554, .par_p10 = 30,
+    .par_h1 = 781, .par_h2 = 1017, .par_h3 = 0, .par_h4 = 45, .par_h5 = 20, .par_h6 = 120, .par_h7 = -100,
+    .par_gh1 = -37, .par_gh2 = -11781, .par_gh3 = 18,
+    .res_heat_range = 1, .res_heat_val = 42, .range_sw_err = 0,
+};
+
+static const uint32_t gas_lookup1[16] = {
+    2147483647u, 2147483647u, 2147483647u, 2147483647u, 2147483647u, 2126008810u, 2147483647u, 2130303777u,
+    2147483647u, 2147483647u, 2143188679u, 2136746228u, 2147483647u, 2126008810u, 2147483647u, 2147483647u};
+static const uint32_t gas_lookup2[16] = {
+    4096000000u, 2048000000u, 1024000000u, 512000000u, 255744255u, 127110228u, 64000000u, 32258064u,
+    16016016u, 8000000u, 4000000u, 2000000u, 1000000u, 500000u, 250000u, 125000u};
+
+/* static function prototypes */
+static void     vbme680_reset();
+static void     vbme680_count(uint16_t, bool);
+static int64_t  vbme680_tph_us();
+static int64_t  vbme680_gas_wait_us();
+static void     vbme680_update(int64_t);
+static void     vbme680_convert();
+static void     vbme680_measure(int64_t, bool);
+static bool     vbme680_heat_stab(double);
+static void     put_calib(uint8_t, uint8_t);
+static int32_t  temperature(uint32_t, int32_t *);
+static uint32_t pressure(uint32_t, int32_t);
+static uint32_t humidity(uint16_t, int32_t);
+static uint32_t gas_resistance(uint16_t, uint8_t);
+static uint8_t  heater_res(int, int);
+
+/**
+ * @brief Power the sensor up.
+ * @param addr Its I2C address.
+ */
+void vbme680_init(uint8_t addr)
+{
+    vbme680_stats_t stats = vbme680.stats;
+
+    memset(&vbme680, 0, sizeof(vbme680));
+    vbme680.addr = addr;
+    vbme680.stats = stats;
+    vbme680_reset();
+
+    /* calibration, at the indices the driver reads it from */
+    put_calib(BME680_T1_LSB_REG, calib.par_t1 & 0xff);
+    put_calib(BME680_T1_MSB_REG, calib.par_t1 >> 8);
+    put_calib(BME680_T2_LSB_REG, calib.par_t2 & 0xff);
+    put_calib(BME680_T2_MSB_REG, (uint16_t)calib.par_t2 >> 8);
+    put_calib(BME680_T3_REG, calib.par_t3);
+    put_calib(BME680_P1_LSB_REG, calib.par_p1 & 0xff);
+    put_calib(BME680_P1_MSB_REG, calib.par_p1 >> 8);
+    put_calib(BME680_P2_LSB_REG, calib.par_p2 & 0xff);
+    put_calib(BME680_P2_MSB_REG, (uint16_t)calib.par_p2 >> 8);
+    put_calib(BME680_P3_REG, calib.par_p3);
+    put_calib(BME680_P4_LSB_REG, calib.par_p4 & 0xff);
+    put_calib(BME680_P4_MSB_REG, (uint16_t)calib.par_p4 >> 8);
+    put_calib(BME680_P5_LSB_REG, calib.par_p5 & 0xff);
+    put_calib(BME680_P5_MSB_REG, (uint16_t)calib.par_p5 >> 8);
+    put_calib(BME680_P6_REG, calib.par_p6);
+    put_calib(BME680_P7_REG, calib.par_p7);
+    put_calib(BME680_P8_LSB_REG, calib.par_p8 & 0xff);
+    put_calib(BME680_P8_MSB_REG, (uint16_t)calib.par_p8 >> 8);
+    put_calib(BME680_P9_LSB_REG, calib.par_p9 & 0xff);
+    put_calib(BME680_P9_MSB_REG, (uint16_t)calib.par_p9 >> 8);
+    put_calib(BME680_P10_REG, calib.par_p10);
+    put_calib(BME680_H2_MSB_REG, calib.par_h2 >> 4);
+    put_calib(BME680_H1_LSB_REG, ((calib.par_h2 & 0x0f) << 4) | (calib.par_h1 & 0x0f));
+    put_calib(BME680_H1_MSB_REG, calib.par_h1 >> 4);
+    put_calib(BME680_H3_REG, calib.par_h3);
+    put_calib(BME680_H4_REG, calib.par_h4);
+    put_calib(BME680_H5_REG, calib.par_h5);
+    put_calib(BME680_H6_REG, calib.par_h6);
+    put_calib(BME680_H7_REG, calib.par_h7);
+    put_calib(BME680_GH1_REG, calib.par_gh1);
+    put_calib(BME680_GH2_LSB_REG, calib.par_gh2 & 0xff);
+    put_calib(BME680_GH2_MSB_REG, (uint16_t)calib.par_gh2 >> 8);
+    put_calib(BME680_GH3_REG, calib.par_gh3);
+    vbme680.regs[BME680_ADDR_RES_HEAT_RANGE_ADDR] = calib.res_heat_range << 4;
+    vbme680.regs[BME680_ADDR_RES_HEAT_VAL_ADDR] = calib.res_heat_val;
+    vbme680.regs[BME680_ADDR_RANGE_SW_ERR_ADDR] = (uint8_t)(calib.range_sw_err << 4);
+    vbme680.regs[BME680_CHIP_ID_ADDR] = BME680_CHIP_ID;
+}
+
+/**
+ * @brief Read consecutive registers.
+ * @param addr The I2C address on the bus.
+ * @param reg The first register.
+ * @param data Where to store the values.
+ * @param len The number of registers.
+ * @return 0 on success, -1 if the sensor does not acknowledge.
+ */
+int8_t vbme680_read(uint8_t addr, uint8_t reg, uint8_t *data, uint16_t len)
+{
+    int64_t now = esp_timer_get_time();
+
+    vbme680_count(len, true);
+    if (addr != vbme680.addr || env_fault("bme680", now))
+        return -1;
+    vbme680_update(now);
+    for (uint16_t i = 0; i < len; i++)
+        data[i] = vbme680.regs[(uint8_t)(reg + i)];
+    return 0;
+}
+
+/**
+ * @brief Write registers, as I2C writes them: the value of the first register,
+ * then address and value pairs.
+ * @param addr The I2C address on the bus.
+ * @param reg The first register.
+ * @param data The value, address, value... sequence.
+ * @param len The length of the sequence.
+ * @return 0 on success, -1 if the sensor does not acknowledge.
+ */
+int8_t vbme680_write(uint8_t addr, uint8_t reg, const uint8_t *data, uint16_t len)
+{
+    int64_t now = esp_timer_get_time();
+    uint8_t value;
+
+    vbme680_count(len, false);
+    if (addr != vbme680.addr || env_fault("bme680", now))
+        return -1;
+    vbme680_update(now);
+    for (uint16_t i = 0; i < len; i += 2)
+    {
+        value = data[i];
+        if (reg == BME680_SOFT_RESET_ADDR)
+        {
+            if (value == BME680_SOFT_RESET_CMD)
+                vbme680_reset();
+        }
+        else if (reg == REG_CTRL_MEAS)
+        {
+            vbme680.regs[reg] = value;
+            if ((value & BME680_MODE_MSK) == BME680_FORCED_MODE && !vbme680.converting)
+            {
+                vbme680.converting = true;
+                vbme680.start = now;
+                vbme680.gas_start = now + vbme680_tph_us();
+                vbme680.end = vbme680.gas_start + vbme680_gas_wait_us();
+                vbme680.regs[REG_MEAS_STATUS] = MEASURING_MSK;
+            }
+        }
+        else if (reg >= 0x50 && reg <= 0x75)
+        {
+            vbme680.regs[reg] = value; /* control registers, the others are read-only */
+        }
+        if (i + 1 < len)
+            reg = data[i + 1];
+    }
+    return 0;
+}
+
+/**
+ * @brief Replace the conversions of the environment by recorded frames,
+ * replayed in a loop.
+ * @param path The recording.
+ * @return The number of frames, -1 if the recording cannot be read or holds
+ *         no frame.
+ */
+int vbme680_replay(const char *path)
+{
+    char line[2 * BME680_FIELD_LENGTH + 64];
+    unsigned int byte;
+    int n_line = 0;
+    int n;
+    FILE *file;
+
+    if ((file = fopen(path, "r")) == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    free(frames);
+    frames = malloc(REPLAY_MAX_FRAMES * sizeof(*frames));
+    n_frames = next_frame = 0;
+    while (fgets(line, sizeof(line), file) != NULL && n_frames < REPLAY_MAX_FRAMES)
+    {
+        n_line++;
+        line[strcspn(line, "#\r\n")] = '\0';
+        if (strspn(line, " \t") == strlen(line))
+            continue;
+        for (int i = 0, used = 0; i < BME680_FIELD_LENGTH; i++)
+        {
+            if (sscanf(line + used, "%2x%n", &byte, &n) != 1)
+            {
+                fprintf(stderr, "%s:%d: invalid frame\n", path, n_line);
+                fclose(file);
+                n_frames = 0;
+                return -1;
+            }
+            frames[n_frames][i] = byte;
+            used += n;
+        }
+        n_frames++;
+    }
+    fclose(file);
+    return n_frames > 0 ? n_frames : -1;
+}
+
+/**
+ * @brief Get the bus traffic since the last reset of the counters.
+ * @param stats Where to store the counters.
+ */
+void vbme680_get_stats(vbme680_stats_t *stats)
+{
+    *stats = vbme680.stats;
+}
+
+/**
+ * @brief Reset the bus traffic counters.
+ */
+void vbme680_reset_stats()
+{
+    memset(&vbme680.stats, 0, sizeof(vbme680.stats));
+}
+
+/**
+ * Restore the power-on values of the control and data registers.
+ */
+static void vbme680_reset()
+{
+    memset(&vbme680.regs[0x1d], 0, 0x75 - 0x1d + 1);
+    vbme680.regs[0x2b] = 0;
+    vbme680.converting = false;
+}
+
+/**
+ * Count a transaction. A read is the address, the register, the address
+ * again after a repeated start, then the data; a write the address, the
+ * register and the data. Start and stop take a clock each.
+ */
+static void vbme680_count(uint16_t len, bool read)
+{
+    if (read)
+    {
+        vbme680.stats.reads++;
+        vbme680.stats.bytes += 3 + len;
+        vbme680.stats.bits += (3 + len) * I2C_BYTE_BITS + 3;
+    }
+    else
+    {
+        vbme680.stats.writes++;
+        vbme680.stats.bytes += 2 + len;
+        vbme680.stats.bits += (2 + len) * I2C_BYTE_BITS + 2;
+    }
+}
+
+/**
+ * Time of the TPH part of a forced conversion: the oversampled cycles, with
+ * the gas measurement itself.
+ */
+static int64_t vbme680_tph_us()
+{
+    static const uint8_t cycles[8] = {0, 1, 2, 4, 8, 16, 16, 16};
+    uint8_t ctrl_meas = vbme680.regs[REG_CTRL_MEAS];
+
+    return (cycles[ctrl_meas >> 5] + cycles[(ctrl_meas >> 2) & 0x07] + cycles[vbme680.regs[REG_CTRL_HUM] & 0x07])
+           * TPH_CYCLE_US + TPH_SWITCH_US + GAS_MEAS_US + WAKE_UP_US;
+}
+
+/**
+ * Time the heater is on, from the wait of the selected heater profile.
+ */
+static int64_t vbme680_gas_wait_us()
+{
+    uint8_t profile = vbme680.regs[REG_CTRL_GAS_1] & BME680_NBCONV_MSK;
+    uint8_t gas_wait = vbme680.regs[BME680_GAS_WAIT0_ADDR + profile];
+
+    if (!(vbme680.regs[REG_CTRL_GAS_1] & BME680_RUN_GAS_MSK) || profile > 9)
+        return 0;
+    return (int64_t)((gas_wait & 0x3f) << (2 * (gas_wait >> 6))) * 1000;
+}
+
+/**
+ * Track the conversion: gas_measuring while the heater is on, then the field
+ * data is latched, new_data is set and the sensor goes back to sleep.
+ */
+static void vbme680_update(int64_t now)
+{
+    if (!vbme680.converting)
+        return;
+    if (now >= vbme680.end)
+    {
+        vbme680.converting = false;
+        vbme680_convert();
+        vbme680.regs[REG_CTRL_MEAS] &= ~BME680_MODE_MSK;
+    }
+    else if (now >= vbme680.gas_start && vbme680.end > vbme680.gas_start)
+    {
+        vbme680.regs[REG_MEAS_STATUS] |= GAS_MEASURING_MSK;
+    }
+}
+
+/**
+ * Latch the field data of the conversion, from the recording if there is
+ * one, and the status bits.
+ */
+static void vbme680_convert()
+{
+    bool run_gas = vbme680.regs[REG_CTRL_GAS_1] & BME680_RUN_GAS_MSK;
+    uint8_t profile = vbme680.regs[REG_CTRL_GAS_1] & BME680_NBCONV_MSK;
+    uint8_t *regs = vbme680.regs;
+
+    if (n_frames > 0)
+    {
+        memcpy(&regs[REG_PRESS_MSB], &frames[next_frame][REG_PRESS_MSB - BME680_FIELD0_ADDR],
+               REG_GAS_R_LSB - REG_PRESS_MSB);
+        regs[REG_GAS_R_LSB] = frames[next_frame][REG_GAS_R_LSB - BME680_FIELD0_ADDR]
+                              & ~(BME680_GASM_VALID_MSK | BME680_HEAT_STAB_MSK);
+        next_frame = (next_frame + 1) % n_frames;
+    }
+    else
+    {
+        vbme680_measure(vbme680.start, run_gas);
+    }
+    if (run_gas)
+    {
+        regs[REG_GAS_R_LSB] |= BME680_GASM_VALID_MSK;
+        if (vbme680_heat_stab(env_value(ENV_TEMPERATURE, vbme680.start)))
+            regs[REG_GAS_R_LSB] |= BME680_HEAT_STAB_MSK;
+    }
+    regs[REG_MEAS_STATUS] = BME680_NEW_DATA_MSK | (run_gas ? profile : 0);
+    regs[REG_MEAS_STATUS + 1]++; /* sub-measurement index */
+}
+
+/**
+ * Find the raw values the compensation of the driver turns into the
+ * environment as the sensor sees it. Each compensation is monotonic in its
+ * ADC value, a bisection finds the closest one.
+ */
+static void vbme680_measure(int64_t time, bool run_gas)
+{
+    double target;
+    int32_t t_fine;
+    uint32_t lo, hi, mid;
+    uint32_t adc_temp, adc_pres, adc_hum;
+    uint16_t adc_gas = 0;
+    uint8_t gas_range = 0;
+    uint8_t *regs = vbme680.regs;
+
+    target = env_read("bme680", ENV_TEMPERATURE, time) * 100;
+    for (lo = 0, hi = (1 << 20) - 1; lo < hi;)
+    {
+        mid = (lo + hi) / 2;
+        if (temperature(mid, &t_fine) < target)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    adc_temp = lo;
+    temperature(adc_temp, &t_fine);
+
+    target = env_read("bme680", ENV_PRESSURE, time);
+    for (lo = 0x10000, hi = 0xf0000; lo < hi;) /* decreasing */
+    {
+        mid = (lo + hi) / 2;
+        if (pressure(mid, t_fine) > target)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    adc_pres = lo;
+
+    target = env_read("bme680", ENV_HUMIDITY, time) * 1000;
+    for (lo = 0, hi = 0xffff; lo < hi;)
+    {
+        mid = (lo + hi) / 2;
+        if (humidity(mid, t_fine) < target)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    adc_hum = lo;
+
+    if (run_gas)
+    {
+        /* the range that keeps the ADC closest to mid-scale */
+        target = env_read("bme680", ENV_GAS_RESISTANCE, time);
+        for (uint8_t range = 0; range < 16; range++)
+        {
+            for (lo = 0, hi = 1023; lo < hi;) /* decreasing */
+            {
+                mid = (lo + hi) / 2;
+                if (gas_resistance(mid, range) > target)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if (lo > 0 && lo < 1023 && (gas_range == 0 || abs((int)lo - 512) < abs((int)adc_gas - 512)))
+            {
+                adc_gas = lo;
+                gas_range = range;
+            }
+        }
+    }
+
+    regs[0x1f] = adc_pres >> 12;
+    regs[0x20] = adc_pres >> 4;
+    regs[0x21] = (adc_pres & 0x0f) << 4;
+    regs[0x22] = adc_temp >> 12;
+    regs[0x23] = adc_temp >> 4;
+    regs[0x24] = (adc_temp & 0x0f) << 4;
+    regs[0x25] = adc_hum >> 8;
+    regs[0x26] = adc_hum;
+    regs[0x2a] = adc_gas >> 2;
+    regs[REG_GAS_R_LSB] = ((adc_gas & 0x03) << 6) | gas_range;
+
+}
+
+/**
+ * Tell whether the heater reached its target: the plate heats up from the
+ * ambient temperature with a first order response, the target is the
+ * temperature at which the heater resistance matches the code of the
+ * selected profile.
+ */
+static bool vbme680_heat_stab(double ambient)
+{
+    uint8_t profile = vbme680.regs[REG_CTRL_GAS_1] & BME680_NBCONV_MSK;
+    uint8_t code = vbme680.regs[BME680_RES_HEAT0_ADDR + profile];
+    int amb = (int)lround(ambient);
+    int target = 0;
+    int best = 256;
+
+    if (vbme680.regs[REG_CTRL_GAS_0] & HEAT_OFF_MSK)
+        return false;
+    for (int t = amb > 0 ? amb : 0; t <= HEATER_MAX_C; t++)
+    {
+        if (abs(heater_res(t, amb) - code) < best)
+        {
+            best = abs(heater_res(t, amb) - code);
+            target = t;
+        }
+    }
+    if (target - ambient <= HEATER_STAB_C)
+        return false; /* not heated at all */
+    return vbme680_gas_wait_us() / 1000.0 >= HEATER_TAU_MS * log((target - ambient) / HEATER_STAB_C);
+}
+
+static void put_calib(uint8_t index, uint8_t value)
+{
+    if (index < BME680_COEFF_ADDR1_LEN)
+        vbme680.regs[BME680_COEFF_ADDR1 + index] = value;
+    else
+        vbme680.regs[BME680_COEFF_ADDR2 + index - BME680_COEFF_ADDR1_LEN] = value;
+}
+
+/* the integer compensation of the driver, in 0.01 degC, Pa, 0.001 %RH and Ohm */
+
+static int32_t temperature(uint32_t adc, int32_t *t_fine)
+{
+    int64_t var1, var2, var3;
+
+    var1 = ((int32_t)adc >> 3) - ((int32_t)calib.par_t1 << 1);
+    var2 = (var1 * (int32_t)calib.par_t2) >> 11;
+    var3 = ((var1 >> 1) * (var1 >> 1)) >> 12;
+    var3 = (var3 * ((int32_t)calib.par_t3 << 4)) >> 14;
+    *t_fine = (int32_t)(var2 + var3);
+    return (*t_fine * 5 + 128) >> 8;
+}
+
+static uint32_t pressure(uint32_t adc, int32_t t_fine)
+{
+    int32_t var1, var2, var3, comp;
+
+    var1 = (t_fine >> 1) - 64000;
+    var2 = ((((var1 >> 2) * (var1 >> 2)) >> 11) * (int32_t)calib.par_p6) >> 2;
+    var2 = var2 + ((var1 * (int32_t)calib.par_p5) << 1);
+    var2 = (var2 >> 2) + ((int32_t)calib.par_p4 << 16);
+    var1 = (((((var1 >> 2) * (var1 >> 2)) >> 13) * ((int32_t)calib.par_p3 << 5)) >> 3)
+           + (((int32_t)calib.par_p2 * var1) >> 1);
+    var1 = var1 >> 18;
+    var1 = ((32768 + var1) * (int32_t)calib.par_p1) >> 15;
+    comp = 1048576 - adc;
+    comp = (int32_t)((comp - (var2 >> 12)) * (uint32_t)3125);
+    if (comp >= BME680_MAX_OVERFLOW_VAL)
+        comp = (comp / (uint32_t)var1) << 1;
+    else
+        comp = (comp << 1) / (uint32_t)var1;
+    var1 = ((int32_t)calib.par_p9 * (int32_t)(((comp >> 3) * (comp >> 3)) >> 13)) >> 12;
+    var2 = ((int32_t)(comp >> 2) * (int32_t)calib.par_p8) >> 13;
+    var3 = ((int32_t)(comp >> 8) * (int32_t)(comp >> 8) * (int32_t)(comp >> 8) * (int32_t)calib.par_p10) >> 17;
+    return (uint32_t)(comp + ((var1 + var2 + var3 + ((int32_t)calib.par_p7 << 7)) >> 4));
+}
+
+static uint32_t humidity(uint16_t adc, int32_t t_fine)
+{
+    int32_t var1, var2, var3, var4, var5, var6, temp_scaled, comp;
+
+    temp_scaled = ((t_fine * 5) + 128) >> 8;
+    var1 = (int32_t)(adc - ((int32_t)calib.par_h1 * 16)) - (((temp_scaled * (int32_t)calib.par_h3) / 100) >> 1);
+    var2 = ((int32_t)calib.par_h2 * (((temp_scaled * (int32_t)calib.par_h4) / 100)
+            + (((temp_scaled * ((temp_scaled * (int32_t)calib.par_h5) / 100)) >> 6) / 100) + (1 << 14))) >> 10;
+    var3 = var1 * var2;
+    var4 = (int32_t)calib.par_h6 << 7;
+    var4 = (var4 + ((temp_scaled * (int32_t)calib.par_h7) / 100)) >> 4;
+    var5 = ((var3 >> 14) * (var3 >> 14)) >> 10;
+    var6 = (var4 * var5) >> 1;
+    comp = (((var3 + var6) >> 10) * 1000) >> 12;
+    return comp > 100000 ? 100000 : comp < 0 ? 0 : comp;
+}
+
+static uint32_t gas_resistance(uint16_t adc, uint8_t range)
+{
+    int64_t var1, var3;
+    uint64_t var2;
+
+    var1 = (int64_t)((1340 + 5 * (int64_t)calib.range_sw_err) * (int64_t)gas_lookup1[range]) >> 16;
+    var2 = ((int64_t)adc << 15) - 16777216 + var1;
+    var3 = ((int64_t)gas_lookup2[range] * var1) >> 9;
+    return (uint32_t)((var3 + ((int64_t)var2 >> 1)) / (int64_t)var2);
+}
+
+static uint8_t heater_res(int temp, int amb)
+{
+    int32_t var1, var2, var3, var4, var5;
+
+    var1 = ((amb * calib.par_gh3) / 1000) * 256;
+    var2 = (calib.par_gh1 + 784) * (((((calib.par_gh2 + 154009) * temp * 5) / 100) + 3276800) / 10);
+    var3 = var1 + (var2 / 2);
+    var4 = var3 / (calib.res_heat_range + 4);
+    var5 = (131 * calib.res_heat_val) + 65536;
+    return (uint8_t)(((((var4 / var5) - 250) * 34) + 50) / 100);
+}
@@ -0,0 +1,23 @@
+#ifndef __VBME680_H__
+#define __VBME680_H__
+
+#include <stdint.h>
+
+/* type definitions */
+typedef struct vbme680_stats
+{
+    uint32_t reads;  /* transactions */
+    uint32_t writes;
+    uint32_t bytes;  /* clocked on the bus, addresses and registers included */
+    uint32_t bits;   /* clock cycles, start and stop conditions included */
+} vbme680_stats_t;
+
+/* function prototypes */
+void   vbme680_init(uint8_t);
+int8_t vbme680_read(uint8_t, uint8_t, uint8_t *, uint16_t);
+int8_t vbme680_write(uint8_t, uint8_t, const uint8_t *, uint16_t);
+int    vbme680_replay(const char *);
+void   vbme680_get_stats(vbme680_stats_t *);
+void   vbme680_reset_stats();
+
+#endif /* __VBME680_H__ */
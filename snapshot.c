@@ -0,0 +1,100 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "logger.h"
+#include "esp_timer.h"
+#include "mcp9700.h"
+#include "timesync.h"
+#include "trace.h"
+#include "snapshot.h"
+
+#define TAG              "envmon:snapshot"
+#define BME680_HEATR_TEMP 320 //degC
+#define BME680_HEATR_DUR  150 //ms
+
+static snapshot_t snapshot;
+
+/**
+ * @brief Configure the sensors for snapshot sampling. The BME680 is set up for
+ * forced-mode measurements of temperature, pressure, humidity and gas.
+ * @param bme The initialized BME680 device.
+ */
+void snapshot_init(struct bme680_dev *bme)
+{
+    int8_t rslt;
+
+    snapshot.bme = bme;
+    bme->tph_sett.os_hum = BME680_OS_2X;
+    bme->tph_sett.os_pres = BME680_OS_4X;
+    bme->tph_sett.os_temp = BME680_OS_8X;
+    bme->tph_sett.filter = BME680_FILTER_SIZE_3;
+    bme->gas_sett.run_gas = BME680_ENABLE_GAS_MEAS;
+    bme->gas_sett.heatr_temp = BME680_HEATR_TEMP;
+    bme->gas_sett.heatr_dur = BME680_HEATR_DUR;
+    bme->power_mode = BME680_FORCED_MODE;
+    rslt = bme680_set_sensor_settings(BME680_OST_SEL | BME680_OSP_SEL | BME680_OSH_SEL
+                                      | BME680_FILTER_SEL | BME680_GAS_SENSOR_SEL, bme);
+    if (rslt != BME680_OK)
+        LOGW(TAG, "BME680 settings failed: %d", rslt);
+    bme680_get_profile_dur(&snapshot.bme680_dur_ms, bme);
+    LOGI(TAG, "BME680 measurement duration: %u ms", snapshot.bme680_dur_ms);
+}
+
+/**
+ * @brief Sample all the sensors at once. The BME680 conversion and the VMA311
+ * start signal are triggered together, the MCP9700 ADC burst runs while they
+ * are pending, then the results are collected. The snapshot takes as long as
+ * the slowest sensor instead of the sum of all of them, and all the values
+ * share the timestamp of the trigger.
+ * @param data Where to store the values. The values of the sensors that are
+ *             not sampled are left unchanged.
+ * @param sensors The SNAPSHOT_* bits of the sensors to sample.
+ */
+void snapshot_take(snapshot_data_t *data, uint8_t sensors)
+{
+    int64_t elapsed_us;
+    int8_t rslt = BME680_OK;
+
+    //trigger, the sensor reads are traced from trigger to collection
+    TRACE_BEGIN(TRACE_SNAPSHOT, sensors);
+    data->sampled = sensors;
+    data->mono_time = esp_timer_get_time();
+    if (sensors & SNAPSHOT_BME680)
+    {
+        TRACE_BEGIN(TRACE_BME680_READ, 0);
+        rslt = bme680_set_sensor_mode(snapshot.bme); //forced mode: one conversion
+    }
+    if (sensors & SNAPSHOT_VMA311)
+    {
+        TRACE_BEGIN(TRACE_VMA311_READ, 0);
+        vma311_start(); //start signal, must stay low for 20 ms
+    }
+
+    //ADC burst while the others convert
+    if (sensors & SNAPSHOT_MCP9700)
+    {
+        TRACE_BEGIN(TRACE_MCP9700_READ, 0);
+        data->mcp9700 = mcp9700_get_value();
+        TRACE_END(TRACE_MCP9700_READ, 0);
+    }
+
+    //collect, the DHT protocol first since its timing is the strictest
+    if (sensors & SNAPSHOT_VMA311)
+    {
+        data->vma311 = vma311_finish();
+        TRACE_END(TRACE_VMA311_READ, 0);
+    }
+    if (sensors & SNAPSHOT_BME680)
+    {
+        elapsed_us = esp_timer_get_time() - data->mono_time;
+        if (elapsed_us < snapshot.bme680_dur_ms * 1000)
+            vTaskDelay(pdMS_TO_TICKS(snapshot.bme680_dur_ms - elapsed_us / 1000) + 1);
+        if (rslt == BME680_OK)
+            rslt = bme680_get_sensor_data(&data->bme680, snapshot.bme);
+        data->bme680_status = rslt;
+        TRACE_END(TRACE_BME680_READ, (uint8_t)rslt);
+    }
+
+    data->timestamp = timesync_to_epoch_ms(data->mono_time);
+    data->cycle_us = esp_timer_get_time() - data->mono_time;
+    TRACE_END(TRACE_SNAPSHOT, data->cycle_us);
+}
@@ -0,0 +1,34 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stdint.h>
+#include "vma311.h"
+#include "bme680.h"
+
+#define SNAPSHOT_MCP9700 (1 << 0)
+#define SNAPSHOT_VMA311  (1 << 1)
+#define SNAPSHOT_BME680  (1 << 2)
+#define SNAPSHOT_ALL     (SNAPSHOT_MCP9700 | SNAPSHOT_VMA311 | SNAPSHOT_BME680)
+
+typedef struct snapshot_data
+{
+    uint8_t sampled; //SNAPSHOT_* bits of the sensors sampled
+    int64_t timestamp; //epoch time in ms shared by all the values, 0 if unknown
+    int64_t mono_time; //esp_timer time of the trigger in us
+    int32_t cycle_us; //time taken by the whole snapshot
+    int32_t mcp9700; //temperature in degC
+    vma311_data_t vma311;
+    int8_t bme680_status; //result of the BME680 API, BME680_OK on success
+    struct bme680_field_data bme680;
+} snapshot_data_t;
+
+typedef struct snapshot
+{
+    struct bme680_dev *bme;
+    uint16_t bme680_dur_ms; //duration of a BME680 forced-mode measurement
+} snapshot_t;
+
+void snapshot_init(struct bme680_dev *);
+void snapshot_take(snapshot_data_t *, uint8_t);
+
+#endif /* __SNAPSHOT_H__ */
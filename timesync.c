@@ -0,0 +1,156 @@
+#include <sys/time.h>
+#include "esp_attr.h"
+#include "logger.h"
+#include "esp_sntp.h"
+#include "esp_timer.h"
+#include "timesync.h"
+
+#define TAG              "envmon:timesync"
+#define SYNC_INTERVAL_MS (3600 * 1000)
+#define MAX_DRIFT_PPB    500000 /* 500 ppm, beyond that the sync is bogus */
+#define MIN_DRIFT_SPAN   (60 * 1000000LL) /* us between syncs to estimate drift */
+#define MAX_SLEW_US      1000000 /* larger corrections are clock steps */
+
+static timesync_t timesync = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+/* survive deep sleep: the system time is kept by the RTC, not esp_timer */
+static RTC_DATA_ATTR bool    rtc_synced;
+static RTC_DATA_ATTR int64_t rtc_drift_ppb;
+
+static void    timesync_handle_sync(struct timeval *);
+static int64_t timesync_epoch_us(int64_t);
+
+/**
+ * @brief Start the SNTP client. Call it once the Wi-Fi is connected. After a
+ * deep sleep, the time synchronized before sleeping is used until the next
+ * synchronization.
+ * @param server The NTP server name, e.g. "pool.ntp.org".
+ */
+void timesync_init(const char *server)
+{
+    struct timeval tv;
+
+    if (rtc_synced)
+    {
+        gettimeofday(&tv, NULL);
+        portENTER_CRITICAL(&timesync.lock);
+        timesync.ref_mono = esp_timer_get_time();
+        timesync.ref_epoch = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+        timesync.drift_ppb = rtc_drift_ppb;
+        timesync.synced = true;
+        timesync.n_steps++;
+        portEXIT_CRITICAL(&timesync.lock);
+        LOGI(TAG, "Time restored from RTC");
+    }
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, server);
+    sntp_set_time_sync_notification_cb(timesync_handle_sync);
+    sntp_set_sync_interval(SYNC_INTERVAL_MS);
+    sntp_init();
+}
+
+/**
+ * @brief Tell whether the time has been synchronized at least once.
+ */
+bool timesync_is_synced()
+{
+    return timesync.synced;
+}
+
+/**
+ * @brief Convert a time captured with esp_timer_get_time() to the Unix epoch.
+ * @param mono_us The esp_timer time in us.
+ * @return The epoch time in ms, or 0 if the time is not synchronized.
+ */
+int64_t timesync_to_epoch_ms(int64_t mono_us)
+{
+    int64_t epoch;
+
+    portENTER_CRITICAL(&timesync.lock);
+    epoch = timesync.synced ? timesync_epoch_us(mono_us) / 1000 : 0;
+    portEXIT_CRITICAL(&timesync.lock);
+    return epoch;
+}
+
+/**
+ * @brief Get the current epoch time. Successive calls never go backwards,
+ * even when a synchronization steps the clock back.
+ * @return The epoch time in ms, or 0 if the time is not synchronized.
+ */
+int64_t timesync_now_ms()
+{
+    int64_t epoch;
+
+    portENTER_CRITICAL(&timesync.lock);
+    if (timesync.synced)
+    {
+        epoch = timesync_epoch_us(esp_timer_get_time());
+        if (epoch < timesync.last_epoch)
+            epoch = timesync.last_epoch;
+        timesync.last_epoch = epoch;
+        epoch /= 1000;
+    }
+    else
+    {
+        epoch = 0;
+    }
+    portEXIT_CRITICAL(&timesync.lock);
+    return epoch;
+}
+
+/**
+ * @brief Count the clock steps: the first synchronization, which takes the
+ * timestamps from 0 to the epoch, and the corrections of more than
+ * MAX_SLEW_US. Users that keep timestamps across cycles, such as the batches,
+ * restart when the count changes.
+ * @return The number of clock steps since boot.
+ */
+uint32_t timesync_get_steps()
+{
+    return timesync.n_steps;
+}
+
+/**
+ * Extrapolate the epoch time from the last synchronization, corrected by the
+ * measured drift of esp_timer. The lock must be held.
+ */
+static int64_t timesync_epoch_us(int64_t mono_us)
+{
+    int64_t elapsed = mono_us - timesync.ref_mono;
+
+    return timesync.ref_epoch + elapsed + elapsed * timesync.drift_ppb / 1000000000;
+}
+
+/**
+ * Called by the SNTP client after each synchronization of the system time.
+ * The drift is measured between two synchronizations far enough apart.
+ */
+static void timesync_handle_sync(struct timeval *tv)
+{
+    int64_t mono = esp_timer_get_time();
+    int64_t epoch = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+    int64_t span, error;
+    double drift;
+
+    portENTER_CRITICAL(&timesync.lock);
+    error = timesync.synced ? epoch - timesync_epoch_us(mono) : 0;
+    if (!timesync.synced || error > MAX_SLEW_US || error < -MAX_SLEW_US)
+        timesync.n_steps++;
+    span = mono - timesync.ref_mono;
+    if (timesync.synced && span >= MIN_DRIFT_SPAN)
+    {
+        //in double: a clock step of a few s would overflow the product in int64
+        drift = (double)((epoch - timesync.ref_epoch) - span) * 1e9 / span;
+        if (drift > -MAX_DRIFT_PPB && drift < MAX_DRIFT_PPB)
+            timesync.drift_ppb = (int64_t)drift;
+    }
+    timesync.ref_mono = mono;
+    timesync.ref_epoch = epoch;
+    timesync.synced = true;
+    rtc_drift_ppb = timesync.drift_ppb;
+    rtc_synced = true;
+    portEXIT_CRITICAL(&timesync.lock);
+    LOGI(TAG, "Time synchronized, drift=%lld ppb", (long long)timesync.drift_ppb);
+}
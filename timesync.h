@@ -0,0 +1,25 @@
+#ifndef __TIMESYNC_H__
+#define __TIMESYNC_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+typedef struct timesync
+{
+    portMUX_TYPE lock;
+    bool synced;
+    int64_t ref_mono;   /* esp_timer time of the last synchronization, us */
+    int64_t ref_epoch;  /* epoch time of the last synchronization, us */
+    int64_t drift_ppb;  /* epoch rate minus esp_timer rate, parts per billion */
+    int64_t last_epoch; /* last value returned, keeps time monotonic */
+    uint32_t n_steps;   /* clock steps: first synchronization or large correction */
+} timesync_t;
+
+void     timesync_init(const char *);
+bool     timesync_is_synced();
+int64_t  timesync_to_epoch_ms(int64_t);
+int64_t  timesync_now_ms();
+uint32_t timesync_get_steps();
+
+#endif /* __TIMESYNC_H__ */
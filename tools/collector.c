@@ -0,0 +1,573 @@
+/*
+ * Ingestion collector: subscribes to the sample topics of every device and
+ * appends the samples to a columnar store (see colstore.h).
+ *
+ * usage: collector [-H host] [-p port] [-q qos] [-c client_id] [-d dir] [-F flush_s] [-i interval_s]
+ *        collector -f recording [-l loops] [-d dir] [-F flush_s] [-i interval_s]
+ *
+ * Topics and payloads, <device> being the first level of the topic:
+ *   <device>/{mcp9700,vma311,bme680,fused}/<metric>
+ *       text "23.45", JSON {"value":23.45,"ts":<ms>,...} or a JSON array of
+ *       such objects; text and JSON without "ts" are stamped on receipt
+ *   <device>/samples   CBOR cycles (see sample.h)
+ *   <device>/batch     compressed batches (see tsc.h)
+ *
+ * The network thread decodes the messages and hands the samples to the
+ * storage thread through a lock-free single-producer single-consumer ring
+ * (see spsc.h). When the ring is full, the network thread waits and TCP
+ * pushes back on the broker. The storage thread appends to per-series
+ * buffers, stored in the mapped files COLSTORE_BUFFER_ROWS rows at a time and
+ * every flush_s seconds (5 by default): a reader of the store, e.g. colquery,
+ * sees the samples within that period.
+ *
+ * With -f, the messages are read from a recording instead, one
+ * "topic hex_payload" per line as written by mosquitto_sub -v -F '%t %x',
+ * replayed loops times with the timestamps shifted so that they stay new:
+ * a benchmark of the decoding and the storage without a broker.
+ *
+ * Each interval prints one line, the totals follow at the end:
+ *   t=<s> messages_per_s= samples_per_s= stored_per_s= dropped=<n> errors=<n> queue_waits=<n> series=<n> bytes=<b>
+ *   total messages=<n> samples=<n> stored=<n> dropped=<n> ... net_cpu_s= storage_cpu_s= ns_per_sample=
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "../sample.h"
+#include "colstore.h"
+#include "sample_decode.h"
+#include "spsc.h"
+#include "tsc_decode.h"
+
+#define QUEUE_SLOTS      (1 << 16)
+#define POP_MAX          1024
+#define MAX_SAMPLES      4096
+#define RX_SIZE          (1 << 20)
+#define LINE_MAX_SIZE    (2 * 65536 + 256)
+#define PAYLOAD_MAX_SIZE 65536
+#define KEEPALIVE_S      60
+#define RETRY_S          2
+#define IDLE_NS          200000 /* storage thread poll period when the ring is empty */
+
+typedef struct record
+{
+    char     device[COLSTORE_NAME_MAX_SIZE];
+    sample_t sample;
+} record_t;
+
+typedef struct counters
+{
+    atomic_long messages;
+    atomic_long samples;    /* decoded and queued */
+    atomic_long stored;
+    atomic_long dropped;    /* older than the last sample of their series */
+    atomic_long errors;     /* not stored, the files of their series cannot be written */
+    atomic_long queue_waits;
+    atomic_long bytes;
+    atomic_int  series;
+} counters_t;
+
+static const char *const filters[] = {"+/mcp9700/#", "+/vma311/#", "+/bme680/#", "+/fused/#", "+/samples", "+/batch"};
+
+static spsc_t         queue;
+static counters_t     counters;
+static atomic_bool    draining;
+static volatile bool  stopping;
+static const char    *dir = "envmon_data";
+static double         storage_cpu_s;
+static sample_t       samples[MAX_SAMPLES];
+static uint8_t        payload[PAYLOAD_MAX_SIZE + 1];
+static int64_t        ts_shift; /* added to the timestamps of a replay loop */
+static int64_t        flush_ns = 5000000000LL;
+static int64_t        last_tx_ns; /* monotonic time of the last packet sent, for the keepalive */
+
+static int64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int find_name(const char *name, int len, const char *(*lookup)(uint8_t), int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if ((int)strlen(lookup(i)) == len && strncmp(lookup(i), name, len) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* "-12.345" -> -12345, exponent -3 */
+static const char *parse_decimal(const char *p, const char *end, int32_t *value, int8_t *exponent)
+{
+    bool negative = p < end && *p == '-';
+    int64_t v = 0;
+    int digits = 0, decimals = -1;
+
+    for (p += negative; p < end && digits < 10; p++)
+    {
+        if (*p >= '0' && *p <= '9')
+        {
+            v = v * 10 + (*p - '0');
+            digits++;
+            decimals += decimals >= 0;
+        }
+        else if (*p == '.' && decimals < 0)
+        {
+            decimals = 0;
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (digits == 0 || v > INT32_MAX)
+        return NULL;
+    *value = negative ? -v : v;
+    *exponent = decimals > 0 ? -decimals : 0;
+    return p;
+}
+
+static void push(const char *device, int len, const sample_t *s)
+{
+    record_t r;
+
+    snprintf(r.device, sizeof(r.device), "%.*s", len, device);
+    r.sample = *s;
+    r.sample.timestamp += ts_shift;
+    while (!spsc_push(&queue, &r))
+    {
+        atomic_fetch_add_explicit(&counters.queue_waits, 1, memory_order_relaxed);
+        sched_yield();
+    }
+    atomic_fetch_add_explicit(&counters.samples, 1, memory_order_relaxed);
+}
+
+/* text, a JSON object or an array of JSON objects */
+static void decode_values(const char *device, int device_len, int sensor, int metric, const char *p, int len,
+                          int64_t received_ms)
+{
+    const char *end = p + len, *object_end, *field;
+    sample_t s = {.sensor = sensor, .metric = metric};
+
+    if (len > 0 && p[0] != '{' && p[0] != '[')
+    {
+        if (parse_decimal(p, end, &s.value, &s.exponent) != NULL)
+        {
+            s.timestamp = received_ms;
+            push(device, device_len, &s);
+        }
+        return;
+    }
+    while ((p = memchr(p, '{', end - p)) != NULL)
+    {
+        object_end = memchr(p, '}', end - p);
+        if (object_end == NULL)
+            return;
+        s.timestamp = received_ms;
+        if ((field = memmem(p, object_end - p, "\"ts\":", 5)) != NULL)
+            s.timestamp = strtoll(field + 5, NULL, 10);
+        if ((field = memmem(p, object_end - p, "\"value\":", 8)) != NULL
+            && parse_decimal(field + 8, object_end, &s.value, &s.exponent) != NULL)
+            push(device, device_len, &s);
+        p = object_end;
+    }
+}
+
+static void on_message(const char *topic, int topic_len, uint8_t *data, int len)
+{
+    const char *end = topic + topic_len;
+    const char *level = memchr(topic, '/', topic_len);
+    const char *next;
+    int device_len, sensor, metric, n = 0;
+
+    atomic_fetch_add_explicit(&counters.messages, 1, memory_order_relaxed);
+    if (level == NULL || (device_len = level - topic) == 0 || device_len >= COLSTORE_NAME_MAX_SIZE)
+        return;
+    level++;
+    if (end - level == 7 && memcmp(level, "samples", 7) == 0)
+        n = sample_decode_cbor(data, len, samples, MAX_SAMPLES);
+    else if (end - level == 5 && memcmp(level, "batch", 5) == 0)
+        n = tsc_decode(data, len, samples, MAX_SAMPLES);
+    else if ((next = memchr(level, '/', end - level)) != NULL
+             && (sensor = find_name(level, next - level, sample_sensor_name, SAMPLE_FUSED + 1)) >= 0
+             && (metric = find_name(next + 1, end - next - 1, sample_metric_name, SAMPLE_GAS_RESISTANCE + 1)) >= 0)
+        decode_values(topic, device_len, sensor, metric, (const char *)data, len, now_ns(CLOCK_REALTIME) / 1000000);
+    for (int i = 0; i < n; i++)
+        push(topic, device_len, &samples[i]);
+}
+
+static void *storage_task(void *arg)
+{
+    static record_t batch[POP_MAX];
+    colstore_t store;
+    colstore_series_t *s = NULL;
+    int64_t last_flush = now_ns(CLOCK_MONOTONIC);
+    long stored, dropped;
+    size_t n;
+
+    (void)arg;
+    if (colstore_open(&store, dir, true) != 0)
+    {
+        perror(dir);
+        exit(1);
+    }
+    for (;;)
+    {
+        n = spsc_pop(&queue, batch, POP_MAX);
+        stored = store.n_rows;
+        dropped = store.n_dropped;
+        for (size_t i = 0; i < n; i++)
+        {
+            const sample_t *x = &batch[i].sample;
+
+            if (s == NULL || s->sensor != x->sensor || s->metric != x->metric || strcmp(s->device, batch[i].device))
+                s = colstore_series(&store, batch[i].device, x->sensor, x->metric, x->exponent);
+            if (s == NULL || colstore_append(&store, s, x->timestamp, x->value, x->exponent) < 0)
+                atomic_fetch_add_explicit(&counters.errors, 1, memory_order_relaxed);
+        }
+        atomic_fetch_add_explicit(&counters.stored, store.n_rows - stored, memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters.dropped, store.n_dropped - dropped, memory_order_relaxed);
+        if (n == 0 && atomic_load(&draining))
+            break;
+        if (now_ns(CLOCK_MONOTONIC) - last_flush >= flush_ns)
+        {
+            colstore_flush(&store);
+            last_flush = now_ns(CLOCK_MONOTONIC);
+            atomic_store_explicit(&counters.bytes, store.n_bytes, memory_order_relaxed);
+            atomic_store_explicit(&counters.series, store.n_series, memory_order_relaxed);
+        }
+        if (n == 0)
+            nanosleep(&(struct timespec){0, IDLE_NS}, NULL);
+    }
+    colstore_close(&store);
+    atomic_store(&counters.bytes, store.n_bytes);
+    atomic_store(&counters.series, store.n_series);
+    storage_cpu_s = now_ns(CLOCK_THREAD_CPUTIME_ID) / 1e9;
+    return NULL;
+}
+
+/* MQTT 3.1.1, blocking */
+
+static int put_string(uint8_t *p, const char *s)
+{
+    int len = strlen(s);
+
+    p[0] = len >> 8;
+    p[1] = len & 0xff;
+    memcpy(&p[2], s, len);
+    return 2 + len;
+}
+
+static bool mqtt_send(int fd, uint8_t type, const uint8_t *body, int len)
+{
+    uint8_t packet[1 + 4 + 1024];
+    int n = 1, remaining = len;
+
+    packet[0] = type;
+    do
+    {
+        packet[n++] = (remaining & 0x7f) | (remaining > 0x7f ? 0x80 : 0);
+        remaining >>= 7;
+    } while (remaining > 0);
+    memcpy(&packet[n], body, len);
+    last_tx_ns = now_ns(CLOCK_MONOTONIC);
+    return send(fd, packet, n + len, MSG_NOSIGNAL) == n + len;
+}
+
+static int mqtt_connect(const char *host, const char *port, const char *client_id, int qos)
+{
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct timeval timeout = {.tv_sec = KEEPALIVE_S / 2};
+    struct addrinfo *addrs;
+    uint8_t body[1024];
+    uint8_t connack[4];
+    int fd, len, one = 1;
+    uint16_t msg_id = 1;
+
+    if (getaddrinfo(host, port, &hints, &addrs) != 0)
+        return -1;
+    fd = socket(addrs->ai_family, addrs->ai_socktype, addrs->ai_protocol);
+    if (fd < 0 || connect(fd, addrs->ai_addr, addrs->ai_addrlen) != 0)
+    {
+        freeaddrinfo(addrs);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    freeaddrinfo(addrs);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    len = put_string(body, "MQTT");
+    body[len++] = 4;
+    body[len++] = qos > 0 ? 0x00 : 0x02; /* with QoS 1, the broker keeps the messages while away */
+    body[len++] = 0;
+    body[len++] = KEEPALIVE_S;
+    len += put_string(&body[len], client_id);
+    if (!mqtt_send(fd, 0x10, body, len) || recv(fd, connack, sizeof(connack), MSG_WAITALL) != sizeof(connack)
+        || connack[0] != 0x20 || connack[3] != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    body[0] = msg_id >> 8;
+    body[1] = msg_id & 0xff;
+    len = 2;
+    for (size_t i = 0; i < sizeof(filters) / sizeof(filters[0]); i++)
+    {
+        len += put_string(&body[len], filters[i]);
+        body[len++] = qos;
+    }
+    if (!mqtt_send(fd, 0x82, body, len))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * receive until the connection is lost. The broker counts the keepalive from
+ * the packets the client sends, which received messages do not reset: a
+ * PINGREQ goes out halfway through it whenever nothing else did, the receive
+ * timeout bounding the wait when nothing is received either.
+ */
+static void mqtt_receive(int fd)
+{
+    static uint8_t rx[RX_SIZE];
+    int rx_len = 0, offset, remaining, total, topic_len, qos;
+    uint8_t *p;
+    ssize_t n;
+
+    while (!stopping)
+    {
+        n = recv(fd, rx + rx_len, RX_SIZE - rx_len, 0);
+        if (now_ns(CLOCK_MONOTONIC) - last_tx_ns >= KEEPALIVE_S * 500000000LL && !mqtt_send(fd, 0xc0, NULL, 0))
+            return; /* PINGREQ */
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            continue;
+        if (n <= 0)
+            return;
+        rx_len += n;
+        for (p = rx; p < rx + rx_len; p += total)
+        {
+            remaining = 0;
+            for (offset = 1; p + offset < rx + rx_len && offset <= 4; offset++)
+            {
+                remaining |= (p[offset] & 0x7f) << 7 * (offset - 1);
+                if (!(p[offset] & 0x80))
+                    break;
+            }
+            if (p + offset >= rx + rx_len)
+                break;
+            total = offset + 1 + remaining;
+            if (offset > 4 || total > RX_SIZE)
+                return;
+            if (p + total > rx + rx_len)
+                break;
+            if (p[0] >> 4 != 3) /* SUBACK, PINGRESP */
+                continue;
+            qos = (p[0] >> 1) & 3;
+            offset++;
+            topic_len = p[offset] << 8 | p[offset + 1];
+            offset += 2;
+            if (qos > 0 && !mqtt_send(fd, 0x40, &p[offset + topic_len], 2)) /* PUBACK */
+                return;
+            on_message((const char *)&p[offset], topic_len, &p[offset + topic_len + (qos ? 2 : 0)],
+                       total - offset - topic_len - (qos ? 2 : 0));
+        }
+        rx_len -= p - rx;
+        memmove(rx, p, rx_len);
+    }
+}
+
+static int decode_hex(const char *hex, uint8_t *out, int max)
+{
+    int n = 0, hi, lo;
+
+    while (n < max && (hi = hex[0]) && (lo = hex[1]))
+    {
+        hi = hi <= '9' ? hi - '0' : (hi | 0x20) - 'a' + 10;
+        lo = lo <= '9' ? lo - '0' : (lo | 0x20) - 'a' + 10;
+        if (hi < 0 || hi > 15 || lo < 0 || lo > 15)
+            break;
+        out[n++] = hi << 4 | lo;
+        hex += 2;
+    }
+    return n;
+}
+
+static void replay(const char *path, int loops)
+{
+    static char line[LINE_MAX_SIZE];
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    char *hex;
+    int len;
+
+    if (f == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    for (int loop = 0; loop < loops && !stopping; loop++)
+    {
+        while (fgets(line, sizeof(line), f) != NULL && !stopping)
+        {
+            if ((hex = strchr(line, ' ')) == NULL)
+                continue;
+            hex[strcspn(hex, "\r\n")] = '\0';
+            len = decode_hex(hex + 1, payload, PAYLOAD_MAX_SIZE);
+            on_message(line, hex - line, payload, len);
+        }
+        if (f == stdin)
+            break;
+        rewind(f);
+        ts_shift += 86400000; /* a day later each loop, so that a recording of less than a day stays new */
+    }
+    if (f != stdin)
+        fclose(f);
+}
+
+static void report(const char *label, const counters_t *c, const long *prev, double seconds)
+{
+    printf("%s messages_per_s=%.0f samples_per_s=%.0f stored_per_s=%.0f dropped=%ld errors=%ld queue_waits=%ld"
+           " series=%d bytes=%ld\n",
+           label, (atomic_load(&c->messages) - prev[0]) / seconds, (atomic_load(&c->samples) - prev[1]) / seconds,
+           (atomic_load(&c->stored) - prev[2]) / seconds, atomic_load(&c->dropped), atomic_load(&c->errors),
+           atomic_load(&c->queue_waits), atomic_load(&c->series), atomic_load(&c->bytes));
+}
+
+static void *report_task(void *arg)
+{
+    double interval_s = *(double *)arg;
+    int64_t start = now_ns(CLOCK_MONOTONIC);
+    long prev[3] = {0};
+    char label[32];
+
+    for (;;)
+    {
+        nanosleep(&(struct timespec){(time_t)interval_s, (long)((interval_s - (time_t)interval_s) * 1e9)}, NULL);
+        snprintf(label, sizeof(label), "t=%.0f", (now_ns(CLOCK_MONOTONIC) - start) / 1e9);
+        report(label, &counters, prev, interval_s);
+        prev[0] = atomic_load(&counters.messages);
+        prev[1] = atomic_load(&counters.samples);
+        prev[2] = atomic_load(&counters.stored);
+    }
+    return NULL;
+}
+
+static void stop(int sig)
+{
+    (void)sig;
+    stopping = true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-H host] [-p port] [-q qos] [-c client_id] [-d dir] [-F flush_s] [-i interval_s]\n"
+                    "       %s -f recording [-l loops] [-d dir] [-F flush_s] [-i interval_s]\n", name, name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = "localhost", *port = "1883", *client_id = "envmon_collector", *recording = NULL;
+    double interval_s = 5;
+    int qos = 0, loops = 1, opt, fd;
+    pthread_t storage, reporter;
+    int64_t start, elapsed;
+    long zero[3] = {0};
+    long n_samples;
+
+    while ((opt = getopt(argc, argv, "H:p:q:c:d:F:i:f:l:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'H':
+                host = optarg;
+                break;
+            case 'p':
+                port = optarg;
+                break;
+            case 'q':
+                qos = atoi(optarg);
+                break;
+            case 'c':
+                client_id = optarg;
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            case 'F':
+                flush_ns = (int64_t)(atof(optarg) * 1e9);
+                break;
+            case 'i':
+                interval_s = atof(optarg);
+                break;
+            case 'f':
+                recording = optarg;
+                break;
+            case 'l':
+                loops = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (qos < 0 || qos > 1 || flush_ns <= 0 || interval_s <= 0 || loops <= 0 || strlen(client_id) > 64)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (spsc_init(&queue, QUEUE_SLOTS, sizeof(record_t)) != 0)
+    {
+        perror("spsc_init");
+        return 1;
+    }
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    start = now_ns(CLOCK_MONOTONIC);
+    pthread_create(&storage, NULL, storage_task, NULL);
+    pthread_create(&reporter, NULL, report_task, &interval_s);
+
+    if (recording != NULL)
+        replay(recording, loops);
+    while (recording == NULL && !stopping)
+    {
+        if ((fd = mqtt_connect(host, port, client_id, qos)) < 0)
+        {
+            fprintf(stderr, "%s:%s: cannot connect, retrying\n", host, port);
+            sleep(RETRY_S);
+            continue;
+        }
+        mqtt_receive(fd);
+        close(fd);
+    }
+
+    atomic_store(&draining, true);
+    pthread_join(storage, NULL);
+    elapsed = now_ns(CLOCK_MONOTONIC) - start;
+    n_samples = atomic_load(&counters.samples);
+    report("total", &counters, zero, elapsed / 1e9);
+    printf("total messages=%ld samples=%ld stored=%ld dropped=%ld net_cpu_s=%.3f storage_cpu_s=%.3f"
+           " ns_per_sample=%.1f\n",
+           atomic_load(&counters.messages), n_samples, atomic_load(&counters.stored), atomic_load(&counters.dropped),
+           now_ns(CLOCK_THREAD_CPUTIME_ID) / 1e9, storage_cpu_s, n_samples ? (double)elapsed / n_samples : 0);
+    return 0;
+}
@@ -0,0 +1,290 @@
+/*
+ * Queries of a columnar store written by the collector (see colstore.h).
+ *
+ * usage: colquery -d dir [-f from_ms] [-t to_ms] [-r rows|1m|1h] device sensor.metric
+ *        colquery -d dir -b [-y days] [-n queries]
+ *
+ * Without -r, the samples of the range are aggregated from the rollups:
+ *   count=<n> min= max= mean= query_us=
+ * With -r, the rows or the rollup records of the range are listed instead,
+ * "ts value" or "start min max mean count", the values scaled. The range is
+ * the whole series by default. The store may be appended to meanwhile.
+ *
+ * With -b, a benchmark: a year (or days) of samples every 5 s are appended to
+ * the series bench/fused.temp of a new store, then random ranges are
+ * queried and a sample of them checked against a scan of the rows:
+ *   rows=<n> append_ns_per_row= bytes=<b>
+ *   queries=<n> p50_us= p99_us= max_us= scan_us= mismatches=<n>
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../sample.h"
+#include "colstore.h"
+
+#define BENCH_PERIOD_MS 5000
+#define BENCH_CHECKS    20 /* queries checked against a scan */
+#define READ_MAX        4096
+
+static int64_t  ts[READ_MAX];
+static int32_t  values[READ_MAX];
+static colstore_rollup_t records[READ_MAX];
+
+static int64_t now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static double scale(double value, int8_t exponent)
+{
+    return value * pow(10, exponent);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* "sensor.metric" to codes */
+static int parse_series(const char *name, uint8_t *sensor, uint8_t *metric)
+{
+    const char *dot = strchr(name, '.');
+
+    if (dot == NULL)
+        return -1;
+    for (int i = 0; i <= SAMPLE_FUSED; i++)
+    {
+        for (int j = 0; j <= SAMPLE_GAS_RESISTANCE; j++)
+        {
+            if (strncmp(name, sample_sensor_name(i), dot - name) == 0 && sample_sensor_name(i)[dot - name] == '\0'
+                && strcmp(dot + 1, sample_metric_name(j)) == 0)
+            {
+                *sensor = i;
+                *metric = j;
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+static int query(colstore_t *store, colstore_series_t *s, int64_t from, int64_t to, const char *list)
+{
+    colstore_stats_t stats;
+    int64_t start;
+    long n;
+
+    if (list == NULL)
+    {
+        start = now_ns();
+        if (colstore_query(store, s, from, to, &stats) != 0)
+            return 1;
+        printf("count=%lld min=%g max=%g mean=%g query_us=%.1f\n", (long long)stats.count,
+               stats.count ? scale(stats.min, s->exponent) : 0, stats.count ? scale(stats.max, s->exponent) : 0,
+               stats.count ? scale((double)stats.sum / stats.count, s->exponent) : 0, (now_ns() - start) / 1e3);
+        return 0;
+    }
+    if (strcmp(list, "rows") == 0)
+    {
+        do
+        {
+            if ((n = colstore_read(store, s, from, to, ts, values, READ_MAX)) < 0)
+                return 1;
+            for (long i = 0; i < n; i++)
+                printf("%lld %g\n", (long long)ts[i], scale(values[i], s->exponent));
+            if (n > 0)
+                from = ts[n - 1] + 1;
+        } while (n == READ_MAX);
+        return 0;
+    }
+    do
+    {
+        n = colstore_rollups(store, s, strcmp(list, "1h") == 0 ? COLSTORE_1H : COLSTORE_1M, from, to, records,
+                             READ_MAX);
+        if (n < 0)
+            return 1;
+        for (long i = 0; i < n; i++)
+            printf("%lld %g %g %g %u\n", (long long)records[i].start, scale(records[i].min, s->exponent),
+                   scale(records[i].max, s->exponent),
+                   scale((double)records[i].sum / records[i].count, s->exponent), records[i].count);
+        if (n > 0)
+            from = records[n - 1].start + 1;
+    } while (n == READ_MAX);
+    return 0;
+}
+
+/* aggregate a range from its rows, the reference of the benchmark */
+static void scan(colstore_t *store, colstore_series_t *s, int64_t from, int64_t to, colstore_stats_t *stats)
+{
+    long n;
+
+    *stats = (colstore_stats_t){.min = INT32_MAX, .max = INT32_MIN};
+    do
+    {
+        n = colstore_read(store, s, from, to, ts, values, READ_MAX);
+        for (long i = 0; i < n; i++)
+        {
+            if (values[i] < stats->min)
+                stats->min = values[i];
+            if (values[i] > stats->max)
+                stats->max = values[i];
+            stats->sum += values[i];
+            stats->count++;
+        }
+        if (n > 0)
+            from = ts[n - 1] + 1;
+    } while (n == READ_MAX);
+}
+
+static int bench(const char *dir, int days, int n_queries)
+{
+    const int64_t origin = 1704067200000LL; /* 2024-01-01 */
+    const int64_t span = days * 86400000LL;
+    colstore_t store;
+    colstore_series_t *s;
+    colstore_stats_t stats, reference;
+    double *us, scan_us = 0;
+    unsigned seed = 1;
+    int64_t start, from, to;
+    long rows = 0, mismatches = 0;
+
+    if (colstore_open(&store, dir, true) != 0 || (s = colstore_series(&store, "bench", SAMPLE_FUSED,
+                                                                      SAMPLE_TEMPERATURE, -2)) == NULL)
+    {
+        perror(dir);
+        return 1;
+    }
+    if (s->n_rows > 0)
+    {
+        fprintf(stderr, "%s: the benchmark needs a new store\n", dir);
+        return 1;
+    }
+    /* a daily cycle around 21 degC with noise */
+    start = now_ns();
+    for (int64_t t = origin; t < origin + span; t += BENCH_PERIOD_MS, rows++)
+    {
+        int32_t value = 2100 + 400 * sin(2 * M_PI * (t % 86400000) / 86400000) + rand_r(&seed) % 50;
+
+        if (colstore_append(&store, s, t, value, -2) != 0)
+        {
+            fprintf(stderr, "%s: append failed\n", dir);
+            return 1;
+        }
+    }
+    printf("rows=%ld append_ns_per_row=%.1f bytes=%ld\n", rows, (double)(now_ns() - start) / rows, store.n_bytes);
+    colstore_close(&store);
+
+    if (colstore_open(&store, dir, false) != 0
+        || (s = colstore_series(&store, "bench", SAMPLE_FUSED, SAMPLE_TEMPERATURE, -2)) == NULL
+        || (us = malloc(n_queries * sizeof(double))) == NULL)
+    {
+        perror(dir);
+        return 1;
+    }
+    for (int i = 0; i < n_queries; i++)
+    {
+        from = origin + (int64_t)((double)rand_r(&seed) / RAND_MAX * span);
+        to = from + (int64_t)((double)rand_r(&seed) / RAND_MAX * (origin + span - from));
+        start = now_ns();
+        colstore_query(&store, s, from, to, &stats);
+        us[i] = (now_ns() - start) / 1e3;
+        if (i < BENCH_CHECKS)
+        {
+            start = now_ns();
+            scan(&store, s, from, to, &reference);
+            scan_us += (now_ns() - start) / 1e3;
+            mismatches += memcmp(&stats, &reference, sizeof(stats)) != 0;
+        }
+    }
+    qsort(us, n_queries, sizeof(double), compare_double);
+    printf("queries=%d p50_us=%.1f p99_us=%.1f max_us=%.1f scan_us=%.1f mismatches=%ld\n", n_queries,
+           us[n_queries / 2], us[n_queries * 99 / 100], us[n_queries - 1],
+           scan_us / (n_queries < BENCH_CHECKS ? n_queries : BENCH_CHECKS), mismatches);
+    free(us);
+    colstore_close(&store);
+    return mismatches != 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s -d dir [-f from_ms] [-t to_ms] [-r rows|1m|1h] device sensor.metric\n"
+                    "       %s -d dir -b [-y days] [-n queries]\n",
+            name, name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = NULL, *list = NULL;
+    int64_t from = INT64_MIN, to = INT64_MAX;
+    int days = 365, n_queries = 1000, opt;
+    bool benchmark = false;
+    colstore_t store;
+    colstore_series_t *s;
+    uint8_t sensor, metric;
+    int err;
+
+    while ((opt = getopt(argc, argv, "d:f:t:r:by:n:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                dir = optarg;
+                break;
+            case 'f':
+                from = strtoll(optarg, NULL, 10);
+                break;
+            case 't':
+                to = strtoll(optarg, NULL, 10);
+                break;
+            case 'r':
+                list = optarg;
+                break;
+            case 'b':
+                benchmark = true;
+                break;
+            case 'y':
+                days = atoi(optarg);
+                break;
+            case 'n':
+                n_queries = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (dir == NULL || (benchmark ? days <= 0 || n_queries <= 0 : optind + 2 != argc)
+        || (list != NULL && strcmp(list, "rows") != 0 && strcmp(list, "1m") != 0 && strcmp(list, "1h") != 0))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (benchmark)
+        return bench(dir, days, n_queries);
+    if (parse_series(argv[optind + 1], &sensor, &metric) != 0)
+    {
+        fprintf(stderr, "%s: not a sensor.metric\n", argv[optind + 1]);
+        return 1;
+    }
+    if (colstore_open(&store, dir, false) != 0)
+    {
+        perror(dir);
+        return 1;
+    }
+    if ((s = colstore_series(&store, argv[optind], sensor, metric, 0)) == NULL)
+    {
+        fprintf(stderr, "%s/%s: no such series\n", argv[optind], argv[optind + 1]);
+        return 1;
+    }
+    err = query(&store, s, from, to, list);
+    colstore_close(&store);
+    return err;
+}
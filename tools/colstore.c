@@ -0,0 +1,935 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../sample.h"
+#include "colstore.h"
+
+#define INITIAL_SIZE         1024 /* slots of the series table, a power of two */
+#define SEGMENT_INITIAL_ROWS 1024 /* rows of a new segment */
+#define ROLLUP_INITIAL       1024 /* records of a new rollup file */
+#define MINUTE_MS            60000
+#define HOUR_MS              3600000
+#define FILE_PATH_SIZE       (COLSTORE_PATH_MAX_SIZE + 3 * COLSTORE_NAME_MAX_SIZE)
+
+typedef struct colstore_column
+{
+    char     magic[4];
+    uint8_t  version;
+    uint8_t  column;
+    int8_t   exponent;
+    uint8_t  reserved;
+    uint32_t n_rows;
+    uint32_t reserved2;
+    uint8_t  data[];
+} colstore_column_t;
+
+typedef struct colstore_rollup_file
+{
+    char              magic[4];
+    uint8_t           version;
+    uint8_t           reserved[3];
+    int64_t           width; /* ms */
+    int64_t           n_records;
+    int64_t           reserved2;
+    colstore_rollup_t records[];
+} colstore_rollup_file_t;
+
+static const size_t  column_width[2] = {sizeof(int64_t), sizeof(int32_t)};
+static const char   *column_name[2] = {"ts", "val"};
+static const int64_t level_width[COLSTORE_N_LEVELS] = {MINUTE_MS, HOUR_MS};
+static const char   *level_name[COLSTORE_N_LEVELS] = {"1m", "1h"};
+
+static uint32_t           series_hash(const char *, uint8_t, uint8_t);
+static colstore_series_t *series_open(colstore_t *, const char *, uint8_t, uint8_t, int8_t);
+static void               series_path(const colstore_t *, const colstore_series_t *, const char *, char *, size_t);
+static int                series_map(colstore_t *, colstore_series_t *);
+static void               series_load(colstore_series_t *);
+static void               series_unmap(colstore_t *, colstore_series_t *);
+static int                series_use(colstore_t *, colstore_series_t *);
+static int                series_flush(colstore_t *, colstore_series_t *);
+static int                series_recover(colstore_t *, colstore_series_t *);
+static int                segment_add(colstore_t *, colstore_series_t *);
+static int                segment_map(colstore_t *, colstore_series_t *, int, long);
+static int                column_map(colstore_t *, colstore_series_t *, int, int, long);
+static int                level_map(colstore_t *, colstore_series_t *, int);
+static int                rollup_add(colstore_t *, colstore_series_t *, int, int64_t, int32_t);
+static int64_t            row_ts(const colstore_series_t *, long);
+static long               row_seek(colstore_series_t *, int64_t);
+static long               record_seek(const colstore_rollup_file_t *, long, int64_t);
+static void               add_rows(colstore_series_t *, int64_t, int64_t, colstore_stats_t *);
+static void               add_records(const colstore_rollup_file_t *, int64_t, int64_t, colstore_stats_t *);
+static void               add_minutes(colstore_series_t *, int64_t, int64_t, colstore_stats_t *);
+static void               lru_unlink(colstore_t *, colstore_series_t *);
+static void               lru_push(colstore_t *, colstore_series_t *);
+static int                table_grow(colstore_t *);
+
+static inline int64_t *segment_ts(const colstore_segment_t *seg)
+{
+    return (int64_t *)seg->columns[0]->data;
+}
+
+static inline int32_t *segment_values(const colstore_segment_t *seg)
+{
+    return (int32_t *)seg->columns[1]->data;
+}
+
+static inline long segment_capacity(const colstore_segment_t *seg)
+{
+    return seg->capacity[0] < seg->capacity[1] ? seg->capacity[0] : seg->capacity[1];
+}
+
+/* the rows of both columns */
+static inline long segment_rows(const colstore_segment_t *seg)
+{
+    uint32_t ts_rows = __atomic_load_n(&seg->columns[0]->n_rows, __ATOMIC_ACQUIRE);
+    uint32_t value_rows = __atomic_load_n(&seg->columns[1]->n_rows, __ATOMIC_ACQUIRE);
+
+    return ts_rows < value_rows ? ts_rows : value_rows;
+}
+
+static inline int64_t floor_to(int64_t x, int64_t width)
+{
+    return x - ((x % width) + width) % width;
+}
+
+/**
+ * @brief Open a store. The series are opened on their first use.
+ * @param store The store.
+ * @param dir The directory of the store, created if needed when writable.
+ * @param writable Whether samples are appended, otherwise the store is only
+ *        read, possibly while another process appends.
+ * @return 0, or -1 with errno set.
+ */
+int colstore_open(colstore_t *store, const char *dir, bool writable)
+{
+    memset(store, 0, sizeof(*store));
+    if (strlen(dir) >= sizeof(store->dir))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (writable && mkdir(dir, 0755) != 0 && errno != EEXIST)
+        return -1;
+    snprintf(store->dir, sizeof(store->dir), "%s", dir);
+    store->writable = writable;
+    store->size = INITIAL_SIZE;
+    store->table = calloc(store->size, sizeof(store->table[0]));
+    return store->table != NULL ? 0 : -1;
+}
+
+/**
+ * @brief Find a series, opening its files, or creating them if the store is
+ * writable.
+ * @param store The store.
+ * @param device The name of the device, a single topic level.
+ * @param sensor The sensor code.
+ * @param metric The metric code.
+ * @param exponent The exponent of the values, if the series is created.
+ * @return The series, or NULL if its files cannot be opened.
+ */
+colstore_series_t *colstore_series(colstore_t *store, const char *device, uint8_t sensor, uint8_t metric,
+                                   int8_t exponent)
+{
+    uint32_t i = series_hash(device, sensor, metric) & (store->size - 1);
+    colstore_series_t *s;
+
+    for (; (s = store->table[i]) != NULL; i = (i + 1) & (store->size - 1))
+    {
+        if (s->sensor == sensor && s->metric == metric && strcmp(s->device, device) == 0)
+            return s;
+    }
+    if ((s = series_open(store, device, sensor, metric, exponent)) == NULL)
+        return NULL;
+    store->table[i] = s;
+    if (++store->n_series * 2 > store->size && table_grow(store) != 0)
+        return NULL;
+    return s;
+}
+
+/**
+ * @brief Append a sample to a series, the value is rescaled to the exponent
+ * of the series.
+ * @param store The store, writable.
+ * @param s The series.
+ * @param ts The timestamp in ms since the Unix epoch.
+ * @param value The value.
+ * @param exponent The exponent of the value.
+ * @return 0, 1 if the sample is not newer than the last one and is dropped,
+ *         or -1 if the buffer was full and cannot be stored.
+ */
+int colstore_append(colstore_t *store, colstore_series_t *s, int64_t ts, int32_t value, int8_t exponent)
+{
+    if (ts <= s->last_ts)
+    {
+        store->n_dropped++;
+        return 1;
+    }
+    for (; exponent > s->exponent; exponent--)
+        value *= 10;
+    for (; exponent < s->exponent; exponent++)
+        value /= 10;
+    s->ts[s->n_buffered] = ts;
+    s->values[s->n_buffered] = value;
+    s->last_ts = ts;
+    store->n_rows++;
+    if (++s->n_buffered == COLSTORE_BUFFER_ROWS)
+        return series_flush(store, s);
+    return 0;
+}
+
+/**
+ * @brief Store the buffered rows of every series.
+ * @param store The store.
+ * @return 0, or -1 if a series cannot be mapped or grown.
+ */
+int colstore_flush(colstore_t *store)
+{
+    int err = 0;
+
+    for (int i = 0; i < store->size; i++)
+    {
+        if (store->table[i] != NULL && store->table[i]->n_buffered > 0)
+            err |= series_flush(store, store->table[i]);
+    }
+    return err;
+}
+
+/**
+ * @brief Flush, unmap and close every series.
+ * @param store The store.
+ */
+void colstore_close(colstore_t *store)
+{
+    if (store->writable)
+        colstore_flush(store);
+    for (int i = 0; i < store->size; i++)
+    {
+        if (store->table[i] == NULL)
+            continue;
+        series_unmap(store, store->table[i]);
+        free(store->table[i]->index);
+        free(store->table[i]);
+    }
+    free(store->table);
+    store->table = NULL;
+}
+
+/**
+ * @brief Aggregate the samples of a time range: the whole hours come from the
+ * 1 h rollups, the whole minutes from the 1 min ones, the rest from the rows.
+ * @param store The store.
+ * @param s The series.
+ * @param from The start of the range, in ms since the Unix epoch.
+ * @param to The end of the range, excluded.
+ * @param stats The count, min, max and sum of the values, in units of
+ *        10^s->exponent. Min and max are only meaningful if count > 0.
+ * @return 0, or -1 if the series cannot be mapped.
+ */
+int colstore_query(colstore_t *store, colstore_series_t *s, int64_t from, int64_t to, colstore_stats_t *stats)
+{
+    int64_t first_hour, last_hour;
+
+    *stats = (colstore_stats_t){.min = INT32_MAX, .max = INT32_MIN};
+    if (series_use(store, s) != 0)
+        return -1;
+    if (s->n_rows == 0)
+        return 0;
+    /* within the data, so that the rounding cannot overflow */
+    if (from < row_ts(s, 0))
+        from = row_ts(s, 0);
+    if (to > s->last_ts)
+        to = s->last_ts + 1;
+    if (from >= to)
+        return 0;
+    first_hour = floor_to(from + HOUR_MS - 1, HOUR_MS);
+    last_hour = floor_to(to, HOUR_MS);
+    if (first_hour >= last_hour)
+    {
+        add_minutes(s, from, to, stats);
+        return 0;
+    }
+    add_minutes(s, from, first_hour, stats);
+    add_records(s->levels[COLSTORE_1H].file, first_hour, last_hour, stats);
+    add_minutes(s, last_hour, to, stats);
+    return 0;
+}
+
+/**
+ * @brief Read the rows of a time range.
+ * @param store The store.
+ * @param s The series.
+ * @param from The start of the range, in ms since the Unix epoch.
+ * @param to The end of the range, excluded.
+ * @param ts The timestamps read.
+ * @param values The values read, in units of 10^s->exponent.
+ * @param max The size of ts and values.
+ * @return The number of rows read, max if there are more, or -1 if the series
+ *         cannot be mapped.
+ */
+long colstore_read(colstore_t *store, colstore_series_t *s, int64_t from, int64_t to, int64_t *ts, int32_t *values,
+                   long max)
+{
+    long n = 0;
+
+    if (series_use(store, s) != 0)
+        return -1;
+    for (long row = row_seek(s, from); row < s->n_rows && n < max; row++, n++)
+    {
+        const colstore_segment_t *seg = &s->segments[row / COLSTORE_SEGMENT_ROWS];
+
+        ts[n] = segment_ts(seg)[row % COLSTORE_SEGMENT_ROWS];
+        if (ts[n] >= to)
+            break;
+        values[n] = segment_values(seg)[row % COLSTORE_SEGMENT_ROWS];
+    }
+    return n;
+}
+
+/**
+ * @brief Read the rollup records of a time range.
+ * @param store The store.
+ * @param s The series.
+ * @param level The width of the records.
+ * @param from The start of the range, in ms since the Unix epoch.
+ * @param to The end of the range, excluded.
+ * @param records The records read, from the first starting at or after from.
+ * @param max The size of records.
+ * @return The number of records read, max if there are more, or -1 if the
+ *         series cannot be mapped.
+ */
+long colstore_rollups(colstore_t *store, colstore_series_t *s, colstore_level_id_t level, int64_t from, int64_t to,
+                      colstore_rollup_t *records, long max)
+{
+    const colstore_rollup_file_t *f;
+    long n_records, i, n = 0;
+
+    if (series_use(store, s) != 0)
+        return -1;
+    f = s->levels[level].file;
+    n_records = __atomic_load_n(&f->n_records, __ATOMIC_ACQUIRE);
+    for (i = record_seek(f, n_records, from); i < n_records && n < max && f->records[i].start < to; i++)
+        records[n++] = f->records[i];
+    return n;
+}
+
+/* FNV-1a */
+static uint32_t series_hash(const char *device, uint8_t sensor, uint8_t metric)
+{
+    uint32_t h = 2166136261u;
+
+    while (*device)
+        h = (h ^ (uint8_t)*device++) * 16777619u;
+    h = (h ^ sensor) * 16777619u;
+    return (h ^ metric) * 16777619u;
+}
+
+/**
+ * Open the files of a series, creating them in a writable store, and map it.
+ * \return the series, or NULL.
+ */
+static colstore_series_t *series_open(colstore_t *store, const char *device, uint8_t sensor, uint8_t metric,
+                                      int8_t exponent)
+{
+    char path[FILE_PATH_SIZE];
+    colstore_series_t *s;
+    struct stat st;
+    bool opened;
+
+    if (strlen(device) >= COLSTORE_NAME_MAX_SIZE || strchr(device, '/') != NULL || device[0] == '.')
+        return NULL;
+    if ((s = calloc(1, sizeof(*s))) == NULL)
+        return NULL;
+    snprintf(s->device, sizeof(s->device), "%s", device);
+    s->sensor = sensor;
+    s->metric = metric;
+    s->exponent = exponent;
+    s->last_ts = INT64_MIN;
+    if (store->writable)
+    {
+        snprintf(path, sizeof(path), "%s/%s", store->dir, device);
+        mkdir(path, 0755);
+        series_path(store, s, NULL, path, sizeof(path));
+        mkdir(path, 0755);
+    }
+    for (;; s->n_segments++)
+    {
+        char name[16];
+
+        snprintf(name, sizeof(name), "%06d.ts", s->n_segments);
+        series_path(store, s, name, path, sizeof(path));
+        if (stat(path, &st) != 0)
+            break;
+    }
+    opened = (s->n_segments > 0 || store->writable) && series_map(store, s) == 0
+             && (s->n_segments > 0 || segment_add(store, s) == 0);
+    if (opened)
+        series_load(s);
+    if (!opened || (store->writable && series_recover(store, s) != 0))
+    {
+        series_unmap(store, s);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+/* the directory of the series, or one of its files */
+static void series_path(const colstore_t *store, const colstore_series_t *s, const char *file, char *path,
+                        size_t size)
+{
+    snprintf(path, size, "%s/%s/%s.%s%s%s", store->dir, s->device, sample_sensor_name(s->sensor),
+             sample_metric_name(s->metric), file != NULL ? "/" : "", file != NULL ? file : "");
+}
+
+/**
+ * Map the last segment and the rollups of a series if they are not, and make
+ * it the most recently used one.
+ */
+static int series_map(colstore_t *store, colstore_series_t *s)
+{
+    if (s->mapped)
+    {
+        if (store->lru_first != s)
+        {
+            lru_unlink(store, s);
+            lru_push(store, s);
+        }
+        return 0;
+    }
+    if (store->n_mapped == COLSTORE_MAX_MAPPED)
+        series_unmap(store, store->lru_last);
+    s->segments = calloc(s->n_segments + 1, sizeof(s->segments[0]));
+    s->mapped = true;
+    store->n_mapped++;
+    lru_push(store, s);
+    if (s->segments == NULL || (s->n_segments > 0 && segment_map(store, s, s->n_segments - 1, 0) != 0)
+        || level_map(store, s, COLSTORE_1M) != 0 || level_map(store, s, COLSTORE_1H) != 0)
+    {
+        series_unmap(store, s);
+        return -1;
+    }
+    return 0;
+}
+
+/* the rows, exponent and last timestamp of a series, from its last segment */
+static void series_load(colstore_series_t *s)
+{
+    const colstore_segment_t *seg = &s->segments[s->n_segments - 1];
+    long rows = segment_rows(seg);
+
+    s->exponent = seg->columns[1]->exponent;
+    s->n_rows = (long)(s->n_segments - 1) * COLSTORE_SEGMENT_ROWS + rows;
+    if (rows > 0)
+        s->last_ts = segment_ts(seg)[rows - 1];
+}
+
+static void series_unmap(colstore_t *store, colstore_series_t *s)
+{
+    if (!s->mapped)
+        return;
+    for (int i = 0; s->segments != NULL && i < s->n_segments; i++)
+    {
+        for (int column = 0; column < 2; column++)
+        {
+            if (s->segments[i].columns[column] != NULL)
+                munmap(s->segments[i].columns[column],
+                       sizeof(colstore_column_t) + s->segments[i].capacity[column] * column_width[column]);
+        }
+    }
+    for (int level = 0; level < COLSTORE_N_LEVELS; level++)
+    {
+        if (s->levels[level].file != NULL)
+        {
+            munmap(s->levels[level].file,
+                   sizeof(colstore_rollup_file_t) + s->levels[level].capacity * sizeof(colstore_rollup_t));
+            s->levels[level].file = NULL;
+        }
+    }
+    free(s->segments);
+    s->segments = NULL;
+    s->mapped = false;
+    store->n_mapped--;
+    lru_unlink(store, s);
+}
+
+/**
+ * Store the buffered rows of a series in its last segment, grown or a new one
+ * when it is full, and add them to the rollups. If the series cannot be mapped
+ * or grown, the rows are lost.
+ */
+static int series_flush(colstore_t *store, colstore_series_t *s)
+{
+    colstore_segment_t *seg;
+    long i, offset;
+    int err = 0;
+
+    if (series_map(store, s) != 0)
+    {
+        s->n_buffered = 0;
+        return -1;
+    }
+    for (int row = 0; row < s->n_buffered; row++)
+    {
+        i = s->n_rows / COLSTORE_SEGMENT_ROWS;
+        offset = s->n_rows % COLSTORE_SEGMENT_ROWS;
+        if ((i == s->n_segments && segment_add(store, s) != 0)
+            || (offset == segment_capacity(&s->segments[i]) && segment_map(store, s, i, offset + 1) != 0))
+        {
+            err = -1;
+            break;
+        }
+        seg = &s->segments[i];
+        segment_ts(seg)[offset] = s->ts[row];
+        segment_values(seg)[offset] = s->values[row];
+        /* a reader sees the row once it is in both columns */
+        __atomic_store_n(&seg->columns[0]->n_rows, offset + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&seg->columns[1]->n_rows, offset + 1, __ATOMIC_RELEASE);
+        s->n_rows++;
+        store->n_bytes += sizeof(int64_t) + sizeof(int32_t);
+        for (int level = 0; level < COLSTORE_N_LEVELS; level++)
+            err |= rollup_add(store, s, level, s->ts[row], s->values[row]);
+    }
+    s->n_buffered = 0;
+    return err;
+}
+
+/**
+ * Map every segment of a series for reading, its buffered rows stored. In a
+ * store read while another process appends, pick up the new rows, segments
+ * and rollup records.
+ */
+static int series_use(colstore_t *store, colstore_series_t *s)
+{
+    char path[FILE_PATH_SIZE], name[16];
+    colstore_segment_t *segments;
+    struct stat st;
+    long rows;
+
+    if ((s->n_buffered > 0 && series_flush(store, s) != 0) || series_map(store, s) != 0)
+        return -1;
+    if (!store->writable)
+    {
+        while (segment_rows(&s->segments[s->n_segments - 1]) == COLSTORE_SEGMENT_ROWS)
+        {
+            snprintf(name, sizeof(name), "%06d.ts", s->n_segments);
+            series_path(store, s, name, path, sizeof(path));
+            if (stat(path, &st) != 0)
+                break;
+            if ((segments = realloc(s->segments, (s->n_segments + 1) * sizeof(s->segments[0]))) == NULL)
+                return -1;
+            s->segments = segments;
+            memset(&s->segments[s->n_segments], 0, sizeof(s->segments[0]));
+            if (segment_map(store, s, s->n_segments, 0) != 0)
+                return -1;
+            s->n_segments++;
+        }
+        series_load(s);
+        for (int level = 0; level < COLSTORE_N_LEVELS; level++)
+        {
+            if (__atomic_load_n(&s->levels[level].file->n_records, __ATOMIC_ACQUIRE) > s->levels[level].capacity
+                && level_map(store, s, level) != 0)
+                return -1;
+        }
+    }
+    for (int i = 0; i < s->n_segments; i++)
+    {
+        rows = i < s->n_segments - 1 ? COLSTORE_SEGMENT_ROWS : s->n_rows - (long)i * COLSTORE_SEGMENT_ROWS;
+        if ((s->segments[i].columns[0] == NULL || s->segments[i].columns[1] == NULL
+             || segment_capacity(&s->segments[i]) < rows)
+            && segment_map(store, s, i, 0) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * Rebuild the rollups of the last hour of a series from its rows: the writer
+ * may have stopped between a row and its records.
+ */
+static int series_recover(colstore_t *store, colstore_series_t *s)
+{
+    int64_t hour = floor_to(s->last_ts, HOUR_MS);
+    long row = s->n_rows;
+    int err = 0;
+
+    if (s->n_rows == 0)
+        return 0;
+    for (int level = 0; level < COLSTORE_N_LEVELS; level++)
+    {
+        colstore_rollup_file_t *f = s->levels[level].file;
+
+        f->n_records = record_seek(f, f->n_records, hour);
+    }
+    while (row > 0)
+    {
+        long i = (row - 1) / COLSTORE_SEGMENT_ROWS;
+
+        if (s->segments[i].columns[0] == NULL && segment_map(store, s, i, 0) != 0)
+            return -1;
+        if (row_ts(s, row - 1) < hour)
+            break;
+        row--;
+    }
+    for (; row < s->n_rows; row++)
+    {
+        const colstore_segment_t *seg = &s->segments[row / COLSTORE_SEGMENT_ROWS];
+        long offset = row % COLSTORE_SEGMENT_ROWS;
+
+        for (int level = 0; level < COLSTORE_N_LEVELS; level++)
+            err |= rollup_add(store, s, level, segment_ts(seg)[offset], segment_values(seg)[offset]);
+    }
+    return err;
+}
+
+/* create and map the next segment of a series */
+static int segment_add(colstore_t *store, colstore_series_t *s)
+{
+    colstore_segment_t *segments = realloc(s->segments, (s->n_segments + 1) * sizeof(s->segments[0]));
+
+    if (segments == NULL)
+        return -1;
+    s->segments = segments;
+    memset(&s->segments[s->n_segments], 0, sizeof(s->segments[0]));
+    if (segment_map(store, s, s->n_segments, 1) != 0)
+        return -1;
+    s->n_segments++;
+    return 0;
+}
+
+/* map both columns of a segment, see column_map() */
+static int segment_map(colstore_t *store, colstore_series_t *s, int i, long rows)
+{
+    for (int column = 0; column < 2; column++)
+    {
+        if (column_map(store, s, i, column, rows) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * Map a column of a segment, or map it again once it has grown. In a writable
+ * store, the file is created or grown by doubling to hold at least rows.
+ */
+static int column_map(colstore_t *store, colstore_series_t *s, int i, int column, long rows)
+{
+    char path[FILE_PATH_SIZE], name[16];
+    colstore_segment_t *seg = &s->segments[i];
+    colstore_column_t *c;
+    struct stat st;
+    long capacity;
+    int fd;
+
+    snprintf(name, sizeof(name), "%06d.%s", i, column_name[column]);
+    series_path(store, s, name, path, sizeof(path));
+    if ((fd = open(path, store->writable ? O_RDWR | O_CREAT : O_RDONLY, 0644)) < 0 || fstat(fd, &st) != 0)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    capacity = st.st_size < (off_t)sizeof(*c) ? 0 : (st.st_size - sizeof(*c)) / column_width[column];
+    if (store->writable && capacity < rows)
+    {
+        while (capacity < rows)
+            capacity = capacity ? 2 * capacity : SEGMENT_INITIAL_ROWS;
+        if (capacity > COLSTORE_SEGMENT_ROWS)
+            capacity = COLSTORE_SEGMENT_ROWS;
+        if (ftruncate(fd, sizeof(*c) + capacity * column_width[column]) != 0)
+        {
+            perror(path);
+            close(fd);
+            return -1;
+        }
+    }
+    if (seg->columns[column] != NULL)
+        munmap(seg->columns[column], sizeof(*c) + seg->capacity[column] * column_width[column]);
+    seg->columns[column] = NULL;
+    c = capacity == 0 ? MAP_FAILED
+                      : mmap(NULL, sizeof(*c) + capacity * column_width[column],
+                             PROT_READ | (store->writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+    close(fd);
+    if (c == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: %s\n", path, capacity == 0 ? "not a column" : strerror(errno));
+        return -1;
+    }
+    if (c->magic[0] == '\0' && store->writable)
+    {
+        memcpy(c->magic, "ENVC", 4);
+        c->version = COLSTORE_VERSION;
+        c->column = column;
+        c->exponent = s->exponent;
+    }
+    if (memcmp(c->magic, "ENVC", 4) != 0 || c->version != COLSTORE_VERSION || c->column != column)
+    {
+        fprintf(stderr, "%s: not a column of version %d\n", path, COLSTORE_VERSION);
+        munmap(c, sizeof(*c) + capacity * column_width[column]);
+        return -1;
+    }
+    seg->columns[column] = c;
+    seg->capacity[column] = capacity;
+    return 0;
+}
+
+/**
+ * Map a rollup file of a series, or map it again once it has grown. In a
+ * writable store, the file is created or grown to hold at least one more
+ * record.
+ */
+static int level_map(colstore_t *store, colstore_series_t *s, int level)
+{
+    char path[FILE_PATH_SIZE], name[16];
+    colstore_level_t *l = &s->levels[level];
+    colstore_rollup_file_t *f;
+    struct stat st;
+    long capacity;
+    int fd;
+
+    snprintf(name, sizeof(name), "%s.rollup", level_name[level]);
+    series_path(store, s, name, path, sizeof(path));
+    if ((fd = open(path, store->writable ? O_RDWR | O_CREAT : O_RDONLY, 0644)) < 0 || fstat(fd, &st) != 0)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    capacity = st.st_size < (off_t)sizeof(*f) ? 0 : (st.st_size - sizeof(*f)) / sizeof(colstore_rollup_t);
+    if (store->writable && (capacity == 0 || (l->file != NULL && l->file->n_records == capacity)))
+    {
+        capacity = capacity ? 2 * capacity : ROLLUP_INITIAL;
+        if (ftruncate(fd, sizeof(*f) + capacity * sizeof(colstore_rollup_t)) != 0)
+        {
+            perror(path);
+            close(fd);
+            return -1;
+        }
+    }
+    if (l->file != NULL)
+        munmap(l->file, sizeof(*f) + l->capacity * sizeof(colstore_rollup_t));
+    l->file = NULL;
+    f = capacity == 0 ? MAP_FAILED
+                      : mmap(NULL, sizeof(*f) + capacity * sizeof(colstore_rollup_t),
+                             PROT_READ | (store->writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+    close(fd);
+    if (f == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: %s\n", path, capacity == 0 ? "not a rollup file" : strerror(errno));
+        return -1;
+    }
+    if (f->magic[0] == '\0' && store->writable)
+    {
+        memcpy(f->magic, "ENVR", 4);
+        f->version = COLSTORE_VERSION;
+        f->width = level_width[level];
+    }
+    if (memcmp(f->magic, "ENVR", 4) != 0 || f->version != COLSTORE_VERSION || f->width != level_width[level])
+    {
+        fprintf(stderr, "%s: not a rollup file of version %d\n", path, COLSTORE_VERSION);
+        munmap(f, sizeof(*f) + capacity * sizeof(colstore_rollup_t));
+        return -1;
+    }
+    l->file = f;
+    l->capacity = capacity;
+    return 0;
+}
+
+/* add a value to the last record of a rollup, or to a new one */
+static int rollup_add(colstore_t *store, colstore_series_t *s, int level, int64_t ts, int32_t value)
+{
+    int64_t start = floor_to(ts, level_width[level]);
+    colstore_rollup_file_t *f = s->levels[level].file;
+    colstore_rollup_t *r;
+    long n = f->n_records;
+
+    if (n > 0 && f->records[n - 1].start == start)
+    {
+        r = &f->records[n - 1];
+        if (value < r->min)
+            r->min = value;
+        if (value > r->max)
+            r->max = value;
+        r->sum += value;
+        r->count++;
+        return 0;
+    }
+    if (n == s->levels[level].capacity)
+    {
+        if (level_map(store, s, level) != 0)
+            return -1;
+        f = s->levels[level].file;
+    }
+    f->records[n] = (colstore_rollup_t){.start = start, .min = value, .max = value, .sum = value, .count = 1};
+    __atomic_store_n(&f->n_records, n + 1, __ATOMIC_RELEASE);
+    store->n_bytes += sizeof(colstore_rollup_t);
+    return 0;
+}
+
+/* the segment of the row is mapped */
+static int64_t row_ts(const colstore_series_t *s, long row)
+{
+    return segment_ts(&s->segments[row / COLSTORE_SEGMENT_ROWS])[row % COLSTORE_SEGMENT_ROWS];
+}
+
+/**
+ * Find the first row at or after a time, extending the sparse index to the
+ * rows appended since the last seek: a binary search in the index, then in
+ * the stride of rows it points to.
+ * \return the row, s->n_rows if there is none.
+ */
+static long row_seek(colstore_series_t *s, int64_t ts)
+{
+    long n_index = (s->n_rows + COLSTORE_INDEX_STRIDE - 1) / COLSTORE_INDEX_STRIDE;
+    long lo = 0, hi, mid;
+    int64_t *index;
+
+    if (n_index > s->n_index)
+    {
+        if ((index = realloc(s->index, n_index * sizeof(int64_t))) == NULL)
+            n_index = s->n_index; /* searched in the rows past the index */
+        else
+            s->index = index;
+        for (; s->n_index < n_index; s->n_index++)
+            s->index[s->n_index] = row_ts(s, s->n_index * COLSTORE_INDEX_STRIDE);
+    }
+    /* the first stride starting at or after ts */
+    for (hi = s->n_index; lo < hi;)
+    {
+        mid = (lo + hi) / 2;
+        if (s->index[mid] < ts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return 0;
+    /* in the previous one, or the first row of this one */
+    hi = lo == s->n_index ? s->n_rows : lo * COLSTORE_INDEX_STRIDE;
+    lo = (lo - 1) * COLSTORE_INDEX_STRIDE + 1;
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (row_ts(s, mid) < ts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* the first record starting at or after a time */
+static long record_seek(const colstore_rollup_file_t *f, long n_records, int64_t start)
+{
+    long lo = 0, hi = n_records, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (f->records[mid].start < start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void add_rows(colstore_series_t *s, int64_t from, int64_t to, colstore_stats_t *stats)
+{
+    int64_t ts;
+    int32_t value;
+
+    for (long row = row_seek(s, from); row < s->n_rows && (ts = row_ts(s, row)) < to; row++)
+    {
+        value = segment_values(&s->segments[row / COLSTORE_SEGMENT_ROWS])[row % COLSTORE_SEGMENT_ROWS];
+        if (value < stats->min)
+            stats->min = value;
+        if (value > stats->max)
+            stats->max = value;
+        stats->sum += value;
+        stats->count++;
+    }
+}
+
+static void add_records(const colstore_rollup_file_t *f, int64_t from, int64_t to, colstore_stats_t *stats)
+{
+    long n_records = __atomic_load_n(&f->n_records, __ATOMIC_ACQUIRE);
+
+    for (long i = record_seek(f, n_records, from); i < n_records && f->records[i].start < to; i++)
+    {
+        if (f->records[i].min < stats->min)
+            stats->min = f->records[i].min;
+        if (f->records[i].max > stats->max)
+            stats->max = f->records[i].max;
+        stats->sum += f->records[i].sum;
+        stats->count += f->records[i].count;
+    }
+}
+
+/* the whole minutes of a range from the 1 min rollups, the rest from the rows */
+static void add_minutes(colstore_series_t *s, int64_t from, int64_t to, colstore_stats_t *stats)
+{
+    int64_t first_minute = floor_to(from + MINUTE_MS - 1, MINUTE_MS);
+    int64_t last_minute = floor_to(to, MINUTE_MS);
+
+    if (first_minute >= last_minute)
+    {
+        add_rows(s, from, to, stats);
+        return;
+    }
+    add_rows(s, from, first_minute, stats);
+    add_records(s->levels[COLSTORE_1M].file, first_minute, last_minute, stats);
+    add_rows(s, last_minute, to, stats);
+}
+
+static void lru_unlink(colstore_t *store, colstore_series_t *s)
+{
+    if (s->lru_prev != NULL)
+        s->lru_prev->lru_next = s->lru_next;
+    else
+        store->lru_first = s->lru_next;
+    if (s->lru_next != NULL)
+        s->lru_next->lru_prev = s->lru_prev;
+    else
+        store->lru_last = s->lru_prev;
+    s->lru_prev = s->lru_next = NULL;
+}
+
+static void lru_push(colstore_t *store, colstore_series_t *s)
+{
+    s->lru_next = store->lru_first;
+    if (store->lru_first != NULL)
+        store->lru_first->lru_prev = s;
+    else
+        store->lru_last = s;
+    store->lru_first = s;
+}
+
+static int table_grow(colstore_t *store)
+{
+    colstore_series_t **old = store->table;
+    int old_size = store->size;
+    uint32_t j;
+
+    store->size *= 2;
+    if ((store->table = calloc(store->size, sizeof(store->table[0]))) == NULL)
+        return -1;
+    for (int i = 0; i < old_size; i++)
+    {
+        if (old[i] == NULL)
+            continue;
+        for (j = series_hash(old[i]->device, old[i]->sensor, old[i]->metric) & (store->size - 1); store->table[j];
+             j = (j + 1) & (store->size - 1))
+            ;
+        store->table[j] = old[i];
+    }
+    free(old);
+    return 0;
+}
@@ -0,0 +1,136 @@
+#ifndef __COLSTORE_H__
+#define __COLSTORE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Columnar store of sample series
+ *
+ * A series holds the samples of one metric of one sensor of one device, in
+ * the directory <dir>/<device>/<sensor>.<metric>:
+ *   000000.ts, 000000.val, 000001.ts, ...
+ *       segments of COLSTORE_SEGMENT_ROWS rows at most: the timestamp column
+ *       (int64, ms since the Unix epoch) and the value column (int32), fixed
+ *       width, little endian, after a 16-byte header
+ *   1m.rollup, 1h.rollup
+ *       a 32-byte header, then one record per minute or hour holding samples:
+ *       start, min, max, sum and count of the values
+ * Column header: magic "ENVC", version, column (0 timestamps, 1 values),
+ * exponent of the values, a reserved byte, number of rows (uint32) and 4
+ * reserved bytes. Rollup header: magic "ENVR", version, 3 reserved bytes,
+ * bucket width in ms and number of records (int64), 8 reserved bytes. The
+ * files grow by doubling as rows and records are added.
+ *
+ * The files are memory-mapped. The rows appended to a series are buffered,
+ * COLSTORE_BUFFER_ROWS at most, then stored in its last segment while the
+ * last record of each rollup is updated, or one is added: a series is mapped
+ * once per buffer rather than per row. The timestamps of a series only
+ * increase: older samples and duplicates, e.g. a sample received both as text
+ * and in a CBOR cycle, are dropped. On opening a series for writing, the
+ * rollups of its last hour are rebuilt from the rows, in case the writer
+ * stopped between the two.
+ *
+ * A sparse index, the timestamp of every COLSTORE_INDEX_STRIDE-th row, is
+ * built on the first read of a series: a seek is a binary search in it, then
+ * in one stride of rows. A range query takes the whole hours from the 1 h
+ * rollups, the minutes at the edges from the 1 min ones and the rest from the
+ * rows: a year of data is about 9k records, plus at most 118 and two minutes
+ * of rows.
+ *
+ * At most COLSTORE_MAX_MAPPED series are mapped at a time, the least recently
+ * used one is unmapped to make room: a fleet has more series than a process
+ * has mappings (vm.max_map_count).
+ */
+#define COLSTORE_VERSION       2
+#define COLSTORE_SEGMENT_ROWS  (1 << 20)
+#define COLSTORE_INDEX_STRIDE  4096
+#define COLSTORE_BUFFER_ROWS   64
+#define COLSTORE_MAX_MAPPED    8192
+#define COLSTORE_N_LEVELS      2
+#define COLSTORE_NAME_MAX_SIZE 32
+#define COLSTORE_PATH_MAX_SIZE 256
+
+typedef enum colstore_level_id
+{
+    COLSTORE_1M,
+    COLSTORE_1H
+} colstore_level_id_t;
+
+typedef struct colstore_rollup
+{
+    int64_t  start; /* ms since the Unix epoch */
+    int32_t  min;
+    int32_t  max;
+    int64_t  sum;
+    uint32_t count;
+    uint32_t reserved;
+} colstore_rollup_t;
+
+typedef struct colstore_level
+{
+    struct colstore_rollup_file *file;
+    long                         capacity; /* records mapped */
+} colstore_level_t;
+
+typedef struct colstore_segment
+{
+    struct colstore_column *columns[2];  /* timestamps and values, mapped on use */
+    long                    capacity[2]; /* rows mapped */
+} colstore_segment_t;
+
+typedef struct colstore_series
+{
+    char                    device[COLSTORE_NAME_MAX_SIZE];
+    uint8_t                 sensor;
+    uint8_t                 metric;
+    int8_t                  exponent;
+    int64_t                 last_ts;
+    long                    n_rows; /* stored */
+    int64_t                 ts[COLSTORE_BUFFER_ROWS];
+    int32_t                 values[COLSTORE_BUFFER_ROWS];
+    int                     n_buffered;
+    colstore_segment_t     *segments;
+    int                     n_segments;
+    colstore_level_t        levels[COLSTORE_N_LEVELS];
+    bool                    mapped;
+    int64_t                *index;
+    long                    n_index;
+    struct colstore_series *lru_prev;
+    struct colstore_series *lru_next;
+} colstore_series_t;
+
+typedef struct colstore
+{
+    char                dir[COLSTORE_PATH_MAX_SIZE];
+    bool                writable;
+    colstore_series_t **table;     /* open addressing */
+    int                 size;
+    int                 n_series;
+    int                 n_mapped;
+    colstore_series_t  *lru_first; /* most recently used */
+    colstore_series_t  *lru_last;
+    long                n_rows;    /* appended */
+    long                n_dropped;
+    long                n_bytes;   /* stored, rollups included */
+} colstore_t;
+
+typedef struct colstore_stats
+{
+    int64_t count;
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+} colstore_stats_t;
+
+int                colstore_open(colstore_t *, const char *, bool);
+colstore_series_t *colstore_series(colstore_t *, const char *, uint8_t, uint8_t, int8_t);
+int                colstore_append(colstore_t *, colstore_series_t *, int64_t, int32_t, int8_t);
+int                colstore_flush(colstore_t *);
+void               colstore_close(colstore_t *);
+int                colstore_query(colstore_t *, colstore_series_t *, int64_t, int64_t, colstore_stats_t *);
+long               colstore_read(colstore_t *, colstore_series_t *, int64_t, int64_t, int64_t *, int32_t *, long);
+long               colstore_rollups(colstore_t *, colstore_series_t *, colstore_level_id_t, int64_t, int64_t,
+                                    colstore_rollup_t *, long);
+
+#endif /* __COLSTORE_H__ */
@@ -0,0 +1,86 @@
+#!/bin/sh
+#
+# End-to-end latency benchmark against a local Mosquitto broker.
+#
+# usage: e2e_bench.sh [-p port] [-t duration_s] [-w warmup_s] [-d] [scenario...]
+#
+# For each scenario, a broker is started on the port, a subscriber records
+# every message of the device, the device is configured through the command
+# topic (see config.h) and e2e_latency (make e2e_latency) summarizes the run.
+# A scenario is a name and its commands, e.g. 'batch10=raw 0; batch 10'.
+# Without scenarios, the baseline of seven raw text publishes per cycle is
+# run, then with QoS 1, then compressed batches of 1, 10 and 60 cycles.
+#
+# The device is the host build (make -C ../sim), run at real time with a
+# fresh state so that each scenario starts from the firmware defaults. With
+# -d, a device configured for this broker is used instead: the scenario runs
+# for the duration from the moment the commands are sent, and the drop rate
+# is not known.
+#
+# Output: "scenario=<name>" then the lines of e2e_latency.
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+SIM=$DIR/../sim/envmon_sim
+PORT=18830
+DURATION=60
+WARMUP=10
+DEVICE=0
+PREFIX=vn170735
+RAW="mcp9700/temp vma311/temp vma311/humidity bme680/temp bme680/humidity bme680/pressure bme680/gas_resistance"
+
+while getopts p:t:w:dh opt; do
+    case $opt in
+        p) PORT=$OPTARG ;;
+        t) DURATION=$OPTARG ;;
+        w) WARMUP=$OPTARG ;;
+        d) DEVICE=1 ;;
+        *) echo "usage: $0 [-p port] [-t duration_s] [-w warmup_s] [-d] [scenario...]" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -eq 0 ]; then
+    qos1="raw 1"
+    for topic in $RAW; do
+        qos1="$qos1; qos $PREFIX/$topic 1"
+    done
+    set -- "baseline=raw 1" "qos1=$qos1" "batch1=raw 0; batch 1" "batch10=raw 0; batch 10" \
+           "batch60=raw 0; batch 60"
+fi
+
+WORK=$(mktemp -d)
+trap 'kill $(jobs -p) 2>/dev/null; rm -rf "$WORK"' EXIT INT TERM
+
+mosquitto -p "$PORT" >"$WORK/mosquitto.log" 2>&1 &
+sleep 1
+
+for scenario in "$@"; do
+    name=${scenario%%=*}
+    commands=${scenario#*=}
+    rm -rf "$WORK/state" && mkdir "$WORK/state"
+
+    mosquitto_sub -h localhost -p "$PORT" -t "$PREFIX/#" -q 1 -v -F '%U %t %x' >"$WORK/received" &
+    sub=$!
+    sleep 1
+    if [ $DEVICE -eq 0 ]; then
+        "$SIM" -x 1 -q -m "mqtt://localhost:$PORT" -d "$WORK/state" -o "$WORK/traffic" \
+               -t $((DURATION + 5)) >/dev/null &
+        sim=$!
+        sleep 5 # association and connection
+    fi
+    mosquitto_pub -h localhost -p "$PORT" -t "$PREFIX/config/cmd" -q 1 -m "$commands"
+    if [ $DEVICE -eq 0 ]; then
+        wait $sim
+    else
+        sleep "$DURATION"
+    fi
+    sleep 1 # the last acknowledgements
+    kill $sub
+
+    echo "scenario=$name"
+    if [ $DEVICE -eq 0 ]; then
+        "$DIR/e2e_latency" -w "$WARMUP" -o "$WORK/traffic" <"$WORK/received"
+    else
+        "$DIR/e2e_latency" -w "$WARMUP" <"$WORK/received"
+    fi
+done
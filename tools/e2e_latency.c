@@ -0,0 +1,241 @@
+/*
+ * End-to-end latency of the samples, from their acquisition to their receipt
+ * by a subscriber of the broker.
+ *
+ * usage: mosquitto_sub -h host -t 'vn170735/#' -v -F '%U %t %x' | e2e_latency [-o traffic] [-w warmup_s]
+ *
+ * Each input line is one received message: the Unix time of its receipt with
+ * ns, its topic and its payload in hexadecimal. The acquisition time is the
+ * "ts" member of the JSON payloads, the base timestamp plus the offsets of the
+ * CBOR cycles (/samples, see sample.h) and the timestamps of the compressed
+ * batches (/batch, see tsc.h). Messages without one, the commands and
+ * summaries, only count in the throughput.
+ *
+ * With the traffic log of the host build (envmon_sim -o), the messages the
+ * device published but the subscriber did not get are counted as dropped.
+ * The first warmup_s seconds of messages are left out of the latency, so that
+ * the connection and the first cycle do not weigh on the distribution.
+ *
+ * One line per topic, then the totals:
+ *   topic=<t> messages=<n> samples=<n> bytes=<b> p50_ms= p95_ms= p99_ms= max_ms= [sent=<n> drop_rate=]
+ *   all messages=<n> samples=<n> bytes=<b> duration_s= msg_per_s= samples_per_s= bytes_per_s= p50_ms= ... [sent= drop_rate=]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sample_decode.h"
+#include "tsc_decode.h"
+
+#define MAX_TOPICS       64
+#define TOPIC_MAX_SIZE   128
+#define LINE_MAX_SIZE    (2 * 65536 + 256)
+#define PAYLOAD_MAX_SIZE 65536
+#define MAX_SAMPLES      4096
+
+typedef struct latencies
+{
+    double *ms;
+    int     n;
+    int     size;
+} latencies_t;
+
+typedef struct topic
+{
+    char        name[TOPIC_MAX_SIZE];
+    long        messages;
+    long        samples;
+    long        bytes;
+    long        sent;
+    latencies_t latencies;
+} topic_t;
+
+static topic_t  topics[MAX_TOPICS];
+static int      n_topics;
+static char     line[LINE_MAX_SIZE];
+static uint8_t  payload[PAYLOAD_MAX_SIZE + 1];
+static sample_t samples[MAX_SAMPLES];
+
+static topic_t *find_topic(const char *name)
+{
+    for (int i = 0; i < n_topics; i++)
+    {
+        if (strcmp(topics[i].name, name) == 0)
+            return &topics[i];
+    }
+    if (n_topics == MAX_TOPICS)
+        return NULL;
+    snprintf(topics[n_topics].name, TOPIC_MAX_SIZE, "%s", name);
+    return &topics[n_topics++];
+}
+
+static void add_latency(latencies_t *l, double ms)
+{
+    if (l->n == l->size)
+    {
+        l->size = l->size ? 2 * l->size : 1024;
+        l->ms = realloc(l->ms, l->size * sizeof(double));
+        if (l->ms == NULL)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    l->ms[l->n++] = ms;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* nearest rank, l->ms sorted */
+static double percentile(const latencies_t *l, int p)
+{
+    int rank = (int)(((long)p * l->n + 99) / 100);
+
+    return l->n ? l->ms[rank > 0 ? rank - 1 : 0] : 0;
+}
+
+static int decode_hex(const char *hex, uint8_t *out, int max)
+{
+    unsigned byte;
+    int n = 0;
+
+    while (hex[0] && hex[1] && n < max && sscanf(hex, "%2x", &byte) == 1)
+    {
+        out[n++] = byte;
+        hex += 2;
+    }
+    return n;
+}
+
+/* acquisition times of the samples of a message, in ms since the epoch */
+static int decode_timestamps(const char *topic, uint8_t *data, int len)
+{
+    const char *suffix = strrchr(topic, '/');
+    const char *ts;
+    int n;
+
+    if (suffix != NULL && strcmp(suffix, "/samples") == 0)
+        return sample_decode_cbor(data, len, samples, MAX_SAMPLES);
+    if (suffix != NULL && strcmp(suffix, "/batch") == 0)
+        return tsc_decode(data, len, samples, MAX_SAMPLES);
+    data[len] = '\0';
+    if (data[0] != '{' || (ts = strstr((const char *)data, "\"ts\":")) == NULL)
+        return 0;
+    n = sscanf(ts + 5, "%lld", (long long *)&samples[0].timestamp);
+    return n == 1 && samples[0].timestamp > 0;
+}
+
+/* the MQTT messages of the traffic log: "time_ms proto topic qos payload" */
+static void load_traffic(const char *path)
+{
+    char proto[8], name[TOPIC_MAX_SIZE];
+    FILE *f = fopen(path, "r");
+    topic_t *t;
+    long ms;
+
+    if (f == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (sscanf(line, "%ld %7s %127s", &ms, proto, name) == 3 && strcmp(proto, "mqtt") == 0
+            && (t = find_topic(name)) != NULL)
+            t->sent++;
+    }
+    fclose(f);
+}
+
+static void print_stats(latencies_t *l)
+{
+    qsort(l->ms, l->n, sizeof(double), compare_double);
+    printf(" p50_ms=%.2f p95_ms=%.2f p99_ms=%.2f max_ms=%.2f", percentile(l, 50), percentile(l, 95),
+           percentile(l, 99), l->n ? l->ms[l->n - 1] : 0);
+}
+
+static void print_drops(long received, long sent)
+{
+    if (sent > 0)
+        printf(" sent=%ld drop_rate=%.4f", sent, received < sent ? 1.0 - (double)received / sent : 0);
+}
+
+int main(int argc, char **argv)
+{
+    char name[TOPIC_MAX_SIZE];
+    const char *traffic = NULL;
+    double warmup_s = 0;
+    double first = 0, last = 0, received;
+    long messages = 0, n_samples = 0, bytes = 0, sent = 0, delivered = 0;
+    latencies_t all = {0};
+    topic_t *t;
+    int offset, len, n, opt;
+
+    while ((opt = getopt(argc, argv, "o:w:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'o':
+                traffic = optarg;
+                break;
+            case 'w':
+                warmup_s = atof(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: mosquitto_sub -v -F '%%U %%t %%x' ... | %s [-o traffic] [-w warmup_s]\n",
+                        argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (traffic != NULL)
+        load_traffic(traffic);
+
+    while (fgets(line, sizeof(line), stdin) != NULL)
+    {
+        if (sscanf(line, "%lf %127s %n", &received, name, &offset) != 2 || (t = find_topic(name)) == NULL)
+            continue;
+        line[offset + strcspn(line + offset, "\r\n")] = '\0';
+        len = decode_hex(line + offset, payload, PAYLOAD_MAX_SIZE);
+        if (messages++ == 0)
+            first = received;
+        last = received;
+        bytes += len;
+        t->messages++;
+        t->bytes += len;
+        if ((n = decode_timestamps(name, payload, len)) <= 0)
+            continue;
+        t->samples += n;
+        n_samples += n;
+        if (received - first < warmup_s)
+            continue;
+        for (int i = 0; i < n; i++)
+        {
+            add_latency(&t->latencies, received * 1000 - samples[i].timestamp);
+            add_latency(&all, received * 1000 - samples[i].timestamp);
+        }
+    }
+
+    for (int i = 0; i < n_topics; i++)
+    {
+        t = &topics[i];
+        sent += t->sent;
+        delivered += t->sent > 0 ? t->messages : 0; /* the commands are not from the device */
+        printf("topic=%s messages=%ld samples=%ld bytes=%ld", t->name, t->messages, t->samples, t->bytes);
+        print_stats(&t->latencies);
+        print_drops(t->messages, t->sent);
+        putchar('\n');
+    }
+    printf("all messages=%ld samples=%ld bytes=%ld duration_s=%.1f", messages, n_samples, bytes, last - first);
+    if (last > first)
+        printf(" msg_per_s=%.2f samples_per_s=%.2f bytes_per_s=%.1f", messages / (last - first),
+               n_samples / (last - first), bytes / (last - first));
+    print_stats(&all);
+    print_drops(delivered, sent);
+    putchar('\n');
+    return 0;
+}
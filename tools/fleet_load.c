@@ -0,0 +1,820 @@
+/*
+ * Fleet load generator: virtual envmon devices publishing to an MQTT broker.
+ *
+ * usage: fleet_load [-H host] [-p port] [-n devices] [-u prefix] [-c cycle_ms] [-j jitter_ms]
+ *                   [-b batch_cycles] [-q qos] [-R connects_per_s] [-S storm_period_s]
+ *                   [-w watched] [-t duration_s] [-i interval_s]
+ *
+ * Each device has its own connection and publishes what the firmware does,
+ * with <user> its prefix followed by its number:
+ *   raw mode (-b 0, the default):
+ *     <user>/mcp9700/temp, <user>/vma311/{temp,humidity},
+ *     <user>/bme680/{temp,humidity,pressure,gas_resistance}
+ *       {"value":<text>,"ts":<ms>}                      QoS -q
+ *     <user>/samples   the cycle in CBOR (see sample.h)  QoS -q
+ *   batch mode (-b cycles): <user>/batch, the cycles compressed as batch.c
+ *     does (see tsc.h), QoS 1
+ *   both: <user>/fused/{temp,humidity}
+ *       {"value":<text>,"ts":<ms>,"ci95":<x>,"faulty":0}  QoS 1
+ * A cycle starts every cycle_ms, give or take jitter_ms. The values are
+ * random walks around indoor conditions.
+ *
+ * The devices connect at connects_per_s (0: all at once). Every
+ * storm_period_s, all of them drop their connection and connect again at that
+ * rate, as after an outage of the access point or the broker. One event loop
+ * on epoll runs every connection, so the limit is the number of descriptors
+ * (ulimit -n) and local ports.
+ *
+ * Broker-side latency is measured twice: the PUBACK round trip of the QoS 1
+ * messages, and the delivery to a subscriber of the first watched devices,
+ * from the "ts" and CBOR/batch timestamps of the payloads. Each interval
+ * prints one line, the totals follow at the end:
+ *   t=<s> connected=<n> msg_per_s= bytes_per_s= samples_per_s= connects= failures= drops=
+ *         connect_p50_ms= connect_p99_ms= puback_p50_ms= puback_p99_ms= delivery_p50_ms= delivery_p99_ms=
+ *   total messages=<n> bytes=<b> samples=<n> msg_per_s= ... delivered=<n>
+ * The percentiles are bucket bounds of histogram.c.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "../histogram.h"
+#include "../sample.h"
+#include "../tsc.h"
+#include "sample_decode.h"
+#include "tsc_decode.h"
+
+#define USER_MAX_SIZE    32
+#define TOPIC_MAX_SIZE   64
+#define N_RAW            7
+#define N_SAMPLES        (N_RAW + 2)
+#define BATCH_MAX_SIZE   256 /* MQTT_DATA_MAX_SIZE */
+#define CBOR_MAX_SIZE    256
+#define RX_SIZE          64
+#define WATCH_RX_SIZE    65536
+#define TX_MAX_SIZE      65536 /* unsent bytes of a device beyond which messages are dropped */
+#define N_INFLIGHT       64
+#define KEEPALIVE_S      120
+#define CONNECT_TIMEOUT  10000000000LL /* ns */
+#define RETRY_NS         1000000000LL
+#define MAX_EVENTS       1024
+#define NS_PER_MS        1000000LL
+
+typedef enum
+{
+    DEVICE_IDLE,
+    DEVICE_CONNECTING, /* TCP */
+    DEVICE_CONNACK,
+    DEVICE_CONNECTED
+} device_state_t;
+
+typedef struct device
+{
+    int            index;
+    int            fd;
+    device_state_t state;
+    bool           watcher;       /* subscribes to the watched devices instead of publishing */
+    char           user[USER_MAX_SIZE];
+    int64_t        due_ns;        /* next cycle, connection attempt or timeout */
+    int            heap_pos;
+    int64_t        connect_ns;
+    uint16_t       msg_id;
+    int64_t        inflight[N_INFLIGHT]; /* send time by msg_id, 0 once acknowledged */
+    uint8_t       *rx;
+    int            rx_len;
+    int            rx_size;
+    uint8_t       *tx;
+    int            tx_len;
+    int            tx_size;
+    double         temp;          /* random walks */
+    double         rh;
+    double         pressure;
+    double         gas;
+    tsc_encoder_t  enc;
+    bool           batch_open;
+    uint8_t        batch[BATCH_MAX_SIZE];
+} device_t;
+
+typedef struct stats
+{
+    long        messages;
+    long        bytes;
+    long        samples;
+    long        connects;
+    long        failures;
+    long        drops;
+    long        delivered;
+    histogram_t connect;
+    histogram_t puback;
+    histogram_t delivery;
+} stats_t;
+
+static const char *const raw_topics[N_RAW] = {
+    "mcp9700/temp", "vma311/temp", "vma311/humidity", "bme680/temp",
+    "bme680/humidity", "bme680/pressure", "bme680/gas_resistance",
+};
+
+static struct addrinfo *broker;
+static device_t       **heap;
+static int              heap_len;
+static device_t        *devices;
+static int              n_devices;
+static int              epoll_fd;
+static stats_t          interval;
+static stats_t          total;
+static volatile bool    stopping;
+static const char      *prefix = "fleet";
+static int64_t          cycle_ns = 5000 * NS_PER_MS;
+static int64_t          jitter_ns = 100 * NS_PER_MS;
+static int              batch_cycles;
+static int              qos;
+static double           connect_rate = 1000;
+static int              n_watched = 10;
+static int64_t          next_connect_ns; /* when the next connection may start */
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t epoch_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static double uniform(double a, double b)
+{
+    return a + (b - a) * rand() / ((double)RAND_MAX + 1);
+}
+
+static void count(stats_t *s, long messages, long bytes, long samples)
+{
+    s->messages += messages;
+    s->bytes += bytes;
+    s->samples += samples;
+}
+
+/* timers: a binary min-heap of the devices by due_ns */
+
+static void heap_swap(int i, int j)
+{
+    device_t *d = heap[i];
+
+    heap[i] = heap[j];
+    heap[j] = d;
+    heap[i]->heap_pos = i;
+    heap[j]->heap_pos = j;
+}
+
+static void heap_fix(device_t *d)
+{
+    int i = d->heap_pos, child;
+
+    while (i > 0 && heap[(i - 1) / 2]->due_ns > heap[i]->due_ns)
+    {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    for (;;)
+    {
+        child = 2 * i + 1;
+        if (child >= heap_len)
+            break;
+        if (child + 1 < heap_len && heap[child + 1]->due_ns < heap[child]->due_ns)
+            child++;
+        if (heap[i]->due_ns <= heap[child]->due_ns)
+            break;
+        heap_swap(i, child);
+        i = child;
+    }
+}
+
+static void schedule(device_t *d, int64_t due_ns)
+{
+    d->due_ns = due_ns;
+    heap_fix(d);
+}
+
+/* the connection rate is a schedule shared by all devices */
+static int64_t connect_slot(int64_t now)
+{
+    if (connect_rate <= 0)
+        return now;
+    if (next_connect_ns < now)
+        next_connect_ns = now;
+    next_connect_ns += (int64_t)(1e9 / connect_rate);
+    return next_connect_ns;
+}
+
+/* MQTT packets */
+
+static int put_string(uint8_t *p, const char *s)
+{
+    int len = strlen(s);
+
+    p[0] = len >> 8;
+    p[1] = len & 0xff;
+    memcpy(&p[2], s, len);
+    return 2 + len;
+}
+
+static void watch_events(device_t *d)
+{
+    struct epoll_event ev = {.events = EPOLLIN | (d->tx_len > 0 || d->state == DEVICE_CONNECTING ? EPOLLOUT : 0),
+                             .data.ptr = d};
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, d->fd, &ev);
+}
+
+/* write what the socket takes, keep the rest for EPOLLOUT */
+static bool device_flush(device_t *d)
+{
+    ssize_t n;
+
+    while (d->tx_len > 0)
+    {
+        n = send(d->fd, d->tx, d->tx_len, MSG_NOSIGNAL);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        memmove(d->tx, d->tx + n, d->tx_len - n);
+        d->tx_len -= n;
+    }
+    return true;
+}
+
+static bool device_send(device_t *d, uint8_t type, const uint8_t *body, int body_len, const void *payload,
+                        int payload_len)
+{
+    int remaining = body_len + payload_len;
+    int len = 1;
+    bool pending = d->tx_len > 0;
+
+    if (d->tx_len + 5 + remaining > TX_MAX_SIZE)
+    {
+        interval.drops++;
+        total.drops++;
+        return false;
+    }
+    if (d->tx_len + 5 + remaining > d->tx_size)
+    {
+        d->tx_size = d->tx_len + 5 + remaining + 1024;
+        d->tx = realloc(d->tx, d->tx_size);
+    }
+    d->tx[d->tx_len] = type;
+    do
+    {
+        d->tx[d->tx_len + len++] = (remaining & 0x7f) | (remaining > 0x7f ? 0x80 : 0);
+        remaining >>= 7;
+    } while (remaining > 0);
+    memcpy(d->tx + d->tx_len + len, body, body_len);
+    memcpy(d->tx + d->tx_len + len + body_len, payload, payload_len);
+    d->tx_len += len + body_len + payload_len;
+    if (!pending && d->state != DEVICE_CONNECTING)
+    {
+        device_flush(d);
+        if (d->tx_len > 0)
+            watch_events(d);
+    }
+    return true;
+}
+
+static void device_publish(device_t *d, const char *topic, const void *payload, int len, int q, int n_samples)
+{
+    char name[USER_MAX_SIZE + TOPIC_MAX_SIZE];
+    uint8_t body[2 + sizeof(name) + 2];
+    int body_len;
+
+    snprintf(name, sizeof(name), "%s/%s", d->user, topic);
+    body_len = put_string(body, name);
+    if (q > 0)
+    {
+        d->msg_id = d->msg_id % 0xffff + 1;
+        body[body_len++] = d->msg_id >> 8;
+        body[body_len++] = d->msg_id & 0xff;
+    }
+    if (!device_send(d, 0x30 | q << 1, body, body_len, payload, len))
+        return;
+    if (q > 0)
+        d->inflight[d->msg_id % N_INFLIGHT] = now_ns();
+    count(&interval, 1, len, n_samples);
+    count(&total, 1, len, n_samples);
+}
+
+static void device_close(device_t *d, int64_t retry_ns)
+{
+    if (d->fd >= 0)
+        close(d->fd); /* also leaves the epoll set */
+    d->fd = -1;
+    d->state = DEVICE_IDLE;
+    d->rx_len = 0;
+    d->tx_len = 0;
+    d->batch_open = false;
+    memset(d->inflight, 0, sizeof(d->inflight));
+    schedule(d, retry_ns);
+}
+
+static void device_connect(device_t *d, int64_t now)
+{
+    struct epoll_event ev = {.events = EPOLLOUT | EPOLLIN, .data.ptr = d};
+    int one = 1;
+
+    d->fd = socket(broker->ai_family, broker->ai_socktype | SOCK_NONBLOCK, broker->ai_protocol);
+    if (d->fd < 0)
+    {
+        perror("socket");
+        interval.failures++;
+        total.failures++;
+        schedule(d, now + RETRY_NS);
+        return;
+    }
+    setsockopt(d->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    d->state = DEVICE_CONNECTING;
+    d->connect_ns = now;
+    if (connect(d->fd, broker->ai_addr, broker->ai_addrlen) != 0 && errno != EINPROGRESS)
+    {
+        interval.failures++;
+        total.failures++;
+        device_close(d, now + RETRY_NS);
+        return;
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, d->fd, &ev);
+    schedule(d, now + CONNECT_TIMEOUT);
+}
+
+static void device_send_connect(device_t *d)
+{
+    uint8_t body[10 + 2 + USER_MAX_SIZE + 8];
+    int keepalive = cycle_ns / 1000000000 * 3 > KEEPALIVE_S ? cycle_ns / 1000000000 * 3 : KEEPALIVE_S;
+
+    if (d->watcher)
+        keepalive = 0; /* it never sends anything */
+    char client_id[USER_MAX_SIZE + 8];
+    int len;
+
+    snprintf(client_id, sizeof(client_id), "%s%s", d->user, d->watcher ? "-watch" : "");
+    len = put_string(body, "MQTT");
+    body[len++] = 4;
+    body[len++] = 0x02; /* clean session */
+    body[len++] = keepalive > 0xffff ? 0xff : keepalive >> 8;
+    body[len++] = keepalive > 0xffff ? 0xff : keepalive & 0xff;
+    len += put_string(&body[len], client_id);
+    d->state = DEVICE_CONNACK;
+    device_send(d, 0x10, body, len, NULL, 0);
+    watch_events(d);
+}
+
+static void device_subscribe(device_t *d)
+{
+    uint8_t body[2 + 2 + USER_MAX_SIZE + 2 + 1];
+    char filter[USER_MAX_SIZE + 2];
+    int len;
+
+    for (int i = 0; i < n_watched && i < n_devices; i++)
+    {
+        snprintf(filter, sizeof(filter), "%s/#", devices[i].user);
+        d->msg_id = d->msg_id % 0xffff + 1;
+        body[0] = d->msg_id >> 8;
+        body[1] = d->msg_id & 0xff;
+        len = 2 + put_string(&body[2], filter);
+        body[len++] = 0;
+        device_send(d, 0x82, body, len, NULL, 0);
+    }
+}
+
+/* one cycle of the firmware: the raw values, their fusion, then the cycle */
+static void device_cycle(device_t *d)
+{
+    uint8_t cbor[CBOR_MAX_SIZE];
+    sample_t s[N_SAMPLES];
+    char payload[128];
+    char text[SAMPLE_TEXT_MAX_SIZE];
+    int64_t ts = epoch_ms();
+    double temp;
+    int len;
+
+    d->temp += uniform(-0.02, 0.02);
+    d->rh += uniform(-0.1, 0.1);
+    d->pressure += uniform(-2, 2);
+    d->gas += uniform(-500, 500);
+    temp = d->temp + uniform(-0.3, 0.3);
+    s[0] = (sample_t){SAMPLE_MCP9700, SAMPLE_TEMPERATURE, 0, lround(temp), ts};
+    s[1] = (sample_t){SAMPLE_VMA311, SAMPLE_TEMPERATURE, -1, lround(temp * 10), ts};
+    s[2] = (sample_t){SAMPLE_VMA311, SAMPLE_HUMIDITY, -1, lround(d->rh * 10), ts};
+    s[3] = (sample_t){SAMPLE_BME680, SAMPLE_TEMPERATURE, -2, lround(d->temp * 100), ts};
+    s[4] = (sample_t){SAMPLE_BME680, SAMPLE_HUMIDITY, -3, lround(d->rh * 1000), ts};
+    s[5] = (sample_t){SAMPLE_BME680, SAMPLE_PRESSURE, 0, lround(d->pressure), ts};
+    s[6] = (sample_t){SAMPLE_BME680, SAMPLE_GAS_RESISTANCE, 0, lround(d->gas), ts};
+    s[7] = (sample_t){SAMPLE_FUSED, SAMPLE_TEMPERATURE, -2, lround(d->temp * 100), ts};
+    s[8] = (sample_t){SAMPLE_FUSED, SAMPLE_HUMIDITY, -2, lround(d->rh * 100), ts};
+
+    if (batch_cycles == 0)
+    {
+        for (int i = 0; i < N_RAW; i++)
+        {
+            sample_format_text(&s[i], text, sizeof(text));
+            len = snprintf(payload, sizeof(payload), "{\"value\":%s,\"ts\":%lld}", text, (long long)ts);
+            device_publish(d, raw_topics[i], payload, len, qos, 1);
+        }
+    }
+    for (int i = N_RAW; i < N_SAMPLES; i++)
+    {
+        sample_format_text(&s[i], text, sizeof(text));
+        len = snprintf(payload, sizeof(payload), "{\"value\":%s,\"ts\":%lld,\"ci95\":%.2f,\"faulty\":0}", text,
+                       (long long)ts, uniform(0.3, 0.7));
+        device_publish(d, i == N_RAW ? "fused/temp" : "fused/humidity", payload, len, 1, 1);
+    }
+    if (batch_cycles == 0)
+    {
+        len = sample_encode_cbor(s, N_SAMPLES, cbor, sizeof(cbor));
+        if (len > 0)
+            device_publish(d, "samples", cbor, len, qos, N_SAMPLES);
+        return;
+    }
+    if (!d->batch_open)
+        d->batch_open = tsc_begin(&d->enc, d->batch, sizeof(d->batch), s, N_SAMPLES) == 0;
+    if (tsc_append(&d->enc, ts, s, N_SAMPLES) != 0)
+    {
+        len = tsc_finish(&d->enc);
+        device_publish(d, "batch", d->batch, len, 1, (long)d->enc.state.n_cycles * N_SAMPLES);
+        tsc_begin(&d->enc, d->batch, sizeof(d->batch), s, N_SAMPLES);
+        tsc_append(&d->enc, ts, s, N_SAMPLES);
+    }
+    if (d->enc.state.n_cycles >= batch_cycles)
+    {
+        len = tsc_finish(&d->enc);
+        device_publish(d, "batch", d->batch, len, 1, (long)d->enc.state.n_cycles * N_SAMPLES);
+        d->batch_open = false;
+    }
+}
+
+/* acquisition times of a message to the watcher, as e2e_latency does */
+static void watcher_received(const char *topic, uint8_t *data, int len)
+{
+    static sample_t samples[4096];
+    const char *suffix = strrchr(topic, '/');
+    int64_t now = epoch_ms();
+    const char *ts;
+    int n = 0;
+
+    if (suffix != NULL && strcmp(suffix, "/samples") == 0)
+    {
+        n = sample_decode_cbor(data, len, samples, 4096);
+    }
+    else if (suffix != NULL && strcmp(suffix, "/batch") == 0)
+    {
+        n = tsc_decode(data, len, samples, 4096);
+    }
+    else if ((ts = memmem(data, len, "\"ts\":", 5)) != NULL)
+    {
+        samples[0].timestamp = strtoll(ts + 5, NULL, 10);
+        n = 1;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        histogram_add(&interval.delivery, (now - samples[i].timestamp) * 1000);
+        histogram_add(&total.delivery, (now - samples[i].timestamp) * 1000);
+    }
+    interval.delivered++;
+    total.delivered++;
+}
+
+static void device_packet(device_t *d, uint8_t *p, int len, int offset, int64_t now)
+{
+    char topic[USER_MAX_SIZE + TOPIC_MAX_SIZE];
+    int msg_id;
+    int topic_len;
+
+    switch (p[0] >> 4)
+    {
+        case 2: /* CONNACK */
+            if (d->state != DEVICE_CONNACK || len < 4 || p[3] != 0)
+            {
+                interval.failures++;
+                total.failures++;
+                device_close(d, connect_slot(now + RETRY_NS));
+                return;
+            }
+            d->state = DEVICE_CONNECTED;
+            histogram_add(&interval.connect, (now - d->connect_ns) / 1000);
+            histogram_add(&total.connect, (now - d->connect_ns) / 1000);
+            interval.connects++;
+            total.connects++;
+            if (d->watcher)
+                device_subscribe(d);
+            schedule(d, d->watcher ? INT64_MAX : now + (int64_t)uniform(0, cycle_ns)); /* devices out of phase */
+            break;
+        case 3: /* PUBLISH */
+            topic_len = p[offset] << 8 | p[offset + 1];
+            offset += 2;
+            if (!d->watcher || offset + topic_len > len)
+                break;
+            snprintf(topic, sizeof(topic), "%.*s", topic_len, (const char *)&p[offset]);
+            offset += topic_len + (p[0] & 0x06 ? 2 : 0);
+            watcher_received(topic, &p[offset], len - offset);
+            break;
+        case 4: /* PUBACK */
+            msg_id = p[offset] << 8 | p[offset + 1];
+            if (d->inflight[msg_id % N_INFLIGHT] != 0)
+            {
+                histogram_add(&interval.puback, (now - d->inflight[msg_id % N_INFLIGHT]) / 1000);
+                histogram_add(&total.puback, (now - d->inflight[msg_id % N_INFLIGHT]) / 1000);
+                d->inflight[msg_id % N_INFLIGHT] = 0;
+            }
+            break;
+        default: /* SUBACK, PINGRESP */
+            break;
+    }
+}
+
+static void device_io(device_t *d, uint32_t events, int64_t now)
+{
+    int err = 0, offset, remaining, total_len;
+    socklen_t err_len = sizeof(err);
+    ssize_t n;
+
+    if (d->state == DEVICE_CONNECTING && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+    {
+        getsockopt(d->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+        if (err != 0)
+        {
+            interval.failures++;
+            total.failures++;
+            device_close(d, connect_slot(now + RETRY_NS));
+            return;
+        }
+        device_send_connect(d);
+    }
+    if ((events & EPOLLOUT) && d->tx_len > 0)
+    {
+        if (!device_flush(d))
+        {
+            device_close(d, connect_slot(now + RETRY_NS));
+            return;
+        }
+        if (d->tx_len == 0)
+            watch_events(d);
+    }
+    if (!(events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+        return;
+    for (;;)
+    {
+        n = recv(d->fd, d->rx + d->rx_len, d->rx_size - d->rx_len, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            device_close(d, connect_slot(now + RETRY_NS));
+            return;
+        }
+        if (n < 0)
+            return;
+        d->rx_len += n;
+        for (;;)
+        {
+            remaining = 0;
+            for (offset = 1; offset < d->rx_len && offset <= 4; offset++)
+            {
+                remaining |= (d->rx[offset] & 0x7f) << 7 * (offset - 1);
+                if (!(d->rx[offset] & 0x80))
+                    break;
+            }
+            if (offset >= d->rx_len || offset > 4)
+                break;
+            total_len = offset + 1 + remaining;
+            if (total_len > d->rx_size)
+            {
+                device_close(d, connect_slot(now + RETRY_NS));
+                return;
+            }
+            if (total_len > d->rx_len)
+                break;
+            device_packet(d, d->rx, total_len, offset + 1, now);
+            if (d->fd < 0)
+                return;
+            memmove(d->rx, d->rx + total_len, d->rx_len - total_len);
+            d->rx_len -= total_len;
+        }
+    }
+}
+
+static void device_timer(device_t *d, int64_t now)
+{
+    int64_t due;
+
+    switch (d->state)
+    {
+        case DEVICE_IDLE:
+            device_connect(d, now);
+            break;
+        case DEVICE_CONNECTING:
+        case DEVICE_CONNACK:
+            interval.failures++;
+            total.failures++;
+            device_close(d, connect_slot(now + RETRY_NS));
+            break;
+        case DEVICE_CONNECTED:
+            device_cycle(d);
+            due = d->due_ns + cycle_ns + (int64_t)uniform(-jitter_ns, jitter_ns);
+            schedule(d, due > now ? due : now); /* overloaded, the missed cycles are skipped */
+            break;
+    }
+}
+
+static void storm(int64_t now)
+{
+    for (int i = 0; i < n_devices; i++)
+    {
+        if (devices[i].state != DEVICE_IDLE)
+            device_close(&devices[i], connect_slot(now));
+    }
+}
+
+static void report(const char *label, stats_t *s, double seconds)
+{
+    int connected = 0;
+
+    for (int i = 0; i < n_devices; i++)
+        connected += devices[i].state == DEVICE_CONNECTED;
+    printf("%s connected=%d msg_per_s=%.1f bytes_per_s=%.0f samples_per_s=%.1f connects=%ld failures=%ld drops=%ld"
+           " connect_p50_ms=%.1f connect_p99_ms=%.1f puback_p50_ms=%.1f puback_p99_ms=%.1f delivery_p50_ms=%.1f"
+           " delivery_p99_ms=%.1f\n",
+           label, connected, s->messages / seconds, s->bytes / seconds, s->samples / seconds, s->connects,
+           s->failures, s->drops, histogram_percentile(&s->connect, 50) / 1000.0,
+           histogram_percentile(&s->connect, 99) / 1000.0, histogram_percentile(&s->puback, 50) / 1000.0,
+           histogram_percentile(&s->puback, 99) / 1000.0, histogram_percentile(&s->delivery, 50) / 1000.0,
+           histogram_percentile(&s->delivery, 99) / 1000.0);
+}
+
+static void stop(int sig)
+{
+    (void)sig;
+    stopping = true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-H host] [-p port] [-n devices] [-u prefix] [-c cycle_ms] [-j jitter_ms]\n"
+                    "       [-b batch_cycles] [-q qos] [-R connects_per_s] [-S storm_period_s]\n"
+                    "       [-w watched] [-t duration_s] [-i interval_s]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct epoll_event events[MAX_EVENTS];
+    const char *host = "localhost";
+    const char *port = "1883";
+    double duration_s = 60, interval_s = 5, storm_s = 0;
+    int64_t start, now, next_report, next_storm, timeout;
+    device_t *d;
+    char label[32];
+    int opt, n;
+
+    n_devices = 100;
+    while ((opt = getopt(argc, argv, "H:p:n:u:c:j:b:q:R:S:w:t:i:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'H':
+                host = optarg;
+                break;
+            case 'p':
+                port = optarg;
+                break;
+            case 'n':
+                n_devices = atoi(optarg);
+                break;
+            case 'u':
+                prefix = optarg;
+                break;
+            case 'c':
+                cycle_ns = atol(optarg) * NS_PER_MS;
+                break;
+            case 'j':
+                jitter_ns = atol(optarg) * NS_PER_MS;
+                break;
+            case 'b':
+                batch_cycles = atoi(optarg);
+                break;
+            case 'q':
+                qos = atoi(optarg);
+                break;
+            case 'R':
+                connect_rate = atof(optarg);
+                break;
+            case 'S':
+                storm_s = atof(optarg);
+                break;
+            case 'w':
+                n_watched = atoi(optarg);
+                break;
+            case 't':
+                duration_s = atof(optarg);
+                break;
+            case 'i':
+                interval_s = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (n_devices <= 0 || cycle_ns <= 0 || jitter_ns < 0 || jitter_ns >= cycle_ns || batch_cycles < 0
+        || qos < 0 || qos > 1 || interval_s <= 0 || strlen(prefix) > USER_MAX_SIZE - 8)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if ((n = getaddrinfo(host, port, &hints, &broker)) != 0)
+    {
+        fprintf(stderr, "%s: %s\n", host, gai_strerror(n));
+        return 1;
+    }
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    srand(1);
+
+    /* the devices, then the watcher */
+    epoll_fd = epoll_create1(0);
+    devices = calloc(n_devices + 1, sizeof(device_t));
+    heap = calloc(n_devices + 1, sizeof(device_t *));
+    if (devices == NULL || heap == NULL)
+    {
+        perror("calloc");
+        return 1;
+    }
+    start = now_ns();
+    for (int i = 0; i <= n_devices; i++)
+    {
+        d = &devices[i];
+        d->index = i;
+        d->fd = -1;
+        d->watcher = i == n_devices;
+        snprintf(d->user, sizeof(d->user), "%s%05d", prefix, i);
+        d->rx_size = d->watcher ? WATCH_RX_SIZE : RX_SIZE;
+        d->rx = malloc(d->rx_size);
+        d->temp = uniform(19, 24);
+        d->rh = uniform(35, 55);
+        d->pressure = uniform(100500, 102000);
+        d->gas = uniform(50000, 150000);
+        d->heap_pos = heap_len;
+        heap[heap_len++] = d;
+        schedule(d, d->watcher ? start : connect_slot(start));
+    }
+    if (n_watched == 0)
+        schedule(&devices[n_devices], INT64_MAX);
+
+    next_report = start + (int64_t)(interval_s * 1e9);
+    next_storm = storm_s > 0 ? start + (int64_t)(storm_s * 1e9) : INT64_MAX;
+    while (!stopping)
+    {
+        now = now_ns();
+        if (duration_s > 0 && now - start >= (int64_t)(duration_s * 1e9))
+            break;
+        while (heap[0]->due_ns <= now)
+            device_timer(heap[0], now);
+        if (now >= next_report)
+        {
+            snprintf(label, sizeof(label), "t=%.0f", (now - start) / 1e9);
+            report(label, &interval, interval_s);
+            memset(&interval, 0, sizeof(interval));
+            next_report += (int64_t)(interval_s * 1e9);
+        }
+        if (now >= next_storm)
+        {
+            storm(now);
+            next_storm += (int64_t)(storm_s * 1e9);
+        }
+        timeout = heap[0]->due_ns < next_report ? heap[0]->due_ns : next_report;
+        timeout = timeout > now ? (timeout - now + NS_PER_MS - 1) / NS_PER_MS : 0;
+        n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        now = now_ns();
+        for (int i = 0; i < n; i++)
+        {
+            d = events[i].data.ptr;
+            if (d->fd >= 0)
+                device_io(d, events[i].events, now);
+        }
+    }
+    report("total", &total, (now_ns() - start) / 1e9);
+    printf("total messages=%ld bytes=%ld samples=%ld delivered=%ld\n", total.messages, total.bytes, total.samples,
+           total.delivered);
+    return 0;
+}
@@ -0,0 +1,386 @@
+/*
+ * Microbenchmarks of the pure computations of the sensor drivers: the BME680
+ * compensation (integer and floating point), the heater settings, the DHT11
+ * bit decoding and checksum of the VMA311 and the MCP9700 conversion.
+ *
+ * usage: kernel_bench [-o results.txt] [name_prefix]
+ *
+ * Each kernel runs on a cycle of KERNEL_N_INPUTS realistic inputs, long
+ * enough to take MIN_RUN_MS, and the best of REPEAT runs is kept. One line
+ * per kernel, after a line describing the platform:
+ *   platform=<host|esp32> cycles=<tsc|ccount|none>
+ *   kernel=<name> ns_per_op=<ns> cycles_per_op=<cycles> ops=<n>
+ * On the host the cycles are TSC ticks, on the ESP32 CPU cycles.
+ *
+ * On target, build this directory's kernel_bench.c, kernel_bme680.c and
+ * kernel_bme680_float.c as the main component of an ESP-IDF application:
+ * app_main prints the same lines on the console.
+ *
+ * The drivers are compiled into the benchmark to reach their static
+ * functions. The DHT11 line is replayed from memory and the 1 us delays
+ * between polls are skipped, what is measured is the decoding work per
+ * poll.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "rom/ets_sys.h"
+#include "esp_timer.h"
+#ifdef ESP_PLATFORM
+#include "esp_cpu.h"
+#else
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+#include "kernel_bench.h"
+
+/* the DHT11 line of the VMA311 driver is the one replayed below */
+static int  bench_line_level(gpio_num_t);
+static void bench_delay_us(uint32_t);
+#define gpio_get_level bench_line_level
+#define ets_delay_us   bench_delay_us
+#include "../vma311.c"
+#undef gpio_get_level
+#undef ets_delay_us
+#include "../mcp9700.c"
+
+/* macro definitions */
+#define MIN_RUN_MS      20
+#define REPEAT          5
+#define MAX_OPS         (1u << 30)
+#define DHT_LOW_POLLS   50 /* start of each bit */
+#define DHT_ZERO_POLLS  26
+#define DHT_ONE_POLLS   70
+#define DHT_FRAME_POLLS (40 * (DHT_LOW_POLLS + DHT_ONE_POLLS + 1))
+
+/* global variables */
+kernel_inputs_t kernel_inputs;
+
+/* static variables */
+static uint8_t                       dht_frames[KERNEL_N_INPUTS][5];
+static uint8_t                       dht_line[DHT_FRAME_POLLS];
+static uint16_t                      dht_byte_start[5];
+static uint32_t                      dht_pos;
+static esp_adc_cal_characteristics_t mcp9700_chars;
+static volatile uint32_t             sink;
+
+/* static function prototypes */
+static void     bench_init_inputs();
+static void     bench_line_frame(const uint8_t *);
+static uint32_t run_vma311_read_byte(uint32_t);
+static uint32_t run_vma311_check_crc(uint32_t);
+static uint32_t run_mcp9700_raw_to_temperature(uint32_t);
+static void     bench_run(const kernel_t *, FILE *, const char *);
+static int64_t  bench_time_ns();
+static uint64_t bench_cycles();
+static void     bench_suite(FILE *, const char *);
+
+static const kernel_t driver_kernels[] = {
+    {"vma311_read_byte", run_vma311_read_byte},
+    {"vma311_check_crc", run_vma311_check_crc},
+    {"mcp9700_raw_to_temperature", run_mcp9700_raw_to_temperature},
+    {NULL, NULL},
+};
+
+#ifdef ESP_PLATFORM
+void app_main()
+{
+    vTaskDelay(pdMS_TO_TICKS(1000)); //let the console settle
+    bench_suite(stdout, "");
+}
+#else
+int main(int argc, char **argv)
+{
+    FILE *out = stdout;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:h")) != -1)
+    {
+        if (opt == 'o' && (out = fopen(optarg, "w")) == NULL)
+        {
+            perror(optarg);
+            return 1;
+        }
+        if (opt != 'o')
+        {
+            fprintf(stderr, "usage: %s [-o results.txt] [name_prefix]\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    bench_suite(out, optind < argc ? argv[optind] : "");
+    return fclose(out) == 0 ? 0 : 1;
+}
+#endif
+
+static void bench_suite(FILE *out, const char *prefix)
+{
+    bench_init_inputs();
+#ifdef ESP_PLATFORM
+    fprintf(out, "platform=esp32 cycles=ccount\n");
+#elif defined(__x86_64__) || defined(__i386__)
+    fprintf(out, "platform=host cycles=tsc\n");
+#else
+    fprintf(out, "platform=host cycles=none\n");
+#endif
+    for (const kernel_t *k = bme680_int_kernels; k->name != NULL; k++)
+        bench_run(k, out, prefix);
+    for (const kernel_t *k = bme680_float_kernels; k->name != NULL; k++)
+        bench_run(k, out, prefix);
+    for (const kernel_t *k = driver_kernels; k->name != NULL; k++)
+        bench_run(k, out, prefix);
+}
+
+/**
+ * Inputs spread over the range the sensors produce indoors, from a fixed
+ * generator so that every run sees the same ones.
+ */
+static void bench_init_inputs()
+{
+    uint32_t x = 2463534242u;
+
+    for (int i = 0; i < KERNEL_N_INPUTS; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        kernel_inputs.adc_temp[i] = 480000 + x % 60000;
+        kernel_inputs.adc_pres[i] = 330000 + (x >> 4) % 60000;
+        kernel_inputs.adc_hum[i] = 20000 + (x >> 8) % 15000;
+        kernel_inputs.adc_gas[i] = 100 + (x >> 12) % 800;
+        kernel_inputs.gas_range[i] = (x >> 22) % 16;
+        kernel_inputs.heatr_temp[i] = 200 + (x >> 16) % 200;
+        kernel_inputs.heatr_dur[i] = 1 + (x >> 20) % 4000;
+        kernel_inputs.adc_raw[i] = 2000 + (x >> 3) % 1000;
+        for (int j = 0; j < 4; j++)
+            dht_frames[i][j] = x >> (8 * j);
+        dht_frames[i][4] = dht_frames[i][0] + dht_frames[i][1] + dht_frames[i][2] + dht_frames[i][3];
+        if (i % 4 == 3)
+            dht_frames[i][4]++; /* some transmission errors */
+    }
+    esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN, ADC_WIDTH, DEFAULT_VREF, &mcp9700_chars);
+}
+
+/**
+ * Lay the polls of a DHT11 frame out as the driver samples them: per bit,
+ * low then high for a number of polls telling 0 from 1.
+ */
+static void bench_line_frame(const uint8_t *frame)
+{
+    int n = 0;
+
+    for (int byte = 0; byte < 5; byte++)
+    {
+        dht_byte_start[byte] = n;
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            memset(&dht_line[n], 0, DHT_LOW_POLLS);
+            n += DHT_LOW_POLLS;
+            memset(&dht_line[n], 1, frame[byte] >> bit & 1 ? DHT_ONE_POLLS : DHT_ZERO_POLLS);
+            n += frame[byte] >> bit & 1 ? DHT_ONE_POLLS : DHT_ZERO_POLLS;
+        }
+    }
+    dht_line[n] = 0; /* end of frame */
+}
+
+static int bench_line_level(gpio_num_t num)
+{
+    (void)num;
+    return dht_line[dht_pos++];
+}
+
+static void bench_delay_us(uint32_t us)
+{
+    (void)us;
+}
+
+static uint32_t run_vma311_read_byte(uint32_t n)
+{
+    uint32_t sum = 0;
+    uint8_t byte;
+
+    bench_line_frame(dht_frames[0]);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        byte = 0;
+        dht_pos = dht_byte_start[i % 5];
+        vma311_read_byte(&byte);
+        sum += byte;
+    }
+    return sum;
+}
+
+static uint32_t run_vma311_check_crc(uint32_t n)
+{
+    uint32_t sum = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+        sum += vma311_check_crc(dht_frames[i % KERNEL_N_INPUTS]) == VMA311_OK;
+    return sum;
+}
+
+static uint32_t run_mcp9700_raw_to_temperature(uint32_t n)
+{
+    uint32_t sum = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+        sum += mcp9700_raw_to_temperature(kernel_inputs.adc_raw[i % KERNEL_N_INPUTS], &mcp9700_chars);
+    return sum;
+}
+
+/**
+ * Find how many operations take MIN_RUN_MS, then keep the best of REPEAT
+ * runs of that many.
+ */
+static void bench_run(const kernel_t *k, FILE *out, const char *prefix)
+{
+    uint32_t ops = 64;
+    int64_t start;
+    int64_t ns;
+    int64_t best_ns = INT64_MAX;
+    uint64_t cycles;
+    uint64_t best_cycles = UINT64_MAX;
+
+    if (strncmp(k->name, prefix, strlen(prefix)) != 0)
+        return;
+    do
+    {
+        ops *= 2;
+        start = bench_time_ns();
+        sink += k->run(ops);
+        ns = bench_time_ns() - start;
+    } while (ns < MIN_RUN_MS * 1000000LL && ops < MAX_OPS);
+    for (int i = 0; i < REPEAT; i++)
+    {
+        start = bench_time_ns();
+        cycles = bench_cycles();
+        sink += k->run(ops);
+        cycles = bench_cycles() - cycles;
+        ns = bench_time_ns() - start;
+        if (ns < best_ns)
+            best_ns = ns;
+        if (cycles < best_cycles)
+            best_cycles = cycles;
+    }
+    fprintf(out, "kernel=%s ns_per_op=%.2f cycles_per_op=%.1f ops=%u\n", k->name, (double)best_ns / ops,
+            (double)best_cycles / ops, ops);
+}
+
+static int64_t bench_time_ns()
+{
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time() * 1000;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * The 32-bit CCOUNT of the ESP32 wraps after 17 s at 240 MHz, longer than
+ * any run.
+ */
+static uint64_t bench_cycles()
+{
+#ifdef ESP_PLATFORM
+    return (uint32_t)esp_cpu_get_ccount();
+#elif defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+#ifndef ESP_PLATFORM
+/* the ESP-IDF calls of the drivers, never made by the kernels */
+
+int64_t esp_timer_get_time()
+{
+    return bench_time_ns() / 1000;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    (void)ticks;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t num)
+{
+    (void)num;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t num, gpio_mode_t mode)
+{
+    (void)num;
+    (void)mode;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t num, uint32_t level)
+{
+    (void)num;
+    (void)level;
+    return ESP_OK;
+}
+
+esp_err_t adc1_config_width(adc_bits_width_t width)
+{
+    (void)width;
+    return ESP_OK;
+}
+
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten)
+{
+    (void)channel;
+    (void)atten;
+    return ESP_OK;
+}
+
+esp_err_t adc2_config_channel_atten(adc2_channel_t channel, adc_atten_t atten)
+{
+    (void)channel;
+    (void)atten;
+    return ESP_OK;
+}
+
+int adc1_get_raw(adc1_channel_t channel)
+{
+    (void)channel;
+    return 0;
+}
+
+esp_err_t adc2_get_raw(adc2_channel_t channel, adc_bits_width_t width, int *raw)
+{
+    (void)channel;
+    (void)width;
+    *raw = 0;
+    return ESP_OK;
+}
+
+/* the linear characteristic of ESP-IDF, with the coefficients of a typical chip */
+esp_adc_cal_value_t esp_adc_cal_characterize(adc_unit_t unit, adc_atten_t atten, adc_bits_width_t width,
+                                             uint32_t default_vref, esp_adc_cal_characteristics_t *chars)
+{
+    memset(chars, 0, sizeof(*chars));
+    chars->adc_num = unit;
+    chars->atten = atten;
+    chars->bit_width = width;
+    chars->vref = default_vref;
+    chars->coeff_a = 53442; /* 0.815 mV per count */
+    chars->coeff_b = 142;
+    return ESP_ADC_CAL_VAL_DEFAULT_VREF;
+}
+
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t raw, const esp_adc_cal_characteristics_t *chars)
+{
+    return (uint32_t)((((uint64_t)raw * chars->coeff_a + 32768) >> 16) + chars->coeff_b);
+}
+#endif
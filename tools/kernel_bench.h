@@ -0,0 +1,33 @@
+#ifndef __KERNEL_BENCH_H__
+#define __KERNEL_BENCH_H__
+
+#include <stdint.h>
+
+/* macro definitions */
+#define KERNEL_N_INPUTS 64 /* power of 2, the kernels cycle through them */
+
+/* type definitions */
+typedef struct kernel
+{
+    const char *name;
+    uint32_t  (*run)(uint32_t); /* run n operations, returns a checksum of the results */
+} kernel_t;
+
+typedef struct kernel_inputs
+{
+    uint32_t adc_temp[KERNEL_N_INPUTS];
+    uint32_t adc_pres[KERNEL_N_INPUTS];
+    uint16_t adc_hum[KERNEL_N_INPUTS];
+    uint16_t adc_gas[KERNEL_N_INPUTS];
+    uint8_t  gas_range[KERNEL_N_INPUTS];
+    uint16_t heatr_temp[KERNEL_N_INPUTS];
+    uint16_t heatr_dur[KERNEL_N_INPUTS];
+    uint32_t adc_raw[KERNEL_N_INPUTS];
+} kernel_inputs_t;
+
+/* global variables */
+extern kernel_inputs_t kernel_inputs;
+extern const kernel_t  bme680_int_kernels[];
+extern const kernel_t  bme680_float_kernels[];
+
+#endif /* __KERNEL_BENCH_H__ */
@@ -0,0 +1,124 @@
+/*
+ * BME680 compensation kernels for kernel_bench. The driver is compiled into
+ * this file to reach its static functions; kernel_bme680_float.c builds it
+ * again with BME680_FLOAT_POINT_COMPENSATION for the floating point ones.
+ */
+#ifdef BME680_FLOAT_POINT_COMPENSATION
+/* the API of the driver is already defined by the integer build */
+#define bme680_init                bme680_float_init
+#define bme680_get_regs            bme680_float_get_regs
+#define bme680_set_regs            bme680_float_set_regs
+#define bme680_soft_reset          bme680_float_soft_reset
+#define bme680_set_sensor_mode     bme680_float_set_sensor_mode
+#define bme680_get_sensor_mode     bme680_float_get_sensor_mode
+#define bme680_set_profile_dur     bme680_float_set_profile_dur
+#define bme680_get_profile_dur     bme680_float_get_profile_dur
+#define bme680_get_sensor_data     bme680_float_get_sensor_data
+#define bme680_set_sensor_settings bme680_float_set_sensor_settings
+#define bme680_get_sensor_settings bme680_float_get_sensor_settings
+#define KERNELS                    bme680_float_kernels
+#define VARIANT                    "_float"
+#define RESULT                     float
+#else
+#define KERNELS                    bme680_int_kernels
+#define VARIANT                    "_int"
+#define RESULT                     uint32_t
+#endif
+
+#include "../bme680.c"
+#include "kernel_bench.h"
+
+/* static variables */
+/* calibration of a production sample, as the virtual sensor of sim/ */
+static struct bme680_dev dev = {
+    .amb_temp = 25,
+    .calib = {
+        .par_t1 = 26154, .par_t2 = 26374, .par_t3 = 3,
+        .par_p1 = 36187, .par_p2 = -10378, .par_p3 = 88, .par_p4 = 6986, .par_p5 = -117,
+        .par_p6 = 30, .par_p7 = 34, .par_p8 = -3340, .par_p9 = -2554, .par_p10 = 30,
+        .par_h1 = 781, .par_h2 = 1017, .par_h3 = 0, .par_h4 = 45, .par_h5 = 20, .par_h6 = 120, .par_h7 = -100,
+        .par_gh1 = -37, .par_gh2 = -11781, .par_gh3 = 18,
+        .res_heat_range = 1, .res_heat_val = 42, .range_sw_err = 0,
+        .t_fine = 107520, /* 21 degC, for the kernels that depend on it */
+    },
+};
+
+/* static function prototypes */
+static uint32_t run_temperature(uint32_t);
+static uint32_t run_pressure(uint32_t);
+static uint32_t run_humidity(uint32_t);
+static uint32_t run_gas_resistance(uint32_t);
+static uint32_t run_heater_res(uint32_t);
+#ifndef BME680_FLOAT_POINT_COMPENSATION
+static uint32_t run_heater_dur(uint32_t);
+#endif
+
+const kernel_t KERNELS[] = {
+    {"bme680_calc_temperature" VARIANT, run_temperature},
+    {"bme680_calc_pressure" VARIANT, run_pressure},
+    {"bme680_calc_humidity" VARIANT, run_humidity},
+    {"bme680_calc_gas_resistance" VARIANT, run_gas_resistance},
+    {"bme680_calc_heater_res" VARIANT, run_heater_res},
+#ifndef BME680_FLOAT_POINT_COMPENSATION
+    {"bme680_calc_heater_dur", run_heater_dur},
+#endif
+    {NULL, NULL},
+};
+
+static uint32_t run_temperature(uint32_t n)
+{
+    RESULT sum = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+        sum += calc_temperature(kernel_inputs.adc_temp[i % KERNEL_N_INPUTS], &dev);
+    dev.calib.t_fine = 107520;
+    return (uint32_t)sum;
+}
+
+static uint32_t run_pressure(uint32_t n)
+{
+    RESULT sum = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+        sum += calc_pressure(kernel_inputs.adc_pres[i % KERNEL_N_INPUTS], &dev);
+    return (uint32_t)sum;
+}
+
+static uint32_t run_humidity(uint32_t n)
+{
+    RESULT sum = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+        sum += calc_humidity(kernel_inputs.adc_hum[i % KERNEL_N_INPUTS], &dev);
+    return (uint32_t)sum;
+}
+
+static uint32_t run_gas_resistance(uint32_t n)
+{
+    RESULT sum = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+        sum += calc_gas_resistance(kernel_inputs.adc_gas[i % KERNEL_N_INPUTS],
+                                   kernel_inputs.gas_range[i % KERNEL_N_INPUTS], &dev);
+    return (uint32_t)sum;
+}
+
+static uint32_t run_heater_res(uint32_t n)
+{
+    RESULT sum = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+        sum += calc_heater_res(kernel_inputs.heatr_temp[i % KERNEL_N_INPUTS], &dev);
+    return (uint32_t)sum;
+}
+
+#ifndef BME680_FLOAT_POINT_COMPENSATION
+static uint32_t run_heater_dur(uint32_t n)
+{
+    uint32_t sum = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+        sum += calc_heater_dur(kernel_inputs.heatr_dur[i % KERNEL_N_INPUTS]);
+    return sum;
+}
+#endif
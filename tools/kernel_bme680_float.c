@@ -0,0 +1,5 @@
+/*
+ * Floating point variants of the BME680 compensation kernels.
+ */
+#define BME680_FLOAT_POINT_COMPENSATION
+#include "kernel_bme680.c"
@@ -0,0 +1,117 @@
+#include <math.h>
+#include "sample_decode.h"
+
+#define CBOR_UINT  0
+#define CBOR_NINT  1
+#define CBOR_ARRAY 4
+
+typedef struct cbor_reader
+{
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+} cbor_reader_t;
+
+static int cbor_get_head(cbor_reader_t *, int *, uint64_t *);
+static int cbor_get_uint(cbor_reader_t *, uint64_t *);
+static int cbor_get_int(cbor_reader_t *, int64_t *);
+
+
+/**
+ * @brief Decode a CBOR sample message produced by sample_encode_cbor().
+ * @param buf The message.
+ * @param len The length of the message.
+ * @param samples Where to store the samples, with absolute timestamps.
+ * @param max The capacity of samples.
+ * @return The number of samples, or -1 if the message is malformed, of an
+ *         unknown schema version or holds more than max samples.
+ */
+int sample_decode_cbor(const uint8_t *buf, size_t len, sample_t *samples, int max)
+{
+    cbor_reader_t r = {buf, len, 0};
+    uint64_t n_items, version, base, n_fields, sensor, metric, dt;
+    int64_t exponent, value;
+    int major;
+
+    if (cbor_get_head(&r, &major, &n_items) || major != CBOR_ARRAY || n_items < 2)
+        return -1;
+    if (cbor_get_uint(&r, &version) || version != SAMPLE_SCHEMA_VERSION)
+        return -1;
+    if (cbor_get_uint(&r, &base))
+        return -1;
+    if (n_items - 2 > (uint64_t)max)
+        return -1;
+    for (uint64_t i = 0; i < n_items - 2; i++)
+    {
+        if (cbor_get_head(&r, &major, &n_fields) || major != CBOR_ARRAY || n_fields != 5)
+            return -1;
+        if (cbor_get_uint(&r, &sensor) || cbor_get_uint(&r, &metric) ||
+            cbor_get_int(&r, &exponent) || cbor_get_int(&r, &value) ||
+            cbor_get_uint(&r, &dt))
+            return -1;
+        if (exponent < INT8_MIN || exponent > INT8_MAX || value < INT32_MIN || value > INT32_MAX)
+            return -1;
+        samples[i].sensor = sensor;
+        samples[i].metric = metric;
+        samples[i].exponent = exponent;
+        samples[i].value = value;
+        samples[i].timestamp = base ? (int64_t)(base + dt) : 0;
+    }
+    return r.pos == r.len ? (int)(n_items - 2) : -1;
+}
+
+/**
+ * @brief Get the physical value of a sample.
+ */
+double sample_value(const sample_t *sample)
+{
+    return sample->value * pow(10, sample->exponent);
+}
+
+static int cbor_get_head(cbor_reader_t *r, int *major, uint64_t *arg)
+{
+    uint8_t info;
+    int n;
+
+    if (r->pos >= r->len)
+        return -1;
+    *major = r->buf[r->pos] >> 5;
+    info = r->buf[r->pos++] & 0x1f;
+    if (info < 24)
+    {
+        *arg = info;
+        return 0;
+    }
+    if (info > 27)
+        return -1; /* indefinite lengths are not part of the schema */
+    n = 1 << (info - 24);
+    if (r->pos + n > r->len)
+        return -1;
+    *arg = 0;
+    for (int i = 0; i < n; i++)
+        *arg = (*arg << 8) | r->buf[r->pos++];
+    return 0;
+}
+
+static int cbor_get_uint(cbor_reader_t *r, uint64_t *value)
+{
+    int major;
+
+    return cbor_get_head(r, &major, value) || major != CBOR_UINT;
+}
+
+static int cbor_get_int(cbor_reader_t *r, int64_t *value)
+{
+    uint64_t arg;
+    int major;
+
+    if (cbor_get_head(r, &major, &arg) || arg > INT64_MAX)
+        return -1;
+    if (major == CBOR_UINT)
+        *value = arg;
+    else if (major == CBOR_NINT)
+        *value = -1 - (int64_t)arg;
+    else
+        return -1;
+    return 0;
+}
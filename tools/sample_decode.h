@@ -0,0 +1,11 @@
+#ifndef __SAMPLE_DECODE_H__
+#define __SAMPLE_DECODE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../sample.h"
+
+int    sample_decode_cbor(const uint8_t *, size_t, sample_t *, int);
+double sample_value(const sample_t *);
+
+#endif /* __SAMPLE_DECODE_H__ */
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <string.h>
+#include "spsc.h"
+
+/**
+ * @brief Allocate a ring.
+ * @param q The ring.
+ * @param capacity The number of slots, a power of two.
+ * @param elem_size The size of an element.
+ * @return 0, or -1 if the capacity is not a power of two or out of memory.
+ */
+int spsc_init(spsc_t *q, size_t capacity, size_t elem_size)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+        return -1;
+    memset(q, 0, sizeof(*q));
+    q->slots = malloc(capacity * elem_size);
+    if (q->slots == NULL)
+        return -1;
+    q->mask = capacity - 1;
+    q->elem_size = elem_size;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    return 0;
+}
+
+void spsc_free(spsc_t *q)
+{
+    free(q->slots);
+    q->slots = NULL;
+}
+
+/**
+ * @brief Append an element. Producer side only.
+ * @param q The ring.
+ * @param elem The element, copied.
+ * @return false if the ring is full.
+ */
+bool spsc_push(spsc_t *q, const void *elem)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    if (head - q->tail_cache > q->mask)
+    {
+        q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire);
+        if (head - q->tail_cache > q->mask)
+            return false;
+    }
+    memcpy(q->slots + (head & q->mask) * q->elem_size, elem, q->elem_size);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Take the oldest elements. Consumer side only.
+ * @param q The ring.
+ * @param elems Where to copy them.
+ * @param max The capacity of elems.
+ * @return The number of elements taken, 0 if the ring is empty.
+ */
+size_t spsc_pop(spsc_t *q, void *elems, size_t max)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t n, first;
+
+    if (q->head_cache == tail)
+    {
+        q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);
+        if (q->head_cache == tail)
+            return 0;
+    }
+    n = q->head_cache - tail < max ? q->head_cache - tail : max;
+    first = (q->mask + 1) - (tail & q->mask); /* slots before the end of the ring */
+    if (first > n)
+        first = n;
+    memcpy(elems, q->slots + (tail & q->mask) * q->elem_size, first * q->elem_size);
+    memcpy((unsigned char *)elems + first * q->elem_size, q->slots, (n - first) * q->elem_size);
+    atomic_store_explicit(&q->tail, tail + n, memory_order_release);
+    return n;
+}
@@ -0,0 +1,34 @@
+#ifndef __SPSC_H__
+#define __SPSC_H__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Single-producer single-consumer ring of fixed-size elements, lock-free.
+ *
+ * The producer owns the head, the consumer the tail, each on its own cache
+ * line. Each side keeps a copy of the other index and reads the shared one
+ * only when its copy says the ring is full or empty, so the cache lines
+ * bounce once per batch rather than once per element.
+ */
+#define SPSC_CACHE_LINE 64
+
+typedef struct spsc
+{
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t head; /* next slot written, producer */
+    size_t tail_cache;
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t tail; /* next slot read, consumer */
+    size_t head_cache;
+    _Alignas(SPSC_CACHE_LINE) size_t mask;
+    size_t elem_size;
+    unsigned char *slots;
+} spsc_t;
+
+int    spsc_init(spsc_t *, size_t, size_t);
+void   spsc_free(spsc_t *);
+bool   spsc_push(spsc_t *, const void *);
+size_t spsc_pop(spsc_t *, void *, size_t);
+
+#endif /* __SPSC_H__ */
@@ -0,0 +1,186 @@
+/*
+ * Conversion of envmon event trace dumps (see trace.h) to the Chrome trace
+ * format, for chrome://tracing or ui.perfetto.dev.
+ *
+ * usage: trace2json [file] > trace.json
+ *
+ * The dumps are read from the file or the standard input: a console log, or
+ * the messages of the trace topic, e.g. mosquitto_sub -t vn170735/trace. Only
+ * the lines holding "trace:" are read, from there on, so log prefixes are
+ * ignored. The 32-bit event times are extended with the time of their dump,
+ * events are at most 71 minutes older than it. Each task is a thread, the
+ * core and the argument of an event are in its args. Then, on stderr:
+ *   dumps=<n> events=<n> tasks=<n> overwritten=<n>
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_MAX_SIZE 512
+#define NAME_MAX_SIZE 32
+#define MAX_IDS       64
+#define MAX_TASKS     64
+
+typedef struct event
+{
+    int64_t  ts; /* us since boot */
+    long     seq;
+    uint64_t task;
+    uint32_t arg;
+    int      id;
+    int      core;
+    char     phase;
+} event_t;
+
+typedef struct task
+{
+    uint64_t handle;
+    char     name[NAME_MAX_SIZE];
+} task_t;
+
+static event_t *events;
+static long     n_events, capacity;
+static char     id_names[MAX_IDS][NAME_MAX_SIZE];
+static task_t   tasks[MAX_TASKS];
+static int      n_tasks;
+
+static int compare_events(const void *a, const void *b)
+{
+    const event_t *x = a, *y = b;
+
+    if (x->ts != y->ts)
+        return x->ts < y->ts ? -1 : 1;
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/* thread id of a task, added if new */
+static int task_tid(uint64_t handle, const char *name)
+{
+    int i;
+
+    for (i = 0; i < n_tasks && tasks[i].handle != handle; i++)
+        ;
+    if (i == n_tasks)
+    {
+        if (n_tasks == MAX_TASKS)
+            return 0;
+        tasks[n_tasks].handle = handle;
+        snprintf(tasks[n_tasks].name, NAME_MAX_SIZE, "%s", name ? name : "?");
+        n_tasks++;
+    }
+    else if (name)
+    {
+        snprintf(tasks[i].name, NAME_MAX_SIZE, "%s", name);
+    }
+    return i + 1;
+}
+
+/* JSON string of a name, which may be any text of the device */
+static void print_name(const char *name)
+{
+    putchar('"');
+    for (; *name; name++)
+    {
+        if (*name == '"' || *name == '\\')
+            putchar('\\');
+        if ((unsigned char)*name >= ' ')
+            putchar(*name);
+    }
+    putchar('"');
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [file] > trace.json\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in = stdin;
+    char line[LINE_MAX_SIZE], name[NAME_MAX_SIZE];
+    char *p;
+    event_t e;
+    uint32_t time;
+    uint64_t now = 0, n_overwritten, overwritten = 0;
+    unsigned long long handle;
+    int id, n, n_dumps = 0;
+
+    if (argc > 2 || (argc == 2 && argv[1][0] == '-'))
+    {
+        usage(argv[0]);
+        return argc == 2 && strcmp(argv[1], "-h") == 0 ? 0 : 1;
+    }
+    if (argc == 2 && (in = fopen(argv[1], "r")) == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), in))
+    {
+        if ((p = strstr(line, "trace:")) == NULL)
+            continue;
+        p += strlen("trace:");
+        if (sscanf(p, "e %" SCNu32 " %d %llx %c %d %" SCNu32, &time, &e.core, &handle, &e.phase, &e.id,
+                   &e.arg) == 6)
+        {
+            if (n_dumps == 0)
+                continue; /* the start of the dump is missing */
+            if (n_events == capacity)
+            {
+                capacity = capacity ? 2 * capacity : 4096;
+                if ((events = realloc(events, capacity * sizeof(event_t))) == NULL)
+                {
+                    perror("realloc");
+                    return 1;
+                }
+            }
+            /* events precede the dump: go back from its time */
+            e.ts = (int64_t)(now - (uint32_t)((uint32_t)now - time));
+            e.seq = n_events;
+            e.task = handle;
+            events[n_events++] = e;
+        }
+        else if (sscanf(p, "task %llx %31s", &handle, name) == 2)
+        {
+            task_tid(handle, name);
+        }
+        else if (sscanf(p, "id %d %31s", &id, name) == 2)
+        {
+            if (id >= 0 && id < MAX_IDS)
+                snprintf(id_names[id], NAME_MAX_SIZE, "%s", name);
+        }
+        else if (sscanf(p, "start %" SCNu64 " %d %" SCNu64, &now, &n, &n_overwritten) == 3)
+        {
+            overwritten += n_overwritten;
+            n_dumps++;
+        }
+    }
+    if (in != stdin)
+        fclose(in);
+
+    qsort(events, n_events, sizeof(event_t), compare_events);
+    printf("{\"traceEvents\":[");
+    for (int i = 0; i < n_tasks; i++)
+    {
+        printf("%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+               i ? "," : "", i + 1);
+        print_name(tasks[i].name);
+        printf("}}");
+    }
+    for (long i = 0; i < n_events; i++)
+    {
+        e = events[i];
+        printf("%s\n{\"name\":", i || n_tasks ? "," : "");
+        if (e.id >= 0 && e.id < MAX_IDS && id_names[e.id][0])
+            print_name(id_names[e.id]);
+        else
+            printf("\"id%d\"", e.id);
+        printf(",\"ph\":\"%c\",\"ts\":%" PRId64 ",\"pid\":1,\"tid\":%d,%s\"args\":{\"core\":%d,\"arg\":%" PRIu32 "}}",
+               e.phase, e.ts, task_tid(e.task, NULL), e.phase == 'i' ? "\"s\":\"t\"," : "", e.core, e.arg);
+    }
+    printf("\n],\"displayTimeUnit\":\"ms\"}\n");
+    fprintf(stderr, "dumps=%d events=%ld tasks=%d overwritten=%" PRIu64 "\n", n_dumps, n_events, n_tasks,
+            overwritten);
+    return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * Compression benchmark for sample batches.
+ *
+ * usage: tsc_bench [recorded.csv] [batch_size_bytes]
+ *
+ * The recording holds one sample per line: timestamp_ms,sensor,metric,exponent,value
+ * Consecutive lines with the same timestamp form a cycle. Without a recording,
+ * one day of 5 s cycles of slowly changing environmental signals is
+ * synthesized. The batches are encoded as the firmware does, decoded back and
+ * compared to the text and CBOR payloads of the same cycles. Before that,
+ * batches of edge cases are checked to decode to their cycles: clock steps,
+ * as on the first time synchronization within a batch, and extreme values.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../tsc.h"
+#include "tsc_decode.h"
+
+#define MAX_SAMPLES    (1 << 20)
+#define CYCLE_MAX      TSC_MAX_SERIES
+#define DEFAULT_BATCH  256
+#define TEXT_TOPIC_LEN 24 /* average length of a per-metric topic */
+#define REPEAT         20
+
+static sample_t samples[MAX_SAMPLES];
+static sample_t decoded[MAX_SAMPLES];
+
+static int load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    long long ts;
+    int sensor, metric, exponent, n = 0;
+    long value;
+
+    if (f == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    while (n < MAX_SAMPLES && fscanf(f, "%lld,%d,%d,%d,%ld", &ts, &sensor, &metric, &exponent, &value) == 5)
+        samples[n++] = (sample_t){sensor, metric, exponent, value, ts};
+    fclose(f);
+    return n;
+}
+
+static int synthesize(void)
+{
+    const int64_t start = 1700000000000;
+    int n = 0;
+    double t, temp, rh;
+
+    srand(1);
+    for (int c = 0; c < 24 * 3600 / 5; c++)
+    {
+        t = c * 5.0;
+        temp = 21.0 + 2.0 * sin(t / 86400 * 2 * M_PI) + (rand() % 5 - 2) * 0.01;
+        rh = 45.0 - 5.0 * sin(t / 86400 * 2 * M_PI) + (rand() % 5 - 2) * 0.01;
+        int64_t ts = start + c * 5000 + rand() % 7 - 3;
+        samples[n++] = (sample_t){SAMPLE_MCP9700, SAMPLE_TEMPERATURE, 0, lround(temp), ts};
+        samples[n++] = (sample_t){SAMPLE_VMA311, SAMPLE_TEMPERATURE, -1, lround(temp * 10), ts};
+        samples[n++] = (sample_t){SAMPLE_VMA311, SAMPLE_HUMIDITY, -1, lround(rh * 10), ts};
+        samples[n++] = (sample_t){SAMPLE_BME680, SAMPLE_TEMPERATURE, -2, lround(temp * 100), ts};
+        samples[n++] = (sample_t){SAMPLE_BME680, SAMPLE_HUMIDITY, -3, lround(rh * 1000), ts};
+        samples[n++] = (sample_t){SAMPLE_BME680, SAMPLE_PRESSURE, 0, 101325 + lround(50 * sin(t / 7200)) + rand() % 3, ts};
+        samples[n++] = (sample_t){SAMPLE_BME680, SAMPLE_GAS_RESISTANCE, 0, 120000 + lround(3000 * sin(t / 3600)) + rand() % 200, ts};
+    }
+    return n;
+}
+
+static int cycle_len(int first, int n)
+{
+    int len = 1;
+
+    while (first + len < n && len < CYCLE_MAX && samples[first + len].timestamp == samples[first].timestamp)
+        len++;
+    return len;
+}
+
+/* encode all samples into batches of at most batch_size bytes, like batch.c */
+static long encode_all(int n, int batch_size, uint8_t *out, int *sizes, int *n_batches)
+{
+    tsc_encoder_t enc;
+    long total = 0;
+    int open = 0, len, size;
+
+    *n_batches = 0;
+    for (int i = 0; i < n; i += len)
+    {
+        len = cycle_len(i, n);
+        if (!open)
+            open = tsc_begin(&enc, out + total, batch_size, &samples[i], len) == 0;
+        if (tsc_append(&enc, samples[i].timestamp, &samples[i], len) != 0)
+        {
+            size = tsc_finish(&enc);
+            sizes[(*n_batches)++] = size;
+            total += size;
+            tsc_begin(&enc, out + total, batch_size, &samples[i], len);
+            tsc_append(&enc, samples[i].timestamp, &samples[i], len);
+        }
+    }
+    if (open)
+    {
+        size = tsc_finish(&enc);
+        sizes[(*n_batches)++] = size;
+        total += size;
+    }
+    return total;
+}
+
+/* encode cycles of one sample in a single batch and decode them back */
+static int round_trip(const int64_t *ts, const int32_t *values, int n)
+{
+    tsc_encoder_t enc;
+    uint8_t buf[1024];
+    sample_t in[16], out[16];
+    int len;
+
+    for (int i = 0; i < n; i++)
+        in[i] = (sample_t){SAMPLE_BME680, SAMPLE_PRESSURE, 0, values[i], ts[i]};
+    tsc_begin(&enc, buf, sizeof(buf), in, 1);
+    for (int i = 0; i < n; i++)
+    {
+        if (tsc_append(&enc, ts[i], &in[i], 1) != 0)
+            return -1;
+    }
+    len = tsc_finish(&enc);
+    if (tsc_decode(buf, len, out, 16) != n)
+        return -1;
+    for (int i = 0; i < n; i++)
+    {
+        if (out[i].timestamp != ts[i] || out[i].value != values[i])
+            return -1;
+    }
+    return 0;
+}
+
+static int check_edge_cases(void)
+{
+    static const int64_t step_ts[] = {0, 0, 1760000000000, 1760000005000, 0, INT64_MAX / 4, 5000};
+    static const int64_t wide_ts[] = {1760000000000, 1760004294967, 1760000000000, 1760008589934};
+    static const int32_t values[] = {0, INT32_MIN, INT32_MAX, -1, 1, INT32_MIN, 0};
+
+    if (round_trip(step_ts, values, 7) != 0 || round_trip(wide_ts, values, 4) != 0)
+    {
+        fprintf(stderr, "edge cases do not round-trip\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int n = argc > 1 ? load(argv[1]) : synthesize();
+    int batch_size = argc > 2 ? atoi(argv[2]) : DEFAULT_BATCH;
+    static uint8_t out[16 * MAX_SAMPLES];
+    static int sizes[MAX_SAMPLES];
+    long text_bytes = 0, cbor_bytes = 0, tsc_bytes;
+    int n_batches, n_decoded = 0, len;
+    char text[SAMPLE_TEXT_MAX_SIZE];
+    uint8_t cbor[512];
+    struct timespec t0, t1;
+    double ns;
+
+    if (n == 0 || batch_size < 64 || batch_size > 65536)
+    {
+        fprintf(stderr, "usage: %s [recorded.csv] [batch_size_bytes]\n", argv[0]);
+        return 1;
+    }
+    if (check_edge_cases() != 0)
+        return 1;
+    for (int i = 0; i < n; i += len)
+    {
+        len = cycle_len(i, n);
+        for (int j = 0; j < len; j++)
+            text_bytes += sample_format_text(&samples[i + j], text, sizeof(text)) + TEXT_TOPIC_LEN;
+        cbor_bytes += sample_encode_cbor(&samples[i], len, cbor, sizeof(cbor));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int r = 0; r < REPEAT; r++)
+        tsc_bytes = encode_all(n, batch_size, out, sizes, &n_batches);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / REPEAT / n;
+
+    for (long off = 0, b = 0; b < n_batches; off += sizes[b++])
+    {
+        int got = tsc_decode(out + off, sizes[b], decoded + n_decoded, MAX_SAMPLES - n_decoded);
+        if (got < 0)
+        {
+            fprintf(stderr, "decode error in batch %ld\n", b);
+            return 1;
+        }
+        n_decoded += got;
+    }
+    if (n_decoded != n)
+    {
+        fprintf(stderr, "decoded %d samples out of %d\n", n_decoded, n);
+        return 1;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (decoded[i].value != samples[i].value || decoded[i].timestamp != samples[i].timestamp)
+        {
+            fprintf(stderr, "mismatch at sample %d\n", i);
+            return 1;
+        }
+    }
+
+    printf("samples=%d batches=%d batch_size=%d\n", n, n_batches, batch_size);
+    printf("text_bytes=%ld (%.2f B/sample)\n", text_bytes, (double)text_bytes / n);
+    printf("cbor_bytes=%ld (%.2f B/sample)\n", cbor_bytes, (double)cbor_bytes / n);
+    printf("tsc_bytes=%ld (%.2f B/sample)\n", tsc_bytes, (double)tsc_bytes / n);
+    printf("ratio_vs_text=%.2f ratio_vs_cbor=%.2f\n", (double)text_bytes / tsc_bytes, (double)cbor_bytes / tsc_bytes);
+    printf("encode_ns_per_sample=%.1f\n", ns);
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include "../tsc.h"
+#include "tsc_decode.h"
+
+typedef struct bit_reader
+{
+    const uint8_t *buf;
+    size_t bit_len;
+    size_t pos;
+} bit_reader_t;
+
+static int get_bits(bit_reader_t *, int, uint64_t *);
+static int get_prefix(bit_reader_t *, int);
+
+static inline int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/**
+ * @brief Decode a batch produced by the tsc encoder (see tsc.h).
+ * @param buf The batch.
+ * @param len The length of the batch.
+ * @param samples Where to store the samples, cycle by cycle, series by series.
+ *                Missing values are skipped.
+ * @param max The capacity of samples.
+ * @return The number of samples, or -1 if the batch is malformed or holds more
+ *         than max samples.
+ */
+int tsc_decode(const uint8_t *buf, size_t len, sample_t *samples, int max)
+{
+    bit_reader_t r = {buf, 8 * len, 0};
+    int n_series, n_cycles, n = 0, prefix;
+    int64_t timestamp = 0, delta = 0;
+    int32_t values[TSC_MAX_SERIES] = {0};
+    uint64_t bits;
+    static const int ts_widths[] = {0, 7, 9, 12, 32, 64};
+    static const int value_widths[] = {0, 4, 8, 16, 32};
+
+    if (len < 4 || buf[0] != TSC_VERSION)
+        return -1;
+    n_series = buf[1];
+    n_cycles = (buf[2] << 8) | buf[3];
+    if (n_series > TSC_MAX_SERIES || len < (size_t)TSC_HEADER_SIZE(n_series))
+        return -1;
+    r.pos = 8 * TSC_HEADER_SIZE(n_series);
+    for (int c = 0; c < n_cycles; c++)
+    {
+        if (c == 0)
+        {
+            if (get_bits(&r, 64, &bits))
+                return -1;
+            timestamp = bits;
+        }
+        else
+        {
+            if ((prefix = get_prefix(&r, 5)) < 0 || get_bits(&r, ts_widths[prefix], &bits))
+                return -1;
+            delta += unzigzag(bits);
+            timestamp += delta;
+        }
+        for (int i = 0; i < n_series; i++)
+        {
+            if ((prefix = get_prefix(&r, 5)) < 0)
+                return -1;
+            if (prefix == 5)
+                continue; /* no value in this cycle */
+            if (get_bits(&r, value_widths[prefix], &bits))
+                return -1;
+            values[i] = (int32_t)((uint32_t)values[i] + (uint32_t)unzigzag(bits));
+            if (n == max)
+                return -1;
+            samples[n].sensor = buf[4 + 3 * i];
+            samples[n].metric = buf[5 + 3 * i];
+            samples[n].exponent = (int8_t)buf[6 + 3 * i];
+            samples[n].value = values[i];
+            samples[n].timestamp = timestamp;
+            n++;
+        }
+    }
+    return n;
+}
+
+static int get_bits(bit_reader_t *r, int n, uint64_t *value)
+{
+    if (r->pos + n > r->bit_len)
+        return -1;
+    *value = 0;
+    for (int i = 0; i < n; i++, r->pos++)
+        *value = (*value << 1) | ((r->buf[r->pos / 8] >> (7 - r->pos % 8)) & 1);
+    return 0;
+}
+
+/**
+ * Read a unary prefix: the number of leading 1 bits, at most max_ones.
+ */
+static int get_prefix(bit_reader_t *r, int max_ones)
+{
+    uint64_t bit;
+    int n = 0;
+
+    while (n < max_ones)
+    {
+        if (get_bits(r, 1, &bit))
+            return -1;
+        if (bit == 0)
+            break;
+        n++;
+    }
+    return n;
+}
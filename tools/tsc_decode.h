@@ -0,0 +1,10 @@
+#ifndef __TSC_DECODE_H__
+#define __TSC_DECODE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../sample.h"
+
+int tsc_decode(const uint8_t *, size_t, sample_t *, int);
+
+#endif /* __TSC_DECODE_H__ */
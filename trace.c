@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "logger.h"
+#include "esp_timer.h"
+#include "trace.h"
+
+#define TAG              "envmon:trace"
+#define DUMP_STACK_SIZE  3072
+#define DUMP_PRIORITY    1
+#define DUMP_PACE_MS     20
+#define LINE_MAX_SIZE    64
+
+static trace_t trace = {
+    .enabled = true,
+};
+
+static const char *trace_id_names[TRACE_N_IDS] = {
+    [TRACE_CYCLE] = "cycle",
+    [TRACE_SNAPSHOT] = "snapshot",
+    [TRACE_MCP9700_READ] = "mcp9700_read",
+    [TRACE_VMA311_READ] = "vma311_read",
+    [TRACE_BME680_READ] = "bme680_read",
+    [TRACE_AIO_POST] = "aio_post",
+    [TRACE_AIO_CONNECT] = "aio_connect",
+    [TRACE_AIO_REQUEST] = "aio_request",
+    [TRACE_AIO_RESPONSE] = "aio_response",
+    [TRACE_AIO_DATA] = "aio_data",
+    [TRACE_AIO_ERROR] = "aio_error",
+    [TRACE_MQTT_PUBLISH] = "mqtt_publish",
+    [TRACE_MQTT_PUBACK] = "mqtt_puback",
+    [TRACE_MQTT_CONNECTED] = "mqtt_connected",
+    [TRACE_MQTT_DISCONNECTED] = "mqtt_disconnected",
+    [TRACE_WIFI_CONNECT] = "wifi_connect",
+    [TRACE_WIFI_DISCONNECTED] = "wifi_disconnected",
+};
+
+static void trace_on_command(const char *, int);
+static void trace_dump_task(void *);
+static void trace_emit(char *, int *, const char *, int);
+static bool trace_link_idle();
+
+/**
+ * @brief Listen for trace commands. Tracing is on from boot, the trace points
+ * hit before this call are kept.
+ * @param cmd_topic The topic on which trace commands are received.
+ * @param dump_stream The stream on which MQTT dumps are published.
+ */
+void trace_init(const char *cmd_topic, const mqtt_stream_t *dump_stream)
+{
+    trace.stream = dump_stream;
+    xTaskCreate(trace_dump_task, "trace", DUMP_STACK_SIZE, NULL, DUMP_PRIORITY, &trace.dump_task);
+    mqtt_subscribe(cmd_topic, 1, trace_on_command);
+}
+
+/**
+ * @brief Record an event in the ring of the current core. Safe from any task
+ * or interrupt, use the TRACE_ macros rather than calling it directly.
+ * @param phase Begin, end or instant.
+ * @param id The trace point.
+ * @param arg A value attached to the event, e.g. a length or an identifier.
+ */
+void trace_event(trace_phase_t phase, trace_id_t id, uint32_t arg)
+{
+    trace_ring_t *ring;
+    trace_event_t *e;
+    uint8_t core;
+
+    if (!trace.enabled)
+        return;
+    core = xPortGetCoreID();
+    ring = &trace.rings[core];
+    e = &ring->events[atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed) & (TRACE_RING_LEN - 1)];
+    e->time = (uint32_t)esp_timer_get_time();
+    e->arg = arg;
+    e->task = xTaskGetCurrentTaskHandle();
+    e->id = id;
+    e->phase = phase;
+    e->core = core;
+}
+
+/**
+ * @brief Pause or resume tracing.
+ * @param enabled Whether trace points record events.
+ */
+void trace_set_enabled(bool enabled)
+{
+    trace.enabled = enabled;
+}
+
+/**
+ * @brief Write the recorded events and empty the rings. Tracing is paused
+ * meanwhile and resumed only if it was on. Called from the dump task, or from
+ * any task that may block for the duration of the dump. A dump to MQTT is
+ * refused, the events kept, while the client is disconnected or the offline
+ * queue holds messages: it would push the sensor data out of the queue.
+ * @param output The console or the dump stream.
+ */
+void trace_dump(trace_output_t output)
+{
+    static TaskHandle_t tasks[TRACE_N_TASKS];
+    char buf[MQTT_DATA_MAX_SIZE];
+    char line[LINE_MAX_SIZE];
+    const trace_event_t *e;
+    bool enabled = trace.enabled;
+    unsigned head, first;
+    uint32_t overwritten = 0;
+    int n_tasks = 0;
+    int len = output == TRACE_MQTT ? 0 : -1;
+    int i;
+
+    if (output == TRACE_MQTT && !trace_link_idle())
+    {
+        LOGW(TAG, "MQTT link down or backlogged, trace dump refused");
+        return;
+    }
+    trace.enabled = false;
+    //let the trace points already past the check finish their event
+    vTaskDelay(1);
+    for (int c = 0; c < portNUM_PROCESSORS; c++)
+    {
+        head = atomic_load(&trace.rings[c].head);
+        if (head > TRACE_RING_LEN)
+            overwritten += head - TRACE_RING_LEN;
+    }
+    trace_emit(buf, &len, line, snprintf(line, sizeof(line), "trace:start %" PRId64 " %d %" PRIu32,
+                                         esp_timer_get_time(), portNUM_PROCESSORS, overwritten));
+    for (i = 0; i < TRACE_N_IDS; i++)
+        trace_emit(buf, &len, line, snprintf(line, sizeof(line), "trace:id %d %s", i, trace_id_names[i]));
+    for (int c = 0; c < portNUM_PROCESSORS; c++)
+    {
+        head = atomic_load(&trace.rings[c].head);
+        first = head > TRACE_RING_LEN ? head - TRACE_RING_LEN : 0;
+        for (unsigned n = first; n < head; n++)
+        {
+            e = &trace.rings[c].events[n & (TRACE_RING_LEN - 1)];
+            for (i = 0; i < n_tasks && tasks[i] != e->task; i++)
+                ;
+            if (i == n_tasks && n_tasks < TRACE_N_TASKS)
+            {
+                tasks[n_tasks++] = e->task;
+                //events recorded in an interrupt before the scheduler started have no task
+                trace_emit(buf, &len, line, snprintf(line, sizeof(line), "trace:task %" PRIxPTR " %s",
+                                                     (uintptr_t)e->task, e->task ? pcTaskGetName(e->task) : "isr"));
+            }
+            trace_emit(buf, &len, line, snprintf(line, sizeof(line), "trace:e %" PRIu32 " %u %" PRIxPTR " %c %u %" PRIu32,
+                                                 e->time, e->core, (uintptr_t)e->task, e->phase, e->id, e->arg));
+        }
+        atomic_store(&trace.rings[c].head, 0);
+    }
+    trace_emit(buf, &len, line, snprintf(line, sizeof(line), "trace:end"));
+    if (len > 0 && trace_link_idle())
+        mqtt_publish_stream(trace.stream, buf, len);
+    trace.enabled = enabled;
+}
+
+/**
+ * Commands, run in the MQTT task: the dump itself is left to the dump task,
+ * it would block the reception of messages.
+ */
+static void trace_on_command(const char *data, int len)
+{
+    if (len == 4 && strncmp(data, "uart", len) == 0)
+        trace.output = TRACE_UART;
+    else if (len == 4 && strncmp(data, "mqtt", len) == 0)
+        trace.output = TRACE_MQTT;
+    else if (len == 5 && strncmp(data, "start", len) == 0)
+    {
+        trace_set_enabled(true);
+        return;
+    }
+    else if (len == 4 && strncmp(data, "stop", len) == 0)
+    {
+        trace_set_enabled(false);
+        return;
+    }
+    else
+    {
+        LOGW(TAG, "Unknown trace command: %.*s", len, data);
+        return;
+    }
+    xTaskNotifyGive(trace.dump_task);
+}
+
+static void trace_dump_task(void *arg)
+{
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        trace_dump(trace.output);
+    }
+}
+
+/**
+ * Write a line of a dump: to the console when *len is negative, otherwise
+ * appended to the message in buf, which is published first if the line does
+ * not fit. Messages are paced so that a dump does not fill the outbox, and
+ * dropped if the link went down or backlogged meanwhile.
+ */
+static void trace_emit(char *buf, int *len, const char *line, int line_len)
+{
+    if (*len < 0)
+    {
+        printf("%s\n", line);
+        return;
+    }
+    if (*len + line_len + 1 > MQTT_DATA_MAX_SIZE)
+    {
+        if (trace_link_idle())
+            mqtt_publish_stream(trace.stream, buf, *len);
+        else
+            LOGW(TAG, "MQTT link down or backlogged, trace dump cut");
+        *len = 0;
+        vTaskDelay(DUMP_PACE_MS / portTICK_PERIOD_MS);
+    }
+    memcpy(buf + *len, line, line_len);
+    buf[*len + line_len] = '\n';
+    *len += line_len + 1;
+}
+
+/**
+ * Whether a message published now goes straight to the client outbox rather
+ * than to the offline queue.
+ */
+static bool trace_link_idle()
+{
+    uint32_t depth;
+    uint32_t n_dropped;
+
+    mqtt_get_queue_stats(&depth, &n_dropped);
+    return mqtt_is_connected() && depth == 0;
+}
@@ -0,0 +1,121 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt.h"
+
+/*
+ * Event tracer
+ *
+ * A trace point writes one fixed-size event, begin, end or instant, in the
+ * ring of the core it runs on. A slot is reserved with an atomic increment of
+ * the ring head, so tasks preempted or moved to the other core never share
+ * one, without locks or critical sections. When a ring is full, its oldest
+ * events are overwritten.
+ *
+ * The time is esp_timer_get_time() in us, truncated to 32 bits: the cycle
+ * counter stops in light sleep and changes rate with the CPU frequency, so it
+ * cannot be converted to time with power management enabled.
+ *
+ * A dump pauses tracing, writes the events of every ring and starts again
+ * with empty rings. It goes to the console or, in messages of at most
+ * MQTT_DATA_MAX_SIZE bytes, to the dump stream, as lines:
+ *   trace:start <now_us> <cores> <overwritten>
+ *   trace:id <id> <name>                      one per trace point
+ *   trace:task <task> <name>                  one per task seen
+ *   trace:e <time_us> <core> <task> <B|E|i> <id> <arg>
+ *   trace:end
+ * with task the handle in hexadecimal. tools/trace2json converts a dump to
+ * the Chrome trace format (chrome://tracing, ui.perfetto.dev). A dump never
+ * goes through the MQTT offline queue, where it would push out the sensor
+ * data: it is refused while the link is down or backlogged.
+ *
+ * The command topic takes "uart" or "mqtt", a dump to that output, "start" or
+ * "stop". With TRACE_ENABLE 0 the trace points compile to nothing.
+ */
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE 1
+#endif
+#define TRACE_RING_LEN 512 /* events per core, a power of two */
+#define TRACE_N_TASKS  16  /* tasks named in a dump */
+
+typedef enum trace_id
+{
+    TRACE_CYCLE,
+    TRACE_SNAPSHOT,
+    TRACE_MCP9700_READ,
+    TRACE_VMA311_READ,
+    TRACE_BME680_READ,
+    TRACE_AIO_POST,
+    TRACE_AIO_CONNECT,
+    TRACE_AIO_REQUEST,
+    TRACE_AIO_RESPONSE,
+    TRACE_AIO_DATA,
+    TRACE_AIO_ERROR,
+    TRACE_MQTT_PUBLISH,
+    TRACE_MQTT_PUBACK,
+    TRACE_MQTT_CONNECTED,
+    TRACE_MQTT_DISCONNECTED,
+    TRACE_WIFI_CONNECT,
+    TRACE_WIFI_DISCONNECTED,
+    TRACE_N_IDS
+} trace_id_t;
+
+typedef enum trace_phase
+{
+    TRACE_PHASE_BEGIN   = 'B',
+    TRACE_PHASE_END     = 'E',
+    TRACE_PHASE_INSTANT = 'i'
+} trace_phase_t;
+
+typedef struct trace_event
+{
+    uint32_t     time; /* us */
+    uint32_t     arg;
+    TaskHandle_t task;
+    uint16_t     id;
+    uint8_t      phase;
+    uint8_t      core;
+} trace_event_t;
+
+typedef struct trace_ring
+{
+    trace_event_t events[TRACE_RING_LEN];
+    atomic_uint   head; /* events written since the last dump */
+} trace_ring_t;
+
+typedef enum trace_output
+{
+    TRACE_UART,
+    TRACE_MQTT
+} trace_output_t;
+
+typedef struct trace
+{
+    trace_ring_t         rings[portNUM_PROCESSORS];
+    volatile bool        enabled;
+    const mqtt_stream_t *stream;
+    TaskHandle_t         dump_task;
+    volatile uint8_t     output;
+} trace_t;
+
+#if TRACE_ENABLE
+#define TRACE_BEGIN(id, arg)   trace_event(TRACE_PHASE_BEGIN, id, arg)
+#define TRACE_END(id, arg)     trace_event(TRACE_PHASE_END, id, arg)
+#define TRACE_INSTANT(id, arg) trace_event(TRACE_PHASE_INSTANT, id, arg)
+#else
+#define TRACE_BEGIN(id, arg)   ((void)0)
+#define TRACE_END(id, arg)     ((void)0)
+#define TRACE_INSTANT(id, arg) ((void)0)
+#endif
+
+void trace_init(const char *, const mqtt_stream_t *);
+void trace_event(trace_phase_t, trace_id_t, uint32_t);
+void trace_set_enabled(bool);
+void trace_dump(trace_output_t);
+
+#endif /* __TRACE_H__ */
@@ -0,0 +1,185 @@
+#include <string.h>
+#include "tsc.h"
+
+static void tsc_put_bits(tsc_encoder_t *, uint64_t, int);
+static void tsc_put_timestamp(tsc_encoder_t *, int64_t);
+static void tsc_put_value(tsc_encoder_t *, int, const sample_t *);
+
+static inline uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+/**
+ * @brief Start a batch. The series of the batch are those of the given samples.
+ * @param enc The encoder.
+ * @param buf The output buffer, which holds the batch until it is finished.
+ * @param size The size of the output buffer.
+ * @param samples Samples giving the sensor, metric and exponent of each series.
+ * @param n_series The number of series.
+ * @return 0 on success, -1 if there are too many series for the buffer.
+ */
+int tsc_begin(tsc_encoder_t *enc, uint8_t *buf, int size, const sample_t *samples, int n_series)
+{
+    if (n_series > TSC_MAX_SERIES || TSC_HEADER_SIZE(n_series) > size)
+        return -1;
+    memset(enc, 0, sizeof(*enc));
+    enc->buf = buf;
+    enc->size = size;
+    enc->n_series = n_series;
+    buf[0] = TSC_VERSION;
+    buf[1] = n_series;
+    for (int i = 0; i < n_series; i++)
+    {
+        enc->sensors[i] = samples[i].sensor;
+        enc->metrics[i] = samples[i].metric;
+        buf[4 + 3 * i] = samples[i].sensor;
+        buf[5 + 3 * i] = samples[i].metric;
+        buf[6 + 3 * i] = samples[i].exponent;
+    }
+    enc->state.bit_len = 8 * TSC_HEADER_SIZE(n_series);
+    return 0;
+}
+
+/**
+ * @brief Append a cycle to the batch. Samples of series not in the batch are
+ * ignored, series without a sample are marked as missing.
+ * @param enc The encoder.
+ * @param timestamp The timestamp of the cycle in ms.
+ * @param samples The samples of the cycle.
+ * @param n The number of samples.
+ * @return 0 on success, -1 if the cycle does not fit in the buffer, in which
+ *         case the batch is left as it was.
+ */
+int tsc_append(tsc_encoder_t *enc, int64_t timestamp, const sample_t *samples, int n)
+{
+    tsc_state_t saved = enc->state;
+    const sample_t *sample;
+    int byte;
+
+    tsc_put_timestamp(enc, timestamp);
+    for (int i = 0; i < enc->n_series; i++)
+    {
+        /* samples usually come in the order of the series */
+        sample = NULL;
+        if (i < n && samples[i].sensor == enc->sensors[i] && samples[i].metric == enc->metrics[i])
+            sample = &samples[i];
+        for (int j = 0; sample == NULL && j < n; j++)
+        {
+            if (samples[j].sensor == enc->sensors[i] && samples[j].metric == enc->metrics[i])
+                sample = &samples[j];
+        }
+        tsc_put_value(enc, i, sample);
+    }
+    if (enc->overflow)
+    {
+        enc->state = saved;
+        enc->overflow = false;
+        /* clear the bits written past the restored end in the last byte */
+        byte = enc->state.bit_len / 8;
+        if (enc->state.bit_len % 8)
+            enc->buf[byte] &= 0xff << (8 - enc->state.bit_len % 8);
+        return -1;
+    }
+    enc->state.n_cycles++;
+    return 0;
+}
+
+/**
+ * @brief Finish the batch.
+ * @param enc The encoder.
+ * @return The length of the batch in bytes.
+ */
+int tsc_finish(tsc_encoder_t *enc)
+{
+    enc->buf[2] = enc->state.n_cycles >> 8;
+    enc->buf[3] = enc->state.n_cycles;
+    return (enc->state.bit_len + 7) / 8;
+}
+
+static void tsc_put_timestamp(tsc_encoder_t *enc, int64_t timestamp)
+{
+    tsc_state_t *s = &enc->state;
+    int64_t delta;
+    uint64_t dod;
+
+    if (s->n_cycles == 0)
+    {
+        tsc_put_bits(enc, timestamp, 64);
+    }
+    else
+    {
+        delta = timestamp - s->prev_timestamp;
+        dod = zigzag(delta - s->prev_delta);
+        if (dod == 0)
+            tsc_put_bits(enc, 0x0, 1);
+        else if (dod < (1 << 7))
+            tsc_put_bits(enc, (0x2ull << 7) | dod, 2 + 7);
+        else if (dod < (1 << 9))
+            tsc_put_bits(enc, (0x6ull << 9) | dod, 3 + 9);
+        else if (dod < (1 << 12))
+            tsc_put_bits(enc, (0xeull << 12) | dod, 4 + 12);
+        else if (dod <= 0xffffffff)
+            tsc_put_bits(enc, (0x1eull << 32) | dod, 5 + 32);
+        else
+        {
+            tsc_put_bits(enc, 0x1f, 5);
+            tsc_put_bits(enc, dod, 64);
+        }
+        s->prev_delta = delta;
+    }
+    s->prev_timestamp = timestamp;
+}
+
+static void tsc_put_value(tsc_encoder_t *enc, int series, const sample_t *sample)
+{
+    tsc_state_t *s = &enc->state;
+    uint64_t delta;
+
+    if (sample == NULL)
+    {
+        tsc_put_bits(enc, 0x1f, 5);
+        return;
+    }
+    /* wrapping 32-bit difference, so the zig-zag value always fits 32 bits */
+    delta = zigzag((int32_t)((uint32_t)sample->value - (uint32_t)s->prev_values[series]));
+    if (delta == 0)
+        tsc_put_bits(enc, 0x0, 1);
+    else if (delta < (1 << 4))
+        tsc_put_bits(enc, (0x2ull << 4) | delta, 2 + 4);
+    else if (delta < (1 << 8))
+        tsc_put_bits(enc, (0x6ull << 8) | delta, 3 + 8);
+    else if (delta < (1 << 16))
+        tsc_put_bits(enc, (0xeull << 16) | delta, 4 + 16);
+    else
+        tsc_put_bits(enc, (0x1eull << 32) | delta, 5 + 32);
+    s->prev_values[series] = sample->value;
+}
+
+/**
+ * Write the n low bits of value, MSB first. Past the end of the buffer the
+ * overflow flag is raised and nothing is written.
+ */
+static void tsc_put_bits(tsc_encoder_t *enc, uint64_t value, int n)
+{
+    int pos = enc->state.bit_len;
+    int free_bits;
+    int chunk;
+
+    if (enc->overflow || pos + n > 8 * enc->size)
+    {
+        enc->overflow = true;
+        return;
+    }
+    while (n > 0)
+    {
+        free_bits = 8 - pos % 8;
+        if (free_bits == 8)
+            enc->buf[pos / 8] = 0;
+        chunk = n < free_bits ? n : free_bits;
+        enc->buf[pos / 8] |= ((value >> (n - chunk)) & ((1u << chunk) - 1)) << (free_bits - chunk);
+        pos += chunk;
+        n -= chunk;
+    }
+    enc->state.bit_len = pos;
+}
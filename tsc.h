@@ -0,0 +1,56 @@
+#ifndef __TSC_H__
+#define __TSC_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sample.h"
+
+/*
+ * Time-series compression of sample batches
+ *
+ * A batch is a table of cycles: one timestamp per cycle and one value per
+ * series. It is encoded incrementally, so a cycle costs O(series) and the raw
+ * samples are never stored.
+ *
+ * Header (bytes): version (1), number of series M, number of cycles (uint16,
+ * big endian), then M times: sensor, metric, exponent.
+ * Bit stream (MSB first), for each cycle:
+ *   timestamp: 64 bits raw for the first cycle, then the zig-zag encoded
+ *              delta-of-delta in ms:
+ *              '0' = 0, '10'+7 bits, '110'+9 bits, '1110'+12 bits,
+ *              '11110'+32 bits, '11111'+64 bits (a clock step, e.g. the
+ *              first time synchronization)
+ *   values:    for each series, the zig-zag encoded delta to the previous
+ *              value of the series (0 before the first value):
+ *              '0' = 0, '10'+4 bits, '110'+8 bits, '1110'+16 bits,
+ *              '11110'+32 bits, '11111' = no value in this cycle
+ */
+#define TSC_VERSION     2
+#define TSC_MAX_SERIES  16
+#define TSC_HEADER_SIZE(n_series) (4 + 3 * (n_series))
+
+typedef struct tsc_state
+{
+    int     bit_len;
+    int     n_cycles;
+    int64_t prev_timestamp;
+    int64_t prev_delta;
+    int32_t prev_values[TSC_MAX_SERIES];
+} tsc_state_t;
+
+typedef struct tsc_encoder
+{
+    uint8_t *buf;
+    int size;
+    int n_series;
+    uint8_t sensors[TSC_MAX_SERIES];
+    uint8_t metrics[TSC_MAX_SERIES];
+    bool overflow;
+    tsc_state_t state;
+} tsc_encoder_t;
+
+int tsc_begin(tsc_encoder_t *, uint8_t *, int, const sample_t *, int);
+int tsc_append(tsc_encoder_t *, int64_t, const sample_t *, int);
+int tsc_finish(tsc_encoder_t *);
+
+#endif /* __TSC_H__ */
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/task.h"
+#include "logger.h"
+#include "aio.h"
+#include "datalog.h"
+#include "uplink.h"
+
+#define TAG             "envmon:uplink"
+#define UPLINK_PRIORITY 3
+#define AIO_POST_MS     2000 //30 data points per minute, the Adafruit IO free plan limit
+
+static void uplink_console_write(const uplink_record_t *, int);
+static void uplink_mqtt_write(const uplink_record_t *, int);
+static void uplink_aio_write(const uplink_record_t *, int);
+static void uplink_flash_write(const uplink_record_t *, int);
+static void uplink_task(void *);
+
+/*
+ * Adafruit IO answers in hundreds of ms and limits the data rate, so its sink
+ * waits to gather records, only posts the latest value of each feed and
+ * spaces its posts by AIO_POST_MS. The flash log groups writes to wake the
+ * flash less often.
+ */
+static uplink_sink_t sinks[UPLINK_N_SINKS] = {
+    [UPLINK_CONSOLE] = {"console", uplink_console_write, 16, 16, 0, 2048},
+    [UPLINK_MQTT]    = {"mqtt", uplink_mqtt_write, 32, 8, 0, 3072},
+    [UPLINK_AIO]     = {"aio", uplink_aio_write, 16, 16, 2000, 8192},
+    [UPLINK_FLASH]   = {"flash", uplink_flash_write, 32, 32, 5000, 3072},
+};
+
+/**
+ * @brief Start the sinks. The data log is optional, without its partition
+ * the flash sink discards its records. The console sink is left out of the
+ * builds that log below ESP_LOG_INFO (see logger.h), and a sink that cannot
+ * be allocated is left out too: their records are then discarded.
+ * @param datalog_label The label of the data log partition.
+ */
+void uplink_init(const char *datalog_label)
+{
+    uplink_sink_t *sink;
+
+    datalog_init(datalog_label);
+    for (int i = 0; i < UPLINK_N_SINKS; i++)
+    {
+        if (i == UPLINK_CONSOLE && LOGGER_LEVEL < ESP_LOG_INFO)
+            continue;
+        sink = &sinks[i];
+        sink->records = malloc(sink->batch * sizeof(uplink_record_t));
+        sink->queue = sink->records ? xQueueCreate(sink->queue_len, sizeof(uplink_record_t)) : NULL;
+        if (!sink->queue || xTaskCreate(uplink_task, sink->name, sink->stack_size, sink, UPLINK_PRIORITY, NULL) != pdPASS)
+        {
+            LOGE(TAG, "Not enough memory for the %s sink", sink->name);
+            if (sink->queue)
+                vQueueDelete(sink->queue);
+            free(sink->records);
+            sink->queue = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Encode a sample and hand it to the sinks. Never blocks.
+ * @param route The route of the series of the sample.
+ * @param sample The sample.
+ * @param detail JSON members sent next to the value on MQTT, or NULL.
+ * @param to The UPLINK_TO() bits of the sinks.
+ */
+void uplink_publish(const uplink_route_t *route, const sample_t *sample, const char *detail, uint8_t to)
+{
+    uplink_record_t record;
+    uplink_record_t oldest;
+    uplink_sink_t *sink;
+
+    record.route = route;
+    record.sample = *sample;
+    sample_format_text(sample, record.text, sizeof(record.text));
+    snprintf(record.detail, sizeof(record.detail), "%s", detail ? detail : "");
+    for (int i = 0; i < UPLINK_N_SINKS; i++)
+    {
+        sink = &sinks[i];
+        if (!(to & UPLINK_TO(i)) || !sink->queue)
+            continue;
+        if (xQueueSend(sink->queue, &record, 0) != pdPASS)
+        {
+            xQueueReceive(sink->queue, &oldest, 0);
+            sink->n_dropped++;
+            xQueueSend(sink->queue, &record, 0);
+        }
+    }
+}
+
+/**
+ * @brief Get the counters of a sink.
+ * @param id The sink.
+ * @param n_sent Where to store the number of records written.
+ * @param n_dropped Where to store the number of records dropped because the
+ *                  queue was full.
+ */
+void uplink_get_stats(uplink_sink_id_t id, uint32_t *n_sent, uint32_t *n_dropped)
+{
+    *n_sent = sinks[id].n_sent;
+    *n_dropped = sinks[id].n_dropped;
+}
+
+static void uplink_task(void *arg)
+{
+    uplink_sink_t *sink = arg;
+    uplink_record_t *records = sink->records;
+    TickType_t deadline;
+    TickType_t now;
+    int n;
+
+    while (1)
+    {
+        xQueueReceive(sink->queue, &records[0], portMAX_DELAY);
+        n = 1;
+        deadline = xTaskGetTickCount() + pdMS_TO_TICKS(sink->max_delay_ms);
+        while (n < sink->batch)
+        {
+            now = xTaskGetTickCount();
+            if (xQueueReceive(sink->queue, &records[n], (int32_t)(deadline - now) > 0 ? deadline - now : 0) != pdPASS)
+                break;
+            n++;
+        }
+        sink->write(records, n);
+        sink->n_sent += n;
+    }
+}
+
+static void uplink_console_write(const uplink_record_t *records, int n)
+{
+    for (int i = 0; i < n; i++)
+        printf("%s:%s %s%s%s\n", records[i].route->name, records[i].text, records[i].route->units,
+               records[i].detail[0] ? " " : "", records[i].detail);
+}
+
+static void uplink_mqtt_write(const uplink_record_t *records, int n)
+{
+    char payload[SAMPLE_TEXT_MAX_SIZE + UPLINK_DETAIL_MAX_SIZE + 40];
+    const uplink_record_t *r;
+
+    //the acquisition time goes along, so that the latency to the subscribers can be measured
+    for (int i = 0; i < n; i++)
+    {
+        r = &records[i];
+        if (!r->route->stream)
+            continue;
+        snprintf(payload, sizeof(payload), "{\"value\":%s,\"ts\":%lld%s%s}", r->text,
+                 (long long)r->sample.timestamp, r->detail[0] ? "," : "", r->detail);
+        mqtt_publish_stream(r->route->stream, payload, 0);
+    }
+}
+
+static void uplink_aio_write(const uplink_record_t *records, int n)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t pause;
+    bool superseded;
+    int n_posts = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (!records[i].route->feed_key)
+            continue;
+        superseded = false;
+        for (int j = i + 1; j < n && !superseded; j++)
+            superseded = records[j].route == records[i].route;
+        if (!superseded)
+        {
+            aio_create_data(records[i].text, records[i].route->feed_key);
+            n_posts++;
+        }
+    }
+
+    //stay under the rate limit: the records queued meanwhile go in the next batch, where the latest of each feed wins
+    pause = n_posts * pdMS_TO_TICKS(AIO_POST_MS) - (xTaskGetTickCount() - start);
+    if ((int32_t)pause > 0)
+        vTaskDelay(pause);
+}
+
+static void uplink_flash_write(const uplink_record_t *records, int n)
+{
+    for (int i = 0; i < n; i++)
+        datalog_append(&records[i].sample);
+}
@@ -0,0 +1,73 @@
+#ifndef __UPLINK_H__
+#define __UPLINK_H__
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "mqtt.h"
+#include "sample.h"
+
+#define UPLINK_DETAIL_MAX_SIZE 48
+
+typedef enum uplink_sink_id
+{
+    UPLINK_CONSOLE,
+    UPLINK_MQTT,
+    UPLINK_AIO,
+    UPLINK_FLASH,
+    UPLINK_N_SINKS
+} uplink_sink_id_t;
+
+#define UPLINK_TO(sink) (1 << (sink))
+#define UPLINK_ALL      (UPLINK_TO(UPLINK_N_SINKS) - 1)
+
+/*
+ * Where the records of one series go: a console label, a MQTT stream and an
+ * Adafruit IO feed key. Routes are defined once and never change.
+ */
+typedef struct uplink_route
+{
+    const char *name;
+    const mqtt_stream_t *stream;
+    const char *feed_key;
+    const char *units; //shown on the console
+} uplink_route_t;
+
+/*
+ * A sample encoded once for all the sinks: the text value, and optional JSON
+ * members that the MQTT sink sends next to the value.
+ */
+typedef struct uplink_record
+{
+    const uplink_route_t *route;
+    sample_t sample;
+    char text[SAMPLE_TEXT_MAX_SIZE];
+    char detail[UPLINK_DETAIL_MAX_SIZE];
+} uplink_record_t;
+
+/*
+ * A sink has its own queue and task. The task waits for a record, then
+ * gathers up to batch records for at most max_delay_ms and writes them at
+ * once. When the queue is full the oldest record is dropped, so a slow sink
+ * loses its own records without holding back the producer or the other
+ * sinks.
+ */
+typedef struct uplink_sink
+{
+    const char *name;
+    void (*write)(const uplink_record_t *, int);
+    int queue_len;
+    int batch;
+    uint32_t max_delay_ms;
+    uint32_t stack_size;
+    QueueHandle_t queue;
+    uplink_record_t *records; //batch being written
+    uint32_t n_sent;
+    uint32_t n_dropped;
+} uplink_sink_t;
+
+void uplink_init(const char *);
+void uplink_publish(const uplink_route_t *, const sample_t *, const char *, uint8_t);
+void uplink_get_stats(uplink_sink_id_t, uint32_t *, uint32_t *);
+
+#endif /* __UPLINK_H__ */
@@ -1,10 +1,14 @@
 #include "vma311.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "esp_timer.h"
+
+#define VMA311_MIN_INTERVAL_US 1000000 //the DHT11 needs 1 s between reads
 
 static vma311_t vma311; //instance of a vma311 struct
 
 static void vma311_send_start_signal();
+static void vma311_end_start_signal();
 static int vma311_wait(uint16_t, int);
 static int vma311_check_response();
 static inline vma311_status_t vma311_read_byte(uint8_t *);
@@ -13,21 +17,38 @@ static vma311_status_t vma311_check_crc(uint8_t *);
 void vma311_init(gpio_num_t num) //initializes the gpio
 {
     vma311.num = num; //assign the pin value
-    vma311.last_read_time = -2000000;
+    vma311.last_read_time = -VMA311_MIN_INTERVAL_US;
     gpio_reset_pin(num);
     vTaskDelay(pdMS_TO_TICKS(1000)); //waiting for 1 sec 
 }
 
 vma311_data_t vma311_get_values() //get_values() called in the main 
 {
-    vma311_data_t error_data = {VMA311_TIMEOUT_ERROR, -1, -1, -1, -1}; //if there is an error, return -1 in the array
-    uint8_t data[5] = {0, 0, 0, 0, 0}; //the vma has 5 bytes so we have an 5 dim array to store the values
-    if (esp_timer_get_time() - 2000000 < vma311.last_read_time)
+    vma311_start();
+    return vma311_finish();
+}
+
+void vma311_start() //the 20 ms start signal runs while the caller triggers other sensors
+{
+    if (esp_timer_get_time() - VMA311_MIN_INTERVAL_US < vma311.last_read_time)
     {
-        return vma311.data; //last measure
+        return; //too early, vma311_finish reports that nothing was sampled
     }
     vma311.last_read_time = esp_timer_get_time(); //sets the time of the last reading to the beginning of this reading
     vma311_send_start_signal(); //activates the sensor 
+}
+
+vma311_data_t vma311_finish()
+{
+    vma311_data_t error_data = {VMA311_TIMEOUT_ERROR, -1, -1, -1, -1}; //if there is an error, return -1 in the array
+    vma311_data_t not_sampled = vma311.data; //the last measure, flagged as not new
+    uint8_t data[5] = {0, 0, 0, 0, 0}; //the vma has 5 bytes so we have an 5 dim array to store the values
+    if (vma311.start_time == 0)
+    {
+        not_sampled.status = VMA311_NOT_SAMPLED;
+        return not_sampled;
+    }
+    vma311_end_start_signal();
     if (vma311_check_response() == VMA311_TIMEOUT_ERROR)
     {
         return error_data; //When it takes too long, return an error
@@ -56,7 +77,17 @@ void vma311_send_start_signal()// this code indicates the different steps for se
 {
     gpio_set_direction(vma311.num, GPIO_MODE_OUTPUT); //set GPIO as an output
     gpio_set_level(vma311.num, 0); //gpio set to 0
-    ets_delay_us(20 * 1000);
+    vma311.start_time = esp_timer_get_time();
+}
+
+void vma311_end_start_signal()// the line must have been low for at least 20 ms
+{
+    int64_t elapsed = esp_timer_get_time() - vma311.start_time;
+    if (elapsed < 20 * 1000)
+    {
+        ets_delay_us(20 * 1000 - elapsed);
+    }
+    vma311.start_time = 0;
     gpio_set_level(vma311.num, 1); //gpio set to 1
     ets_delay_us(40);
 }
@@ -6,7 +6,8 @@
 // type definitions
 typedef enum vma311_status
 {
-    VMA311_CRC_ERROR = -2,
+    VMA311_NOT_SAMPLED = -3, //read too early after the previous one, no new values
+    VMA311_CRC_ERROR,
     VMA311_TIMEOUT_ERROR,
     VMA311_OK
 } vma311_status_t;
@@ -24,11 +25,14 @@ typedef struct vma311 //to define which gpio is linked and collect the values
 {
     gpio_num_t num;
     int64_t last_read_time;
+    int64_t start_time; //when the start signal was pulled low, 0 if not started
     vma311_data_t data;
 } vma311_t;
 
 //function prototypes 
 void          vma311_init(gpio_num_t); //to set the gpio linked
 vma311_data_t vma311_get_values(); //get values that we will use in the main function
+void          vma311_start(); //pull the start signal low, the sensor is read by vma311_finish
+vma311_data_t vma311_finish(); //end the start signal and read the values
 
 #endif
@@ -1,5 +1,7 @@
 #include <string.h>
 #include "wifi.h"
+#include "logger.h"
+#include "trace.h"
 
 /* macro definitions */
 #define CONNECTED_BIT BIT0
@@ -7,18 +9,32 @@
 #define MAX_RETRY     16
 #define TAG           "envmon:wifi"
 
+/* power management */
+#define BEACON_INTERVAL_MS     102 /* 100 TU, the usual AP default */
+#define PS_MAX_MODEM_PERIOD_MS 1000
+#define PS_WAKEUPS_PER_PERIOD  4
+#define PS_MAX_LISTEN_INTERVAL 10
+#define PM_MIN_FREQ_MHZ        40
+
 /* static variables */
 static EventGroupHandle_t event_group;
 static int                n_retry;
+static wifi_ps_type_t     ps_type = WIFI_PS_MIN_MODEM;
+static uint16_t           listen_interval;
+static bool               started;
+static uint32_t           n_disconnects;
+static uint32_t           n_reconnects;
 
 /* static function prototypes */
 static void event_handler(void*, esp_event_base_t, int32_t, void*);
+static void link_event_handler(void*, esp_event_base_t, int32_t, void*);
 static void nvs_init();
 static void wifi_init_event();
 static void wifi_init_netif();
 static void wifi_config(const char *, const char *);
 static void wifi_get_status(const char *);
 static void wifi_deinit_event();
+static void wifi_apply_power_save();
 
 /**
  * Initialize the Wi-Fi station to connect to access point identified by the
@@ -33,9 +49,106 @@ void wifi_init(const char *ssid, const char *password)
     wifi_init_netif();
     wifi_config(ssid, password);
     ESP_ERROR_CHECK(esp_wifi_start() );
-    ESP_LOGI(TAG, "Wi-Fi station initialization finished");
+    started = true;
+    wifi_apply_power_save();
+    LOGI(TAG, "Wi-Fi station initialization finished");
     wifi_get_status(ssid);
     wifi_deinit_event();
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT,
+                                               WIFI_EVENT_STA_DISCONNECTED,
+                                               &link_event_handler,
+                                               NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT,
+                                               IP_EVENT_STA_GOT_IP,
+                                               &link_event_handler,
+                                               NULL));
+}
+
+/**
+ * Get the signal strength of the access point the station is associated with.
+ * \param rssi Where to store the RSSI in dBm.
+ * \return 0 on success, -1 if the station is not associated.
+ */
+int wifi_get_rssi(int8_t *rssi)
+{
+    wifi_ap_record_t ap_info;
+
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK)
+        return -1;
+    *rssi = ap_info.rssi;
+    return 0;
+}
+
+/**
+ * Get the link counters accumulated since the initial connection.
+ * \param disconnects Where to store the number of lost connections.
+ * \param reconnects Where to store the number of connections restored.
+ */
+void wifi_get_link_stats(uint32_t *disconnects, uint32_t *reconnects)
+{
+    *disconnects = n_disconnects;
+    *reconnects = n_reconnects;
+}
+
+/**
+ * Select the modem power-save mode and the DTIM listen interval from the
+ * period at which data is published. Short periods keep the modem on every
+ * DTIM (WIFI_PS_MIN_MODEM). Longer periods allow WIFI_PS_MAX_MODEM with a
+ * listen interval that still wakes the radio several times per period, so
+ * PUBACKs and incoming messages are not delayed by a whole period. Automatic
+ * light sleep is enabled when the power management is built in.
+ * Call it before wifi_init() so the listen interval is used at association;
+ * afterwards only the power-save mode is updated, and only when it changes,
+ * so it can follow a period that changes every cycle.
+ * \param publish_period_ms The period between two publications in ms.
+ */
+void wifi_set_power_save(uint32_t publish_period_ms)
+{
+    wifi_ps_type_t type = WIFI_PS_MAX_MODEM;
+    uint32_t interval;
+
+    if (publish_period_ms < PS_MAX_MODEM_PERIOD_MS)
+    {
+        type = WIFI_PS_MIN_MODEM;
+        interval = 0; /* 0 lets the driver use the default (3) */
+    }
+    else
+    {
+        interval = publish_period_ms / (PS_WAKEUPS_PER_PERIOD * BEACON_INTERVAL_MS);
+        if (interval < 1)
+            interval = 1;
+        if (interval > PS_MAX_LISTEN_INTERVAL)
+            interval = PS_MAX_LISTEN_INTERVAL;
+    }
+    if (started && type == ps_type)
+        return;
+    ps_type = type;
+    if (!started)
+        listen_interval = interval;
+    LOGI(TAG, "Power save: %s, listen interval=%u",
+             ps_type == WIFI_PS_MAX_MODEM ? "max modem" : "min modem", listen_interval);
+    if (started)
+        wifi_apply_power_save();
+}
+
+/**
+ * Apply the selected power-save mode to the running driver and enable the
+ * automatic light sleep.
+ */
+static void wifi_apply_power_save()
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_config_esp32_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = PM_MIN_FREQ_MHZ,
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true
+#endif
+    };
+
+    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+#endif
+    ESP_ERROR_CHECK(esp_wifi_set_ps(ps_type));
 }
 
 /**
@@ -50,7 +163,7 @@ void nvs_init()
       ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
-    ESP_LOGI(TAG, "NVS flash initialized");
+    LOGI(TAG, "NVS flash initialized");
 }
 
 /**
@@ -96,6 +209,7 @@ void wifi_config(const char *ssid, const char *password)
 
     strcpy((char *)config.sta.ssid, ssid);
     strcpy((char *)config.sta.password, password);
+    config.sta.listen_interval = listen_interval;
     ESP_ERROR_CHECK(esp_wifi_init(&init_config));
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
     ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &config) );
@@ -113,13 +227,13 @@ void wifi_get_status(const char *ssid)
             portMAX_DELAY);
     if (bits & CONNECTED_BIT)
     {
-        ESP_LOGI(TAG, "Connection to AP SSID:%s established", ssid);
+        LOGI(TAG, "Connection to AP SSID:%s established", ssid);
     }
     else if (bits & FAIL_BIT)
     {
-        ESP_LOGI(TAG, "Connection to AP SSID:%s failed", ssid);
+        LOGI(TAG, "Connection to AP SSID:%s failed", ssid);
     } else {
-        ESP_LOGE(TAG, "Unexpected event");
+        LOGE(TAG, "Unexpected event");
     }
 }
 
@@ -139,27 +253,52 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
     {
+        TRACE_BEGIN(TRACE_WIFI_CONNECT, 0);
         esp_wifi_connect();
     }
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
     {
+        TRACE_INSTANT(TRACE_WIFI_DISCONNECTED, n_retry);
         if (n_retry < MAX_RETRY)
         {
             esp_wifi_connect();
             n_retry++;
-            ESP_LOGI(TAG, "Connection to AP retried");
+            LOGI(TAG, "Connection to AP retried");
         }
         else
         {
+            TRACE_END(TRACE_WIFI_CONNECT, n_retry);
             xEventGroupSetBits(event_group, FAIL_BIT);
         }
-        ESP_LOGI(TAG,"Connection to AP failed");
+        LOGI(TAG,"Connection to AP failed");
     }
     else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
     {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(TAG, "IP obtained:" IPSTR, IP2STR(&event->ip_info.ip));
+        LOGI(TAG, "IP obtained:" IPSTR, IP2STR(&event->ip_info.ip));
+        TRACE_END(TRACE_WIFI_CONNECT, n_retry);
         n_retry = 0;
         xEventGroupSetBits(event_group, CONNECTED_BIT);
     }
 }
+
+/**
+ * Keep the station connected once initialized and count link losses.
+ */
+static void link_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
+{
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        n_disconnects++;
+        LOGI(TAG, "Connection to AP lost, reconnecting");
+        TRACE_INSTANT(TRACE_WIFI_DISCONNECTED, n_disconnects);
+        TRACE_BEGIN(TRACE_WIFI_CONNECT, 0);
+        esp_wifi_connect();
+    }
+    else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        n_reconnects++;
+        LOGI(TAG, "Connection to AP restored");
+        TRACE_END(TRACE_WIFI_CONNECT, n_reconnects);
+    }
+}
@@ -5,8 +5,12 @@
 #include "freertos/event_groups.h"
 #include "esp_log.h"
 #include "esp_wifi.h"
+#include "esp_pm.h"
 #include "nvs_flash.h"
 
 void wifi_init(const char *, const char *);
+void wifi_set_power_save(uint32_t);
+int  wifi_get_rssi(int8_t *);
+void wifi_get_link_stats(uint32_t *, uint32_t *);
 
 #endif /* __WIFI_H__ */